@@ -0,0 +1,84 @@
+/** @file atomics.h
+ ** @brief Minimal atomic operations shared by lock-free components
+ ** @author Zhiwei Zeng
+ ** @date 2018.06.04
+ **/
+
+/*
+Copyright (C) 2018 Zhiwei Zeng.
+Copyright (C) 2018 Chengdu ZLT Technology Co., Ltd.
+All rights reserved.
+
+This file is part of the railway monitor toolkit and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef _ATOMICS_H_
+#define _ATOMICS_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#if defined(_MSC_VER)
+#	include <intrin.h>
+#	include <emmintrin.h>
+#	define ATOMIC_INLINE static __inline
+#else
+#	define ATOMIC_INLINE static inline
+#endif
+
+/** @name Acquire/release access to a shared word.
+ ** @{ */
+ATOMIC_INLINE unsigned int atomic_load_acquire(const volatile unsigned int *ptr)
+{
+#if defined(_MSC_VER)
+	unsigned int val = *ptr;
+	_ReadWriteBarrier();
+	return val;
+#else
+	return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+#endif
+}
+
+ATOMIC_INLINE void atomic_store_release(volatile unsigned int *ptr, unsigned int val)
+{
+#if defined(_MSC_VER)
+	_ReadWriteBarrier();
+	*ptr = val;
+#else
+	__atomic_store_n(ptr, val, __ATOMIC_RELEASE);
+#endif
+}
+/** @} */
+
+/** @name Atomic read-modify-write of a shared counter.
+ ** @{ */
+ATOMIC_INLINE int atomic_fetch_add(volatile int *ptr, int val)
+{
+#if defined(_MSC_VER)
+	return (int)_InterlockedExchangeAdd((volatile long *)ptr, (long)val);
+#else
+	return __atomic_fetch_add(ptr, val, __ATOMIC_ACQ_REL);
+#endif
+}
+/** @} */
+
+/** @name Full memory barrier, orders earlier stores before later loads.
+ ** @{ */
+ATOMIC_INLINE void atomic_fence()
+{
+#if defined(_MSC_VER)
+	_mm_mfence();
+#else
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+#endif
+}
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
\ No newline at end of file
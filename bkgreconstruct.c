@@ -25,12 +25,26 @@ the terms of the BSD license (see the COPYING file).
 #include "fifo.h"
 #include "minfilter.h"
 #include "gaussfilter.h"
+#include "framepool.h"
+#include "timer.h"
+
+#ifdef CPU_X86
+#	include <immintrin.h>
+#endif
+
+/* stage threads block on empty or full rings at most this many
+   milliseconds before they check the stop flag again. */
+#define BKGRECONST_WAIT_TIMEOUT 100
 
 struct tagBkgReconst
 {
 	int caches;						/**< image caches. */
-	unsigned int width;				/**< image width. */
-	unsigned int height;			/**< image height. */
+	unsigned int decimation;		/**< background is estimated at 1/decimation size. */
+	unsigned int out_width;			/**< infrared and background image width. */
+	unsigned int out_height;		/**< infrared and background image height. */
+	unsigned int out_size;			/**< background image size. */
+	unsigned int width;				/**< width background is estimated at. */
+	unsigned int height;			/**< height background is estimated at. */
 	unsigned int minbw;				/**< minimum blob width. */
 	unsigned int minbh;				/**< minimum blob height. */
 	unsigned int mingr;				/**< minimum gray range. */
@@ -40,26 +54,36 @@ struct tagBkgReconst
 	float gf_sigma;					/**< sigma of gaussian filter. */
 	unsigned int image_size;		/**< image size. */
 	unsigned int blob_size;			/**< blob maximum size per image. */
-	Fifo *infd_ring;				/**< infrared image ring buffer.*/
-	Fifo *infm_ring;				/**< infrared image ring buffer.*/
+	Fifo *infd_ring;				/**< infrared frame ring buffer.*/
+	Fifo *infm_ring;				/**< infrared frame ring buffer.*/
 	Fifo *blob_ring;				/**< decomposed blob ring buffer. */
 	Fifo *minf_ring;				/**< minimum filtered image ring buffer. */
 	Fifo *gfbr_ring;				/**< gaussian filtered background ring buffer. */
 	QTree *qtree;					/**< quadtree. */
-	Blob *iblob;					/**< decomposed blobs. */
-	Blob *oblob;					/**< output blob. */
-	unsigned char *i_infd_image;	/**< input infrared image. */
-	unsigned char *o_infd_image;	/**< output infrared image. */
-	unsigned char *infm_image;		/**< infrared image for minimum filter. */
-	unsigned char *i_minf_image;	/**< input minimum filter image. */
-	unsigned char *o_minf_image;	/**< output minimum filter image. */
+	GaussFilter *gfilter;			/**< gaussian filter. */
 	unsigned char *bkgr_image;		/**< background reconstructed image. */
-	unsigned char *i_gfbr_image;	/**< input gaussian filtered background image. */
-	unsigned char *o_gfbr_image;	/**< output gaussian filtered background image. */
-	float *U;						/**< interpolation ratio. */
-	float *VT;						/**< interpolation ratio. */
-	float *temp1;					/**< temporary variable. */
-	float *temp2;					/**< temporary variable. */
+	float **UM;						/**< U*M of each blob height, or NULL. */
+	float **VT;						/**< VT of each blob width, or NULL. */
+	float *basis;					/**< storage of all U*M and VT. */
+	unsigned int refresh;			/**< whole background rebuilt every refresh frames. */
+	unsigned int threshold;			/**< control point change a blob is refitted past. */
+	unsigned int frames;			/**< frames reconstructed. */
+	float *feats;					/**< control points each node was last fitted with. */
+	unsigned int *stamps;			/**< frames count + 1 when each node was last a leaf. */
+	unsigned char *gfbr_image;		/**< gaussian filtered background kept across frames. */
+	Quadrant *dirty;				/**< disjoint rectangles refitted blobs blur into. */
+	unsigned int ndirty;			/**< number of dirty rectangles. */
+	unsigned char *minf_scratch;	/**< scratch rows of minimum filter. */
+	unsigned char *mdec_image;		/**< decimated infrared image of minimum filter. */
+	unsigned char *qdec_image;		/**< decimated infrared image of quadtree. */
+	short *upsm_rows;				/**< background rows upsampled horizontally. */
+	unsigned int *upsm_x0;			/**< left source column of each output column. */
+	unsigned int *upsm_x1;			/**< right source column of each output column. */
+	short *upsm_xw;					/**< weight of right source column. */
+	unsigned int *upsm_y0;			/**< upper source row of each output row. */
+	unsigned int *upsm_y1;			/**< lower source row of each output row. */
+	short *upsm_yw;					/**< weight of lower source row. */
+	StatTimer timers[BKGRECONST_STAGES];	/**< processing time of each stage. */
 	int stop_reconst;				/**< reconstruction thread state. */
 };
 
@@ -70,10 +94,9 @@ static int minimum_filter_start(BkgReconst *self);
 static void *minimum_filter_thread(void *s);
 static int quadtree_decomp_start(BkgReconst *self);
 static void *quadtree_decomp_thread(void *s);
-static void bezier_interpolate(unsigned char *image, unsigned int width,
-                               unsigned int height, Blob *blob, int nblobs,
-							   float *U, float *VT, float *temp1, float *temp2,
-							   unsigned char *bkgr_image);
+static int bezier_interpolate(BkgReconst *self, unsigned char *image,
+                              Blob *blob, int full);
+static void mark_dirty(BkgReconst *self, const Quadrant *quad);
 static void bezier_interp_coeff(float *ic, int dimx, int dimy);
 static void bezier_trans_matrix(float *a, int aw, int ah, float *b);
 static void bezier_mul_matrix(const float *a, unsigned int aw, unsigned int ah,
@@ -81,18 +104,94 @@ static void bezier_mul_matrix(const float *a, unsigned int aw, unsigned int ah,
 static void bezier_cpoint_feature(unsigned char *image, unsigned int width,
                                   unsigned int height, Quadrant *quad,
 						          float *feat, int nfeats);
-static void bezier_set_surf(unsigned char *image, unsigned int width,
-                            unsigned int height, Quadrant *quad, const float *surf,
-							unsigned int dimx, unsigned int dimy);
 static void *bkgreconst_thread(void *s);
+static int bezier_basis_init(BkgReconst *self);
+static int upsample_init(BkgReconst *self);
+static void upsample_table(unsigned int osize, unsigned int isize, unsigned int factor,
+                           unsigned int *i0, unsigned int *i1, short *w);
+static void decimate(BkgReconst *self, const unsigned char *image, unsigned char *dec_image);
+static void upsample(BkgReconst *self, const unsigned char *image, unsigned char *ups_image);
+static void halve_min_row_nsu(const unsigned char *a, const unsigned char *b,
+                              unsigned int n, unsigned char *dst);
+static void blend_rows_nsu(const short *a, const short *b, short w, unsigned int n,
+                           unsigned char *dst);
+static void mark_blob_sizes(unsigned char *used, unsigned int size);
+static void surf_row_nsu(const float *VT, unsigned int dimx, const float *w,
+                         unsigned char *dst);
+#ifdef CPU_X86
+static void surf_row_sse(const float *VT, unsigned int dimx, const float *w,
+                         unsigned char *dst);
+static void halve_min_row_sse(const unsigned char *a, const unsigned char *b,
+                              unsigned int n, unsigned char *dst);
+static void blend_rows_sse(const short *a, const short *b, short w, unsigned int n,
+                           unsigned char *dst);
+static void surf_row_avx2(const float *VT, unsigned int dimx, const float *w,
+                          unsigned char *dst);
+static void halve_min_row_avx2(const unsigned char *a, const unsigned char *b,
+                               unsigned int n, unsigned char *dst);
+static void blend_rows_avx2(const short *a, const short *b, short w, unsigned int n,
+                            unsigned char *dst);
+#endif
 /** @} */
 
+/* constant interpolation coefficient matrix. */
+static const float M[] = { 1,  0,  0,  0,
+                          -3,  3,  0,  0,
+                           3, -6,  3,  0,
+                          -1,  3, -3,  1};
+
+/* transpose of matrix M. */
+static const float MT[] = { 1, -3,  3, -1,
+                            0,  3, -6,  3,
+                            0,  0,  3, -3,
+                            0,  0,  0,  1};
+
+/* evaluate one row of Bezier surface into 8-bit pixels. */
+typedef void (*SurfRow)(const float *VT, unsigned int dimx, const float *w,
+                        unsigned char *dst);
+
+/* minimum of 2x2 pixel blocks of two rows. */
+typedef void (*HalveMinRow)(const unsigned char *a, const unsigned char *b,
+                            unsigned int n, unsigned char *dst);
+
+/* weighted sum of two Q7 rows into 8-bit pixels. */
+typedef void (*BlendRows)(const short *a, const short *b, short w, unsigned int n,
+                          unsigned char *dst);
+
+/* row kernels by CpuLevel. Blob rows are too short for AVX-512 and the
+   decimated images are too small for it to matter. */
+#ifdef CPU_X86
+static const SurfRow surf_row_fns[CPU_LEVELS] = {
+	surf_row_nsu, surf_row_sse, surf_row_avx2, surf_row_avx2
+};
+static const HalveMinRow halve_min_row_fns[CPU_LEVELS] = {
+	halve_min_row_nsu, halve_min_row_sse, halve_min_row_avx2, halve_min_row_avx2
+};
+static const BlendRows blend_rows_fns[CPU_LEVELS] = {
+	blend_rows_nsu, blend_rows_sse, blend_rows_avx2, blend_rows_avx2
+};
+#else
+static const SurfRow surf_row_fns[CPU_LEVELS] = {
+	surf_row_nsu, surf_row_nsu, surf_row_nsu, surf_row_nsu
+};
+static const HalveMinRow halve_min_row_fns[CPU_LEVELS] = {
+	halve_min_row_nsu, halve_min_row_nsu, halve_min_row_nsu, halve_min_row_nsu
+};
+static const BlendRows blend_rows_fns[CPU_LEVELS] = {
+	blend_rows_nsu, blend_rows_nsu, blend_rows_nsu, blend_rows_nsu
+};
+#endif
+
 /** @brief Create a new instance of BkgReconst.
  ** @return the new instance.
  **/
 BkgReconst *bkgreconst_new()
 {
 	BkgReconst *self = (BkgReconst *)malloc(sizeof(BkgReconst));
+	if (self) {
+		memset(self, 0, sizeof(BkgReconst));
+	}
+	
 	return self;
 }
 
@@ -100,57 +199,81 @@ BkgReconst *bkgreconst_new()
  ** @param self BkgReconst instance.
  ** @param width image width.
  ** @param height image height.
+ ** @param decimation 1, 2 or 4. The background is a smooth surface, so
+ **        minimum filter, quadtree, Bezier fit and gaussian filter can
+ **        run on the infrared image shrunk this many times by taking
+ **        block minimums, and the result is upsampled bilinearly.
  ** @return  0 if success,
  **         -1 if fail.
  **/
 int bkgreconst_init(BkgReconst *self, unsigned int width,
-                    unsigned int height)
+                    unsigned int height, unsigned int decimation)
 {
+	int i;
+	
 	assert(self);
 	
+	if ((1 != decimation && 2 != decimation && 4 != decimation) ||
+		width < 4 * decimation || height < 4 * decimation) {
+		fprintf(stderr, "decimation %u fail[%s:%d].\n", decimation, __FILE__, __LINE__);
+		bkgreconst_delete(self);
+		return -1;
+	}
+	
 	self->caches = 8;
-	self->width = width;
-	self->height = height;
-	self->minbw = 12;
-	self->minbh = 9;
+	self->decimation = decimation;
+	self->out_width = width;
+	self->out_height = height;
+	self->out_size = roundup_power_of_2(width * height * sizeof(unsigned char));
+	self->width = width / decimation;
+	self->height = height / decimation;
+	self->minbw = 12 / decimation;
+	self->minbh = 9 / decimation;
 	self->mingr = 78;
 	self->mnbpi = self->width * self->height / self->minbw / self->minbh;
-	self->mf_size = 11;
+	self->mf_size = (11 / decimation) | 1;
 	self->gf_size = 9;
-	self->gf_sigma = 4.5f;
+	self->gf_sigma = 4.5f / decimation;
 	self->image_size = self->width * self->height * sizeof(unsigned char);
 	self->image_size = roundup_power_of_2(self->image_size);
 	self->blob_size = self->mnbpi * sizeof(Blob);
 	self->blob_size = roundup_power_of_2(self->blob_size);
 	self->stop_reconst = 0;
+	self->refresh = 1;
+	self->threshold = 0;
+	self->frames = 0;
+	
+	for (i = 0; i < BKGRECONST_STAGES; i++) {
+		stat_timer_reset(&self->timers[i]);
+	}
 	
-	self->infd_ring = fifo_alloc(self->caches * self->image_size);
+	self->infd_ring = fifo_alloc_spsc(self->caches * sizeof(Frame *));
 	if (!self->infd_ring) {
-		fprintf(stderr, "fifo_alloc fail[%s:%d].\n", __FILE__, __LINE__);
+		fprintf(stderr, "fifo_alloc_spsc fail[%s:%d].\n", __FILE__, __LINE__);
 		goto clean;
 	}
 	
-	self->infm_ring = fifo_alloc(self->caches * self->image_size);
+	self->infm_ring = fifo_alloc_spsc(self->caches * sizeof(Frame *));
 	if (!self->infm_ring) {
-		fprintf(stderr, "fifo_alloc fail[%s:%d].\n", __FILE__, __LINE__);
+		fprintf(stderr, "fifo_alloc_spsc fail[%s:%d].\n", __FILE__, __LINE__);
 		goto clean;
 	}
 	
-	self->blob_ring = fifo_alloc(self->caches * self->blob_size);
+	self->blob_ring = fifo_alloc_spsc(self->caches * self->blob_size);
 	if (!self->blob_ring) {
-		fprintf(stderr, "fifo_alloc fail[%s:%d].\n", __FILE__, __LINE__);
+		fprintf(stderr, "fifo_alloc_spsc fail[%s:%d].\n", __FILE__, __LINE__);
 		goto clean;
 	}
 	
-	self->minf_ring = fifo_alloc(self->caches * self->image_size);
+	self->minf_ring = fifo_alloc_spsc(self->caches * self->image_size);
 	if (!self->minf_ring) {
-		fprintf(stderr, "fifo_alloc fail[%s:%d].\n", __FILE__, __LINE__);
+		fprintf(stderr, "fifo_alloc_spsc fail[%s:%d].\n", __FILE__, __LINE__);
 		goto clean;
 	}
 	
-	self->gfbr_ring = fifo_alloc(self->caches * self->image_size);
+	self->gfbr_ring = fifo_alloc_spsc(self->caches * self->out_size);
 	if (!self->gfbr_ring) {
-		fprintf(stderr, "fifo_alloc fail[%s:%d].\n", __FILE__, __LINE__);
+		fprintf(stderr, "fifo_alloc_spsc fail[%s:%d].\n", __FILE__, __LINE__);
 		goto clean;
 	}
 	
@@ -160,89 +283,67 @@ int bkgreconst_init(BkgReconst *self, unsigned int width,
 		goto clean;
 	}
 	
-	qtree_init(self->qtree, self->minbw, self->minbh, self->mingr);
-	
-	self->iblob = (Blob *)malloc(self->blob_size);
-	if (!self->iblob) {
-		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
-		goto clean;
-	}
-	
-	self->oblob = (Blob *)malloc(self->blob_size);
-	if (!self->oblob) {
-		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
-		goto clean;
-	}
-	
-	self->i_infd_image = (unsigned char *)malloc(self->image_size);
-	if (!self->i_infd_image) {
-		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
-		goto clean;
-	}
-	
-	self->o_infd_image = (unsigned char *)malloc(self->image_size);
-	if (!self->o_infd_image) {
-		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+	if (qtree_init(self->qtree, self->width, self->height, self->minbw,
+		self->minbh, self->mingr)) {
+		fprintf(stderr, "qtree_init fail[%s:%d].\n", __FILE__, __LINE__);
 		goto clean;
 	}
 	
-	self->infm_image = (unsigned char *)malloc(self->image_size);
-	if (!self->infm_image) {
+	self->bkgr_image = (unsigned char *)malloc(self->image_size);
+	if (!self->bkgr_image) {
 		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
 		goto clean;
 	}
 	
-	self->i_minf_image = (unsigned char *)malloc(self->image_size);
-	if (!self->i_minf_image) {
+	self->gfbr_image = (unsigned char *)malloc(self->image_size);
+	if (!self->gfbr_image) {
 		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
 		goto clean;
 	}
 	
-	self->o_minf_image = (unsigned char *)malloc(self->image_size);
-	if (!self->o_minf_image) {
+	self->minf_scratch = (unsigned char *)malloc(min_filter_scratch(self->width, self->mf_size));
+	if (!self->minf_scratch) {
 		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
 		goto clean;
 	}
 	
-	self->bkgr_image = (unsigned char *)malloc(self->image_size);
-	if (!self->bkgr_image) {
+	self->dirty = (Quadrant *)malloc(self->mnbpi * sizeof(Quadrant));
+	if (!self->dirty) {
 		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
 		goto clean;
 	}
 	
-	self->i_gfbr_image = (unsigned char *)malloc(self->image_size);
-	if (!self->i_gfbr_image) {
+	self->feats = (float *)malloc(qtree_nodes(self->qtree) * 16 * sizeof(float));
+	if (!self->feats) {
 		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
 		goto clean;
 	}
 	
-	self->o_gfbr_image = (unsigned char *)malloc(self->image_size);
-	if (!self->o_gfbr_image) {
-		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+	self->stamps = (unsigned int *)calloc(qtree_nodes(self->qtree), sizeof(unsigned int));
+	if (!self->stamps) {
+		fprintf(stderr, "calloc fail[%s:%d].\n", __FILE__, __LINE__);
 		goto clean;
 	}
 	
-	self->U = (float *)malloc(height * 4 * sizeof(float));
-	if (!self->U) {
-		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+	self->gfilter = gauss_filter_new();
+	if (!self->gfilter) {
+		fprintf(stderr, "gauss_filter_new fail[%s:%d].\n", __FILE__, __LINE__);
 		goto clean;
 	}
 	
-	self->VT = (float *)malloc(4 * width * sizeof(float));
-	if (!self->VT) {
-		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+	if (gauss_filter_init(self->gfilter, self->width, self->height, self->gf_sigma,
+		GAUSS_MODE_AUTO)) {
+		fprintf(stderr, "gauss_filter_init fail[%s:%d].\n", __FILE__, __LINE__);
 		goto clean;
 	}
 	
-	self->temp1 = (float *)malloc(height * 4 * sizeof(float));
-	if (!self->temp1) {
-		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+	if (bezier_basis_init(self)) {
+		fprintf(stderr, "bezier_basis_init fail[%s:%d].\n", __FILE__, __LINE__);
 		goto clean;
 	}
 	
-	self->temp2 = (float *)malloc(height * width * sizeof(float));
-	if (!self->temp2) {
-		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+	if (self->decimation > 1 && upsample_init(self)) {
+		fprintf(stderr, "upsample_init fail[%s:%d].\n", __FILE__, __LINE__);
 		clean:bkgreconst_delete(self);
 		return -1;
 	}
@@ -274,61 +375,80 @@ void bkgreconst_delete(BkgReconst *self)
 		if (self->qtree) {
 			qtree_delete(self->qtree);
 		}
-		if (self->iblob) {
-			free(self->iblob);
-			self->iblob = NULL;
+		if (self->gfilter) {
+			gauss_filter_delete(self->gfilter);
 		}
-		if (self->oblob) {
-			free(self->oblob);
-			self->oblob = NULL;
+		if (self->bkgr_image) {
+			free(self->bkgr_image);
+			self->bkgr_image = NULL;
 		}
-		if (self->i_infd_image) {
-			free(self->i_infd_image);
-			self->i_infd_image = NULL;
+		if (self->UM) {
+			free(self->UM);
+			self->UM = NULL;
 		}
-		if (self->o_infd_image) {
-			free(self->o_infd_image);
-			self->o_infd_image = NULL;
+		if (self->VT) {
+			free(self->VT);
+			self->VT = NULL;
 		}
-		if (self->infm_image) {
-			free(self->infm_image);
-			self->infm_image = NULL;
+		if (self->basis) {
+			free(self->basis);
+			self->basis = NULL;
 		}
-		if (self->i_minf_image) {
-			free(self->i_minf_image);
-			self->i_minf_image = NULL;
+		if (self->gfbr_image) {
+			free(self->gfbr_image);
+			self->gfbr_image = NULL;
 		}
-		if (self->o_minf_image) {
-			free(self->o_minf_image);
-			self->o_minf_image = NULL;
+		if (self->minf_scratch) {
+			free(self->minf_scratch);
+			self->minf_scratch = NULL;
 		}
-		if (self->bkgr_image) {
-			free(self->bkgr_image);
-			self->bkgr_image = NULL;
+		if (self->dirty) {
+			free(self->dirty);
+			self->dirty = NULL;
 		}
-		if (self->i_gfbr_image) {
-			free(self->i_gfbr_image);
-			self->i_gfbr_image = NULL;
+		if (self->feats) {
+			free(self->feats);
+			self->feats = NULL;
 		}
-		if (self->o_gfbr_image) {
-			free(self->o_gfbr_image);
-			self->o_gfbr_image = NULL;
+		if (self->stamps) {
+			free(self->stamps);
+			self->stamps = NULL;
 		}
-		if (self->U) {
-			free(self->U);
-			self->U = NULL;
+		if (self->mdec_image) {
+			free(self->mdec_image);
+			self->mdec_image = NULL;
 		}
-		if (self->VT) {
-			free(self->VT);
-			self->VT = NULL;
+		if (self->qdec_image) {
+			free(self->qdec_image);
+			self->qdec_image = NULL;
+		}
+		if (self->upsm_rows) {
+			free(self->upsm_rows);
+			self->upsm_rows = NULL;
+		}
+		if (self->upsm_x0) {
+			free(self->upsm_x0);
+			self->upsm_x0 = NULL;
+		}
+		if (self->upsm_x1) {
+			free(self->upsm_x1);
+			self->upsm_x1 = NULL;
 		}
-		if (self->temp1) {
-			free(self->temp1);
-			self->temp1 = NULL;
+		if (self->upsm_xw) {
+			free(self->upsm_xw);
+			self->upsm_xw = NULL;
 		}
-		if (self->temp2) {
-			free(self->temp2);
-			self->temp2 = NULL;
+		if (self->upsm_y0) {
+			free(self->upsm_y0);
+			self->upsm_y0 = NULL;
+		}
+		if (self->upsm_y1) {
+			free(self->upsm_y1);
+			self->upsm_y1 = NULL;
+		}
+		if (self->upsm_yw) {
+			free(self->upsm_yw);
+			self->upsm_yw = NULL;
 		}
 		
 		free(self);
@@ -373,6 +493,35 @@ int bkgreconst_start(BkgReconst *self)
 	return 0;
 }
 
+/** @brief Set temporal mode of background reconstruction. A blob that
+ **        was a blob on the previous frame too keeps its surface while
+ **        none of its control points moved past threshold since it was
+ **        last fitted, and only the background around refitted blobs is
+ **        blurred again. The whole background is rebuilt every refresh
+ **        frames. Refresh 1, the default, rebuilds it on every frame.
+ **        Call it before bkgreconst_start.
+ ** @param self BkgReconst instance.
+ ** @param refresh whole background rebuild period in frames.
+ ** @param threshold control point gray change a blob is refitted past.
+ ** @return  0 if success,
+ **         -1 if fail.
+ **/
+int bkgreconst_set_temporal(BkgReconst *self, unsigned int refresh,
+                            unsigned int threshold)
+{
+	assert(self);
+	
+	if (0 == refresh) {
+		return -1;
+	}
+	
+	self->refresh = refresh;
+	self->threshold = threshold;
+	self->frames = 0;
+	
+	return 0;
+}
+
 /** @brief Stop background reconstruction thread.
  ** @param self BkgReconst instance.
  **/
@@ -382,38 +531,41 @@ void bkgreconst_stop(BkgReconst *self)
 	self->stop_reconst = 1;
 }
 
-/** @brief Send image to BkgReconst instance.
+/** @brief Send infrared frame to BkgReconst instance. The frame is
+ **        shared with the reconstruction threads, not copied, and
+ **        the caller keeps its own reference.
  ** @param self BkgReconst instance.
- ** @param image infrared image.
+ ** @param frame infrared frame, gray image in the first width*height bytes.
  ** @return 1 if success,
  **         0 if fail.
  **/
 int bkgreconst_put(BkgReconst *self,
-                   unsigned char *image)
+                   Frame *frame)
 {
-	int len;
-	int ret;
+	char *infd = NULL;
+	char *infm = NULL;
 	
 	assert(self);
-	assert(image);
-	
-	len = self->image_size;
+	assert(frame);
 	
-	memmove(self->i_infd_image, image, self->width * self->height * sizeof(unsigned char));
-	ret = fifo_put(self->infd_ring, self->i_infd_image, len);
-	if (ret != len) {
-		fprintf(stderr, "fifo_put fail[%s:%d].\n", __FILE__, __LINE__);
+	infd = fifo_reserve_write(self->infd_ring, sizeof(frame));
+	infm = fifo_reserve_write(self->infm_ring, sizeof(frame));
+	if (!infd || !infm) {
+		fprintf(stderr, "fifo_reserve_write fail[%s:%d].\n", __FILE__, __LINE__);
 		return 0;
 	}
 	
-	ret = fifo_put(self->infm_ring, self->i_infd_image, len);
-	if (ret != len) {
-		fprintf(stderr, "fifo_put fail[%s:%d].\n", __FILE__, __LINE__);
-		return 0;
-	}
+	/* one reference for each of quadtree decompose and minimum filter. */
+	frame_ref(frame);
+	frame_ref(frame);
+	memmove(infd, &frame, sizeof(frame));
+	memmove(infm, &frame, sizeof(frame));
+	
+	fifo_commit_write(self->infd_ring, sizeof(frame));
+	fifo_commit_write(self->infm_ring, sizeof(frame));
 		
 	return 1;
-}				   
+}
 	
 /** @brief Get reconstructed background from BkgReconst instance.
  ** @param self BkgReconst instance.
@@ -424,20 +576,46 @@ int bkgreconst_put(BkgReconst *self,
 int bkgreconst_get(BkgReconst *self,
                    unsigned char *bkg)
 {
-	int len;
-	int ret;
+	return bkgreconst_get_wait(self, bkg, 0);
+}
+
+/** @brief Get reconstructed background, block until it is ready.
+ ** @param self BkgReconst instance.
+ ** @param bkg reconstructed background image.
+ ** @param timeout maximum milliseconds to wait.
+ ** @return 1 if success,
+ **         0 if timeout.
+ **/ 
+int bkgreconst_get_wait(BkgReconst *self,
+                        unsigned char *bkg, int timeout)
+{
+	char *slot = NULL;
 	
 	assert(self);
 	assert(bkg);
 	
-	len = self->image_size;
-
-	ret = fifo_get(self->gfbr_ring, self->o_gfbr_image, len);
-	if (ret == len) {
-		memmove(bkg, self->o_gfbr_image, self->width * self->height * sizeof(unsigned char));
+	slot = fifo_peek_read_wait(self->gfbr_ring, self->out_size, timeout);
+	if (!slot) {
+		return 0;
 	}
 	
-	return (ret == len);
+	memmove(bkg, slot, self->out_width * self->out_height * sizeof(unsigned char));
+	fifo_release_read(self->gfbr_ring, self->out_size);
+	
+	return 1;
+}
+
+/** @brief Get processing time statistics of a stage.
+ ** @param self BkgReconst instance.
+ ** @param stage processing stage.
+ ** @return duration accumulator.
+ **/
+const StatTimer *bkgreconst_get_timer(BkgReconst *self, BkgReconstStage stage)
+{
+	assert(self);
+	assert(stage < BKGRECONST_STAGES);
+	
+	return &self->timers[stage];
 }
 
 /** @brief Round up to power of 2.
@@ -494,29 +672,38 @@ int minimum_filter_start(BkgReconst *self)
 void *minimum_filter_thread(void *s)
 {
 	BkgReconst *self = (BkgReconst *)s;
-	int read_len;
-	int write_len;
+	Frame *infm_frame = NULL;
+	unsigned char *minf_image = NULL;
+	long long start;
 	
 	while (!self->stop_reconst) {
-		/* read infrared image from ring buffer. */
-		read_len = fifo_get(self->infm_ring, self->infm_image, self->image_size);
-		if (read_len != self->image_size) {
+		/* filter straight into the next free slot of the output ring. */
+		minf_image = (unsigned char *)fifo_reserve_write_wait(self->minf_ring, self->image_size,
+			BKGRECONST_WAIT_TIMEOUT);
+		if (!minf_image) {
 			continue;
 		}
 		
-		/* minimum filter. */
-		min_filter(self->infm_image, self->width, self->height, self->mf_size, self->i_minf_image);
-		/*{
-			FILE *fp = fopen("minf.dat", "wb");
-			fwrite(self->i_minf_image, 1, self->width * self->height, fp);
-			fclose(fp);
-		}*/
+		/* read infrared frame from ring buffer. */
+		if (sizeof(infm_frame) != fifo_get_wait(self->infm_ring, (char *)&infm_frame,
+			sizeof(infm_frame), BKGRECONST_WAIT_TIMEOUT)) {
+			continue;
+		}
 		
-		/* write filtered image to ring buffer. */
-		write_len = fifo_put(self->minf_ring, self->i_minf_image, self->image_size);
-		if (write_len != self->image_size) {
-			fprintf(stderr, "fifo_put fail[%s:%d].\n", __FILE__, __LINE__);
+		/* minimum filter. */
+		start = timer_now_us();
+		if (self->decimation > 1) {
+			decimate(self, infm_frame->data, self->mdec_image);
+			min_filter(self->mdec_image, self->width, self->height, self->mf_size,
+				self->minf_scratch, minf_image);
+		} else {
+			min_filter(infm_frame->data, self->width, self->height, self->mf_size,
+				self->minf_scratch, minf_image);
 		}
+		stat_timer_add(&self->timers[BKGRECONST_STAGE_MINFILTER], timer_now_us() - start);
+		frame_unref(infm_frame);
+		
+		fifo_commit_write(self->minf_ring, self->image_size);
 	}
 	
 	return (void *)(0);
@@ -555,73 +742,85 @@ int quadtree_decomp_start(BkgReconst *self)
 void *quadtree_decomp_thread(void *s)
 {
 	BkgReconst *self = (BkgReconst *)s;
-	int read_len;
+	Frame *infd_frame = NULL;
+	Blob *blob = NULL;
 	int nblobs;
-	int write_len;
+	long long start;
 	
 	while (!self->stop_reconst) {
-		/* read infrared image from ring buffer. */
-		read_len = fifo_get(self->infd_ring, self->o_infd_image, self->image_size);
-		if (read_len != self->image_size) {
+		/* decomposed blobs go straight into the next free slot. */
+		blob = (Blob *)fifo_reserve_write_wait(self->blob_ring, self->blob_size,
+			BKGRECONST_WAIT_TIMEOUT);
+		if (!blob) {
+			continue;
+		}
+		
+		/* read infrared frame from ring buffer. */
+		if (sizeof(infd_frame) != fifo_get_wait(self->infd_ring, (char *)&infd_frame,
+			sizeof(infd_frame), BKGRECONST_WAIT_TIMEOUT)) {
 			continue;
 		}
 
 		/* quadtree decompose. */
-		qtree_decompose(self->qtree, self->o_infd_image, self->width, self->height);
+		start = timer_now_us();
+		if (self->decimation > 1) {
+			decimate(self, infd_frame->data, self->qdec_image);
+			qtree_decompose(self->qtree, self->qdec_image, self->width, self->height);
+		} else {
+			qtree_decompose(self->qtree, infd_frame->data, self->width, self->height);
+		}
+		frame_unref(infd_frame);
 		
-		memset(self->iblob, 0, self->mnbpi * sizeof(Blob));
-		nblobs = gtree_get_leafnode(self->qtree, self->iblob);
+		memset(blob, 0, self->mnbpi * sizeof(Blob));
+		nblobs = gtree_get_leafnode(self->qtree, blob);
 		if (nblobs <= 0) {
 			fprintf(stderr, "gtree_get_leafnode fail[%s:%d].\n", __FILE__, __LINE__);
 		}
 		
 		qtree_reset(self->qtree);
+		stat_timer_add(&self->timers[BKGRECONST_STAGE_QTREE], timer_now_us() - start);
 
-		/* write decomposed blobs to ring buffer. */
-		write_len = fifo_put(self->blob_ring, (char *)self->iblob, self->blob_size);
-		if (write_len != self->blob_size) {
-			fprintf(stderr, "fifo_put fail[%s:%d].\n", __FILE__, __LINE__);
-		}
+		fifo_commit_write(self->blob_ring, self->blob_size);
 	}
 	
 	return (void *)s;
 }
 
-/** @brief Bezier interpolation.
- ** @param image infrared image.
- ** @param width image width.
- ** @param height image height.
- ** @param blob decomposed blob.
- ** @param nblobs number of decomposed blobs.
- ** @param U interpolation coefficient matrix in Y direction.
- ** @param VT interpolation coefficient matrix in X direction.
- ** @param temp1 temporary matrix.
- ** @param temp2 temporary matrix.
- ** @param bkgr_image background reconstructed image. 
- **/
-void bezier_interpolate(unsigned char *image, unsigned int width,
-                        unsigned int height, Blob *blob, int nblobs,
-						float *U, float *VT, float *temp1, float *temp2,
-						unsigned char *bkgr_image)
+/** @brief Bezier interpolation. Each blob surface is U*M*P*MT*VT,
+ **        U*M and VT come from the basis cache, and each row of U*M*P*MT
+ **        is expanded along VT straight into the background image. Unless
+ **        the whole background is rebuilt, a blob keeps its surface if it
+ **        was a blob on the previous frame and its control points P stay
+ **        within threshold of those it was fitted with.
+ ** @param self BkgReconst instance.
+ ** @param image minimum filtered infrared image.
+ ** @param blob decomposed blobs.
+ ** @param full rebuild every blob.
+ ** @return number of refitted blobs, whose blur rectangles are marked
+ **         dirty.
+ **/
+int bezier_interpolate(BkgReconst *self, unsigned char *image,
+                       Blob *blob, int full)
 {
-	int i;
+	SurfRow surf_row = surf_row_fns[cpu_level()];
+	unsigned int i;
 	unsigned int dimx, dimy;
+	unsigned int y, k, l;
 	Blob *bptr = blob;
+	const float *um;
+	const float *vt;
+	unsigned char *dst;
+	float *feat;
 	float P[16];
+	float r[4];
+	float w[4];
+	float sum;
+	int refits = 0;
+	int clean;
 	
-	/* constant interpolation coefficient matrix. */
-	const float M[] = { 1,  0,  0,  0,
-	                   -3,  3,  0,  0,
-					    3, -6,  3,  0,
-					   -1,  3, -3,  1};
-	
-	/* transpose of matrix M. */
-	const float MT[] = { 1, -3,  3, -1,
-	                     0,  3, -6,  3,
-					     0,  0,  3, -3,
-					     0,  0,  0,  1};
+	self->ndirty = 0;
 
-	for (i = 0; i < nblobs; i++) {	
+	for (i = 0; i < self->mnbpi; i++) {	
 		if (bptr->quad.right <= 0 || bptr->quad.bottom <= 0) {
 			break;
 		}
@@ -629,22 +828,57 @@ void bezier_interpolate(unsigned char *image, unsigned int width,
 		dimx = bptr->quad.right - bptr->quad.left;
 		dimy = bptr->quad.bottom - bptr->quad.top;
 
-		bezier_interp_coeff(U, 4, dimy);
+		bezier_cpoint_feature(image, self->width, self->height, &bptr->quad, P, 16);
 		
-		bezier_interp_coeff(temp2, 4, dimx);
-		bezier_trans_matrix(temp2, 4, dimx, VT);
-
-		bezier_cpoint_feature(image, width, height, &bptr->quad, P, 16);
+		/* unchanged blob keeps its surface. */
+		feat = self->feats + bptr->node * 16;
+		clean = !full && self->stamps[bptr->node] == self->frames;
+		for (k = 0; k < 16 && clean; k++) {
+			clean = fabsf(P[k] - feat[k]) <= self->threshold;
+		}
 		
-		bezier_mul_matrix(U, 4, dimy, M, 4, 4, temp1);			/* U*M. */
-		bezier_mul_matrix(temp1, 4, dimy, P, 4, 4, temp2);		/* U*M*P. */
-		bezier_mul_matrix(temp2, 4, dimy, MT, 4, 4, temp1);		/* U*M*P*MT. */
-		bezier_mul_matrix(temp1, 4, dimy, VT, dimx, 4, temp2);	/* U*M*P*MT*VT. */
-
-		bezier_set_surf(bkgr_image, width, height, &bptr->quad, temp2, dimx, dimy);
+		self->stamps[bptr->node] = self->frames + 1;
+		if (clean) {
+			bptr++;
+			continue;
+		}
+		
+		memcpy(feat, P, sizeof(P));
+		refits++;
+		
+		mark_dirty(self, &bptr->quad);
+		
+		um = self->UM[dimy];
+		vt = self->VT[dimx];
+		assert(um && vt);
+		
+		dst = self->bkgr_image + bptr->quad.top * self->width + bptr->quad.left;
+		for (y = 0; y < dimy; y++) {
+			/* row of U*M*P, then of U*M*P*MT. */
+			for (l = 0; l < 4; l++) {
+				sum = 0;
+				for (k = 0; k < 4; k++) {
+					sum += um[y * 4 + k] * P[k * 4 + l];
+				}
+				r[l] = sum;
+			}
+			
+			for (l = 0; l < 4; l++) {
+				sum = 0;
+				for (k = 0; k < 4; k++) {
+					sum += r[k] * MT[k * 4 + l];
+				}
+				w[l] = sum;
+			}
+			
+			surf_row(vt, dimx, w, dst);
+			dst += self->width;
+		}
 		
 		bptr++;
 	}
+	
+	return refits;
 }
 
 /** @brief Calculate interpolation coefficient matrix.
@@ -748,34 +982,45 @@ void bezier_cpoint_feature(unsigned char *image, unsigned int width,
 	}
 }
 
-/** @brief Copy reconstructed surface to background image.
- ** @param image background image.
- ** @param width image width.
- ** @param height image height.
- ** @param quad corresponding quadrant of reconstructed surface.
- ** @param surf reconstructed surface.
- ** @param dimx surface dimension in X direction.
- ** @param dimy surface dimension in Y direction.
+/** @brief Mark where a refitted blob blurs into, the blob grown by the
+ **        gaussian filter reach. Dirty rectangles overlapping or touching
+ **        it are merged into it, so that they stay disjoint and no pixel
+ **        is blurred twice, while changes far apart are blurred apart.
+ ** @param self BkgReconst instance.
+ ** @param quad refitted blob.
  **/
-void bezier_set_surf(unsigned char *image, unsigned int width,
-                     unsigned int height, Quadrant *quad, const float *surf,
-					 unsigned int dimx, unsigned int dimy)
+void mark_dirty(BkgReconst *self, const Quadrant *quad)
 {
-	unsigned int x, y;
-	unsigned char *iptr = NULL;
-	float *sptr = NULL;
-	unsigned int i = 0;
-	
-	iptr = image + quad->top * width;
-	sptr = (float *)surf;
+	unsigned int reach = gauss_filter_reach(self->gfilter);
+	Quadrant rect;
+	Quadrant *dptr;
+	unsigned int i;
 	
-	for (y = quad->top; y < quad->bottom; y++) {
-		for (x = quad->left; x < quad->right; x++) {
-			*(iptr + x) = (unsigned char)(*(sptr + i));
+	rect.left = quad->left > reach ? quad->left - reach : 0;
+	rect.top = quad->top > reach ? quad->top - reach : 0;
+	rect.right = quad->right + reach < self->width ? quad->right + reach : self->width;
+	rect.bottom = quad->bottom + reach < self->height ? quad->bottom + reach : self->height;
+	
+	/* a merged rectangle may reach others, so scan again after each. */
+	i = 0;
+	while (i < self->ndirty) {
+		dptr = &self->dirty[i];
+		if (dptr->left > rect.right || rect.left > dptr->right ||
+			dptr->top > rect.bottom || rect.top > dptr->bottom) {
 			i++;
+			continue;
 		}
-		iptr += width;
+		
+		rect.left = dptr->left < rect.left ? dptr->left : rect.left;
+		rect.top = dptr->top < rect.top ? dptr->top : rect.top;
+		rect.right = dptr->right > rect.right ? dptr->right : rect.right;
+		rect.bottom = dptr->bottom > rect.bottom ? dptr->bottom : rect.bottom;
+		
+		self->dirty[i] = self->dirty[--self->ndirty];
+		i = 0;
 	}
+	
+	self->dirty[self->ndirty++] = rect;
 }
 
 /** @brief Background reconstruction thread.
@@ -784,37 +1029,545 @@ void bezier_set_surf(unsigned char *image, unsigned int width,
 void *bkgreconst_thread(void *s)
 {
 	BkgReconst *self = (BkgReconst *)s;
-	int read_len;
-	int write_len;
+	unsigned char *minf_image = NULL;
+	unsigned char *gfbr_image = NULL;
+	Blob *blob = NULL;
+	Quadrant *rect;
+	unsigned int i;
+	long long start;
+	int full;
 	
 	while (!self->stop_reconst) {
+		/* filtered background goes straight into the next free slot. */
+		gfbr_image = (unsigned char *)fifo_reserve_write_wait(self->gfbr_ring, self->out_size,
+			BKGRECONST_WAIT_TIMEOUT);
+		if (!gfbr_image) {
+			continue;
+		}
+		
 		/* read minimum filtered image from ring buffer. */
-		read_len = fifo_get(self->minf_ring, self->o_minf_image, self->image_size);
-		if (read_len != self->image_size) {
+		minf_image = (unsigned char *)fifo_peek_read_wait(self->minf_ring, self->image_size,
+			BKGRECONST_WAIT_TIMEOUT);
+		if (!minf_image) {
 			continue;
 		}
 
 		/* read quadtree decomposed blobs from ring buffer. */
 		while (!self->stop_reconst) {
-			read_len = fifo_get(self->blob_ring, (char *)self->oblob, self->blob_size);
-			if (read_len == self->blob_size) {
+			blob = (Blob *)fifo_peek_read_wait(self->blob_ring, self->blob_size,
+				BKGRECONST_WAIT_TIMEOUT);
+			if (blob) {
 				break;
 			}
 		}
+		
+		if (!blob) {
+			break;
+		}
 
 		/* Bezier interpolation. */
-		bezier_interpolate(self->o_minf_image, self->width, self->height, self->oblob,
-			self->mnbpi, self->U, self->VT, self->temp1, self->temp2, self->bkgr_image);
+		start = timer_now_us();
+		full = 0 == self->frames % self->refresh;
+		bezier_interpolate(self, minf_image, blob, full);
+		fifo_release_read(self->blob_ring, self->blob_size);
+		fifo_release_read(self->minf_ring, self->image_size);
+		stat_timer_add(&self->timers[BKGRECONST_STAGE_BEZIER], timer_now_us() - start);
 				
-		/* gaussian filter. */
-		gauss_filter(self->bkgr_image, self->width, self->height, self->gf_sigma, self->i_gfbr_image);
+		/* gaussian filter, then upsampling if the background is estimated
+		   at reduced size. */
+		start = timer_now_us();
+		if (1 == self->refresh && 1 == self->decimation) {
+			gauss_filter(self->gfilter, self->bkgr_image, gfbr_image);
+		} else {
+			/* blur again where refitted blobs reach, keep the rest. */
+			if (full) {
+				gauss_filter(self->gfilter, self->bkgr_image, self->gfbr_image);
+			} else {
+				for (i = 0; i < self->ndirty; i++) {
+					rect = &self->dirty[i];
+					gauss_filter_rect(self->gfilter, self->bkgr_image, rect->left, rect->top,
+						rect->right, rect->bottom, self->gfbr_image);
+				}
+			}
 			
-		/* write reconstructed background to ring buffer. */
-		write_len = fifo_put(self->gfbr_ring, self->i_gfbr_image, self->image_size);
-		if (write_len != self->image_size) {
-			fprintf(stderr, "fifo_put fail[%s:%d].\n", __FILE__, __LINE__);
+			if (self->decimation > 1) {
+				upsample(self, self->gfbr_image, gfbr_image);
+			} else {
+				memcpy(gfbr_image, self->gfbr_image, self->width * self->height);
+			}
 		}
+		stat_timer_add(&self->timers[BKGRECONST_STAGE_GAUSS], timer_now_us() - start);
+		self->frames++;
+			
+		fifo_commit_write(self->gfbr_ring, self->out_size);
 	}
 	
 	return (void *)(0);
-}
\ No newline at end of file
+}
+
+/** @brief Build U*M for every blob height and VT for every blob width
+ **        the quadtree can produce. Blob sides are the image sides halved
+ **        again and again, a couple of sizes per level.
+ ** @param self BkgReconst instance.
+ ** @return  0 if success,
+ **         -1 if fail.
+ **/
+int bezier_basis_init(BkgReconst *self)
+{
+	unsigned char *xused = NULL;
+	unsigned char *yused = NULL;
+	float *temp = NULL;
+	float *bptr;
+	unsigned int nfloats = 0;
+	unsigned int dim;
+	int ret = -1;
+	
+	self->UM = (float **)calloc(self->height + 1, sizeof(float *));
+	self->VT = (float **)calloc(self->width + 1, sizeof(float *));
+	xused = (unsigned char *)calloc(self->width + 1, 1);
+	yused = (unsigned char *)calloc(self->height + 1, 1);
+	temp = (float *)malloc(4 * (self->width > self->height ? self->width : self->height) *
+		sizeof(float));
+	if (!self->UM || !self->VT || !xused || !yused || !temp) {
+		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+		goto clean;
+	}
+	
+	mark_blob_sizes(xused, self->width);
+	mark_blob_sizes(yused, self->height);
+	
+	for (dim = 1; dim <= self->height; dim++) {
+		nfloats += yused[dim] ? 4 * dim : 0;
+	}
+	
+	for (dim = 1; dim <= self->width; dim++) {
+		nfloats += xused[dim] ? 4 * dim : 0;
+	}
+	
+	self->basis = (float *)malloc(nfloats * sizeof(float));
+	if (!self->basis) {
+		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+		goto clean;
+	}
+	
+	bptr = self->basis;
+	for (dim = 1; dim <= self->height; dim++) {
+		if (yused[dim]) {
+			bezier_interp_coeff(temp, 4, dim);
+			bezier_mul_matrix(temp, 4, dim, M, 4, 4, bptr);
+			self->UM[dim] = bptr;
+			bptr += 4 * dim;
+		}
+	}
+	
+	for (dim = 1; dim <= self->width; dim++) {
+		if (xused[dim]) {
+			bezier_interp_coeff(temp, 4, dim);
+			bezier_trans_matrix(temp, 4, dim, bptr);
+			self->VT[dim] = bptr;
+			bptr += 4 * dim;
+		}
+	}
+	
+	ret = 0;
+	
+	clean:
+	if (xused) {
+		free(xused);
+	}
+	if (yused) {
+		free(yused);
+	}
+	if (temp) {
+		free(temp);
+	}
+	
+	return ret;
+}
+
+/** @brief Mark a blob side and all sides its halves can have.
+ ** @param used marks indexed by side.
+ ** @param size blob side.
+ **/
+void mark_blob_sizes(unsigned char *used, unsigned int size)
+{
+	if (used[size]) {
+		return;
+	}
+	
+	used[size] = 1;
+	if (size > 1) {
+		mark_blob_sizes(used, size >> 1);
+		mark_blob_sizes(used, size - (size >> 1));
+	}
+}
+
+/** @brief Build buffers and tables of decimation and upsampling.
+ ** @param self BkgReconst instance.
+ ** @return  0 if success,
+ **         -1 if fail.
+ **/
+int upsample_init(BkgReconst *self)
+{
+	/* 4x decimation goes through the 2x decimated image. */
+	unsigned int dec_size = (self->out_width >> 1) * (self->out_height >> 1);
+	
+	self->mdec_image = (unsigned char *)malloc(dec_size);
+	self->qdec_image = (unsigned char *)malloc(dec_size);
+	self->upsm_rows = (short *)malloc(self->out_width * self->height * sizeof(short));
+	self->upsm_x0 = (unsigned int *)malloc(self->out_width * sizeof(unsigned int));
+	self->upsm_x1 = (unsigned int *)malloc(self->out_width * sizeof(unsigned int));
+	self->upsm_xw = (short *)malloc(self->out_width * sizeof(short));
+	self->upsm_y0 = (unsigned int *)malloc(self->out_height * sizeof(unsigned int));
+	self->upsm_y1 = (unsigned int *)malloc(self->out_height * sizeof(unsigned int));
+	self->upsm_yw = (short *)malloc(self->out_height * sizeof(short));
+	if (!self->mdec_image || !self->qdec_image || !self->upsm_rows ||
+		!self->upsm_x0 || !self->upsm_x1 || !self->upsm_xw ||
+		!self->upsm_y0 || !self->upsm_y1 || !self->upsm_yw) {
+		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+		return -1;
+	}
+	
+	upsample_table(self->out_width, self->width, self->decimation,
+		self->upsm_x0, self->upsm_x1, self->upsm_xw);
+	upsample_table(self->out_height, self->height, self->decimation,
+		self->upsm_y0, self->upsm_y1, self->upsm_yw);
+	
+	return 0;
+}
+
+/** @brief Build bilinear sampling table of one direction. Pixel centers
+ **        are aligned, output pixel o samples input position
+ **        (o + 0.5) / factor - 0.5, clamped to the input.
+ ** @param osize output size.
+ ** @param isize input size.
+ ** @param factor upsampling factor.
+ ** @param i0 lower input index of each output pixel.
+ ** @param i1 upper input index of each output pixel.
+ ** @param w Q7 weight of upper input pixel.
+ **/
+void upsample_table(unsigned int osize, unsigned int isize, unsigned int factor,
+                    unsigned int *i0, unsigned int *i1, short *w)
+{
+	unsigned int o;
+	int pos;
+	
+	for (o = 0; o < osize; o++) {
+		/* position in 1/(2 * factor) input pixels. */
+		pos = (int)(2 * o + 1) - (int)factor;
+		if (pos <= 0) {
+			i0[o] = i1[o] = 0;
+			w[o] = 0;
+		} else if ((unsigned int)pos >= 2 * factor * (isize - 1)) {
+			i0[o] = i1[o] = isize - 1;
+			w[o] = 0;
+		} else {
+			i0[o] = pos / (2 * factor);
+			i1[o] = i0[o] + 1;
+			w[o] = (short)(((pos % (2 * factor)) << 7) / (2 * factor));
+		}
+	}
+}
+
+/** @brief Shrink image by block minimums, a 2x2 block at a time.
+ ** @param self BkgReconst instance.
+ ** @param image infrared image.
+ ** @param dec_image image shrunk by decimation.
+ **/
+void decimate(BkgReconst *self, const unsigned char *image, unsigned char *dec_image)
+{
+	HalveMinRow halve_min_row = halve_min_row_fns[cpu_level()];
+	unsigned int iw = self->out_width;
+	unsigned int ow = self->out_width >> 1;
+	unsigned int oh = self->out_height >> 1;
+	unsigned int y;
+	
+	for (y = 0; y < oh; y++) {
+		halve_min_row(image + 2 * y * iw, image + (2 * y + 1) * iw, ow, dec_image + y * ow);
+	}
+	
+	/* 4x decimation halves the 2x decimated image in place. */
+	if (4 == self->decimation) {
+		iw = ow;
+		ow = self->width;
+		oh = self->height;
+		for (y = 0; y < oh; y++) {
+			halve_min_row(dec_image + 2 * y * iw, dec_image + (2 * y + 1) * iw, ow,
+				dec_image + y * ow);
+		}
+	}
+}
+
+/** @brief Upsample background bilinearly to infrared image size. Input
+ **        rows are upsampled horizontally into Q7 rows once, output rows
+ **        blend two of them.
+ ** @param self BkgReconst instance.
+ ** @param image background at reduced size.
+ ** @param ups_image background at infrared image size.
+ **/
+void upsample(BkgReconst *self, const unsigned char *image, unsigned char *ups_image)
+{
+	BlendRows blend_rows = blend_rows_fns[cpu_level()];
+	const unsigned char *src;
+	short *row;
+	unsigned int ow = self->out_width;
+	unsigned int x, y;
+	
+	for (y = 0; y < self->height; y++) {
+		src = image + y * self->width;
+		row = self->upsm_rows + y * ow;
+		for (x = 0; x < ow; x++) {
+			row[x] = (short)(src[self->upsm_x0[x]] * (128 - self->upsm_xw[x]) +
+				src[self->upsm_x1[x]] * self->upsm_xw[x]);
+		}
+	}
+	
+	for (y = 0; y < self->out_height; y++) {
+		blend_rows(self->upsm_rows + self->upsm_y0[y] * ow, self->upsm_rows + self->upsm_y1[y] * ow,
+			self->upsm_yw[y], ow, ups_image + y * ow);
+	}
+}
+
+/** @brief Evaluate one row of Bezier surface, no speed up.
+ ** @param VT VT of blob width, 4 rows of dimx.
+ ** @param dimx blob width.
+ ** @param w row of U*M*P*MT.
+ ** @param dst surface row in background image.
+ **/
+void surf_row_nsu(const float *VT, unsigned int dimx, const float *w,
+                  unsigned char *dst)
+{
+	unsigned int x, k;
+	float sum;
+	
+	for (x = 0; x < dimx; x++) {
+		sum = 0;
+		for (k = 0; k < 4; k++) {
+			sum += w[k] * VT[k * dimx + x];
+		}
+		dst[x] = (unsigned char)sum;
+	}
+}
+
+/** @brief Minimum of 2x2 pixel blocks of two rows, no speed up.
+ ** @param a upper row.
+ ** @param b lower row.
+ ** @param n number of blocks.
+ ** @param dst block minimums, may be a.
+ **/
+void halve_min_row_nsu(const unsigned char *a, const unsigned char *b,
+                       unsigned int n, unsigned char *dst)
+{
+	unsigned int i;
+	unsigned char m0, m1;
+	
+	for (i = 0; i < n; i++) {
+		m0 = a[2 * i] < b[2 * i] ? a[2 * i] : b[2 * i];
+		m1 = a[2 * i + 1] < b[2 * i + 1] ? a[2 * i + 1] : b[2 * i + 1];
+		dst[i] = m0 < m1 ? m0 : m1;
+	}
+}
+
+/** @brief Blend two Q7 rows into 8-bit pixels, no speed up.
+ **        dst = (a * (128 - w) + b * w) / 16384, rounded.
+ ** @param a upper row.
+ ** @param b lower row.
+ ** @param w Q7 weight of lower row.
+ ** @param n row length.
+ ** @param dst output row.
+ **/
+void blend_rows_nsu(const short *a, const short *b, short w, unsigned int n,
+                    unsigned char *dst)
+{
+	unsigned int i;
+	
+	for (i = 0; i < n; i++) {
+		dst[i] = (unsigned char)((a[i] * (128 - w) + b[i] * w + (1 << 13)) >> 14);
+	}
+}
+
+#ifdef CPU_X86
+/** @brief Evaluate one row of Bezier surface with SSE.
+ ** @param VT VT of blob width, 4 rows of dimx.
+ ** @param dimx blob width.
+ ** @param w row of U*M*P*MT.
+ ** @param dst surface row in background image.
+ **/
+CPU_TARGET_SSE41
+void surf_row_sse(const float *VT, unsigned int dimx, const float *w,
+                  unsigned char *dst)
+{
+	unsigned int x;
+	const unsigned int ppl = 4;
+	__m128 W0 = _mm_set1_ps(w[0]);
+	__m128 W1 = _mm_set1_ps(w[1]);
+	__m128 W2 = _mm_set1_ps(w[2]);
+	__m128 W3 = _mm_set1_ps(w[3]);
+	__m128 S;
+	__m128i Z;
+	
+	/* same operation order as the scalar kernel, results are identical. */
+	for (x = 0; x + ppl <= dimx; x += ppl) {
+		S = _mm_mul_ps(W0, _mm_loadu_ps(VT + x));
+		S = _mm_add_ps(S, _mm_mul_ps(W1, _mm_loadu_ps(VT + dimx + x)));
+		S = _mm_add_ps(S, _mm_mul_ps(W2, _mm_loadu_ps(VT + 2 * dimx + x)));
+		S = _mm_add_ps(S, _mm_mul_ps(W3, _mm_loadu_ps(VT + 3 * dimx + x)));
+		Z = _mm_cvttps_epi32(S);
+		Z = _mm_packus_epi16(_mm_packs_epi32(Z, Z), Z);
+		*(int *)(dst + x) = _mm_cvtsi128_si32(Z);
+	}
+	
+	for (; x < dimx; x++) {
+		dst[x] = (unsigned char)(w[0] * VT[x] + w[1] * VT[dimx + x] +
+			w[2] * VT[2 * dimx + x] + w[3] * VT[3 * dimx + x]);
+	}
+}
+
+/** @brief Evaluate one row of Bezier surface with AVX2.
+ ** @param VT VT of blob width, 4 rows of dimx.
+ ** @param dimx blob width.
+ ** @param w row of U*M*P*MT.
+ ** @param dst surface row in background image.
+ **/
+CPU_TARGET_AVX2
+void surf_row_avx2(const float *VT, unsigned int dimx, const float *w,
+                   unsigned char *dst)
+{
+	unsigned int x;
+	const unsigned int ppl = 8;
+	__m256 W0 = _mm256_set1_ps(w[0]);
+	__m256 W1 = _mm256_set1_ps(w[1]);
+	__m256 W2 = _mm256_set1_ps(w[2]);
+	__m256 W3 = _mm256_set1_ps(w[3]);
+	__m256 S;
+	__m256i Z;
+	__m128i P;
+	
+	for (x = 0; x + ppl <= dimx; x += ppl) {
+		S = _mm256_mul_ps(W0, _mm256_loadu_ps(VT + x));
+		S = _mm256_add_ps(S, _mm256_mul_ps(W1, _mm256_loadu_ps(VT + dimx + x)));
+		S = _mm256_add_ps(S, _mm256_mul_ps(W2, _mm256_loadu_ps(VT + 2 * dimx + x)));
+		S = _mm256_add_ps(S, _mm256_mul_ps(W3, _mm256_loadu_ps(VT + 3 * dimx + x)));
+		Z = _mm256_cvttps_epi32(S);
+		P = _mm_packs_epi32(_mm256_castsi256_si128(Z), _mm256_extracti128_si256(Z, 1));
+		_mm_storel_epi64((__m128i *)(dst + x), _mm_packus_epi16(P, P));
+	}
+	
+	for (; x < dimx; x++) {
+		dst[x] = (unsigned char)(w[0] * VT[x] + w[1] * VT[dimx + x] +
+			w[2] * VT[2 * dimx + x] + w[3] * VT[3 * dimx + x]);
+	}
+}
+
+/** @brief Minimum of 2x2 pixel blocks of two rows with SSE.
+ ** @param a upper row.
+ ** @param b lower row.
+ ** @param n number of blocks.
+ ** @param dst block minimums, may be a.
+ **/
+CPU_TARGET_SSE41
+void halve_min_row_sse(const unsigned char *a, const unsigned char *b,
+                       unsigned int n, unsigned char *dst)
+{
+	unsigned int i;
+	const unsigned int ppl = 8;
+	__m128i M;
+	
+	for (i = 0; i + ppl <= n; i += ppl) {
+		M = _mm_min_epu8(_mm_loadu_si128((__m128i *)(a + 2 * i)),
+			_mm_loadu_si128((__m128i *)(b + 2 * i)));
+		M = _mm_min_epu8(M, _mm_srli_epi16(M, 8));
+		M = _mm_and_si128(M, _mm_set1_epi16(0xFF));
+		_mm_storel_epi64((__m128i *)(dst + i), _mm_packus_epi16(M, M));
+	}
+	
+	halve_min_row_nsu(a + 2 * i, b + 2 * i, n - i, dst + i);
+}
+
+/** @brief Blend two Q7 rows into 8-bit pixels with SSE.
+ ** @param a upper row.
+ ** @param b lower row.
+ ** @param w Q7 weight of lower row.
+ ** @param n row length.
+ ** @param dst output row.
+ **/
+CPU_TARGET_SSE41
+void blend_rows_sse(const short *a, const short *b, short w, unsigned int n,
+                    unsigned char *dst)
+{
+	unsigned int i;
+	const unsigned int ppl = 8;
+	__m128i W = _mm_set1_epi32((w << 16) | (128 - w));
+	__m128i R = _mm_set1_epi32(1 << 13);
+	__m128i A, B, L, H;
+	
+	/* a and b interleaved, then one multiply-add per pair. */
+	for (i = 0; i + ppl <= n; i += ppl) {
+		A = _mm_loadu_si128((__m128i *)(a + i));
+		B = _mm_loadu_si128((__m128i *)(b + i));
+		L = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(A, B), W), R), 14);
+		H = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(A, B), W), R), 14);
+		L = _mm_packs_epi32(L, H);
+		_mm_storel_epi64((__m128i *)(dst + i), _mm_packus_epi16(L, L));
+	}
+	
+	blend_rows_nsu(a + i, b + i, w, n - i, dst + i);
+}
+
+/** @brief Minimum of 2x2 pixel blocks of two rows with AVX2.
+ ** @param a upper row.
+ ** @param b lower row.
+ ** @param n number of blocks.
+ ** @param dst block minimums, may be a.
+ **/
+CPU_TARGET_AVX2
+void halve_min_row_avx2(const unsigned char *a, const unsigned char *b,
+                        unsigned int n, unsigned char *dst)
+{
+	unsigned int i;
+	const unsigned int ppl = 16;
+	__m256i M;
+	
+	for (i = 0; i + ppl <= n; i += ppl) {
+		M = _mm256_min_epu8(_mm256_loadu_si256((__m256i *)(a + 2 * i)),
+			_mm256_loadu_si256((__m256i *)(b + 2 * i)));
+		M = _mm256_min_epu8(M, _mm256_srli_epi16(M, 8));
+		M = _mm256_and_si256(M, _mm256_set1_epi16(0xFF));
+		M = _mm256_permute4x64_epi64(_mm256_packus_epi16(M, M), 0xD8);
+		_mm_storeu_si128((__m128i *)(dst + i), _mm256_castsi256_si128(M));
+	}
+	
+	halve_min_row_nsu(a + 2 * i, b + 2 * i, n - i, dst + i);
+}
+
+/** @brief Blend two Q7 rows into 8-bit pixels with AVX2.
+ ** @param a upper row.
+ ** @param b lower row.
+ ** @param w Q7 weight of lower row.
+ ** @param n row length.
+ ** @param dst output row.
+ **/
+CPU_TARGET_AVX2
+void blend_rows_avx2(const short *a, const short *b, short w, unsigned int n,
+                     unsigned char *dst)
+{
+	unsigned int i;
+	const unsigned int ppl = 16;
+	__m256i W = _mm256_set1_epi32((w << 16) | (128 - w));
+	__m256i R = _mm256_set1_epi32(1 << 13);
+	__m256i A, B, L, H;
+	
+	/* unpack and pack work within 128-bit lanes, so the lanes line up. */
+	for (i = 0; i + ppl <= n; i += ppl) {
+		A = _mm256_loadu_si256((__m256i *)(a + i));
+		B = _mm256_loadu_si256((__m256i *)(b + i));
+		L = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(A, B), W), R), 14);
+		H = _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(A, B), W), R), 14);
+		L = _mm256_packs_epi32(L, H);
+		L = _mm256_permute4x64_epi64(_mm256_packus_epi16(L, L), 0xD8);
+		_mm_storeu_si128((__m128i *)(dst + i), _mm256_castsi256_si128(L));
+	}
+	
+	blend_rows_nsu(a + i, b + i, w, n - i, dst + i);
+}
+#endif
\ No newline at end of file
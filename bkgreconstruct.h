@@ -21,28 +21,52 @@ extern "C"
 {
 #endif
 
+#include "framepool.h"
+#include "stats.h"
+
 /** @typedef struct BkgReconst
  ** @brief background reconstruction structure
  **/
 struct tagBkgReconst;
 typedef struct tagBkgReconst BkgReconst;
 
+/** @typedef enum BkgReconstStage
+ ** @brief timed processing stage of background reconstruction
+ **/
+typedef enum
+{
+	BKGRECONST_STAGE_MINFILTER = 0,		/**< minimum filter. */
+	BKGRECONST_STAGE_QTREE,				/**< quadtree decompose. */
+	BKGRECONST_STAGE_BEZIER,			/**< Bezier interpolation. */
+	BKGRECONST_STAGE_GAUSS,				/**< gaussian filter. */
+	BKGRECONST_STAGES
+}BkgReconstStage;
+
 /** @name Create, initialize, and destroy
  ** @{ */
 BkgReconst *bkgreconst_new();
 int bkgreconst_init(BkgReconst *self, unsigned int width,
-                    unsigned int height);
+                    unsigned int height, unsigned int decimation);
 void bkgreconst_delete(BkgReconst *self);
 /** @} */
 
 /** @name Data processing
  ** @{ */
+int bkgreconst_set_temporal(BkgReconst *self, unsigned int refresh,
+                            unsigned int threshold);
 int bkgreconst_start(BkgReconst *self);
 void bkgreconst_stop(BkgReconst *self);
 int bkgreconst_put(BkgReconst *self,
-                   unsigned char *image);
+                   Frame *frame);
 int bkgreconst_get(BkgReconst *self,
                    unsigned char *bkg);
+int bkgreconst_get_wait(BkgReconst *self,
+                        unsigned char *bkg, int timeout);
+/** @} */
+
+/** @name Statistics
+ ** @{ */
+const StatTimer *bkgreconst_get_timer(BkgReconst *self, BkgReconstStage stage);
 /** @} */
 
 #ifdef __cplusplus
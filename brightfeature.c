@@ -0,0 +1,572 @@
+/** @file brightfeature.c - Implementation
+ ** @brief Fused infrared bright feature extraction and overlay
+ ** @author Zhiwei Zeng
+ ** @date 2018.06.04
+ **/
+
+/*
+Copyright (C) 2018 Zhiwei Zeng.
+Copyright (C) 2018 Chengdu ZLT Technology Co., Ltd.
+All rights reserved.
+
+This file is part of the railway monitor toolkit and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "brightfeature.h"
+
+#ifdef CPU_X86
+#	include <immintrin.h>
+#endif
+
+typedef void (*BrightFeatureExtract)(const unsigned char *I, const unsigned char *V,
+                                     const unsigned char *G, unsigned int width,
+                                     unsigned int height, unsigned char *F,
+                                     unsigned int *hist);
+typedef void (*BrightFeatureOverlay)(const unsigned char *V, const unsigned char *F,
+                                     unsigned int width, unsigned int height, float k,
+                                     unsigned char *S, unsigned char *O);
+
+/* kernels by CpuLevel. */
+#ifdef CPU_X86
+static const BrightFeatureExtract bright_feature_extract_fns[CPU_LEVELS] = {
+	bright_feature_extract_nsu, bright_feature_extract_sse,
+	bright_feature_extract_avx2, bright_feature_extract_avx512
+};
+
+static const BrightFeatureOverlay bright_feature_overlay_fns[CPU_LEVELS] = {
+	bright_feature_overlay_nsu, bright_feature_overlay_sse,
+	bright_feature_overlay_avx2, bright_feature_overlay_avx512
+};
+#else
+static const BrightFeatureExtract bright_feature_extract_fns[CPU_LEVELS] = {
+	bright_feature_extract_nsu, bright_feature_extract_nsu,
+	bright_feature_extract_nsu, bright_feature_extract_nsu
+};
+
+static const BrightFeatureOverlay bright_feature_overlay_fns[CPU_LEVELS] = {
+	bright_feature_overlay_nsu, bright_feature_overlay_nsu,
+	bright_feature_overlay_nsu, bright_feature_overlay_nsu
+};
+#endif
+
+/* histogram is counted into this many copies so that runs of equal
+   pixels do not wait on the store of the previous increment. */
+#define HIST_COPIES 4
+
+/* unsuppressed fusion values widened to 16 bits before counting them.
+   Counting from a 16-bit buffer avoids two byte loads and an add per
+   increment. */
+#define HIST_BLOCK 256
+
+typedef unsigned int SubHist[HIST_COPIES][BRIGHT_FEATURE_BINS];
+
+/** @name some private functions.
+ ** @{ */
+static void refine_feature(const unsigned char *I, const unsigned char *V,
+                           const unsigned char *G, unsigned int n,
+                           unsigned char *F, unsigned short *U);
+static void accumulate_hist(const unsigned short *U, unsigned int n,
+                            SubHist subs);
+static void merge_hist(SubHist subs, unsigned int *hist);
+/** @} */
+
+/** @brief Extract refined infrared bright feature and accumulate the
+ **        histogram of the unsuppressed fusion image in one pass. It
+ **        equals to
+ **        brft = I - G, etbk = V - I, F = brft - etbk (all saturated),
+ **        hist[V + F]++.
+ **        The kernel is picked by cpu_level.
+ ** @param I infrared image.
+ ** @param V visual image.
+ ** @param G reconstructed infrared background.
+ ** @param width image width.
+ ** @param height image height.
+ ** @param F refined bright feature image.
+ ** @param hist histogram of BRIGHT_FEATURE_BINS bins.
+ **/
+void bright_feature_extract(const unsigned char *I, const unsigned char *V,
+                            const unsigned char *G, unsigned int width,
+                            unsigned int height, unsigned char *F,
+                            unsigned int *hist)
+{
+	assert(I);
+	assert(V);
+	assert(G);
+	assert(F);
+	assert(hist);
+	
+	bright_feature_extract_fns[cpu_level()](I, V, G, width, height, F, hist);
+}
+
+/** @brief Suppress bright feature and overlay it on visual image in one
+ **        pass. It equals to
+ **        S = k * F (truncated and saturated), O = V + S (saturated).
+ **        The kernel is picked by cpu_level.
+ ** @param V visual image.
+ ** @param F refined bright feature image.
+ ** @param width image width.
+ ** @param height image height.
+ ** @param k suppression ratio.
+ ** @param S suppressed bright feature image.
+ ** @param O fusion image.
+ **/
+void bright_feature_overlay(const unsigned char *V, const unsigned char *F,
+                            unsigned int width, unsigned int height, float k,
+                            unsigned char *S, unsigned char *O)
+{
+	assert(V);
+	assert(F);
+	assert(S);
+	assert(O);
+	
+	bright_feature_overlay_fns[cpu_level()](V, F, width, height, k, S, O);
+}
+
+#ifdef CPU_X86
+/** @brief Extract refined bright feature with SSE.
+ ** @param I infrared image.
+ ** @param V visual image.
+ ** @param G reconstructed infrared background.
+ ** @param width image width.
+ ** @param height image height.
+ ** @param F refined bright feature image.
+ ** @param hist histogram of unsuppressed fusion image.
+ **/
+CPU_TARGET_SSE41
+void bright_feature_extract_sse(const unsigned char *I, const unsigned char *V,
+                                const unsigned char *G, unsigned int width,
+                                unsigned int height, unsigned char *F,
+                                unsigned int *hist)
+{
+	unsigned int i, j;
+	unsigned int npixels;
+	const unsigned int ppl = 16;
+	unsigned short sums[HIST_BLOCK];
+	SubHist subs;
+	
+	__m128i X;
+	__m128i Y;
+	__m128i Z;
+	__m128i ZERO;
+	
+	npixels = width * height;
+	ZERO = _mm_setzero_si128();
+	memset(subs, 0, sizeof(subs));
+	
+	for (i = 0; i + HIST_BLOCK <= npixels; i += HIST_BLOCK) {
+		for (j = 0; j < HIST_BLOCK; j += ppl) {
+			X = _mm_loadu_si128((__m128i *)(I + i + j));
+			Y = _mm_loadu_si128((__m128i *)(V + i + j));
+			Z = _mm_loadu_si128((__m128i *)(G + i + j));
+			
+			Z = _mm_subs_epu8(_mm_subs_epu8(X, Z), _mm_subs_epu8(Y, X));
+			_mm_storeu_si128((__m128i *)(F + i + j), Z);
+			
+			X = _mm_add_epi16(_mm_unpacklo_epi8(Y, ZERO), _mm_unpacklo_epi8(Z, ZERO));
+			_mm_storeu_si128((__m128i *)(sums + j), X);
+			X = _mm_add_epi16(_mm_unpackhi_epi8(Y, ZERO), _mm_unpackhi_epi8(Z, ZERO));
+			_mm_storeu_si128((__m128i *)(sums + j + 8), X);
+		}
+		
+		accumulate_hist(sums, HIST_BLOCK, subs);
+	}
+	
+	refine_feature(I + i, V + i, G + i, npixels - i, F + i, sums);
+	accumulate_hist(sums, npixels - i, subs);
+	merge_hist(subs, hist);
+}
+
+/** @brief Extract refined bright feature with AVX2.
+ ** @param I infrared image.
+ ** @param V visual image.
+ ** @param G reconstructed infrared background.
+ ** @param width image width.
+ ** @param height image height.
+ ** @param F refined bright feature image.
+ ** @param hist histogram of unsuppressed fusion image.
+ **/
+CPU_TARGET_AVX2
+void bright_feature_extract_avx2(const unsigned char *I, const unsigned char *V,
+                                 const unsigned char *G, unsigned int width,
+                                 unsigned int height, unsigned char *F,
+                                 unsigned int *hist)
+{
+	unsigned int i, j;
+	unsigned int npixels;
+	const unsigned int ppl = 32;
+	unsigned short sums[HIST_BLOCK];
+	SubHist subs;
+	
+	__m256i X;
+	__m256i Y;
+	__m256i Z;
+	__m256i ZERO;
+	
+	npixels = width * height;
+	ZERO = _mm256_setzero_si256();
+	memset(subs, 0, sizeof(subs));
+	
+	for (i = 0; i + HIST_BLOCK <= npixels; i += HIST_BLOCK) {
+		for (j = 0; j < HIST_BLOCK; j += ppl) {
+			X = _mm256_loadu_si256((__m256i *)(I + i + j));
+			Y = _mm256_loadu_si256((__m256i *)(V + i + j));
+			Z = _mm256_loadu_si256((__m256i *)(G + i + j));
+			
+			Z = _mm256_subs_epu8(_mm256_subs_epu8(X, Z), _mm256_subs_epu8(Y, X));
+			_mm256_storeu_si256((__m256i *)(F + i + j), Z);
+			
+			/* the unpacks work per 128-bit lane, which leaves the sums out
+			   of pixel order. Counting does not care. */
+			X = _mm256_add_epi16(_mm256_unpacklo_epi8(Y, ZERO), _mm256_unpacklo_epi8(Z, ZERO));
+			_mm256_storeu_si256((__m256i *)(sums + j), X);
+			X = _mm256_add_epi16(_mm256_unpackhi_epi8(Y, ZERO), _mm256_unpackhi_epi8(Z, ZERO));
+			_mm256_storeu_si256((__m256i *)(sums + j + 16), X);
+		}
+		
+		accumulate_hist(sums, HIST_BLOCK, subs);
+	}
+	
+	refine_feature(I + i, V + i, G + i, npixels - i, F + i, sums);
+	accumulate_hist(sums, npixels - i, subs);
+	merge_hist(subs, hist);
+}
+
+/** @brief Extract refined bright feature with AVX-512.
+ ** @param I infrared image.
+ ** @param V visual image.
+ ** @param G reconstructed infrared background.
+ ** @param width image width.
+ ** @param height image height.
+ ** @param F refined bright feature image.
+ ** @param hist histogram of unsuppressed fusion image.
+ **/
+CPU_TARGET_AVX512BW
+void bright_feature_extract_avx512(const unsigned char *I, const unsigned char *V,
+                                   const unsigned char *G, unsigned int width,
+                                   unsigned int height, unsigned char *F,
+                                   unsigned int *hist)
+{
+	unsigned int i, j;
+	unsigned int npixels;
+	const unsigned int ppl = 64;
+	unsigned short sums[HIST_BLOCK];
+	SubHist subs;
+	
+	__m512i X;
+	__m512i Y;
+	__m512i Z;
+	__m512i ZERO;
+	
+	npixels = width * height;
+	ZERO = _mm512_setzero_si512();
+	memset(subs, 0, sizeof(subs));
+	
+	for (i = 0; i + HIST_BLOCK <= npixels; i += HIST_BLOCK) {
+		for (j = 0; j < HIST_BLOCK; j += ppl) {
+			X = _mm512_loadu_si512((void *)(I + i + j));
+			Y = _mm512_loadu_si512((void *)(V + i + j));
+			Z = _mm512_loadu_si512((void *)(G + i + j));
+			
+			Z = _mm512_subs_epu8(_mm512_subs_epu8(X, Z), _mm512_subs_epu8(Y, X));
+			_mm512_storeu_si512((void *)(F + i + j), Z);
+			
+			X = _mm512_add_epi16(_mm512_unpacklo_epi8(Y, ZERO), _mm512_unpacklo_epi8(Z, ZERO));
+			_mm512_storeu_si512((void *)(sums + j), X);
+			X = _mm512_add_epi16(_mm512_unpackhi_epi8(Y, ZERO), _mm512_unpackhi_epi8(Z, ZERO));
+			_mm512_storeu_si512((void *)(sums + j + 32), X);
+		}
+		
+		accumulate_hist(sums, HIST_BLOCK, subs);
+	}
+	
+	refine_feature(I + i, V + i, G + i, npixels - i, F + i, sums);
+	accumulate_hist(sums, npixels - i, subs);
+	merge_hist(subs, hist);
+}
+
+/** @brief Suppress and overlay bright feature with SSE.
+ ** @param V visual image.
+ ** @param F refined bright feature image.
+ ** @param width image width.
+ ** @param height image height.
+ ** @param k suppression ratio.
+ ** @param S suppressed bright feature image.
+ ** @param O fusion image.
+ **/
+CPU_TARGET_SSE41
+void bright_feature_overlay_sse(const unsigned char *V, const unsigned char *F,
+                                unsigned int width, unsigned int height, float k,
+                                unsigned char *S, unsigned char *O)
+{
+	unsigned int i;
+	unsigned int npixels;
+	const unsigned int ppl = 16;
+	
+	__m128 K;
+	__m128i X;
+	__m128i Y0;
+	__m128i Y1;
+	__m128i Y2;
+	__m128i Y3;
+	
+	npixels = width * height;
+	K = _mm_set1_ps(k);
+	
+	for (i = 0; i + ppl <= npixels; i += ppl) {
+		X = _mm_loadu_si128((__m128i *)(F + i));
+		
+		Y0 = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(X)), K));
+		Y1 = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(
+			_mm_srli_si128(X, 4))), K));
+		Y2 = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(
+			_mm_srli_si128(X, 8))), K));
+		Y3 = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(
+			_mm_srli_si128(X, 12))), K));
+		
+		X = _mm_packus_epi16(_mm_packus_epi32(Y0, Y1), _mm_packus_epi32(Y2, Y3));
+		_mm_storeu_si128((__m128i *)(S + i), X);
+		
+		X = _mm_adds_epu8(X, _mm_loadu_si128((__m128i *)(V + i)));
+		_mm_storeu_si128((__m128i *)(O + i), X);
+	}
+	
+	bright_feature_overlay_nsu(V + i, F + i, npixels - i, 1, k, S + i, O + i);
+}
+
+/** @brief Suppress and overlay bright feature with AVX2.
+ ** @param V visual image.
+ ** @param F refined bright feature image.
+ ** @param width image width.
+ ** @param height image height.
+ ** @param k suppression ratio.
+ ** @param S suppressed bright feature image.
+ ** @param O fusion image.
+ **/
+CPU_TARGET_AVX2
+void bright_feature_overlay_avx2(const unsigned char *V, const unsigned char *F,
+                                 unsigned int width, unsigned int height, float k,
+                                 unsigned char *S, unsigned char *O)
+{
+	unsigned int i;
+	unsigned int npixels;
+	const unsigned int ppl = 32;
+	
+	__m256 K;
+	__m256i Y0;
+	__m256i Y1;
+	__m256i Y2;
+	__m256i Y3;
+	__m256i ORDER;
+	
+	npixels = width * height;
+	K = _mm256_set1_ps(k);
+	
+	/* the packs work per 128-bit lane, put the dwords back in order. */
+	ORDER = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	
+	for (i = 0; i + ppl <= npixels; i += ppl) {
+		Y0 = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i *)(F + i)));
+		Y1 = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i *)(F + i + 8)));
+		Y2 = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i *)(F + i + 16)));
+		Y3 = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i *)(F + i + 24)));
+		
+		Y0 = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(Y0), K));
+		Y1 = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(Y1), K));
+		Y2 = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(Y2), K));
+		Y3 = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(Y3), K));
+		
+		Y0 = _mm256_packus_epi32(Y0, Y1);
+		Y2 = _mm256_packus_epi32(Y2, Y3);
+		Y0 = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(Y0, Y2), ORDER);
+		_mm256_storeu_si256((__m256i *)(S + i), Y0);
+		
+		Y0 = _mm256_adds_epu8(Y0, _mm256_loadu_si256((__m256i *)(V + i)));
+		_mm256_storeu_si256((__m256i *)(O + i), Y0);
+	}
+	
+	bright_feature_overlay_nsu(V + i, F + i, npixels - i, 1, k, S + i, O + i);
+}
+
+/** @brief Suppress and overlay bright feature with AVX-512.
+ ** @param V visual image.
+ ** @param F refined bright feature image.
+ ** @param width image width.
+ ** @param height image height.
+ ** @param k suppression ratio.
+ ** @param S suppressed bright feature image.
+ ** @param O fusion image.
+ **/
+CPU_TARGET_AVX512BW
+void bright_feature_overlay_avx512(const unsigned char *V, const unsigned char *F,
+                                   unsigned int width, unsigned int height, float k,
+                                   unsigned char *S, unsigned char *O)
+{
+	unsigned int i;
+	unsigned int npixels;
+	const unsigned int ppl = 32;
+	
+	__m512 K;
+	__m512i Y0;
+	__m512i Y1;
+	__m256i Z;
+	
+	npixels = width * height;
+	K = _mm512_set1_ps(k);
+	
+	for (i = 0; i + ppl <= npixels; i += ppl) {
+		Y0 = _mm512_cvtepu8_epi32(_mm_loadu_si128((__m128i *)(F + i)));
+		Y1 = _mm512_cvtepu8_epi32(_mm_loadu_si128((__m128i *)(F + i + 16)));
+		
+		Y0 = _mm512_cvttps_epi32(_mm512_mul_ps(_mm512_cvtepi32_ps(Y0), K));
+		Y1 = _mm512_cvttps_epi32(_mm512_mul_ps(_mm512_cvtepi32_ps(Y1), K));
+		
+		Z = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm512_cvtusepi32_epi8(Y0)),
+			_mm512_cvtusepi32_epi8(Y1), 1);
+		_mm256_storeu_si256((__m256i *)(S + i), Z);
+		
+		Z = _mm256_adds_epu8(Z, _mm256_loadu_si256((__m256i *)(V + i)));
+		_mm256_storeu_si256((__m256i *)(O + i), Z);
+	}
+	
+	bright_feature_overlay_nsu(V + i, F + i, npixels - i, 1, k, S + i, O + i);
+}
+#endif
+
+/** @brief Extract refined bright feature no speed up.
+ ** @param I infrared image.
+ ** @param V visual image.
+ ** @param G reconstructed infrared background.
+ ** @param width image width.
+ ** @param height image height.
+ ** @param F refined bright feature image.
+ ** @param hist histogram of unsuppressed fusion image.
+ **/
+void bright_feature_extract_nsu(const unsigned char *I, const unsigned char *V,
+                                const unsigned char *G, unsigned int width,
+                                unsigned int height, unsigned char *F,
+                                unsigned int *hist)
+{
+	unsigned int i;
+	unsigned int n;
+	unsigned int npixels;
+	unsigned short sums[HIST_BLOCK];
+	SubHist subs;
+	
+	npixels = width * height;
+	memset(subs, 0, sizeof(subs));
+	
+	for (i = 0; i < npixels; i += n) {
+		n = npixels - i < HIST_BLOCK ? npixels - i : HIST_BLOCK;
+		refine_feature(I + i, V + i, G + i, n, F + i, sums);
+		accumulate_hist(sums, n, subs);
+	}
+	
+	merge_hist(subs, hist);
+}
+
+/** @brief Suppress and overlay bright feature no speed up.
+ ** @param V visual image.
+ ** @param F refined bright feature image.
+ ** @param width image width.
+ ** @param height image height.
+ ** @param k suppression ratio.
+ ** @param S suppressed bright feature image.
+ ** @param O fusion image.
+ **/
+void bright_feature_overlay_nsu(const unsigned char *V, const unsigned char *F,
+                                unsigned int width, unsigned int height, float k,
+                                unsigned char *S, unsigned char *O)
+{
+	unsigned int i;
+	unsigned int npixels;
+	unsigned int sbrf;
+	unsigned int sum;
+	
+	npixels = width * height;
+	
+	for (i = 0; i < npixels; i++) {
+		sbrf = (unsigned int)(k * F[i]);
+		if (sbrf > 255) {
+			sbrf = 255;
+		}
+		
+		sum = V[i] + sbrf;
+		if (sum > 255) {
+			sum = 255;
+		}
+		
+		S[i] = sbrf;
+		O[i] = sum;
+	}
+}
+
+/** @brief Refine bright feature of some pixels.
+ ** @param I infrared image.
+ ** @param V visual image.
+ ** @param G reconstructed infrared background.
+ ** @param n number of pixels.
+ ** @param F refined bright feature image.
+ ** @param U unsuppressed fusion values, visual plus refined bright feature.
+ **/
+void refine_feature(const unsigned char *I, const unsigned char *V,
+                    const unsigned char *G, unsigned int n,
+                    unsigned char *F, unsigned short *U)
+{
+	unsigned int i;
+	int brft;
+	int etbk;
+	int rfbf;
+	
+	/* clamp after subtracting so that compiler makes no branch. */
+	for (i = 0; i < n; i++) {
+		brft = I[i] - G[i];
+		brft = brft < 0 ? 0 : brft;
+		etbk = V[i] - I[i];
+		etbk = etbk < 0 ? 0 : etbk;
+		rfbf = brft - etbk;
+		rfbf = rfbf < 0 ? 0 : rfbf;
+		F[i] = rfbf;
+		U[i] = V[i] + rfbf;
+	}
+}
+
+/** @brief Count the unsuppressed fusion values of a block which is still
+ **        in cache.
+ ** @param U unsuppressed fusion values, visual plus refined bright feature.
+ ** @param n block size.
+ ** @param subs histogram copies.
+ **/
+void accumulate_hist(const unsigned short *U, unsigned int n, SubHist subs)
+{
+	unsigned int i;
+	
+	for (i = 0; i + HIST_COPIES <= n; i += HIST_COPIES) {
+		subs[0][U[i]]++;
+		subs[1][U[i + 1]]++;
+		subs[2][U[i + 2]]++;
+		subs[3][U[i + 3]]++;
+	}
+	
+	for (; i < n; i++) {
+		subs[0][U[i]]++;
+	}
+}
+
+/** @brief Sum histogram copies up.
+ ** @param subs histogram copies.
+ ** @param hist histogram.
+ **/
+void merge_hist(SubHist subs, unsigned int *hist)
+{
+	unsigned int i;
+	
+	for (i = 0; i < BRIGHT_FEATURE_BINS; i++) {
+		hist[i] = subs[0][i] + subs[1][i] + subs[2][i] + subs[3][i];
+	}
+}
\ No newline at end of file
@@ -0,0 +1,79 @@
+/** @file brightfeature.h
+ ** @brief Fused infrared bright feature extraction and overlay
+ ** @author Zhiwei Zeng
+ ** @date 2018.06.04
+ **/
+
+/*
+Copyright (C) 2018 Zhiwei Zeng.
+Copyright (C) 2018 Chengdu ZLT Technology Co., Ltd.
+All rights reserved.
+
+This file is part of the railway monitor toolkit and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef _BRIGHTFEATURE_H_
+#define _BRIGHTFEATURE_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include "cpu.h"
+
+/* unsuppressed fusion image is a sum of two 8-bit images. */
+#define BRIGHT_FEATURE_BINS (255 + 255 + 1)
+
+/** @name Refined bright feature and unsuppressed fusion histogram in one
+ **       pass, suppressed feature and fusion image in another.
+ ** @{ */
+void bright_feature_extract(const unsigned char *I, const unsigned char *V,
+                            const unsigned char *G, unsigned int width,
+                            unsigned int height, unsigned char *F,
+                            unsigned int *hist);
+void bright_feature_overlay(const unsigned char *V, const unsigned char *F,
+                            unsigned int width, unsigned int height, float k,
+                            unsigned char *S, unsigned char *O);
+/** @} */
+
+/** @name Kernel variants, the ones above pick one by cpu_level.
+ ** @{ */
+#ifdef CPU_X86
+void bright_feature_extract_sse(const unsigned char *I, const unsigned char *V,
+                                const unsigned char *G, unsigned int width,
+                                unsigned int height, unsigned char *F,
+                                unsigned int *hist);
+void bright_feature_extract_avx2(const unsigned char *I, const unsigned char *V,
+                                 const unsigned char *G, unsigned int width,
+                                 unsigned int height, unsigned char *F,
+                                 unsigned int *hist);
+void bright_feature_extract_avx512(const unsigned char *I, const unsigned char *V,
+                                   const unsigned char *G, unsigned int width,
+                                   unsigned int height, unsigned char *F,
+                                   unsigned int *hist);
+void bright_feature_overlay_sse(const unsigned char *V, const unsigned char *F,
+                                unsigned int width, unsigned int height, float k,
+                                unsigned char *S, unsigned char *O);
+void bright_feature_overlay_avx2(const unsigned char *V, const unsigned char *F,
+                                 unsigned int width, unsigned int height, float k,
+                                 unsigned char *S, unsigned char *O);
+void bright_feature_overlay_avx512(const unsigned char *V, const unsigned char *F,
+                                   unsigned int width, unsigned int height, float k,
+                                   unsigned char *S, unsigned char *O);
+#endif
+void bright_feature_extract_nsu(const unsigned char *I, const unsigned char *V,
+                                const unsigned char *G, unsigned int width,
+                                unsigned int height, unsigned char *F,
+                                unsigned int *hist);
+void bright_feature_overlay_nsu(const unsigned char *V, const unsigned char *F,
+                                unsigned int width, unsigned int height, float k,
+                                unsigned char *S, unsigned char *O);
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
\ No newline at end of file
@@ -0,0 +1,196 @@
+/** @file cpu.c - Implementation
+ ** @brief Processor feature detection and kernel dispatch level
+ ** @author Zhiwei Zeng
+ ** @date 2018.06.13
+ **/
+
+/*
+Copyright (C) 2018 Zhiwei Zeng.
+Copyright (C) 2018 Chengdu ZLT Technology Co., Ltd.
+All rights reserved.
+
+This file is part of the railway monitor toolkit and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cpu.h"
+
+#if defined(CPU_X86) && defined(_MSC_VER)
+#	include <intrin.h>
+#	include <immintrin.h>
+#elif defined(CPU_X86)
+#	include <cpuid.h>
+#endif
+
+#ifdef _WIN32
+#	include <windows.h>
+#else
+#	include <unistd.h>
+#endif
+
+static volatile int dispatch_level = -1;
+
+static const char *level_names[CPU_LEVELS] = {
+	"scalar", "sse41", "avx2", "avx512bw"
+};
+
+/** @name some private functions
+ ** @{ */
+#ifdef CPU_X86
+static void cpuid(unsigned int leaf, unsigned int subleaf, unsigned int regs[4]);
+static unsigned long long xgetbv();
+#endif
+/** @} */
+
+/** @brief Detect the best instruction set level the processor and the
+ **        operating system both support.
+ ** @return instruction set level.
+ **/
+CpuLevel cpu_detect()
+{
+#ifdef CPU_X86
+	unsigned int regs[4];
+	unsigned int max_leaf;
+	unsigned long long xcr0 = 0;
+	CpuLevel level = CPU_LEVEL_SCALAR;
+	
+	cpuid(0, 0, regs);
+	max_leaf = regs[0];
+	
+	cpuid(1, 0, regs);
+	if (!(regs[2] & (1 << 19))) {
+		return level;
+	}
+	
+	level = CPU_LEVEL_SSE41;
+	
+	/* wide registers are only usable if the system saves them. */
+	if (!(regs[2] & (1 << 27)) || !(regs[2] & (1 << 28)) || max_leaf < 7) {
+		return level;
+	}
+	
+	xcr0 = xgetbv();
+	if (0x6 != (xcr0 & 0x6)) {
+		return level;
+	}
+	
+	cpuid(7, 0, regs);
+	if (!(regs[1] & (1 << 5))) {
+		return level;
+	}
+	
+	level = CPU_LEVEL_AVX2;
+	
+	if (0xE6 == (xcr0 & 0xE6) && (regs[1] & (1 << 16)) && (regs[1] & (1u << 30))) {
+		level = CPU_LEVEL_AVX512BW;
+	}
+	
+	return level;
+#else
+	return CPU_LEVEL_SCALAR;
+#endif
+}
+
+/** @brief Get instruction set level kernels are dispatched to. It is the
+ **        detected level, lowered by the FUSION_CPU environment variable
+ **        (scalar, sse41, avx2 or avx512bw) or cpu_set_level.
+ ** @return instruction set level.
+ **/
+CpuLevel cpu_level()
+{
+	const char *env;
+	int level;
+	int i;
+	
+	if (dispatch_level >= 0) {
+		return (CpuLevel)dispatch_level;
+	}
+	
+	level = cpu_detect();
+	
+	env = getenv("FUSION_CPU");
+	if (env) {
+		for (i = 0; i < CPU_LEVELS; i++) {
+			if (!strcmp(env, level_names[i]) && i < level) {
+				level = i;
+			}
+		}
+	}
+	
+	dispatch_level = level;
+	
+	return (CpuLevel)level;
+}
+
+/** @brief Lower the level kernels are dispatched to, for testing and
+ **        benchmarking. A level above the detected one is clamped.
+ ** @param level instruction set level.
+ **/
+void cpu_set_level(CpuLevel level)
+{
+	CpuLevel detected = cpu_detect();
+	dispatch_level = level < detected ? level : detected;
+}
+
+/** @brief Get instruction set level name.
+ ** @param level instruction set level.
+ ** @return level name.
+ **/
+const char *cpu_level_name(CpuLevel level)
+{
+	if (level < CPU_LEVEL_SCALAR || level >= CPU_LEVELS) {
+		return "unknown";
+	}
+	
+	return level_names[level];
+}
+
+/** @brief Get number of online logical processors.
+ ** @return processor count, at least 1.
+ **/
+int cpu_count()
+{
+#ifdef _WIN32
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+#else
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return n > 0 ? (int)n : 1;
+#endif
+}
+
+#ifdef CPU_X86
+/** @brief Execute cpuid instruction.
+ ** @param leaf function number.
+ ** @param subleaf sub-function number.
+ ** @param regs eax, ebx, ecx and edx.
+ **/
+void cpuid(unsigned int leaf, unsigned int subleaf, unsigned int regs[4])
+{
+#ifdef _MSC_VER
+	__cpuidex((int *)regs, (int)leaf, (int)subleaf);
+#else
+	__cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+/** @brief Read extended control register 0, the register state the
+ **        operating system saves on context switch.
+ ** @return XCR0.
+ **/
+unsigned long long xgetbv()
+{
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	unsigned int eax, edx;
+	__asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+	return ((unsigned long long)edx << 32) | eax;
+#endif
+}
+#endif
\ No newline at end of file
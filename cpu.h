@@ -0,0 +1,65 @@
+/** @file cpu.h
+ ** @brief Processor feature detection and kernel dispatch level
+ ** @author Zhiwei Zeng
+ ** @date 2018.06.13
+ **/
+
+/*
+Copyright (C) 2018 Zhiwei Zeng.
+Copyright (C) 2018 Chengdu ZLT Technology Co., Ltd.
+All rights reserved.
+
+This file is part of the railway monitor toolkit and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef _CPU_H_
+#define _CPU_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#	define CPU_X86 1
+#endif
+
+/* SIMD kernels of all levels are built into one binary, gcc needs to be
+   told per function which instructions it may use. */
+#if defined(CPU_X86) && defined(__GNUC__)
+#	define CPU_TARGET_SSE41 __attribute__((target("sse4.1")))
+#	define CPU_TARGET_AVX2 __attribute__((target("avx2")))
+#	define CPU_TARGET_AVX512BW __attribute__((target("avx512f,avx512bw")))
+#else
+#	define CPU_TARGET_SSE41
+#	define CPU_TARGET_AVX2
+#	define CPU_TARGET_AVX512BW
+#endif
+
+/** @typedef enum CpuLevel
+ ** @brief instruction set level kernels are dispatched to
+ **/
+typedef enum
+{
+	CPU_LEVEL_SCALAR = 0,		/**< plain C. */
+	CPU_LEVEL_SSE41,			/**< SSE4.1. */
+	CPU_LEVEL_AVX2,				/**< AVX2. */
+	CPU_LEVEL_AVX512BW,			/**< AVX-512 F and BW. */
+	CPU_LEVELS
+}CpuLevel;
+
+/** @name Feature detection and dispatch level
+ ** @{ */
+CpuLevel cpu_detect();
+CpuLevel cpu_level();
+void cpu_set_level(CpuLevel level);
+const char *cpu_level_name(CpuLevel level);
+int cpu_count();
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
\ No newline at end of file
@@ -17,8 +17,15 @@ the terms of the BSD license (see the COPYING file).
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <errno.h>
+#ifdef _WIN32
+#	include <sys/timeb.h>
+#else
+#	include <time.h>
+#endif
 
 #include "fifo.h"
+#include "atomics.h"
 
 #ifndef is_power_of_2
 #define is_power_of_2(x) ((x) != 0 && (((x) & ((x) - 1)) == 0))
@@ -28,13 +35,27 @@ the terms of the BSD license (see the COPYING file).
 #define min(a, b) ((a) < (b) ? (a) : (b))
 #endif
 
+#define CACHE_LINE_SIZE 64
+
 struct tagFifo
 {
 	char *buffer;				/**< ring buffer. */
 	unsigned int size;			/**< ring buffer byte size. */
-	unsigned int in;			/**< queue input. */
-	unsigned int out;			/**< queue output. */
-	pthread_mutex_t *mutex;		/**< mutual exclusion lock. */
+	pthread_mutex_t *mutex;		/**< mutual exclusion lock, NULL for SPSC ring. */
+	unsigned int wresv;			/**< bytes reserved by producer but not committed. */
+	unsigned int rresv;			/**< bytes peeked by consumer but not released. */
+	FifoOverflow overflow;		/**< what a full ring does with new record. */
+	unsigned int record;		/**< record byte size dropped at a time. */
+	FifoDrop drop;				/**< called on each dropped record, may be NULL. */
+	volatile unsigned int drops;	/**< number of dropped records. */
+	pthread_mutex_t wait_mutex;	/**< protects blocking waits. */
+	pthread_cond_t wait_cond;	/**< signaled when in or out moves. */
+	volatile unsigned int waiters;	/**< threads blocked on wait_cond. */
+	char pad0[CACHE_LINE_SIZE];	/**< keep producer index on its own cache line. */
+	volatile unsigned int in;	/**< queue input. */
+	char pad1[CACHE_LINE_SIZE];	/**< keep consumer index on its own cache line. */
+	volatile unsigned int out;	/**< queue output. */
+	char pad2[CACHE_LINE_SIZE];
 };
 
 /** @name some private functions
@@ -42,7 +63,13 @@ struct tagFifo
 static unsigned int roundup_power_of_2(unsigned int a);
 static unsigned int __fifo_len(const Fifo *self);
 static unsigned int __fifo_put(Fifo *self, const char *buffer, unsigned int size);
+static int __fifo_has_room(const Fifo *self, unsigned int size, int contiguous);
+static int __fifo_make_room(Fifo *self, unsigned int size, int contiguous);
 static unsigned int __fifo_get(Fifo *self, char *buffer, unsigned int size);
+static unsigned int __fifo_put_spsc(Fifo *self, const char *buffer, unsigned int size);
+static unsigned int __fifo_get_spsc(Fifo *self, char *buffer, unsigned int size);
+static void fifo_wake(Fifo *self);
+static void fifo_abstime(struct timespec *abstime, int timeout);
 /** @} */
 
 /** @brief Create a new instance of ring buffer.
@@ -93,10 +120,41 @@ Fifo *fifo_alloc(unsigned int size)
 	return fifo;
 }
 
+/** @brief Create a new instance of lock-free ring buffer.
+ **        The ring must have exactly one producer thread and one
+ **        consumer thread, then fifo_put and fifo_get need no lock.
+ ** @param size ring buffer byte size.
+ ** @return the new instance.
+ **/
+Fifo *fifo_alloc_spsc(unsigned int size)
+{
+	char *buffer = NULL;
+	Fifo *fifo = NULL;
+	
+	if (!is_power_of_2(size)) {
+		size = roundup_power_of_2(size);
+	}
+	
+	buffer = (char *)malloc(size);
+	if (!buffer) {
+		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+		return fifo;
+	}
+	
+	fifo = fifo_init(buffer, size, NULL);
+	if (!fifo) {
+		free(buffer);
+		buffer = NULL;
+	}
+	
+	return fifo;
+}
+
 /** @brief Create ring buffer with given buffer and mutex.
  ** @param buffer allocated buffer.
  ** @param size allocated buffer size.
- ** @param mutex mutual exclusion lock.
+ ** @param mutex mutual exclusion lock. NULL makes a lock-free
+ **        single producer single consumer ring buffer.
  ** @return the new instance.
  **/
 Fifo *fifo_init(char *buffer, unsigned int size, pthread_mutex_t *mutex)
@@ -122,6 +180,22 @@ Fifo *fifo_init(char *buffer, unsigned int size, pthread_mutex_t *mutex)
 	self->in = 0;
 	self->out = 0;
 	self->mutex = mutex;
+	self->overflow = FIFO_OVERFLOW_REJECT;
+	self->drops = 0;
+	self->waiters = 0;
+	
+	if (0 != pthread_mutex_init(&self->wait_mutex, NULL)) {
+		fprintf(stderr, "mutex init fail[%u:%s].\n", errno, strerror(errno));
+		free(self);
+		return NULL;
+	}
+	
+	if (0 != pthread_cond_init(&self->wait_cond, NULL)) {
+		fprintf(stderr, "cond init fail[%u:%s].\n", errno, strerror(errno));
+		pthread_mutex_destroy(&self->wait_mutex);
+		free(self);
+		return NULL;
+	}
 	
 	return self;
 }
@@ -141,6 +215,8 @@ void fifo_delete(Fifo *self)
 			free(self->mutex);
 			self->mutex = NULL;
 		}
+		pthread_cond_destroy(&self->wait_cond);
+		pthread_mutex_destroy(&self->wait_mutex);
 		free(self);
 		self = NULL;
 	}
@@ -153,6 +229,12 @@ void fifo_delete(Fifo *self)
 unsigned int fifo_len(const Fifo *self)
 {
 	unsigned int len;
+	
+	if (!self->mutex) {
+		len = atomic_load_acquire(&self->in);
+		return len - atomic_load_acquire(&self->out);
+	}
+	
 	pthread_mutex_lock(self->mutex);
 	len = __fifo_len(self);
 	pthread_mutex_unlock(self->mutex);
@@ -169,9 +251,27 @@ unsigned int fifo_len(const Fifo *self)
 unsigned int fifo_put(Fifo *self, const char *buffer, unsigned int size)
 {
 	unsigned int ret;
-	pthread_mutex_lock(self->mutex);
-	ret = __fifo_put(self, buffer, size);
-	pthread_mutex_unlock(self->mutex);
+	
+	if (!self->mutex) {
+		ret = __fifo_put_spsc(self, buffer, size);
+		if (ret != size) {
+			self->drops++;
+		}
+	} else {
+		pthread_mutex_lock(self->mutex);
+		ret = 0;
+		if (__fifo_make_room(self, size, 0) || FIFO_OVERFLOW_REJECT == self->overflow) {
+			ret = __fifo_put(self, buffer, size);
+		}
+		if (ret != size) {
+			self->drops++;
+		}
+		pthread_mutex_unlock(self->mutex);
+	}
+	
+	if (ret) {
+		fifo_wake(self);
+	}
 	
 	return ret;
 }
@@ -185,17 +285,312 @@ unsigned int fifo_put(Fifo *self, const char *buffer, unsigned int size)
 unsigned int fifo_get(Fifo *self, char *buffer, unsigned int size)
 {
 	unsigned int ret;
-	pthread_mutex_lock(self->mutex);
-	ret = __fifo_get(self, buffer, size);
-	if (self->in == self->out) {
-		self->in = self->out = 0;
+	
+	if (!self->mutex) {
+		ret = __fifo_get_spsc(self, buffer, size);
+	} else {
+		pthread_mutex_lock(self->mutex);
+		ret = __fifo_get(self, buffer, size);
+		if (self->in == self->out && !self->wresv) {
+			self->in = self->out = 0;
+		}
+		
+		pthread_mutex_unlock(self->mutex);
 	}
 	
-	pthread_mutex_unlock(self->mutex);
+	if (ret) {
+		fifo_wake(self);
+	}
 	
 	return ret;
 }
 
+/** @brief Reserve a contiguous slot in ring buffer for writing in place.
+ **        The slot is not visible to consumer until fifo_commit_write.
+ ** @param self ring buffer instance.
+ ** @param size slot byte size.
+ ** @return slot address if success,
+ **         NULL if ring buffer has no contiguous free slot of size.
+ **/
+char *fifo_reserve_write(Fifo *self, unsigned int size)
+{
+	char *slot = NULL;
+	unsigned int in;
+	unsigned int out;
+	
+	assert(self);
+	
+	if (self->mutex) {
+		pthread_mutex_lock(self->mutex);
+		/* a new reservation replaces any uncommitted one. */
+		self->wresv = 0;
+		__fifo_make_room(self, size, 1);
+		in = self->in;
+		out = self->out;
+	} else {
+		in = self->in;
+		out = atomic_load_acquire(&self->out);
+	}
+	
+	if (size <= self->size - in + out &&
+		(in & (self->size - 1)) + size <= self->size) {
+		slot = self->buffer + (in & (self->size - 1));
+		self->wresv = size;
+	}
+	
+	if (self->mutex) {
+		pthread_mutex_unlock(self->mutex);
+	}
+	
+	return slot;
+}
+
+/** @brief Publish slot reserved by fifo_reserve_write.
+ ** @param self ring buffer instance.
+ ** @param size slot byte size.
+ **/
+void fifo_commit_write(Fifo *self, unsigned int size)
+{
+	assert(self);
+	
+	if (self->mutex) {
+		pthread_mutex_lock(self->mutex);
+		self->in += size;
+		self->wresv = 0;
+		pthread_mutex_unlock(self->mutex);
+	} else {
+		self->wresv = 0;
+		atomic_store_release(&self->in, self->in + size);
+	}
+	
+	fifo_wake(self);
+}
+
+/** @brief Peek a contiguous slot in ring buffer for reading in place.
+ **        The slot stays owned by consumer until fifo_release_read.
+ ** @param self ring buffer instance.
+ ** @param size slot byte size.
+ ** @return slot address if success,
+ **         NULL if ring buffer has no contiguous data of size.
+ **/
+char *fifo_peek_read(Fifo *self, unsigned int size)
+{
+	char *slot = NULL;
+	unsigned int in;
+	unsigned int out;
+	
+	assert(self);
+	
+	if (self->mutex) {
+		pthread_mutex_lock(self->mutex);
+		in = self->in;
+		out = self->out;
+	} else {
+		out = self->out;
+		in = atomic_load_acquire(&self->in);
+	}
+	
+	if (size <= in - out &&
+		(out & (self->size - 1)) + size <= self->size) {
+		slot = self->buffer + (out & (self->size - 1));
+	}
+	
+	if (self->mutex) {
+		/* an overflowing producer must not drop the slot being read. */
+		if (slot) {
+			self->rresv = size;
+		}
+		pthread_mutex_unlock(self->mutex);
+	}
+	
+	return slot;
+}
+
+/** @brief Return slot obtained by fifo_peek_read to producer.
+ ** @param self ring buffer instance.
+ ** @param size slot byte size.
+ **/
+void fifo_release_read(Fifo *self, unsigned int size)
+{
+	assert(self);
+	
+	if (self->mutex) {
+		pthread_mutex_lock(self->mutex);
+		self->out += size;
+		self->rresv = 0;
+		if (self->in == self->out && !self->wresv) {
+			self->in = self->out = 0;
+		}
+		pthread_mutex_unlock(self->mutex);
+	} else {
+		atomic_store_release(&self->out, self->out + size);
+	}
+	
+	fifo_wake(self);
+}
+
+/** @brief Set what a full ring does with new record. Dropping queued
+ **        records moves the output index from producer side, so only
+ **        a locked ring supports it.
+ ** @param self ring buffer instance.
+ ** @param overflow overflow mode.
+ ** @param record record byte size, ring buffer size must be its multiple.
+ ** @param drop called with each dropped record, NULL if nothing to do.
+ ** @return  0 if success,
+ **         -1 if fail.
+ **/
+int fifo_set_overflow(Fifo *self, FifoOverflow overflow, unsigned int record,
+                      FifoDrop drop)
+{
+	assert(self);
+	
+	if (FIFO_OVERFLOW_REJECT != overflow && (!self->mutex || !record ||
+		self->size % record)) {
+		fprintf(stderr, "fifo_set_overflow fail[%s:%d].\n", __FILE__, __LINE__);
+		return -1;
+	}
+	
+	if (self->mutex) {
+		pthread_mutex_lock(self->mutex);
+	}
+	
+	self->overflow = overflow;
+	self->record = record;
+	self->drop = drop;
+	
+	if (self->mutex) {
+		pthread_mutex_unlock(self->mutex);
+	}
+	
+	return 0;
+}
+
+/** @brief Get number of records dropped by ring buffer, including the
+ **        ones fifo_put could not store.
+ ** @param self ring buffer instance.
+ ** @return dropped records.
+ **/
+unsigned int fifo_drops(const Fifo *self)
+{
+	assert(self);
+	return self->drops;
+}
+
+/** @brief Get data from ring buffer, block until size bytes are there.
+ ** @param self ring buffer instance.
+ ** @param buffer data buffer.
+ ** @param size data buffer size.
+ ** @param timeout maximum milliseconds to wait.
+ ** @return readed data size, 0 if timeout.
+ **/
+unsigned int fifo_get_wait(Fifo *self, char *buffer, unsigned int size, int timeout)
+{
+	struct timespec abstime;
+	
+	assert(self);
+	
+	if (fifo_len(self) < size && timeout > 0) {
+		fifo_abstime(&abstime, timeout);
+		
+		pthread_mutex_lock(&self->wait_mutex);
+		self->waiters++;
+		/* pairs with the barrier in fifo_wake, so either we see the new
+		   data or the waker sees us waiting. */
+		atomic_fence();
+		while (fifo_len(self) < size) {
+			if (ETIMEDOUT == pthread_cond_timedwait(&self->wait_cond, &self->wait_mutex,
+				&abstime)) {
+				break;
+			}
+		}
+		
+		self->waiters--;
+		pthread_mutex_unlock(&self->wait_mutex);
+	}
+	
+	if (fifo_len(self) < size) {
+		return 0;
+	}
+	
+	return fifo_get(self, buffer, size);
+}
+
+/** @brief Reserve a contiguous slot, block until it is free.
+ ** @param self ring buffer instance.
+ ** @param size slot byte size.
+ ** @param timeout maximum milliseconds to wait.
+ ** @return slot address if success,
+ **         NULL if timeout.
+ **/
+char *fifo_reserve_write_wait(Fifo *self, unsigned int size, int timeout)
+{
+	struct timespec abstime;
+	char *slot = NULL;
+	
+	assert(self);
+	
+	slot = fifo_reserve_write(self, size);
+	if (slot || timeout <= 0) {
+		return slot;
+	}
+	
+	fifo_abstime(&abstime, timeout);
+	
+	pthread_mutex_lock(&self->wait_mutex);
+	self->waiters++;
+	atomic_fence();
+	while (!(slot = fifo_reserve_write(self, size))) {
+		if (ETIMEDOUT == pthread_cond_timedwait(&self->wait_cond, &self->wait_mutex,
+			&abstime)) {
+			slot = fifo_reserve_write(self, size);
+			break;
+		}
+	}
+	
+	self->waiters--;
+	pthread_mutex_unlock(&self->wait_mutex);
+	
+	return slot;
+}
+
+/** @brief Peek a contiguous slot, block until it is filled.
+ ** @param self ring buffer instance.
+ ** @param size slot byte size.
+ ** @param timeout maximum milliseconds to wait.
+ ** @return slot address if success,
+ **         NULL if timeout.
+ **/
+char *fifo_peek_read_wait(Fifo *self, unsigned int size, int timeout)
+{
+	struct timespec abstime;
+	char *slot = NULL;
+	
+	assert(self);
+	
+	slot = fifo_peek_read(self, size);
+	if (slot || timeout <= 0) {
+		return slot;
+	}
+	
+	fifo_abstime(&abstime, timeout);
+	
+	pthread_mutex_lock(&self->wait_mutex);
+	self->waiters++;
+	atomic_fence();
+	while (!(slot = fifo_peek_read(self, size))) {
+		if (ETIMEDOUT == pthread_cond_timedwait(&self->wait_cond, &self->wait_mutex,
+			&abstime)) {
+			slot = fifo_peek_read(self, size);
+			break;
+		}
+	}
+	
+	self->waiters--;
+	pthread_mutex_unlock(&self->wait_mutex);
+	
+	return slot;
+}
+
 /** @brief Round up to power of 2.
  ** @param a input number.
  ** @return a number rounded up to power of 2.
@@ -226,6 +621,59 @@ unsigned int __fifo_len(const Fifo *self)
 	return (self->in - self->out);
 }
 
+/** @brief Check whether ring buffer has room for size bytes.
+ ** @param self ring buffer instance.
+ ** @param size data byte size.
+ ** @param contiguous room must not wrap around buffer end.
+ ** @return 1 if there is room,
+ **         0 if not.
+ **/
+int __fifo_has_room(const Fifo *self, unsigned int size, int contiguous)
+{
+	if (size > self->size - self->in + self->out) {
+		return 0;
+	}
+	
+	if (contiguous && (self->in & (self->size - 1)) + size > self->size) {
+		return 0;
+	}
+	
+	return 1;
+}
+
+/** @brief Drop queued records by overflow mode to make room for size bytes.
+ **        The caller holds the lock.
+ ** @param self ring buffer instance.
+ ** @param size data byte size.
+ ** @param contiguous room must not wrap around buffer end.
+ ** @return 1 if there is room,
+ **         0 if not.
+ **/
+int __fifo_make_room(Fifo *self, unsigned int size, int contiguous)
+{
+	while (!__fifo_has_room(self, size, contiguous) ||
+		(FIFO_OVERFLOW_KEEP_NEWEST == self->overflow && self->in != self->out)) {
+		if (FIFO_OVERFLOW_REJECT == self->overflow || self->rresv ||
+			self->in == self->out) {
+			break;
+		}
+		
+		if (self->drop) {
+			self->drop(self->buffer + (self->out & (self->size - 1)));
+		}
+		
+		self->out += self->record;
+		self->drops++;
+	}
+	
+	/* an emptied ring starts over at buffer start, so the room is contiguous. */
+	if (self->in == self->out) {
+		self->in = self->out = 0;
+	}
+	
+	return __fifo_has_room(self, size, contiguous);
+}
+
 /** @brief Put data in ring buffer.
  ** @param self ring buffer instance.
  ** @param buffer data buffer.
@@ -272,4 +720,100 @@ unsigned int __fifo_get(Fifo *self, char *buffer, unsigned int size)
 	self->out += size;
 	
 	return size;
+}
+
+/** @brief Put data in lock-free ring buffer, producer side only.
+ ** @param self ring buffer instance.
+ ** @param buffer data buffer.
+ ** @param size data buffer size.
+ ** @return writed data size.
+ **/
+unsigned int __fifo_put_spsc(Fifo *self, const char *buffer, unsigned int size)
+{
+	unsigned int len = 0;
+	unsigned int in;
+	unsigned int out;
+	
+	assert(self);
+	assert(buffer);
+	
+	/* only the producer writes self->in, the consumer releases self->out. */
+	in = self->in;
+	out = atomic_load_acquire(&self->out);
+	
+	size = min(size, self->size - in + out);
+	len = min(size, self->size - (in & (self->size - 1)));
+	memcpy(self->buffer + (in & (self->size - 1)), buffer, len);
+	memcpy(self->buffer, buffer + len, size - len);
+	
+	/* publish the data before the new input index. */
+	atomic_store_release(&self->in, in + size);
+	
+	return size;
+}
+
+/** @brief Get data from lock-free ring buffer, consumer side only.
+ ** @param self ring buffer instance.
+ ** @param buffer data buffer.
+ ** @param size data buffer size.
+ ** @return readed data size.
+ **/
+unsigned int __fifo_get_spsc(Fifo *self, char *buffer, unsigned int size)
+{
+	unsigned int len = 0;
+	unsigned int in;
+	unsigned int out;
+	
+	assert(self);
+	assert(buffer);
+	
+	/* only the consumer writes self->out, the producer releases self->in. */
+	out = self->out;
+	in = atomic_load_acquire(&self->in);
+	
+	size = min(size, in - out);
+	len = min(size, self->size - (out & (self->size - 1)));
+	memcpy(buffer, self->buffer + (out & (self->size - 1)), len);
+	memcpy(buffer + len, self->buffer, size - len);
+	
+	/* hand the slots back to the producer after copying out. */
+	atomic_store_release(&self->out, out + size);
+	
+	return size;
+}
+
+/** @brief Wake threads blocked on ring buffer after in or out moved.
+ **        Costs one barrier and no lock when nobody is waiting.
+ ** @param self ring buffer instance.
+ **/
+void fifo_wake(Fifo *self)
+{
+	atomic_fence();
+	if (atomic_load_acquire(&self->waiters)) {
+		pthread_mutex_lock(&self->wait_mutex);
+		pthread_cond_broadcast(&self->wait_cond);
+		pthread_mutex_unlock(&self->wait_mutex);
+	}
+}
+
+/** @brief Convert relative timeout to absolute time for pthread_cond_timedwait.
+ ** @param abstime absolute time.
+ ** @param timeout milliseconds from now.
+ **/
+void fifo_abstime(struct timespec *abstime, int timeout)
+{
+#ifdef _WIN32
+	struct _timeb now;
+	_ftime(&now);
+	abstime->tv_sec = (long)now.time + timeout / 1000;
+	abstime->tv_nsec = (now.millitm + timeout % 1000) * 1000000L;
+#else
+	clock_gettime(CLOCK_REALTIME, abstime);
+	abstime->tv_sec += timeout / 1000;
+	abstime->tv_nsec += (timeout % 1000) * 1000000L;
+#endif
+	if (abstime->tv_nsec >= 1000000000L) {
+		abstime->tv_sec++;
+		abstime->tv_nsec -= 1000000000L;
+	}
 }
\ No newline at end of file
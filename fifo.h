@@ -29,9 +29,25 @@ extern "C"
 struct tagFifo;
 typedef struct tagFifo Fifo;
 
+/** @typedef enum FifoOverflow
+ ** @brief what a full ring buffer does with new record
+ **/
+typedef enum
+{
+	FIFO_OVERFLOW_REJECT = 0,		/**< keep queued records, new record is not stored. */
+	FIFO_OVERFLOW_DROP_OLDEST,		/**< drop oldest records until new record fits. */
+	FIFO_OVERFLOW_KEEP_NEWEST		/**< drop all queued records, keep only new record. */
+}FifoOverflow;
+
+/** @typedef FifoDrop
+ ** @brief callback on a dropped record, e.g. to release what it refers to
+ **/
+typedef void (*FifoDrop)(char *record);
+
 /** @name Allocate and destroy
  ** @{ */
 Fifo *fifo_alloc(unsigned int size);
+Fifo *fifo_alloc_spsc(unsigned int size);
 Fifo *fifo_init(char *buffer, unsigned int size, pthread_mutex_t *mutex);
 void fifo_delete(Fifo *self);
 /** @} */
@@ -43,6 +59,28 @@ unsigned int fifo_put(Fifo *self, const char *buffer, unsigned int size);
 unsigned int fifo_get(Fifo *self, char *buffer, unsigned int size);
 /** @} */
 
+/** @name Zero-copy FIFO operation
+ ** @{ */
+char *fifo_reserve_write(Fifo *self, unsigned int size);
+void fifo_commit_write(Fifo *self, unsigned int size);
+char *fifo_peek_read(Fifo *self, unsigned int size);
+void fifo_release_read(Fifo *self, unsigned int size);
+/** @} */
+
+/** @name Overflow handling
+ ** @{ */
+int fifo_set_overflow(Fifo *self, FifoOverflow overflow, unsigned int record,
+                      FifoDrop drop);
+unsigned int fifo_drops(const Fifo *self);
+/** @} */
+
+/** @name Blocking FIFO operation, timeout in milliseconds
+ ** @{ */
+unsigned int fifo_get_wait(Fifo *self, char *buffer, unsigned int size, int timeout);
+char *fifo_reserve_write_wait(Fifo *self, unsigned int size, int timeout);
+char *fifo_peek_read_wait(Fifo *self, unsigned int size, int timeout);
+/** @} */
+
 #ifdef __cplusplus
 }
 #endif
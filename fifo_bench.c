@@ -0,0 +1,293 @@
+/** @file fifo_bench.c
+ ** @brief Ring buffer contention benchmark, mutex versus lock-free SPSC,
+ **        polling versus blocking wait
+ ** @author Zhiwei Zeng
+ ** @date 2018.06.04
+ **/
+
+/*
+Copyright (C) 2018 Zhiwei Zeng.
+Copyright (C) 2018 Chengdu ZLT Technology Co., Ltd.
+All rights reserved.
+
+This file is part of the railway monitor toolkit and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#	include <windows.h>
+#else
+#	include <time.h>
+#	include <sched.h>
+#endif
+
+#include "pthread.h"
+#include "fifo.h"
+
+/** @typedef struct BenchParam
+ ** @brief one producer/consumer run
+ **/
+typedef struct
+{
+	Fifo *ring;					/**< ring under test. */
+	unsigned int rec_size;		/**< record byte size. */
+	unsigned int nrecs;			/**< number of records. */
+	unsigned int errors;		/**< out of order records. */
+	int blocking;				/**< block in fifo_*_wait instead of polling. */
+}BenchParam;
+
+static double now_sec();
+static void yield_cpu();
+static void *producer_thread(void *s);
+static void bench_run(const char *name, Fifo *ring, unsigned int rec_size,
+                      unsigned int nrecs, int blocking);
+static void *latency_thread(void *s);
+static void latency_run(unsigned int nrecs);
+
+int main(int argc, char *argv[])
+{
+	/* records are power of 2 sized like the Fusion frame slots, so a
+	   ring never holds a partial record. */
+	unsigned int rec_sizes[] = {64, 4096, 1 << 18, 1 << 22};
+	unsigned int nbytes = 1 << 30;
+	const unsigned int caches = 4;
+	unsigned int nrecs;
+	unsigned int i;
+	Fifo *ring = NULL;
+
+	if (argc > 1) {
+		nbytes = (unsigned int)atoi(argv[1]) << 20;
+	}
+
+	printf("%-6s %10s %10s %12s %10s %8s\n", "ring", "record", "records", "records/s",
+		"MB/s", "errors");
+
+	for (i = 0; i < sizeof(rec_sizes) / sizeof(rec_sizes[0]); i++) {
+		nrecs = nbytes / rec_sizes[i];
+
+		ring = fifo_alloc(caches * rec_sizes[i]);
+		if (!ring) {
+			fprintf(stderr, "fifo_alloc fail[%s:%d].\n", __FILE__, __LINE__);
+			return -1;
+		}
+
+		bench_run("mutex", ring, rec_sizes[i], nrecs, 0);
+		fifo_delete(ring);
+
+		ring = fifo_alloc_spsc(caches * rec_sizes[i]);
+		if (!ring) {
+			fprintf(stderr, "fifo_alloc_spsc fail[%s:%d].\n", __FILE__, __LINE__);
+			return -1;
+		}
+
+		bench_run("spsc", ring, rec_sizes[i], nrecs, 0);
+		bench_run("wait", ring, rec_sizes[i], nrecs, 1);
+		fifo_delete(ring);
+	}
+
+	latency_run(1000);
+
+	return 0;
+}
+
+/** @brief Get wall clock time.
+ ** @return seconds.
+ **/
+double now_sec()
+{
+#ifdef _WIN32
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER count;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&count);
+	return (double)count.QuadPart / frequency.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+#endif
+}
+
+/** @brief Give up the processor while the ring is full or empty.
+ **/
+void yield_cpu()
+{
+#ifdef _WIN32
+	SwitchToThread();
+#else
+	sched_yield();
+#endif
+}
+
+/** @brief Producer thread, puts numbered records as fast as possible.
+ ** @param s benchmark parameter.
+ **/
+void *producer_thread(void *s)
+{
+	BenchParam *param = (BenchParam *)s;
+	char *rec = NULL;
+	char *slot = NULL;
+	unsigned int i;
+
+	rec = (char *)calloc(param->rec_size, 1);
+	if (!rec) {
+		fprintf(stderr, "calloc fail[%s:%d].\n", __FILE__, __LINE__);
+		return (void *)(0);
+	}
+
+	for (i = 0; i < param->nrecs; i++) {
+		memcpy(rec, &i, sizeof(i));
+		if (param->blocking) {
+			while (!(slot = fifo_reserve_write_wait(param->ring, param->rec_size, 100))) {
+			}
+			memcpy(slot, rec, param->rec_size);
+			fifo_commit_write(param->ring, param->rec_size);
+			continue;
+		}
+		
+		while (fifo_put(param->ring, rec, param->rec_size) != param->rec_size) {
+			yield_cpu();
+		}
+	}
+
+	free(rec);
+
+	return (void *)(0);
+}
+
+/** @brief Run one producer and one consumer through the ring.
+ ** @param name ring name.
+ ** @param ring ring buffer instance.
+ ** @param rec_size record byte size.
+ ** @param nrecs number of records.
+ ** @param blocking block in fifo_*_wait instead of polling.
+ **/
+void bench_run(const char *name, Fifo *ring, unsigned int rec_size,
+               unsigned int nrecs, int blocking)
+{
+	BenchParam param;
+	pthread_t tid;
+	char *rec = NULL;
+	unsigned int i;
+	unsigned int seq;
+	double start, elapsed;
+
+	rec = (char *)malloc(rec_size);
+	if (!rec) {
+		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+		return;
+	}
+
+	param.ring = ring;
+	param.rec_size = rec_size;
+	param.nrecs = nrecs;
+	param.errors = 0;
+	param.blocking = blocking;
+
+	start = now_sec();
+
+	if (0 != pthread_create(&tid, NULL, producer_thread, &param)) {
+		fprintf(stderr, "pthread_create fail[%s:%d].\n", __FILE__, __LINE__);
+		free(rec);
+		return;
+	}
+
+	for (i = 0; i < nrecs; i++) {
+		if (blocking) {
+			while (fifo_get_wait(ring, rec, rec_size, 100) != rec_size) {
+			}
+		} else {
+			while (fifo_get(ring, rec, rec_size) != rec_size) {
+				yield_cpu();
+			}
+		}
+
+		memcpy(&seq, rec, sizeof(seq));
+		if (seq != i) {
+			param.errors++;
+		}
+	}
+
+	pthread_join(tid, NULL);
+	elapsed = now_sec() - start;
+
+	printf("%-6s %10u %10u %12.0f %10.1f %8u\n", name, rec_size, nrecs, nrecs / elapsed,
+		(double)nrecs * rec_size / elapsed / (1 << 20), param.errors);
+
+	free(rec);
+}
+
+/** @brief Latency producer thread, puts a time stamp every millisecond.
+ ** @param s benchmark parameter.
+ **/
+void *latency_thread(void *s)
+{
+	BenchParam *param = (BenchParam *)s;
+	double stamp;
+	unsigned int i;
+	
+	for (i = 0; i < param->nrecs; i++) {
+#ifdef _WIN32
+		Sleep(1);
+#else
+		struct timespec ts = {0, 1000000};
+		nanosleep(&ts, NULL);
+#endif
+		stamp = now_sec();
+		fifo_put(param->ring, (char *)&stamp, sizeof(stamp));
+	}
+	
+	return (void *)(0);
+}
+
+/** @brief Measure how long a consumer blocked in fifo_get_wait takes
+ **        to see a record after it is put.
+ ** @param nrecs number of records.
+ **/
+void latency_run(unsigned int nrecs)
+{
+	BenchParam param;
+	pthread_t tid;
+	double stamp;
+	double latency;
+	double total = 0;
+	double worst = 0;
+	unsigned int i;
+	
+	param.ring = fifo_alloc_spsc(64 * sizeof(stamp));
+	if (!param.ring) {
+		fprintf(stderr, "fifo_alloc_spsc fail[%s:%d].\n", __FILE__, __LINE__);
+		return;
+	}
+	
+	param.rec_size = sizeof(stamp);
+	param.nrecs = nrecs;
+	param.errors = 0;
+	param.blocking = 1;
+	
+	if (0 != pthread_create(&tid, NULL, latency_thread, &param)) {
+		fprintf(stderr, "pthread_create fail[%s:%d].\n", __FILE__, __LINE__);
+		fifo_delete(param.ring);
+		return;
+	}
+	
+	for (i = 0; i < nrecs; i++) {
+		while (fifo_get_wait(param.ring, (char *)&stamp, sizeof(stamp), 100) != sizeof(stamp)) {
+		}
+		
+		latency = now_sec() - stamp;
+		total += latency;
+		if (latency > worst) {
+			worst = latency;
+		}
+	}
+	
+	pthread_join(tid, NULL);
+	fifo_delete(param.ring);
+	
+	printf("wake-up latency: mean %.1f us, max %.1f us over %u records\n",
+		total / nrecs * 1e6, worst * 1e6, nrecs);
+}
\ No newline at end of file
@@ -0,0 +1,179 @@
+/** @file framepool.c - Implementation
+ ** @brief Preallocated pool of reference counted frame buffers
+ ** @author Zhiwei Zeng
+ ** @date 2018.06.06
+ **/
+
+/*
+Copyright (C) 2018 Zhiwei Zeng.
+Copyright (C) 2018 Chengdu ZLT Technology Co., Ltd.
+All rights reserved.
+
+This file is part of the railway monitor toolkit and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "framepool.h"
+#include "fifo.h"
+#include "atomics.h"
+
+struct tagFramePool
+{
+	unsigned int frame_size;	/**< frame data byte size. */
+	unsigned int nframes;		/**< number of frames. */
+	unsigned char *buffer;		/**< frame data of all frames. */
+	Frame *frames;				/**< frame headers. */
+	Fifo *free_ring;			/**< pointers of free frames. */
+};
+
+/** @brief Create a new instance of FramePool.
+ ** @return the new instance.
+ **/
+FramePool *framepool_new()
+{
+	FramePool *self = (FramePool *)malloc(sizeof(FramePool));
+	if (self) {
+		memset(self, 0, sizeof(FramePool));
+	}
+	
+	return self;
+}
+
+/** @brief Initialize new FramePool instance, all frames are allocated here
+ **        and never again while the pool lives.
+ ** @param self FramePool instance.
+ ** @param frame_size frame data byte size.
+ ** @param nframes number of frames.
+ ** @return  0 if success,
+ **         -1 if fail.
+ **/
+int framepool_init(FramePool *self, unsigned int frame_size,
+                   unsigned int nframes)
+{
+	unsigned int stride;
+	unsigned char *data;
+	Frame *frame;
+	unsigned int i;
+	
+	assert(self);
+	
+	self->frame_size = frame_size;
+	self->nframes = nframes;
+	stride = (frame_size + FRAME_ALIGN - 1) & ~(FRAME_ALIGN - 1);
+	
+	self->buffer = (unsigned char *)malloc(nframes * stride + FRAME_ALIGN);
+	if (!self->buffer) {
+		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+		goto clean;
+	}
+	
+	self->frames = (Frame *)malloc(nframes * sizeof(Frame));
+	if (!self->frames) {
+		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+		goto clean;
+	}
+	
+	/* frames are returned from any thread, so the free list is a locked ring. */
+	self->free_ring = fifo_alloc(nframes * sizeof(Frame *));
+	if (!self->free_ring) {
+		fprintf(stderr, "fifo_alloc fail[%s:%d].\n", __FILE__, __LINE__);
+		clean:framepool_delete(self);
+		return -1;
+	}
+	
+	data = (unsigned char *)(((size_t)self->buffer + FRAME_ALIGN - 1) &
+		~(size_t)(FRAME_ALIGN - 1));
+	for (i = 0; i < nframes; i++) {
+		frame = self->frames + i;
+		frame->data = data + i * stride;
+		frame->size = frame_size;
+		frame->refcount = 0;
+		frame->pool = self;
+		fifo_put(self->free_ring, (char *)&frame, sizeof(frame));
+	}
+	
+	return 0;
+}
+
+/** @brief Delete FramePool instance. Frames must not be used any more.
+ ** @param self FramePool instance.
+ **/
+void framepool_delete(FramePool *self)
+{
+	if (self) {
+		if (self->free_ring) {
+			fifo_delete(self->free_ring);
+			self->free_ring = NULL;
+		}
+		if (self->frames) {
+			free(self->frames);
+			self->frames = NULL;
+		}
+		if (self->buffer) {
+			free(self->buffer);
+			self->buffer = NULL;
+		}
+		
+		free(self);
+		self = NULL;
+	}
+}
+
+/** @brief Take a free frame from pool.
+ ** @param self FramePool instance.
+ ** @return frame holding one reference,
+ **         NULL if pool is exhausted.
+ **/
+Frame *framepool_get(FramePool *self)
+{
+	return framepool_get_wait(self, 0);
+}
+
+/** @brief Take a free frame from pool, block until one is returned.
+ ** @param self FramePool instance.
+ ** @param timeout maximum milliseconds to wait.
+ ** @return frame holding one reference,
+ **         NULL if timeout.
+ **/
+Frame *framepool_get_wait(FramePool *self, int timeout)
+{
+	Frame *frame = NULL;
+	
+	assert(self);
+	
+	if (sizeof(frame) != fifo_get_wait(self->free_ring, (char *)&frame,
+		sizeof(frame), timeout)) {
+		return NULL;
+	}
+	
+	frame->refcount = 1;
+	frame->timestamp = 0;
+	
+	return frame;
+}
+
+/** @brief Add a reference to frame for another holder.
+ ** @param frame frame.
+ **/
+void frame_ref(Frame *frame)
+{
+	assert(frame);
+	atomic_fetch_add(&frame->refcount, 1);
+}
+
+/** @brief Drop a reference to frame, the last one returns frame to pool.
+ ** @param frame frame.
+ **/
+void frame_unref(Frame *frame)
+{
+	assert(frame);
+	
+	if (1 == atomic_fetch_add(&frame->refcount, -1)) {
+		fifo_put(frame->pool->free_ring, (char *)&frame, sizeof(frame));
+	}
+}
\ No newline at end of file
@@ -0,0 +1,66 @@
+/** @file framepool.h
+ ** @brief Preallocated pool of reference counted frame buffers
+ ** @author Zhiwei Zeng
+ ** @date 2018.06.06
+ **/
+
+/*
+Copyright (C) 2018 Zhiwei Zeng.
+Copyright (C) 2018 Chengdu ZLT Technology Co., Ltd.
+All rights reserved.
+
+This file is part of the railway monitor toolkit and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef _FRAMEPOOL_H_
+#define _FRAMEPOOL_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** @typedef struct FramePool
+ ** @brief frame buffer pool structure
+ **/
+struct tagFramePool;
+typedef struct tagFramePool FramePool;
+
+/** @typedef struct Frame
+ ** @brief reference counted frame buffer. A frame is shared by
+ **        passing its pointer through the rings, every holder owns
+ **        one reference and the last frame_unref returns it to pool.
+ **/
+typedef struct
+{
+	unsigned char *data;		/**< frame data, FRAME_ALIGN aligned. */
+	unsigned int size;			/**< frame data byte size. */
+	volatile int refcount;		/**< number of holders. */
+	long long timestamp;		/**< capture time in microseconds, see timer_now_us. */
+	FramePool *pool;			/**< owner pool. */
+}Frame;
+
+#define FRAME_ALIGN 64
+
+/** @name Create, initialize, and destroy
+ ** @{ */
+FramePool *framepool_new();
+int framepool_init(FramePool *self, unsigned int frame_size,
+                   unsigned int nframes);
+void framepool_delete(FramePool *self);
+/** @} */
+
+/** @name Frame operation
+ ** @{ */
+Frame *framepool_get(FramePool *self);
+Frame *framepool_get_wait(FramePool *self, int timeout);
+void frame_ref(Frame *frame);
+void frame_unref(Frame *frame);
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
\ No newline at end of file
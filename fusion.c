@@ -17,18 +17,23 @@ the terms of the BSD license (see the COPYING file).
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
-#include <windows.h>
 
 #include "fusion.h"
 #include "pthread.h"
 #include "fifo.h"
+#include "framepool.h"
+#include "timer.h"
 #include "registration.h"
 #include "bkgreconstruct.h"
-#include "imgsubtract.h"
-#include "imgadd.h"
-#include "imgmul.h"
+#include "brightfeature.h"
+#include "workpool.h"
+#include "cpu.h"
 #include "RDC.h"
 
+/* stage threads block on empty or full rings at most this many
+   milliseconds before they check the stop flag again. */
+#define FUSION_WAIT_TIMEOUT 100
+
 typedef enum
 {
 	FRAME_RESOLUTION_OF_384 = 15,
@@ -43,6 +48,14 @@ typedef enum
 	COLOR_STYLE
 }FusionColor;
 
+static const char *stage_names[FUSION_STAGES] = {
+	"rdc", "warp", "minfilter", "qtree", "bezier", "gauss", "fusion", "latency"
+};
+
+static const char *ring_names[FUSION_RINGS] = {
+	"rawi", "rawv", "gsci", "regt", "fusn", "iout", "vout", "brft"
+};
+
 struct tagFusion
 {
 	int caches;						/**< image caches. */
@@ -59,42 +72,64 @@ struct tagFusion
 	int ngls;						/**< number of unsuppression fusion image gray levels. */
 	float ssr;						/**< standard bright feature suppression ratio. */
 	float bpr;						/**< brightest pixel ratio. */
-	Fifo *rawi_ring;				/**< raw infrared image ring buffer. */
-	Fifo *rawv_ring;				/**< raw visual image ring buffer. */
-	Fifo *gsci_ring;				/**< infrared gray scale compressed image ring buffer. */
-	Fifo *regt_ring;				/**< visual registered image ring buffer. */
+	Fifo *rawi_ring;				/**< raw infrared frame ring buffer. */
+	Fifo *rawv_ring;				/**< raw visual frame ring buffer. */
+	Fifo *gsci_ring;				/**< infrared gray scale compressed frame ring buffer. */
+	Fifo *regt_ring;				/**< visual registered frame ring buffer. */
 	Fifo *fusn_ring;				/**< fusion image ring buffer. */
-	Fifo *iout_ring;				/**< infrared image output queue. */
-	Fifo *vout_ring;				/**< visual image output queue. */
+	Fifo *iout_ring;				/**< infrared frame output queue. */
+	Fifo *vout_ring;				/**< visual frame output queue. */
+	FramePool *fpool;				/**< infrared and visual frames shared by the rings. */
+	FramePool *rawi_pool;			/**< raw infrared frames. */
+	FramePool *rawv_pool;			/**< raw visual frames. */
+	FusionSync sync;				/**< infrared and visual frame pairing policy. */
+	int sync_tolerance;				/**< maximum pairing time difference in microseconds. */
+	Frame **vwin;					/**< visual frames waiting to be paired, oldest first. */
+	int nvwin;						/**< number of frames in vwin. */
+	unsigned char *intp_image;		/**< visual image interpolated to infrared time. */
+	unsigned int fusn_rejects;		/**< fusion images not queued. */
+	unsigned int brft_rejects;		/**< bright feature images not queued. */
 	Fifo *brft_ring;				/**< bright feature output queue. */
 	Registration *regist;			/**< image registration instance. */
 	BkgReconst *breconst;			/**< background reconstruction instance. */
 	RDC_Sets rdc_reso;				/**< RDC resolution set. */
 	RDC_Sets rdc_out_format;		/**< RDC output format set. */
 	FusionColor cstyle;				/**< color style of fusion image. */
-	unsigned int *hist;				/**< histogram of unsuppression fusion image. */
-	unsigned char *i_rawi_image;	/**< input raw infrared image. */
-	unsigned char *i_rawv_image;	/**< input raw visual image. */
-	unsigned char *o_rawi_image;	/**< output raw infrared image. */
-	unsigned char *o_rawv_image;	/**< output raw visual image. */
-	unsigned char *i_gsci_image;	/**< input infrared gray scale compressed image. */
-	unsigned char *i_regt_image;	/**< input visual registered image. */
-	unsigned char *o_gsci_image;	/**< output infrared gray scale compressed image. */
-	unsigned char *o_regt_image;	/**< output visual registered image. */
+	WorkPool *wpool;				/**< workers running fusion image strips. */
+	unsigned int nstrips;			/**< horizontal strips of a fusion image. */
+	unsigned int *hist;				/**< histogram of unsuppression fusion image of each strip. */
 	unsigned char *bkgr_image;		/**< background reconstruction image. */
-	unsigned char *etbk_image;		/**< estimated background image. */
-	unsigned char *brft_image;		/**< bright feature image. */
 	unsigned char *rfbf_image;		/**< refine bright feature image. */
-	unsigned char *sbrf_image;		/**< suppressed bright feature image. */
-	unsigned short *usfn_image;		/**< unsuppression fusion image. */
-	unsigned char *i_fusn_image;	/**< input fusion image. */
-	unsigned char *o_fusn_image;	/**< output fusion image. */
-	unsigned char *iout_image;		/**< infrared output image. */
-	unsigned char *vout_image;		/**< visual output image. */
-	unsigned char *fout_image;		/**< feature output image. */
+	unsigned char *sbrf_image;		/**< bright feature image used when feature queue is full. */
+	unsigned char *i_fusn_image;	/**< fusion image used when fusion queue is full. */
+	StatTimer timers[FUSION_STAGES];	/**< processing time of stages run by fusion instance. */
+	StatDepth depths[FUSION_RINGS];		/**< ring buffer depth histograms. */
+	volatile unsigned int inf_in;		/**< infrared frames put. */
+	volatile unsigned int vis_in;		/**< visual frames put. */
+	volatile unsigned int inf_drops;	/**< infrared frames rejected by put. */
+	volatile unsigned int vis_drops;	/**< visual frames rejected by put. */
+	volatile unsigned int unpaired;		/**< infrared frames without visual partner. */
+	volatile unsigned int fusn_out;		/**< fusion images made. */
+	FILE *stats_fp;					/**< periodic statistics dump stream. */
+	int stats_period;				/**< periodic statistics dump period in milliseconds. */
+	int stats_json;					/**< dump statistics as JSON. */
+	long long stats_last;			/**< time of last statistics dump. */
 	int stop_fusn;					/**< fusion thread state. */
 };
 
+/** @typedef struct FusionBatch
+ ** @brief images of a frame shared by the strip tasks
+ **/
+typedef struct
+{
+	Fusion *fusion;						/**< fusion instance. */
+	const unsigned char *gsci_image;	/**< infrared image. */
+	const unsigned char *regt_image;	/**< registered visual image. */
+	unsigned char *sbrf_image;			/**< suppressed bright feature image. */
+	unsigned char *fusn_image;			/**< fusion image. */
+	float sr;							/**< bright feature suppression ratio. */
+}FusionBatch;
+
 /** @name some private functions
  ** @{ */
 static int get_text_lines(const char *filename);
@@ -104,10 +139,21 @@ static int preprocess_infrared_start(Fusion *self);
 static void *preprocess_infrared_thread(void *s);
 static int preprocess_visual_start(Fusion *self);
 static void *preprocess_visual_thread(void *s);
-static void suppress_bright_feature(const unsigned char *rfbf_image, unsigned int width,
-                                    unsigned int height, unsigned short *usfn_image,
-									unsigned int *hist, unsigned int ngls, float ssr,
-									float bpr, unsigned char *sbrf_image);
+static int pair_visual_frame(Fusion *self, long long timestamp, unsigned char **regt_image);
+static void pull_visual_frames(Fusion *self, int timeout);
+static void drop_visual_frames(Fusion *self, int n);
+static Fifo *output_queue(Fusion *self, FusionQueue queue);
+static void drop_frame(char *record);
+static Fifo *stats_ring(Fusion *self, FusionRing ring, unsigned int *record);
+static void sample_ring_depths(Fusion *self);
+static void blend_images(const unsigned char *a, const unsigned char *b, unsigned int size,
+                         int weight, unsigned char *c);
+static int make_workers(Fusion *self, int nworkers);
+static void extract_strip(void *arg, unsigned int index, unsigned int count);
+static void overlay_strip(void *arg, unsigned int index, unsigned int count);
+static float suppression_ratio(const unsigned int *hist, unsigned int nhists,
+                               unsigned int ngls, unsigned int npixels, float ssr,
+							   float bpr);
 /** @} */
 
 /** @brief Create a new instance of image fusion.
@@ -116,6 +162,10 @@ static void suppress_bright_feature(const unsigned char *rfbf_image, unsigned in
 Fusion *fusion_new()
 {
 	Fusion *self = (Fusion *)malloc(sizeof(Fusion));
+	if (self) {
+		memset(self, 0, sizeof(Fusion));
+	}
+	
 	return self;
 }
 
@@ -132,6 +182,8 @@ int fusion_init(Fusion *self,
                 int base_width, int base_height,
                 int unreg_width, int unreg_height)
 {
+	int i;
+	
 	assert(self);
 	
 	self->caches = 4;
@@ -147,42 +199,54 @@ int fusion_init(Fusion *self,
 	self->yuvf_image_size = roundup_power_of_2(self->yuvf_image_size);
 	self->nmsc_image_size = base_width * base_height;
 	self->nmsc_image_size = roundup_power_of_2(self->nmsc_image_size);
-	self->ngls = 0xFFFF + 1;
+	self->ngls = BRIGHT_FEATURE_BINS;
 	self->npoints = get_text_lines("control_points.txt");
 	self->ssr = 0.8f;
 	self->bpr = 0.001f;
-	self->rdc_reso = FRAME_RESOLUTION_OF_640;
+	self->rdc_reso = 384 == base_width ? FRAME_RESOLUTION_OF_384 : FRAME_RESOLUTION_OF_640;
 	self->rdc_out_format = PIXEL_FORMAT_YUV_SEMIPLANAR_420;
 	self->cstyle = COLOR_STYLE;
+	self->sync = SYNC_DROP_OLDEST;
+	self->sync_tolerance = 20000;
+	self->nvwin = 0;
+	self->stats_fp = NULL;
 	self->stop_fusn = 0;
 	
+	for (i = 0; i < FUSION_STAGES; i++) {
+		stat_timer_reset(&self->timers[i]);
+	}
+	
+	for (i = 0; i < FUSION_RINGS; i++) {
+		stat_depth_reset(&self->depths[i]);
+	}
+	
 	self->contrl_points = (int *)malloc(self->npoints * sizeof(int) * 2);
 	if (!self->contrl_points) {
 		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
 		goto clean;
 	}
 	
-	self->rawi_ring = fifo_alloc(self->caches * self->rawi_image_size);
+	self->rawi_ring = fifo_alloc_spsc(self->caches * sizeof(Frame *));
 	if (!self->rawi_ring) {
-		fprintf(stderr, "fifo_alloc fail[%s:%d].\n", __FILE__, __LINE__);
+		fprintf(stderr, "fifo_alloc_spsc fail[%s:%d].\n", __FILE__, __LINE__);
 		goto clean;
 	}
 	
-	self->rawv_ring = fifo_alloc(self->caches * self->rawv_image_size);
+	self->rawv_ring = fifo_alloc_spsc(self->caches * sizeof(Frame *));
 	if (!self->rawv_ring) {
-		fprintf(stderr, "fifo_alloc fail[%s:%d].\n", __FILE__, __LINE__);
+		fprintf(stderr, "fifo_alloc_spsc fail[%s:%d].\n", __FILE__, __LINE__);
 		goto clean;
 	}
 	
-	self->gsci_ring = fifo_alloc(self->caches * self->yuvf_image_size);
+	self->gsci_ring = fifo_alloc_spsc(self->caches * sizeof(Frame *));
 	if (!self->gsci_ring) {
-		fprintf(stderr, "fifo_alloc fail[%s:%d].\n", __FILE__, __LINE__);
+		fprintf(stderr, "fifo_alloc_spsc fail[%s:%d].\n", __FILE__, __LINE__);
 		goto clean;
 	}
 	
-	self->regt_ring = fifo_alloc(self->caches * self->yuvf_image_size);
+	self->regt_ring = fifo_alloc_spsc(self->caches * sizeof(Frame *));
 	if (!self->regt_ring) {
-		fprintf(stderr, "fifo_alloc fail[%s:%d].\n", __FILE__, __LINE__);
+		fprintf(stderr, "fifo_alloc_spsc fail[%s:%d].\n", __FILE__, __LINE__);
 		goto clean;
 	}
 	
@@ -192,124 +256,129 @@ int fusion_init(Fusion *self,
 		goto clean;
 	}
 	
-	self->iout_ring = fifo_alloc(self->caches * self->yuvf_image_size);
+	if (fifo_set_overflow(self->fusn_ring, FIFO_OVERFLOW_DROP_OLDEST, self->yuvf_image_size, NULL)) {
+		fprintf(stderr, "fifo_set_overflow fail[%s:%d].\n", __FILE__, __LINE__);
+		goto clean;
+	}
+	
+	self->iout_ring = fifo_alloc(self->caches * sizeof(Frame *));
 	if (!self->iout_ring) {
 		fprintf(stderr, "fifo_alloc fail[%s:%d].\n", __FILE__, __LINE__);
 		goto clean;
 	}
 	
-	self->vout_ring = fifo_alloc(self->caches * self->yuvf_image_size);
+	if (fifo_set_overflow(self->iout_ring, FIFO_OVERFLOW_DROP_OLDEST, sizeof(Frame *), drop_frame)) {
+		fprintf(stderr, "fifo_set_overflow fail[%s:%d].\n", __FILE__, __LINE__);
+		goto clean;
+	}
+	
+	self->vout_ring = fifo_alloc(self->caches * sizeof(Frame *));
 	if (!self->vout_ring) {
 		fprintf(stderr, "fifo_alloc fail[%s:%d].\n", __FILE__, __LINE__);
 		goto clean;
 	}
 	
-	self->brft_ring = fifo_alloc(self->caches * self->yuvf_image_size);
-	if (!self->brft_ring) {
-		fprintf(stderr, "fifo_alloc fail[%s:%d].\n", __FILE__, __LINE__);
+	if (fifo_set_overflow(self->vout_ring, FIFO_OVERFLOW_DROP_OLDEST, sizeof(Frame *), drop_frame)) {
+		fprintf(stderr, "fifo_set_overflow fail[%s:%d].\n", __FILE__, __LINE__);
 		goto clean;
 	}
 	
-	self->regist = rm_regist_new();
-	if (!self->regist) {
-		fprintf(stderr, "rm_regist_new fail[%s:%d].\n", __FILE__, __LINE__);
+	self->brft_ring = fifo_alloc(self->caches * self->nmsc_image_size);
+	if (!self->brft_ring) {
+		fprintf(stderr, "fifo_alloc fail[%s:%d].\n", __FILE__, __LINE__);
 		goto clean;
 	}
-		
-	if (rm_regist_init(self->regist, base_width, base_height, unreg_width,
-		unreg_height, self->contrl_points, self->npoints, "interpY.txt", "interpX.txt")) {
-		fprintf(stderr, "rm_regist_init fail[%s:%d].\n", __FILE__, __LINE__);
+	
+	if (fifo_set_overflow(self->brft_ring, FIFO_OVERFLOW_DROP_OLDEST, self->nmsc_image_size, NULL)) {
+		fprintf(stderr, "fifo_set_overflow fail[%s:%d].\n", __FILE__, __LINE__);
 		goto clean;
 	}
 	
-	self->breconst = bkgreconst_new();
-	if (!self) {
-		fprintf(stderr, "bkgreconst_new fail[%s:%d].\n", __FILE__, __LINE__);
+	/* enough frames for every frame ring and the pairing window to be
+	   full, with one frame in hand in each preprocess thread. */
+	self->fpool = framepool_new();
+	if (!self->fpool) {
+		fprintf(stderr, "framepool_new fail[%s:%d].\n", __FILE__, __LINE__);
 		goto clean;
 	}
 	
-	if (bkgreconst_init(self->breconst, base_width, base_height)) {
-		fprintf(stderr, "bkgreconst_init fail[%s:%d].\n", __FILE__, __LINE__);
+	if (framepool_init(self->fpool, self->yuvf_image_size, self->caches * 7 + 2)) {
+		fprintf(stderr, "framepool_init fail[%s:%d].\n", __FILE__, __LINE__);
+		self->fpool = NULL;
 		goto clean;
 	}
 	
-	if (RDC_Init(self->rdc_out_format, self->rdc_reso)) {
-		fprintf(stderr, "RDC_Init fail[%s:%d].\n", __FILE__, __LINE__);
+	/* raw frames carry the capture time from fusion_put_* to the pairing. */
+	self->rawi_pool = framepool_new();
+	if (!self->rawi_pool) {
+		fprintf(stderr, "framepool_new fail[%s:%d].\n", __FILE__, __LINE__);
 		goto clean;
 	}
 	
-	self->hist = (unsigned int *)malloc(self->ngls * sizeof(unsigned int));
-	if (!self->hist) {
-		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+	if (framepool_init(self->rawi_pool, self->rawi_image_size, self->caches + 2)) {
+		fprintf(stderr, "framepool_init fail[%s:%d].\n", __FILE__, __LINE__);
+		self->rawi_pool = NULL;
 		goto clean;
 	}
 	
-	self->i_rawi_image = (unsigned char *)malloc(self->rawi_image_size);
-	if (!self->i_rawi_image) {
-		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+	self->rawv_pool = framepool_new();
+	if (!self->rawv_pool) {
+		fprintf(stderr, "framepool_new fail[%s:%d].\n", __FILE__, __LINE__);
 		goto clean;
 	}
 	
-	self->i_rawv_image = (unsigned char *)malloc(self->rawv_image_size);
-	if (!self->i_rawv_image) {
-		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+	if (framepool_init(self->rawv_pool, self->rawv_image_size, self->caches + 2)) {
+		fprintf(stderr, "framepool_init fail[%s:%d].\n", __FILE__, __LINE__);
+		self->rawv_pool = NULL;
 		goto clean;
 	}
 	
-	self->o_rawi_image = (unsigned char *)malloc(self->rawi_image_size);
-	if (!self->o_rawi_image) {
+	self->vwin = (Frame **)malloc(self->caches * sizeof(Frame *));
+	if (!self->vwin) {
 		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
 		goto clean;
 	}
 	
-	self->o_rawv_image = (unsigned char *)malloc(self->rawv_image_size);
-	if (!self->o_rawv_image) {
-		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+	self->regist = rm_regist_new();
+	if (!self->regist) {
+		fprintf(stderr, "rm_regist_new fail[%s:%d].\n", __FILE__, __LINE__);
 		goto clean;
 	}
 		
-	self->i_gsci_image = (unsigned char *)malloc(self->yuvf_image_size);
-	if (!self->i_gsci_image) {
-		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+	if (rm_regist_init(self->regist, base_width, base_height, unreg_width,
+		unreg_height, self->contrl_points, self->npoints, "interp.bin", "interpY.txt",
+		"interpX.txt", WARP_MODE_AUTO)) {
+		fprintf(stderr, "rm_regist_init fail[%s:%d].\n", __FILE__, __LINE__);
 		goto clean;
 	}
 	
-	self->i_regt_image = (unsigned char *)malloc(self->yuvf_image_size);
-	if (!self->i_regt_image) {
-		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+	self->breconst = bkgreconst_new();
+	if (!self) {
+		fprintf(stderr, "bkgreconst_new fail[%s:%d].\n", __FILE__, __LINE__);
 		goto clean;
 	}
 	
-	self->o_gsci_image = (unsigned char *)malloc(self->yuvf_image_size);
-	if (!self->o_gsci_image) {
-		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+	if (bkgreconst_init(self->breconst, base_width, base_height, 1)) {
+		fprintf(stderr, "bkgreconst_init fail[%s:%d].\n", __FILE__, __LINE__);
 		goto clean;
 	}
 	
-	self->o_regt_image = (unsigned char *)malloc(self->yuvf_image_size);
-	if (!self->o_regt_image) {
-		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+	if (RDC_Init(self->rdc_out_format, self->rdc_reso)) {
+		fprintf(stderr, "RDC_Init fail[%s:%d].\n", __FILE__, __LINE__);
 		goto clean;
 	}
 	
-	self->bkgr_image = (unsigned char *)malloc(self->nmsc_image_size);
-	if (!self->bkgr_image) {
-		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+	if (make_workers(self, cpu_count())) {
+		fprintf(stderr, "make_workers fail[%s:%d].\n", __FILE__, __LINE__);
 		goto clean;
 	}
 	
-	self->etbk_image = (unsigned char *)malloc(self->nmsc_image_size);
-	if (!self->etbk_image) {
+	self->bkgr_image = (unsigned char *)malloc(self->nmsc_image_size);
+	if (!self->bkgr_image) {
 		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
 		goto clean;
 	}
 	
-	self->brft_image = (unsigned char *)malloc(self->nmsc_image_size);
-	if (!self->brft_image) {
-		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
-		goto clean;
-	}
-		
 	self->rfbf_image = (unsigned char *)malloc(self->nmsc_image_size);
 	if (!self->rfbf_image) {
 		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
@@ -322,38 +391,14 @@ int fusion_init(Fusion *self,
 		goto clean;
 	}
 	
-	self->usfn_image = (unsigned short *)malloc(base_width * base_height * sizeof(unsigned short));
-	if (!self->usfn_image) {
-		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
-		goto clean;
-	}
-	
 	self->i_fusn_image = (unsigned char *)malloc(self->yuvf_image_size);
 	if (!self->i_fusn_image) {
 		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
 		goto clean;
 	}
 	
-	self->o_fusn_image = (unsigned char *)malloc(self->yuvf_image_size);
-	if (!self->o_fusn_image) {
-		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
-		goto clean;
-	}
-	
-	self->iout_image = (unsigned char *)malloc(self->yuvf_image_size);
-	if (!self->iout_image) {
-		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
-		goto clean;
-	}
-	
-	self->vout_image = (unsigned char *)malloc(self->yuvf_image_size);
-	if (!self->vout_image) {
-		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
-		goto clean;
-	}
-	
-	self->fout_image = (unsigned char *)malloc(self->yuvf_image_size);
-	if (!self->fout_image) {
+	self->intp_image = (unsigned char *)malloc(self->yuvf_image_size);
+	if (!self->intp_image) {
 		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
 		clean:fusion_delete(self);
 		return -1;
@@ -398,54 +443,30 @@ void fusion_delete(Fusion *self)
 		if (self->breconst) {
 			bkgreconst_delete(self->breconst);
 		}
-		if (self->hist) {
-			free(self->hist);
-			self->hist = NULL;
-		}
-		if (self->i_rawi_image) {
-			free(self->i_rawi_image);
-			self->i_rawi_image = NULL;
+		if (self->fpool) {
+			framepool_delete(self->fpool);
 		}
-		if (self->i_rawv_image) {
-			free(self->i_rawv_image);
-			self->i_rawv_image = NULL;
+		if (self->rawi_pool) {
+			framepool_delete(self->rawi_pool);
 		}
-		if (self->o_rawi_image) {
-			free(self->o_rawi_image);
-			self->o_rawi_image = NULL;
+		if (self->rawv_pool) {
+			framepool_delete(self->rawv_pool);
 		}
-		if (self->o_rawv_image) {
-			free(self->o_rawv_image);
-			self->o_rawv_image = NULL;
+		if (self->vwin) {
+			free(self->vwin);
+			self->vwin = NULL;
 		}
-		if (self->i_gsci_image) {
-			free(self->i_gsci_image);
-			self->i_gsci_image = NULL;
+		if (self->wpool) {
+			workpool_delete(self->wpool);
 		}
-		if (self->i_regt_image) {
-			free(self->i_regt_image);
-			self->i_regt_image = NULL;
-		}
-		if (self->o_gsci_image) {
-			free(self->o_gsci_image);
-			self->o_gsci_image = NULL;
-		}
-		if (self->o_regt_image) {
-			free(self->o_regt_image);
-			self->o_regt_image = NULL;
+		if (self->hist) {
+			free(self->hist);
+			self->hist = NULL;
 		}
 		if (self->bkgr_image) {
 			free(self->bkgr_image);
 			self->bkgr_image = NULL;
 		}
-		if (self->etbk_image) {
-			free(self->etbk_image);
-			self->etbk_image = NULL;
-		}
-		if (self->brft_image) {
-			free(self->brft_image);
-			self->brft_image = NULL;
-		}
 		if (self->rfbf_image) {
 			free(self->rfbf_image);
 			self->rfbf_image = NULL;
@@ -454,29 +475,13 @@ void fusion_delete(Fusion *self)
 			free(self->sbrf_image);
 			self->sbrf_image = NULL;
 		}
-		if (self->usfn_image) {
-			free(self->usfn_image);
-			self->usfn_image = NULL;
-		}
 		if (self->i_fusn_image) {
 			free(self->i_fusn_image);
 			self->i_fusn_image = NULL;
 		}
-		if (self->o_fusn_image) {
-			free(self->o_fusn_image);
-			self->o_fusn_image = NULL;
-		}
-		if (self->iout_image) {
-			free(self->iout_image);
-			self->iout_image = NULL;
-		}
-		if (self->vout_image) {
-			free(self->vout_image);
-			self->vout_image = NULL;
-		}
-		if (self->fout_image) {
-			free(self->fout_image);
-			self->fout_image = NULL;
+		if (self->intp_image) {
+			free(self->intp_image);
+			self->intp_image = NULL;
 		}
 		if (self) {
 			free(self);
@@ -537,6 +542,143 @@ void fusion_stop(Fusion *self)
 	bkgreconst_stop(self->breconst);
 }
 
+/** @brief Set how infrared frames are paired with visual frames.
+ **        Call it before fusion_start.
+ ** @param self fusion instance.
+ ** @param sync pairing policy.
+ ** @param tolerance maximum time difference of a pair in microseconds,
+ **        twice that between the two blended visual frames.
+ **/
+void fusion_set_sync(Fusion *self, FusionSync sync, int tolerance)
+{
+	assert(self);
+	self->sync = sync;
+	self->sync_tolerance = tolerance;
+}
+
+/** @brief Set how many threads make a fusion image. The image is cut
+ **        into one horizontal strip per thread, the fusion thread takes a
+ **        strip too. It is the number of logical processors by default.
+ **        Call it after fusion_init and before fusion_start. If it
+ **        fails, the workers set before are kept.
+ ** @param self fusion instance.
+ ** @param nworkers number of threads, 1 makes fusion image on the fusion
+ **        thread alone.
+ ** @return  0 if success,
+ **         -1 if fail.
+ **/
+int fusion_set_workers(Fusion *self, int nworkers)
+{
+	assert(self);
+	return make_workers(self, nworkers);
+}
+
+/** @brief Set how many times smaller the infrared background is
+ **        estimated, see bkgreconst_init. The background reconstruction
+ **        instance is made again, so call it after fusion_init and before
+ **        fusion_set_temporal and fusion_start.
+ ** @param self fusion instance.
+ ** @param decimation 1, 2 or 4.
+ ** @return  0 if success,
+ **         -1 if fail.
+ **/
+int fusion_set_decimation(Fusion *self, unsigned int decimation)
+{
+	BkgReconst *breconst = NULL;
+	
+	assert(self);
+	
+	breconst = bkgreconst_new();
+	if (!breconst) {
+		fprintf(stderr, "bkgreconst_new fail[%s:%d].\n", __FILE__, __LINE__);
+		return -1;
+	}
+	
+	/* bkgreconst_init deletes the instance if it fails, the old one is
+	   kept then. */
+	if (bkgreconst_init(breconst, self->base_width, self->base_height, decimation)) {
+		fprintf(stderr, "bkgreconst_init fail[%s:%d].\n", __FILE__, __LINE__);
+		return -1;
+	}
+	
+	bkgreconst_delete(self->breconst);
+	self->breconst = breconst;
+	
+	return 0;
+}
+
+/** @brief Set temporal mode of background reconstruction, blobs of
+ **        the infrared background are refitted only if their control
+ **        points changed, see bkgreconst_set_temporal. Call it after
+ **        fusion_init and before fusion_start.
+ ** @param self fusion instance.
+ ** @param refresh whole background rebuild period in frames, 1 rebuilds
+ **        it on every frame.
+ ** @param threshold control point gray change a blob is refitted past.
+ ** @return  0 if success,
+ **         -1 if fail.
+ **/
+int fusion_set_temporal(Fusion *self, unsigned int refresh, unsigned int threshold)
+{
+	assert(self);
+	return bkgreconst_set_temporal(self->breconst, refresh, threshold);
+}
+
+/** @brief Set what an output queue does when the caller falls behind.
+ **        FIFO_OVERFLOW_DROP_OLDEST is the default, so the caller always
+ **        gets the latest images. Call it before fusion_start.
+ ** @param self fusion instance.
+ ** @param queue output queue.
+ ** @param overflow overflow mode.
+ ** @return  0 if success,
+ **         -1 if fail.
+ **/
+int fusion_set_overflow(Fusion *self, FusionQueue queue, FifoOverflow overflow)
+{
+	unsigned int record;
+	FifoDrop drop = NULL;
+	
+	assert(self);
+	
+	switch (queue) {
+	case FUSION_QUEUE_INFRARED:
+	case FUSION_QUEUE_VISUAL:
+		record = sizeof(Frame *);
+		drop = drop_frame;
+		break;
+	case FUSION_QUEUE_FEATURE:
+		record = self->nmsc_image_size;
+		break;
+	case FUSION_QUEUE_FUSION:
+	default:
+		record = self->yuvf_image_size;
+		break;
+	}
+	
+	return fifo_set_overflow(output_queue(self, queue), overflow, record, drop);
+}
+
+/** @brief Get number of images an output queue has dropped.
+ ** @param self fusion instance.
+ ** @param queue output queue.
+ ** @return dropped images.
+ **/
+unsigned int fusion_get_drops(Fusion *self, FusionQueue queue)
+{
+	unsigned int drops;
+	
+	assert(self);
+	
+	drops = fifo_drops(output_queue(self, queue));
+	if (FUSION_QUEUE_FUSION == queue) {
+		drops += self->fusn_rejects;
+	} else if (FUSION_QUEUE_FEATURE == queue) {
+		drops += self->brft_rejects;
+	}
+	
+	return drops;
+}
+
 /** @brief Send image pair to fusion instance.
  ** @param self fusion instance.
  ** @param base base image.
@@ -546,31 +688,27 @@ void fusion_stop(Fusion *self)
  **/
 int fusion_put(Fusion *self, unsigned char *base, unsigned char *unreg)
 {
-	int len;
+	long long timestamp;
 	int ret = 0;
 	
 	assert(self);
 	assert(base);
 	assert(unreg);
 	
-	memmove(self->i_rawi_image, base, self->base_width * self->base_height * sizeof(unsigned short));
-	len = fifo_put(self->rawi_ring, self->i_rawi_image, self->rawi_image_size);
-	if (len != self->rawi_image_size) {
-		fprintf(stderr, "fifo_put fail[%s:%d].\n", __FILE__, __LINE__);
+	timestamp = timer_now_us();
+	
+	if (fusion_put_inf_ts(self, base, timestamp)) {
 		ret = -1;
 	}
 	
-	memmove(self->i_rawv_image, unreg, self->unreg_width * self->unreg_height * 3 >> 1);
-	len = fifo_put(self->rawv_ring, self->i_rawv_image, self->rawv_image_size);
-	if (len != self->rawv_image_size) {
-		fprintf(stderr, "fifo_put fail[%s:%d].\n", __FILE__, __LINE__);
+	if (fusion_put_vis_ts(self, unreg, timestamp)) {
 		ret = -1;
 	}
 
 	return ret;
 }
 
-/** @brief Send infrared image to fusion instance.
+/** @brief Send infrared image to fusion instance, stamped with current time.
  ** @param self fusion instance.
  ** @param base base image.
  ** @return  0 if success,
@@ -578,22 +716,46 @@ int fusion_put(Fusion *self, unsigned char *base, unsigned char *unreg)
  **/
 int fusion_put_inf(Fusion *self, unsigned char *base)
 {
-	int len;
+	return fusion_put_inf_ts(self, base, timer_now_us());
+}
+
+/** @brief Send infrared image with its capture time to fusion instance.
+ ** @param self fusion instance.
+ ** @param base base image.
+ ** @param timestamp capture time in microseconds, same clock as timer_now_us.
+ ** @return  0 if success,
+ **         -1 if fail.
+ **/
+int fusion_put_inf_ts(Fusion *self, unsigned char *base, long long timestamp)
+{
+	Frame *frame;
 	
 	assert(self);
 	assert(base);
 	
-	memmove(self->i_rawi_image, base, self->base_width * self->base_height * sizeof(unsigned short));
-	len = fifo_put(self->rawi_ring, self->i_rawi_image, self->rawi_image_size);
-	if (len != self->rawi_image_size) {
+	self->inf_in++;
+	
+	frame = framepool_get(self->rawi_pool);
+	if (!frame) {
+		fprintf(stderr, "framepool_get fail[%s:%d].\n", __FILE__, __LINE__);
+		self->inf_drops++;
+		return -1;
+	}
+	
+	memmove(frame->data, base, self->base_width * self->base_height * sizeof(unsigned short));
+	frame->timestamp = timestamp;
+	
+	if (sizeof(frame) != fifo_put(self->rawi_ring, (char *)&frame, sizeof(frame))) {
 		fprintf(stderr, "fifo_put fail[%s:%d].\n", __FILE__, __LINE__);
+		frame_unref(frame);
+		self->inf_drops++;
 		return -1;
 	}
 	
 	return 0;
 }
 
-/** @brief Send visual image to fusion instance.
+/** @brief Send visual image to fusion instance, stamped with current time.
  ** @param self fusion instance.
  ** @param unreg unregistered image.
  ** @return  0 if success,
@@ -601,16 +763,39 @@ int fusion_put_inf(Fusion *self, unsigned char *base)
  **/
 int fusion_put_vis(Fusion *self, unsigned char *unreg)
 {
-	int len;
-	int ret = 0;
+	return fusion_put_vis_ts(self, unreg, timer_now_us());
+}
+
+/** @brief Send visual image with its capture time to fusion instance.
+ ** @param self fusion instance.
+ ** @param unreg unregistered image.
+ ** @param timestamp capture time in microseconds, same clock as timer_now_us.
+ ** @return  0 if success,
+ **         -1 if fail.
+ **/
+int fusion_put_vis_ts(Fusion *self, unsigned char *unreg, long long timestamp)
+{
+	Frame *frame;
 	
 	assert(self);
 	assert(unreg);
 	
-	memmove(self->i_rawv_image, unreg, self->unreg_width * self->unreg_height * 3 >> 1);
-	len = fifo_put(self->rawv_ring, self->i_rawv_image, self->rawv_image_size);
-	if (len != self->rawv_image_size) {
+	self->vis_in++;
+	
+	frame = framepool_get(self->rawv_pool);
+	if (!frame) {
+		fprintf(stderr, "framepool_get fail[%s:%d].\n", __FILE__, __LINE__);
+		self->vis_drops++;
+		return -1;
+	}
+	
+	memmove(frame->data, unreg, self->unreg_width * self->unreg_height * 3 >> 1);
+	frame->timestamp = timestamp;
+	
+	if (sizeof(frame) != fifo_put(self->rawv_ring, (char *)&frame, sizeof(frame))) {
 		fprintf(stderr, "fifo_put fail[%s:%d].\n", __FILE__, __LINE__);
+		frame_unref(frame);
+		self->vis_drops++;
 		return -1;
 	}
 	
@@ -625,20 +810,20 @@ int fusion_put_vis(Fusion *self, unsigned char *unreg)
  **/
 int fusion_get(Fusion *self, unsigned char *fu)
 {
-	int len;
-	int ret;
+	char *slot;
 	
 	assert(self);
 	assert(fu);
 	
-	len = self->yuvf_image_size;
-	
-	ret = fifo_get(self->fusn_ring, self->o_fusn_image, len);
-	if (ret == len) {
-		memmove(fu, self->o_fusn_image, self->base_width * self->base_height * 3 >> 1);
+	slot = fifo_peek_read(self->fusn_ring, self->yuvf_image_size);
+	if (!slot) {
+		return 0;
 	}
 	
-	return (ret == len);
+	memmove(fu, slot, self->base_width * self->base_height * 3 >> 1);
+	fifo_release_read(self->fusn_ring, self->yuvf_image_size);
+	
+	return 1;
 }
 
 /** @brief Get grayscale compressed infrared image from fusion instance.
@@ -649,20 +834,19 @@ int fusion_get(Fusion *self, unsigned char *fu)
  **/
 int fusion_get_inf(Fusion *self, unsigned char *inf)
 {
-	int len;
-	int ret;
+	Frame *frame;
 	
 	assert(self);
 	assert(inf);
 	
-	len = self->yuvf_image_size;
-	
-	ret = fifo_get(self->iout_ring, self->iout_image, len);
-	if (ret == len) {
-		memmove(inf, self->iout_image, self->base_width * self->base_height * 3 >> 1);
+	if (sizeof(frame) != fifo_get(self->iout_ring, (char *)&frame, sizeof(frame))) {
+		return 0;
 	}
 	
-	return (ret == len);
+	memmove(inf, frame->data, self->base_width * self->base_height * 3 >> 1);
+	frame_unref(frame);
+	
+	return 1;
 }
 
 /** @brief Get registered visual image from fusion instance.
@@ -673,20 +857,19 @@ int fusion_get_inf(Fusion *self, unsigned char *inf)
  **/
 int fusion_get_vis(Fusion *self, unsigned char *vis)
 {
-	int len;
-	int ret;
+	Frame *frame;
 	
 	assert(self);
 	assert(vis);
 	
-	len = self->yuvf_image_size;
-	
-	ret = fifo_get(self->vout_ring, self->vout_image, len);
-	if (ret == len) {
-		memmove(vis, self->vout_image, self->base_width * self->base_height * 3 >> 1);
+	if (sizeof(frame) != fifo_get(self->vout_ring, (char *)&frame, sizeof(frame))) {
+		return 0;
 	}
 	
-	return (ret == len);
+	memmove(vis, frame->data, self->base_width * self->base_height * 3 >> 1);
+	frame_unref(frame);
+	
+	return 1;
 }
 
 /** @brief Get infrared bright feature from fusion instance.
@@ -697,20 +880,163 @@ int fusion_get_vis(Fusion *self, unsigned char *vis)
  **/
 int fusion_get_ibf(Fusion *self, unsigned char *ibf)
 {
-	int len;
-	int ret;
+	char *slot;
 	
 	assert(self);
 	assert(ibf);
 	
-	len = self->nmsc_image_size;
+	slot = fifo_peek_read(self->brft_ring, self->nmsc_image_size);
+	if (!slot) {
+		return 0;
+	}
+	
+	memmove(ibf, slot, self->base_width * self->base_height);
+	fifo_release_read(self->brft_ring, self->nmsc_image_size);
+	
+	return 1;
+}
+
+/** @brief Get statistics of fusion instance. Counters are read without
+ **        lock, so they may be a frame apart from each other.
+ ** @param self fusion instance.
+ ** @param stats statistics.
+ ** @return  0 if success,
+ **         -1 if fail.
+ **/
+int fusion_get_stats(Fusion *self, FusionStats *stats)
+{
+	int i, j;
 	
-	ret = fifo_get(self->brft_ring, self->fout_image, len);
-	if (ret == len) {
-		memmove(ibf, self->fout_image, self->base_width * self->base_height);
+	assert(self);
+	
+	if (!stats) {
+		return -1;
 	}
 	
-	return (ret == len);
+	for (i = 0; i < FUSION_STAGES; i++) {
+		switch (i) {
+		case FUSION_STAGE_MINFILTER:
+			stat_timer_summary(bkgreconst_get_timer(self->breconst,
+				BKGRECONST_STAGE_MINFILTER), &stats->stage[i]);
+			break;
+		case FUSION_STAGE_QTREE:
+			stat_timer_summary(bkgreconst_get_timer(self->breconst,
+				BKGRECONST_STAGE_QTREE), &stats->stage[i]);
+			break;
+		case FUSION_STAGE_BEZIER:
+			stat_timer_summary(bkgreconst_get_timer(self->breconst,
+				BKGRECONST_STAGE_BEZIER), &stats->stage[i]);
+			break;
+		case FUSION_STAGE_GAUSS:
+			stat_timer_summary(bkgreconst_get_timer(self->breconst,
+				BKGRECONST_STAGE_GAUSS), &stats->stage[i]);
+			break;
+		default:
+			stat_timer_summary(&self->timers[i], &stats->stage[i]);
+			break;
+		}
+	}
+	
+	for (i = 0; i < FUSION_RINGS; i++) {
+		for (j = 0; j < STAT_DEPTHS; j++) {
+			stats->depth[i][j] = self->depths[i].hist[j];
+		}
+	}
+	
+	stats->inf_in = self->inf_in;
+	stats->vis_in = self->vis_in;
+	stats->inf_drops = self->inf_drops;
+	stats->vis_drops = self->vis_drops;
+	stats->unpaired = self->unpaired;
+	stats->fusn_out = self->fusn_out;
+	
+	for (i = 0; i < 4; i++) {
+		stats->out_drops[i] = fusion_get_drops(self, (FusionQueue)i);
+	}
+	
+	return 0;
+}
+
+/** @brief Write statistics of fusion instance.
+ ** @param self fusion instance.
+ ** @param fp output stream.
+ ** @param json write one line JSON object instead of text table.
+ **/
+void fusion_dump_stats(Fusion *self, FILE *fp, int json)
+{
+	FusionStats stats;
+	StatSummary *ss;
+	int i, j;
+	
+	assert(self);
+	assert(fp);
+	
+	fusion_get_stats(self, &stats);
+	
+	if (json) {
+		fprintf(fp, "{\"stages\":{");
+		for (i = 0; i < FUSION_STAGES; i++) {
+			ss = &stats.stage[i];
+			fprintf(fp, "%s\"%s\":{\"count\":%u,\"mean\":%.1f,\"p50\":%.1f,"
+				"\"p99\":%.1f,\"max\":%.1f}", i ? "," : "", stage_names[i],
+				ss->count, ss->mean, ss->p50, ss->p99, ss->max);
+		}
+		
+		fprintf(fp, "},\"depths\":{");
+		for (i = 0; i < FUSION_RINGS; i++) {
+			fprintf(fp, "%s\"%s\":[", i ? "," : "", ring_names[i]);
+			for (j = 0; j < STAT_DEPTHS; j++) {
+				fprintf(fp, "%s%u", j ? "," : "", stats.depth[i][j]);
+			}
+			fprintf(fp, "]");
+		}
+		
+		fprintf(fp, "},\"frames\":{\"inf_in\":%u,\"vis_in\":%u,\"inf_drops\":%u,"
+			"\"vis_drops\":%u,\"unpaired\":%u,\"fusn_out\":%u,\"out_drops\":[%u,%u,%u,%u]}}\n",
+			stats.inf_in, stats.vis_in, stats.inf_drops, stats.vis_drops, stats.unpaired,
+			stats.fusn_out, stats.out_drops[0], stats.out_drops[1], stats.out_drops[2],
+			stats.out_drops[3]);
+	} else {
+		fprintf(fp, "%-10s %8s %10s %10s %10s %10s\n", "stage(us)", "count", "mean",
+			"p50", "p99", "max");
+		for (i = 0; i < FUSION_STAGES; i++) {
+			ss = &stats.stage[i];
+			fprintf(fp, "%-10s %8u %10.1f %10.1f %10.1f %10.1f\n", stage_names[i],
+				ss->count, ss->mean, ss->p50, ss->p99, ss->max);
+		}
+		
+		for (i = 0; i < FUSION_RINGS; i++) {
+			fprintf(fp, "%-10s", ring_names[i]);
+			for (j = 0; j < STAT_DEPTHS; j++) {
+				fprintf(fp, " %u", stats.depth[i][j]);
+			}
+			fprintf(fp, "\n");
+		}
+		
+		fprintf(fp, "frames: inf in %u, vis in %u, inf drops %u, vis drops %u, "
+			"unpaired %u, fusion out %u, output drops %u/%u/%u/%u\n",
+			stats.inf_in, stats.vis_in, stats.inf_drops, stats.vis_drops, stats.unpaired,
+			stats.fusn_out, stats.out_drops[0], stats.out_drops[1], stats.out_drops[2],
+			stats.out_drops[3]);
+	}
+	
+	fflush(fp);
+}
+
+/** @brief Let fusion thread write statistics periodically.
+ ** @param self fusion instance.
+ ** @param fp output stream, NULL to disable periodic dump.
+ ** @param period dump period in milliseconds.
+ ** @param json write JSON instead of text table.
+ **/
+void fusion_set_stats_dump(Fusion *self, FILE *fp, int period, int json)
+{
+	assert(self);
+	
+	self->stats_period = period;
+	self->stats_json = json;
+	self->stats_last = timer_now_us();
+	self->stats_fp = fp;
 }
 
 /** @brief Get text lines.
@@ -769,68 +1095,96 @@ unsigned int roundup_power_of_2(unsigned int a)
 void *fusion_thread(void *s)
 {
 	Fusion *self = (Fusion *)s;
-	int read_len;
-	int write_len;
+	char *slot;
+	Frame *gsci_frame;
+	unsigned char *gsci_image;
+	unsigned char *regt_image;
+	unsigned char *fusn_image;
+	unsigned char *sbrf_image;
+	FusionBatch batch;
+	long long timestamp;
+	long long start;
 	
 	while (!self->stop_fusn) {
-		/* read infrared image from ring buffer. */
-		read_len = fifo_get(self->gsci_ring, (char *)self->o_gsci_image, self->yuvf_image_size);
-		if (read_len != self->yuvf_image_size) {
+		if (self->stats_fp && timer_now_us() - self->stats_last >= self->stats_period * 1000LL) {
+			fusion_dump_stats(self, self->stats_fp, self->stats_json);
+			self->stats_last = timer_now_us();
+		}
+		
+		/* peek infrared frame in ring buffer. */
+		slot = fifo_peek_read_wait(self->gsci_ring, sizeof(Frame *), FUSION_WAIT_TIMEOUT);
+		if (!slot) {
 			continue;
 		}
+		
+		memmove(&gsci_frame, slot, sizeof(gsci_frame));
+		gsci_image = gsci_frame->data;
+		timestamp = gsci_frame->timestamp;
 
-		/* read visual image from ring buffer. */
-		read_len = fifo_get(self->regt_ring, (char *)self->o_regt_image, self->yuvf_image_size);
-		if (read_len != self->yuvf_image_size) {
+		/* read infrared reconstructed background from ring buffer, keep
+		   infrared frame until it comes. */
+		if (!bkgreconst_get_wait(self->breconst, self->bkgr_image, FUSION_WAIT_TIMEOUT)) {
 			continue;
 		}
-
-		/* read infrared reconstructed background from ring buffer. */
-		if (!bkgreconst_get(self->breconst, self->bkgr_image)) {
+		
+		/* pick visual image of the same time, the background is consumed
+		   already so infrared frame goes too if there is no partner. */
+		if (pair_visual_frame(self, timestamp, &regt_image) < 0) {
+			fifo_release_read(self->gsci_ring, sizeof(Frame *));
+			frame_unref(gsci_frame);
+			self->unpaired++;
 			continue;
 		}
 		
-		/* extract bright feature. */
-		img_subtract_kr(self->o_gsci_image, self->base_width, self->base_height,
-			self->bkgr_image, self->brft_image);
+		sample_ring_depths(self);
+		start = timer_now_us();
 		
-		/* estimate infrared background. */
-		img_subtract_kr(self->o_regt_image, self->base_width, self->base_height,
-			self->o_gsci_image, self->etbk_image);
+		/* write output straight into the output queues, which drop queued
+		   images by their overflow mode. Fall back to private buffers and
+		   drop this image if a queue still has no room. */
+		fusn_image = (unsigned char *)fifo_reserve_write(self->fusn_ring, self->yuvf_image_size);
+		if (!fusn_image) {
+			self->fusn_rejects++;
+			fusn_image = self->i_fusn_image;
+		}
 		
-		/* refine bright feature. */
-		img_subtract_kr(self->brft_image, self->base_width, self->base_height,
-			self->etbk_image, self->rfbf_image);
+		sbrf_image = (unsigned char *)fifo_reserve_write(self->brft_ring, self->nmsc_image_size);
+		if (!sbrf_image) {
+			self->brft_rejects++;
+			sbrf_image = self->sbrf_image;
+		}
 		
-		/* make unsuppression fusion image. */
-		img_add(self->o_regt_image, self->base_width, self->base_height, self->rfbf_image,
-			self->usfn_image);
+		batch.fusion = self;
+		batch.gsci_image = gsci_image;
+		batch.regt_image = regt_image;
+		batch.sbrf_image = sbrf_image;
+		batch.fusn_image = fusn_image;
 		
-		/* suppress bright feature. */
-		suppress_bright_feature(self->rfbf_image, self->base_width, self->base_height,
-			self->usfn_image, self->hist, self->ngls, self->ssr, self->bpr, self->sbrf_image);
-				
-		/* overlay bright feature. */
-		img_add_kr(self->o_regt_image, self->base_width, self->base_height, self->sbrf_image,
-			self->i_fusn_image);
-
-		if (COLOR_STYLE == self->cstyle) {
-			memmove(self->i_fusn_image + self->base_width * self->base_height, self->o_regt_image +
-				self->base_width * self->base_height, self->base_width * self->base_height >> 1);
-		} else {
-			memset(self->i_fusn_image + self->base_width * self->base_height, 0x80,
-				self->base_width * self->base_height >> 1);
-		}
-			
-		write_len = fifo_put(self->fusn_ring, (char *)self->i_fusn_image, self->yuvf_image_size);
-		if (write_len != self->yuvf_image_size) {
-			fprintf(stderr, "fifo_put fail[%s:%d].\n", __FILE__, __LINE__);
+		/* extract refined bright feature and count the gray levels of
+		   the unsuppressed fusion image of each strip. */
+		workpool_run(self->wpool, extract_strip, &batch, self->nstrips);
+		
+		/* reduce the strip histograms to the suppression ratio. */
+		batch.sr = suppression_ratio(self->hist, self->nstrips, self->ngls,
+			self->base_width * self->base_height, self->ssr, self->bpr);
+		
+		/* suppress bright feature and overlay it on visual image. */
+		workpool_run(self->wpool, overlay_strip, &batch, self->nstrips);
+		
+		fifo_release_read(self->gsci_ring, sizeof(Frame *));
+		frame_unref(gsci_frame);
+		
+		if (fusn_image != self->i_fusn_image) {
+			fifo_commit_write(self->fusn_ring, self->yuvf_image_size);
 		}
 		
-		write_len = fifo_put(self->brft_ring, self->sbrf_image, self->nmsc_image_size);
-		if (write_len != self->nmsc_image_size) {
-			fprintf(stderr, "fifo_put fail[%s:%d].\n", __FILE__, __LINE__);
+		if (sbrf_image != self->sbrf_image) {
+			fifo_commit_write(self->brft_ring, self->nmsc_image_size);
 		}
+		
+		stat_timer_add(&self->timers[FUSION_STAGE_FUSION], timer_now_us() - start);
+		stat_timer_add(&self->timers[FUSION_STAGE_LATENCY], timer_now_us() - timestamp);
+		self->fusn_out++;
 	}
 	
 	return (void *)(0);
@@ -861,31 +1215,58 @@ int preprocess_infrared_start(Fusion *self)
 void *preprocess_infrared_thread(void *s)
 {
 	Fusion *self = (Fusion *)s;
-	int read_len;
+	Frame *rawi_frame;
+	char *slot;
+	Frame *gsci_frame;
 	int write_len;
 	unsigned int rol;
+	long long start;
 	
 	while (!self->stop_fusn) {
-		read_len = fifo_get(self->rawi_ring, self->o_rawi_image, self->rawi_image_size);
-		if (read_len != self->rawi_image_size) {
+		/* leave raw image queued until there is room for its output. */
+		slot = fifo_reserve_write_wait(self->gsci_ring, sizeof(Frame *), FUSION_WAIT_TIMEOUT);
+		if (!slot) {
 			continue;
 		}
 		
-		RDC_SendRawData(self->o_rawi_image, self->base_width * self->base_height *
+		gsci_frame = framepool_get_wait(self->fpool, FUSION_WAIT_TIMEOUT);
+		if (!gsci_frame) {
+			continue;
+		}
+		
+		if (sizeof(rawi_frame) != fifo_get_wait(self->rawi_ring, (char *)&rawi_frame,
+			sizeof(rawi_frame), FUSION_WAIT_TIMEOUT)) {
+			frame_unref(gsci_frame);
+			continue;
+		}
+		
+		start = timer_now_us();
+		RDC_SendRawData(rawi_frame->data, self->base_width * self->base_height *
 			sizeof(unsigned short));
-		RDC_GetFrame(self->i_gsci_image, &rol);
+		RDC_GetFrame(gsci_frame->data, &rol);
+		stat_timer_add(&self->timers[FUSION_STAGE_RDC], timer_now_us() - start);
 		
-		bkgreconst_put(self->breconst, self->i_gsci_image);
+		gsci_frame->timestamp = rawi_frame->timestamp;
+		frame_unref(rawi_frame);
 		
-		write_len = fifo_put(self->gsci_ring, (char *)self->i_gsci_image, self->yuvf_image_size);
-		if (write_len != self->yuvf_image_size) {
-			fprintf(stderr, "fifo_put fail[%s:%d].\n", __FILE__, __LINE__);
+		/* drop the frame here too, or infrared and background would pair up
+		   frames of different time. */
+		if (!bkgreconst_put(self->breconst, gsci_frame)) {
+			frame_unref(gsci_frame);
+			continue;
 		}
 		
-		write_len = fifo_put(self->iout_ring, (char *)self->i_gsci_image, self->yuvf_image_size);
-		if (write_len != self->yuvf_image_size) {
-			fprintf(stderr, "fifo_put fail[%s:%d].\n", __FILE__, __LINE__);
+		/* share the frame with the output queue instead of copying it,
+		   the queue counts the frame if it has to drop it. */
+		frame_ref(gsci_frame);
+		write_len = fifo_put(self->iout_ring, (char *)&gsci_frame, sizeof(gsci_frame));
+		if (write_len != sizeof(gsci_frame)) {
+			frame_unref(gsci_frame);
 		}
+		
+		/* our own reference goes to the fusion thread. */
+		memmove(slot, &gsci_frame, sizeof(gsci_frame));
+		fifo_commit_write(self->gsci_ring, sizeof(gsci_frame));
 	}
 	
 	return (void *)(0);
@@ -916,74 +1297,440 @@ int preprocess_visual_start(Fusion *self)
 void *preprocess_visual_thread(void *s)
 {
 	Fusion *self = (Fusion *)s;
-	int read_len;
+	Frame *rawv_frame;
+	char *slot;
+	Frame *regt_frame;
 	int write_len;
+	long long start;
 	
 	while (!self->stop_fusn) {
-		read_len = fifo_get(self->rawv_ring, self->o_rawv_image, self->rawv_image_size);
-		if (read_len != self->rawv_image_size) {
+		/* leave raw image queued until there is room for its output. */
+		slot = fifo_reserve_write_wait(self->regt_ring, sizeof(Frame *), FUSION_WAIT_TIMEOUT);
+		if (!slot) {
 			continue;
 		}
 		
-		rm_regist_warp_image(self->regist, self->o_rawv_image, self->i_regt_image);
+		regt_frame = framepool_get_wait(self->fpool, FUSION_WAIT_TIMEOUT);
+		if (!regt_frame) {
+			continue;
+		}
 		
-		write_len = fifo_put(self->regt_ring, self->i_regt_image, self->yuvf_image_size);
-		if (write_len != self->yuvf_image_size) {
-			fprintf(stderr, "fifo_put fail[%s:%d].\n", __FILE__, __LINE__);
+		if (sizeof(rawv_frame) != fifo_get_wait(self->rawv_ring, (char *)&rawv_frame,
+			sizeof(rawv_frame), FUSION_WAIT_TIMEOUT)) {
+			frame_unref(regt_frame);
+			continue;
 		}
 		
-		write_len = fifo_put(self->vout_ring, self->i_regt_image, self->yuvf_image_size);
-		if (write_len != self->yuvf_image_size) {
-			fprintf(stderr, "fifo_put fail[%s:%d].\n", __FILE__, __LINE__);
+		start = timer_now_us();
+		rm_regist_warp_image(self->regist, rawv_frame->data, regt_frame->data);
+		stat_timer_add(&self->timers[FUSION_STAGE_WARP], timer_now_us() - start);
+		
+		regt_frame->timestamp = rawv_frame->timestamp;
+		frame_unref(rawv_frame);
+		
+		/* share the frame with the output queue instead of copying it,
+		   the queue counts the frame if it has to drop it. */
+		frame_ref(regt_frame);
+		write_len = fifo_put(self->vout_ring, (char *)&regt_frame, sizeof(regt_frame));
+		if (write_len != sizeof(regt_frame)) {
+			frame_unref(regt_frame);
 		}
+		
+		/* our own reference goes to the fusion thread. */
+		memmove(slot, &regt_frame, sizeof(regt_frame));
+		fifo_commit_write(self->regt_ring, sizeof(regt_frame));
 	}
 	
 	return (void *)(0);
 }
 
-/** @brief Suppress infrared bright feature.
- ** @param rfbf_image refined bright feature image.
- ** @param width image width.
- ** @param height image height.
- ** @param usfn_image unsuppressed fusion image.
- ** @param hist image histogram.
+/** @brief Pick visual image to fuse with infrared frame according to the
+ **        pairing policy. Visual frames are kept in a small window so that
+ **        one can be paired with several infrared frames, or skipped.
+ ** @param self fusion instance.
+ ** @param timestamp capture time of infrared frame.
+ ** @param regt_image paired visual image.
+ ** @return  1 if paired,
+ **         -1 if infrared frame has no partner and should be dropped.
+ **/
+int pair_visual_frame(Fusion *self, long long timestamp, unsigned char **regt_image)
+{
+	long long diff, best_diff;
+	long long t0, t1;
+	int best;
+	int i;
+	
+	pull_visual_frames(self, 0);
+	
+	/* a nearer visual frame may still be on its way. */
+	if (!self->nvwin || (SYNC_HOLD_LAST_VISIBLE != self->sync &&
+		self->vwin[self->nvwin - 1]->timestamp < timestamp)) {
+		pull_visual_frames(self, FUSION_WAIT_TIMEOUT);
+	}
+	
+	if (!self->nvwin) {
+		return -1;
+	}
+	
+	switch (self->sync) {
+	case SYNC_HOLD_LAST_VISIBLE:
+		best = -1;
+		for (i = 0; i < self->nvwin; i++) {
+			if (self->vwin[i]->timestamp <= timestamp) {
+				best = i;
+			}
+		}
+		
+		if (best < 0) {
+			return -1;
+		}
+		
+		drop_visual_frames(self, best);
+		*regt_image = self->vwin[0]->data;
+		return 1;
+	case SYNC_INTERPOLATE:
+		for (i = 0; i < self->nvwin; i++) {
+			if (self->vwin[i]->timestamp >= timestamp) {
+				break;
+			}
+		}
+		
+		/* infrared frame is outside the window, use the nearest end. */
+		if (0 == i || self->nvwin == i) {
+			i = i ? i - 1 : 0;
+			diff = self->vwin[i]->timestamp - timestamp;
+			if (diff > self->sync_tolerance || -diff > self->sync_tolerance) {
+				return -1;
+			}
+			
+			drop_visual_frames(self, i);
+			*regt_image = self->vwin[0]->data;
+			return 1;
+		}
+		
+		drop_visual_frames(self, i - 1);
+		t0 = self->vwin[0]->timestamp;
+		t1 = self->vwin[1]->timestamp;
+		
+		/* too far apart to blend, a visual frame is missing between them. */
+		if (t1 - t0 > 2 * (long long)self->sync_tolerance) {
+			return -1;
+		}
+		
+		blend_images(self->vwin[0]->data, self->vwin[1]->data,
+			self->base_width * self->base_height * 3 >> 1,
+			(int)((timestamp - t0) * 256 / (t1 - t0)), self->intp_image);
+		*regt_image = self->intp_image;
+		return 1;
+	case SYNC_DROP_OLDEST:
+	default:
+		best = 0;
+		best_diff = -1;
+		for (i = 0; i < self->nvwin; i++) {
+			diff = self->vwin[i]->timestamp - timestamp;
+			diff = diff < 0 ? -diff : diff;
+			if (best_diff < 0 || diff < best_diff) {
+				best_diff = diff;
+				best = i;
+			}
+		}
+		
+		if (best_diff > self->sync_tolerance) {
+			/* visual frames older than infrared frame can not match later ones. */
+			if (self->vwin[best]->timestamp < timestamp) {
+				drop_visual_frames(self, best + 1);
+			}
+			return -1;
+		}
+		
+		drop_visual_frames(self, best);
+		*regt_image = self->vwin[0]->data;
+		return 1;
+	}
+}
+
+/** @brief Move registered visual frames from ring buffer to pairing window.
+ **        The oldest frame is dropped when the window is full.
+ ** @param self fusion instance.
+ ** @param timeout maximum milliseconds to wait for the first frame.
+ **/
+void pull_visual_frames(Fusion *self, int timeout)
+{
+	Frame *frame;
+	
+	while (sizeof(frame) == fifo_get_wait(self->regt_ring, (char *)&frame,
+		sizeof(frame), timeout)) {
+		if (self->nvwin == self->caches) {
+			drop_visual_frames(self, 1);
+		}
+		
+		self->vwin[self->nvwin++] = frame;
+		timeout = 0;
+	}
+}
+
+/** @brief Drop the oldest visual frames in pairing window.
+ ** @param self fusion instance.
+ ** @param n number of frames to drop.
+ **/
+void drop_visual_frames(Fusion *self, int n)
+{
+	int i;
+	
+	if (n <= 0) {
+		return;
+	}
+	
+	for (i = 0; i < n; i++) {
+		frame_unref(self->vwin[i]);
+	}
+	
+	for (i = n; i < self->nvwin; i++) {
+		self->vwin[i - n] = self->vwin[i];
+	}
+	
+	self->nvwin -= n;
+}
+
+/** @brief Get ring buffer of output queue.
+ ** @param self fusion instance.
+ ** @param queue output queue.
+ ** @return ring buffer.
+ **/
+Fifo *output_queue(Fusion *self, FusionQueue queue)
+{
+	switch (queue) {
+	case FUSION_QUEUE_INFRARED:
+		return self->iout_ring;
+	case FUSION_QUEUE_VISUAL:
+		return self->vout_ring;
+	case FUSION_QUEUE_FEATURE:
+		return self->brft_ring;
+	case FUSION_QUEUE_FUSION:
+	default:
+		return self->fusn_ring;
+	}
+}
+
+/** @brief Get ring buffer to sample for statistics.
+ ** @param self fusion instance.
+ ** @param ring ring buffer.
+ ** @param record record byte size of the ring buffer.
+ ** @return ring buffer.
+ **/
+Fifo *stats_ring(Fusion *self, FusionRing ring, unsigned int *record)
+{
+	*record = sizeof(Frame *);
+	
+	switch (ring) {
+	case FUSION_RING_RAWI:
+		return self->rawi_ring;
+	case FUSION_RING_RAWV:
+		return self->rawv_ring;
+	case FUSION_RING_GSCI:
+		return self->gsci_ring;
+	case FUSION_RING_REGT:
+		return self->regt_ring;
+	case FUSION_RING_IOUT:
+		return self->iout_ring;
+	case FUSION_RING_VOUT:
+		return self->vout_ring;
+	case FUSION_RING_BRFT:
+		*record = self->nmsc_image_size;
+		return self->brft_ring;
+	case FUSION_RING_FUSN:
+	default:
+		*record = self->yuvf_image_size;
+		return self->fusn_ring;
+	}
+}
+
+/** @brief Add depth of every ring buffer to its histogram.
+ ** @param self fusion instance.
+ **/
+void sample_ring_depths(Fusion *self)
+{
+	unsigned int record;
+	Fifo *ring;
+	int i;
+	
+	for (i = 0; i < FUSION_RINGS; i++) {
+		ring = stats_ring(self, (FusionRing)i, &record);
+		stat_depth_add(&self->depths[i], fifo_len(ring) / record);
+	}
+}
+
+/** @brief Release frame of a record dropped by frame output queue.
+ ** @param record frame pointer record.
+ **/
+void drop_frame(char *record)
+{
+	Frame *frame;
+	
+	memmove(&frame, record, sizeof(frame));
+	frame_unref(frame);
+}
+
+/** @brief Blend two images, c = (a * (256 - weight) + b * weight) / 256.
+ ** @param a image a.
+ ** @param b image b.
+ ** @param size image byte size.
+ ** @param weight weight of image b in [0, 256].
+ ** @param c blended image.
+ **/
+void blend_images(const unsigned char *a, const unsigned char *b, unsigned int size,
+                  int weight, unsigned char *c)
+{
+	unsigned int i;
+	
+	for (i = 0; i < size; i++) {
+		c[i] = (unsigned char)((a[i] * (256 - weight) + b[i] * weight + 128) >> 8);
+	}
+}
+
+/** @brief Replace the worker pool and the strip histograms. The new ones
+ **        are made aside and swapped in only if all of them succeed, so
+ **        that a failure keeps the old pool and histograms working.
+ ** @param self fusion instance.
+ ** @param nworkers number of threads making a fusion image.
+ ** @return  0 if success,
+ **         -1 if fail.
+ **/
+int make_workers(Fusion *self, int nworkers)
+{
+	WorkPool *wpool;
+	unsigned int *hist;
+	unsigned int nstrips;
+	
+	wpool = workpool_new();
+	if (!wpool) {
+		fprintf(stderr, "workpool_new fail[%s:%d].\n", __FILE__, __LINE__);
+		return -1;
+	}
+	
+	if (workpool_init(wpool, nworkers)) {
+		fprintf(stderr, "workpool_init fail[%s:%d].\n", __FILE__, __LINE__);
+		workpool_delete(wpool);
+		return -1;
+	}
+	
+	nstrips = workpool_threads(wpool);
+	hist = (unsigned int *)malloc(nstrips * self->ngls * sizeof(unsigned int));
+	if (!hist) {
+		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+		workpool_delete(wpool);
+		return -1;
+	}
+	
+	if (self->wpool) {
+		workpool_delete(self->wpool);
+	}
+	
+	if (self->hist) {
+		free(self->hist);
+	}
+	
+	self->wpool = wpool;
+	self->hist = hist;
+	self->nstrips = nstrips;
+	
+	return 0;
+}
+
+/** @brief Extract refined bright feature of one strip and count its
+ **        unsuppressed fusion image into the histogram of the strip.
+ ** @param arg images of the frame.
+ ** @param index strip index.
+ ** @param count number of strips.
+ **/
+void extract_strip(void *arg, unsigned int index, unsigned int count)
+{
+	FusionBatch *batch = (FusionBatch *)arg;
+	Fusion *self = batch->fusion;
+	unsigned int top;
+	unsigned int bottom;
+	unsigned int offset;
+	
+	top = self->base_height * index / count;
+	bottom = self->base_height * (index + 1) / count;
+	offset = top * self->base_width;
+	
+	bright_feature_extract(batch->gsci_image + offset, batch->regt_image + offset,
+		self->bkgr_image + offset, self->base_width, bottom - top,
+		self->rfbf_image + offset, self->hist + index * self->ngls);
+}
+
+/** @brief Suppress and overlay bright feature of one strip, and fill
+ **        the chroma rows of the strip.
+ ** @param arg images of the frame.
+ ** @param index strip index.
+ ** @param count number of strips.
+ **/
+void overlay_strip(void *arg, unsigned int index, unsigned int count)
+{
+	FusionBatch *batch = (FusionBatch *)arg;
+	Fusion *self = batch->fusion;
+	unsigned int npixels;
+	unsigned int top;
+	unsigned int bottom;
+	unsigned int offset;
+	unsigned int begin;
+	unsigned int end;
+	
+	npixels = self->base_width * self->base_height;
+	top = self->base_height * index / count;
+	bottom = self->base_height * (index + 1) / count;
+	offset = top * self->base_width;
+	
+	bright_feature_overlay(batch->regt_image + offset, self->rfbf_image + offset,
+		self->base_width, bottom - top, batch->sr, batch->sbrf_image + offset,
+		batch->fusn_image + offset);
+	
+	begin = npixels + (npixels >> 1) * index / count;
+	end = npixels + (npixels >> 1) * (index + 1) / count;
+	
+	if (COLOR_STYLE == self->cstyle) {
+		memmove(batch->fusn_image + begin, batch->regt_image + begin, end - begin);
+	} else {
+		memset(batch->fusn_image + begin, 0x80, end - begin);
+	}
+}
+
+/** @brief Get infrared bright feature suppression ratio from the
+ **        histograms of the strips, which are summed level by level
+ **        from the brightest one until enough pixels are seen.
+ ** @param hist histograms of the strips.
+ ** @param nhists number of histograms.
  ** @param ngls number of unsuppressed fusion image gray levels.
+ ** @param npixels number of image pixels.
  ** @param ssr standard bright feature suppression ratio.
  ** @param bpr brightest pixel ratio.
- ** @param sbrf_image suppressed bright feature image.
+ ** @return suppression ratio.
  **/
-void suppress_bright_feature(const unsigned char *rfbf_image, unsigned int width,
-                             unsigned int height, unsigned short *usfn_image,
-							 unsigned int *hist, unsigned int ngls, float ssr,
-							 float bpr, unsigned char *sbrf_image)
+float suppression_ratio(const unsigned int *hist, unsigned int nhists,
+                        unsigned int ngls, unsigned int npixels, float ssr,
+						float bpr)
 {
 	unsigned int i;
-	unsigned int npixels;
+	unsigned int j;
+	unsigned int count;
 	unsigned int bpc = 0;	/* brightest pixel counter. */
 	unsigned int bpct;		/* brightest pixel count threshold. */
 	float sum = 0;
 	float mean;
 	float sr;				/* suppression ratio. */
 
-	npixels = width * height;
 	bpct = (unsigned int)(bpr * npixels);
 	
-	memset(hist, 0, ngls * sizeof(unsigned int));
-	
-	for (i = 0; i < npixels; i++) {
-		hist[usfn_image[i]]++;
-	}
-	
-	for (i = ngls - 1; i >= 0; i--) {
-		if (!hist[i]) {
-			continue;
+	/* walk down from the brightest level until enough pixels are seen. */
+	for (i = ngls; i > 0 && bpc <= bpct; i--) {
+		count = 0;
+		for (j = 0; j < nhists; j++) {
+			count += hist[j * ngls + i - 1];
 		}
 		
-		bpc += hist[i];
-		sum += hist[i] * i;
-		if (bpc > bpct) {
-			break;
-		}
+		bpc += count;
+		sum += count * (i - 1);
 	}
 	
 	mean = sum / bpc;
@@ -992,5 +1739,5 @@ void suppress_bright_feature(const unsigned char *rfbf_image, unsigned int width
 		sr = ssr;
 	}
 	
-	img_mul_s_kr(rfbf_image, width, height, sr, sbrf_image);
+	return sr;
 }
\ No newline at end of file
@@ -21,12 +21,88 @@ extern "C"
 {
 #endif
 
+#include <stdio.h>
+
+#include "fifo.h"
+#include "stats.h"
+
 /** @typedef struct Fusion
  ** @brief image fusion structure
  **/
 struct tagFusion;
 typedef struct tagFusion Fusion;
 
+/** @typedef enum FusionSync
+ ** @brief infrared and visual frame pairing policy
+ **/
+typedef enum
+{
+	SYNC_DROP_OLDEST = 0,		/**< pair nearest visual frame within tolerance,
+								     drop infrared frame if there is none. */
+	SYNC_HOLD_LAST_VISIBLE,		/**< pair latest visual frame not after infrared frame. */
+	SYNC_INTERPOLATE			/**< blend the two visual frames around infrared frame. */
+}FusionSync;
+
+/** @typedef enum FusionQueue
+ ** @brief output queue of fusion instance
+ **/
+typedef enum
+{
+	FUSION_QUEUE_FUSION = 0,	/**< fusion images, see fusion_get. */
+	FUSION_QUEUE_INFRARED,		/**< infrared images, see fusion_get_inf. */
+	FUSION_QUEUE_VISUAL,		/**< registered visual images, see fusion_get_vis. */
+	FUSION_QUEUE_FEATURE		/**< bright feature images, see fusion_get_ibf. */
+}FusionQueue;
+
+/** @typedef enum FusionStage
+ ** @brief timed processing stage of fusion instance
+ **/
+typedef enum
+{
+	FUSION_STAGE_RDC = 0,		/**< infrared gray scale compression. */
+	FUSION_STAGE_WARP,			/**< visual image registration. */
+	FUSION_STAGE_MINFILTER,		/**< background minimum filter. */
+	FUSION_STAGE_QTREE,			/**< background quadtree decompose. */
+	FUSION_STAGE_BEZIER,		/**< background Bezier interpolation. */
+	FUSION_STAGE_GAUSS,			/**< background gaussian filter. */
+	FUSION_STAGE_FUSION,		/**< bright feature extraction and fusion. */
+	FUSION_STAGE_LATENCY,		/**< infrared capture to fusion image output. */
+	FUSION_STAGES
+}FusionStage;
+
+/** @typedef enum FusionRing
+ ** @brief ring buffer of fusion instance
+ **/
+typedef enum
+{
+	FUSION_RING_RAWI = 0,		/**< raw infrared frames. */
+	FUSION_RING_RAWV,			/**< raw visual frames. */
+	FUSION_RING_GSCI,			/**< gray scale compressed infrared frames. */
+	FUSION_RING_REGT,			/**< registered visual frames. */
+	FUSION_RING_FUSN,			/**< fusion image output queue. */
+	FUSION_RING_IOUT,			/**< infrared image output queue. */
+	FUSION_RING_VOUT,			/**< visual image output queue. */
+	FUSION_RING_BRFT,			/**< bright feature output queue. */
+	FUSION_RINGS
+}FusionRing;
+
+/** @typedef struct FusionStats
+ ** @brief snapshot of fusion instance statistics since fusion_init
+ **/
+typedef struct
+{
+	StatSummary stage[FUSION_STAGES];				/**< processing time of each stage. */
+	unsigned int depth[FUSION_RINGS][STAT_DEPTHS];	/**< ring depth histogram, sampled
+													     once per fusion image. */
+	unsigned int inf_in;							/**< infrared frames put. */
+	unsigned int vis_in;							/**< visual frames put. */
+	unsigned int inf_drops;							/**< infrared frames rejected by put. */
+	unsigned int vis_drops;							/**< visual frames rejected by put. */
+	unsigned int unpaired;							/**< infrared frames without visual partner. */
+	unsigned int fusn_out;							/**< fusion images made. */
+	unsigned int out_drops[4];						/**< images dropped by each FusionQueue. */
+}FusionStats;
+
 /** @name Create, initialize, and destroy
  ** @{ */
 Fusion *fusion_new();
@@ -40,15 +116,30 @@ void fusion_delete(Fusion *self);
  ** @{ */
 int fusion_start(Fusion *self);
 void fusion_stop(Fusion *self);
+void fusion_set_sync(Fusion *self, FusionSync sync, int tolerance);
+int fusion_set_workers(Fusion *self, int nworkers);
+int fusion_set_decimation(Fusion *self, unsigned int decimation);
+int fusion_set_temporal(Fusion *self, unsigned int refresh, unsigned int threshold);
+int fusion_set_overflow(Fusion *self, FusionQueue queue, FifoOverflow overflow);
+unsigned int fusion_get_drops(Fusion *self, FusionQueue queue);
 int fusion_put(Fusion *self, unsigned char *base, unsigned char *unreg);
 int fusion_put_inf(Fusion *self, unsigned char *base);
 int fusion_put_vis(Fusion *self, unsigned char *unreg);
+int fusion_put_inf_ts(Fusion *self, unsigned char *base, long long timestamp);
+int fusion_put_vis_ts(Fusion *self, unsigned char *unreg, long long timestamp);
 int fusion_get(Fusion *self, unsigned char *fu);
 int fusion_get_inf(Fusion *self, unsigned char *inf);
 int fusion_get_vis(Fusion *self, unsigned char *vis);
 int fusion_get_ibf(Fusion *self, unsigned char *ibf);
 /** @} */
 
+/** @name Statistics
+ ** @{ */
+int fusion_get_stats(Fusion *self, FusionStats *stats);
+void fusion_dump_stats(Fusion *self, FILE *fp, int json);
+void fusion_set_stats_dump(Fusion *self, FILE *fp, int period, int json);
+/** @} */
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,452 @@
+/** @file fusion_replay.c
+ ** @brief Headless benchmark, replays recorded infrared and visual frame
+ **        sequences through Fusion
+ ** @author Zhiwei Zeng
+ ** @date 2018.06.11
+ **/
+
+/*
+Copyright (C) 2018 Zhiwei Zeng.
+Copyright (C) 2018 Chengdu ZLT Technology Co., Ltd.
+All rights reserved.
+
+This file is part of the railway monitor toolkit and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#	include <windows.h>
+#else
+#	include <time.h>
+#	include <sys/time.h>
+#	include <sys/resource.h>
+#endif
+
+#include "fusion.h"
+#include "timer.h"
+
+/* give up waiting for the pipeline after this many microseconds without
+   a new fusion image. */
+#define REPLAY_STALL_TIMEOUT 2000000
+
+/** @typedef struct ReplayParam
+ ** @brief command line options
+ **/
+typedef struct
+{
+	const char *inf_file;		/**< raw 16-bit infrared frames, back to back. */
+	const char *vis_file;		/**< YUV420 visual frames, back to back. */
+	const char *out_file;		/**< fusion images output, NULL if not written. */
+	int base_width;				/**< infrared frame width. */
+	int base_height;			/**< infrared frame height. */
+	int unreg_width;			/**< visual frame width. */
+	int unreg_height;			/**< visual frame height. */
+	int fps;					/**< replay rate, 0 for as fast as possible. */
+	int max_frames;				/**< replay at most this many frames, 0 for all. */
+	int inflight;				/**< frame pairs in pipeline at most when fps is 0. */
+	int workers;				/**< threads making a fusion image, 0 for default. */
+	int decimation;				/**< background is estimated this many times smaller. */
+	int refresh;				/**< background rebuild period in frames. */
+	int threshold;				/**< control point change a background blob is refitted past. */
+	int json;					/**< print statistics as JSON. */
+}ReplayParam;
+
+static void usage(const char *prog);
+static int parse_size(const char *arg, int *width, int *height);
+static int parse_args(int argc, char *argv[], ReplayParam *param);
+static double cpu_time_sec();
+static void sleep_us(long long us);
+static unsigned int pending_frames(Fusion *fusion);
+static int drain_output(Fusion *fusion, unsigned char *fusn_image,
+                        unsigned int fusn_size, FILE *out);
+
+int main(int argc, char *argv[])
+{
+	ReplayParam param;
+	Fusion *fusion = NULL;
+	FusionStats stats;
+	FILE *inf_fp = NULL;
+	FILE *vis_fp = NULL;
+	FILE *out_fp = NULL;
+	unsigned char *inf_image = NULL;
+	unsigned char *vis_image = NULL;
+	unsigned char *fusn_image = NULL;
+	unsigned int inf_size, vis_size, fusn_size;
+	unsigned int nframes = 0;
+	unsigned int nouts = 0;
+	long long start, due, last_out, elapsed;
+	double cpu_start, cpu;
+	int ret = -1;
+
+	if (parse_args(argc, argv, &param)) {
+		usage(argv[0]);
+		return -1;
+	}
+
+	inf_size = param.base_width * param.base_height * sizeof(unsigned short);
+	vis_size = param.unreg_width * param.unreg_height * 3 >> 1;
+	fusn_size = param.base_width * param.base_height * 3 >> 1;
+
+	inf_fp = fopen(param.inf_file, "rb");
+	if (!inf_fp) {
+		fprintf(stderr, "fopen %s fail[%s:%d].\n", param.inf_file, __FILE__, __LINE__);
+		goto clean;
+	}
+
+	vis_fp = fopen(param.vis_file, "rb");
+	if (!vis_fp) {
+		fprintf(stderr, "fopen %s fail[%s:%d].\n", param.vis_file, __FILE__, __LINE__);
+		goto clean;
+	}
+
+	if (param.out_file) {
+		out_fp = fopen(param.out_file, "wb");
+		if (!out_fp) {
+			fprintf(stderr, "fopen %s fail[%s:%d].\n", param.out_file, __FILE__, __LINE__);
+			goto clean;
+		}
+	}
+
+	inf_image = (unsigned char *)malloc(inf_size);
+	vis_image = (unsigned char *)malloc(vis_size);
+	fusn_image = (unsigned char *)malloc(fusn_size);
+	if (!inf_image || !vis_image || !fusn_image) {
+		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+		goto clean;
+	}
+
+	fusion = fusion_new();
+	if (!fusion) {
+		fprintf(stderr, "fusion_new fail[%s:%d].\n", __FILE__, __LINE__);
+		goto clean;
+	}
+
+	/* fusion_init deletes the instance if it fails. */
+	if (fusion_init(fusion, param.base_width, param.base_height, param.unreg_width,
+		param.unreg_height)) {
+		fprintf(stderr, "fusion_init fail[%s:%d].\n", __FILE__, __LINE__);
+		fusion = NULL;
+		goto clean;
+	}
+
+	if (param.workers && fusion_set_workers(fusion, param.workers)) {
+		fprintf(stderr, "fusion_set_workers fail[%s:%d].\n", __FILE__, __LINE__);
+		goto clean;
+	}
+
+	if (param.decimation > 1 && fusion_set_decimation(fusion, param.decimation)) {
+		fprintf(stderr, "fusion_set_decimation fail[%s:%d].\n", __FILE__, __LINE__);
+		goto clean;
+	}
+
+	if (fusion_set_temporal(fusion, param.refresh, param.threshold)) {
+		fprintf(stderr, "fusion_set_temporal fail[%s:%d].\n", __FILE__, __LINE__);
+		goto clean;
+	}
+
+	if (fusion_start(fusion)) {
+		fprintf(stderr, "fusion_start fail[%s:%d].\n", __FILE__, __LINE__);
+		goto clean;
+	}
+
+	cpu_start = cpu_time_sec();
+	start = timer_now_us();
+	last_out = start;
+
+	while (!param.max_frames || nframes < (unsigned int)param.max_frames) {
+		if (1 != fread(inf_image, inf_size, 1, inf_fp) ||
+			1 != fread(vis_image, vis_size, 1, vis_fp)) {
+			break;
+		}
+
+		if (param.fps) {
+			due = start + nframes * 1000000LL / param.fps;
+			while (timer_now_us() < due) {
+				nouts += drain_output(fusion, fusn_image, fusn_size, out_fp);
+				sleep_us(due - timer_now_us() < 1000 ? due - timer_now_us() : 1000);
+			}
+		} else {
+			/* as fast as possible, but never faster than the pipeline drains,
+			   or the input rings would reject frames. */
+			while (pending_frames(fusion) >= (unsigned int)param.inflight) {
+				if (drain_output(fusion, fusn_image, fusn_size, out_fp)) {
+					nouts++;
+					last_out = timer_now_us();
+					continue;
+				}
+				if (timer_now_us() - last_out > REPLAY_STALL_TIMEOUT) {
+					fprintf(stderr, "pipeline stalled at frame %u.\n", nframes);
+					break;
+				}
+				sleep_us(100);
+			}
+		}
+
+		fusion_put_inf(fusion, inf_image);
+		fusion_put_vis(fusion, vis_image);
+		nframes++;
+	}
+
+	/* wait for frames still in the pipeline. */
+	last_out = timer_now_us();
+	while (pending_frames(fusion) && timer_now_us() - last_out < REPLAY_STALL_TIMEOUT) {
+		if (drain_output(fusion, fusn_image, fusn_size, out_fp)) {
+			nouts++;
+			last_out = timer_now_us();
+			continue;
+		}
+		sleep_us(100);
+	}
+
+	while (drain_output(fusion, fusn_image, fusn_size, out_fp)) {
+		nouts++;
+	}
+
+	elapsed = timer_now_us() - start;
+	cpu = cpu_time_sec() - cpu_start;
+
+	fusion_get_stats(fusion, &stats);
+
+	if (param.json) {
+		printf("{\"frames\":%u,\"outputs\":%u,\"seconds\":%.3f,\"fps\":%.2f,"
+			"\"cpu\":%.1f,\"latency\":{\"mean\":%.1f,\"p50\":%.1f,\"p99\":%.1f,\"max\":%.1f}}\n",
+			nframes, nouts, elapsed * 1e-6, nouts * 1e6 / elapsed, cpu * 1e8 / elapsed,
+			stats.stage[FUSION_STAGE_LATENCY].mean, stats.stage[FUSION_STAGE_LATENCY].p50,
+			stats.stage[FUSION_STAGE_LATENCY].p99, stats.stage[FUSION_STAGE_LATENCY].max);
+	} else {
+		printf("frames %u, fusion images %u in %.3f s: %.2f fps, cpu %.1f%%\n",
+			nframes, nouts, elapsed * 1e-6, nouts * 1e6 / elapsed, cpu * 1e8 / elapsed);
+		printf("latency(us): mean %.1f, p50 %.1f, p99 %.1f, max %.1f\n",
+			stats.stage[FUSION_STAGE_LATENCY].mean, stats.stage[FUSION_STAGE_LATENCY].p50,
+			stats.stage[FUSION_STAGE_LATENCY].p99, stats.stage[FUSION_STAGE_LATENCY].max);
+	}
+
+	fusion_dump_stats(fusion, stdout, param.json);
+
+	ret = 0;
+
+	clean:
+	if (fusion) {
+		/* stage threads are detached, let them see the stop flag before the
+		   instance goes away. */
+		fusion_stop(fusion);
+		sleep_us(500000);
+		fusion_delete(fusion);
+	}
+
+	if (inf_fp) {
+		fclose(inf_fp);
+	}
+
+	if (vis_fp) {
+		fclose(vis_fp);
+	}
+
+	if (out_fp) {
+		fclose(out_fp);
+	}
+
+	free(inf_image);
+	free(vis_image);
+	free(fusn_image);
+
+	return ret;
+}
+
+/** @brief Print command line usage.
+ ** @param prog program name.
+ **/
+void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s -i infrared.raw -v visual.yuv [options]\n"
+		"  -i file   raw 16-bit infrared frames, back to back\n"
+		"  -v file   YUV420 visual frames, back to back\n"
+		"  -b WxH    infrared frame size, default 384x288\n"
+		"  -u WxH    visual frame size, default 1920x1080\n"
+		"  -r fps    replay rate, default 0 for as fast as possible\n"
+		"  -n count  replay at most count frames\n"
+		"  -q depth  frame pairs in pipeline at most when rate is 0, default 4\n"
+		"  -w count  threads making a fusion image, default one per processor\n"
+		"  -d factor estimate background at 1/factor size, 1, 2 or 4, default 1\n"
+		"  -t count  rebuild whole background every count frames and only\n"
+		"            changed blobs in between, default 1\n"
+		"  -e level  control point change a background blob is refitted past,\n"
+		"            default 2\n"
+		"  -o file   write YUV420 fusion images for golden image comparison\n"
+		"  -j        print statistics as JSON\n"
+		"control_points.txt and interp.bin, or interpY.txt and interpX.txt if\n"
+		"interp.bin is missing, are read from the working directory like the\n"
+		"live viewer does.\n", prog);
+}
+
+/** @brief Parse image size.
+ ** @param arg size string like 384x288.
+ ** @param width image width.
+ ** @param height image height.
+ ** @return  0 if success,
+ **         -1 if fail.
+ **/
+int parse_size(const char *arg, int *width, int *height)
+{
+	if (2 != sscanf(arg, "%dx%d", width, height) || *width <= 0 || *height <= 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/** @brief Parse command line options.
+ ** @param argc number of arguments.
+ ** @param argv arguments.
+ ** @param param options.
+ ** @return  0 if success,
+ **         -1 if fail.
+ **/
+int parse_args(int argc, char *argv[], ReplayParam *param)
+{
+	int i;
+
+	memset(param, 0, sizeof(ReplayParam));
+	param->base_width = 384;
+	param->base_height = 288;
+	param->unreg_width = 1920;
+	param->unreg_height = 1080;
+	param->inflight = 4;
+	param->decimation = 1;
+	param->refresh = 1;
+	param->threshold = 2;
+
+	for (i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-j")) {
+			param->json = 1;
+			continue;
+		}
+
+		if (i + 1 >= argc) {
+			return -1;
+		}
+
+		if (!strcmp(argv[i], "-i")) {
+			param->inf_file = argv[++i];
+		} else if (!strcmp(argv[i], "-v")) {
+			param->vis_file = argv[++i];
+		} else if (!strcmp(argv[i], "-o")) {
+			param->out_file = argv[++i];
+		} else if (!strcmp(argv[i], "-b")) {
+			if (parse_size(argv[++i], &param->base_width, &param->base_height)) {
+				return -1;
+			}
+		} else if (!strcmp(argv[i], "-u")) {
+			if (parse_size(argv[++i], &param->unreg_width, &param->unreg_height)) {
+				return -1;
+			}
+		} else if (!strcmp(argv[i], "-r")) {
+			param->fps = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-n")) {
+			param->max_frames = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-q")) {
+			param->inflight = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-w")) {
+			param->workers = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-d")) {
+			param->decimation = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-t")) {
+			param->refresh = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-e")) {
+			param->threshold = atoi(argv[++i]);
+		} else {
+			return -1;
+		}
+	}
+
+	if (!param->inf_file || !param->vis_file || param->fps < 0 || param->inflight <= 0 ||
+		param->workers < 0 || param->decimation <= 0 || param->refresh <= 0 ||
+		param->threshold < 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/** @brief Get processor time used by all threads of the process.
+ ** @return seconds.
+ **/
+double cpu_time_sec()
+{
+#ifdef _WIN32
+	FILETIME create, exit, kernel, user;
+	ULARGE_INTEGER k, u;
+	GetProcessTimes(GetCurrentProcess(), &create, &exit, &kernel, &user);
+	k.LowPart = kernel.dwLowDateTime;
+	k.HighPart = kernel.dwHighDateTime;
+	u.LowPart = user.dwLowDateTime;
+	u.HighPart = user.dwHighDateTime;
+	return (k.QuadPart + u.QuadPart) * 1e-7;
+#else
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+		(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+#endif
+}
+
+/** @brief Sleep.
+ ** @param us microseconds.
+ **/
+void sleep_us(long long us)
+{
+	if (us <= 0) {
+		return;
+	}
+#ifdef _WIN32
+	Sleep((DWORD)((us + 999) / 1000));
+#else
+	{
+		struct timespec ts;
+		ts.tv_sec = (time_t)(us / 1000000);
+		ts.tv_nsec = (long)(us % 1000000) * 1000;
+		nanosleep(&ts, NULL);
+	}
+#endif
+}
+
+/** @brief Get number of infrared frames put but neither fused nor dropped.
+ ** @param fusion fusion instance.
+ ** @return frames.
+ **/
+unsigned int pending_frames(Fusion *fusion)
+{
+	FusionStats stats;
+	unsigned int done;
+
+	fusion_get_stats(fusion, &stats);
+	done = stats.inf_drops + stats.unpaired + stats.fusn_out;
+
+	return stats.inf_in > done ? stats.inf_in - done : 0;
+}
+
+/** @brief Take one fusion image and write it to output file.
+ ** @param fusion fusion instance.
+ ** @param fusn_image fusion image buffer.
+ ** @param fusn_size fusion image byte size.
+ ** @param out output file, NULL if not written.
+ ** @return 1 if an image is taken,
+ **         0 if none.
+ **/
+int drain_output(Fusion *fusion, unsigned char *fusn_image,
+                 unsigned int fusn_size, FILE *out)
+{
+	if (!fusion_get(fusion, fusn_image)) {
+		return 0;
+	}
+
+	if (out) {
+		fwrite(fusn_image, fusn_size, 1, out);
+	}
+
+	return 1;
+}
\ No newline at end of file
@@ -1,5 +1,5 @@
 /** @file gaussfilter.c - Implementation
- ** @brief IIR Gaussian blur filter.
+ ** @brief Gaussian blur filter.
  ** @author Zhiwei Zeng
  ** @date 2018.05.01
  **/
@@ -18,13 +18,23 @@ the terms of the BSD license (see the COPYING file).
 #include <string.h>
 #include <assert.h>
 #include <math.h>
-#include <tmmintrin.h>
-#include <xmmintrin.h>
-#include <smmintrin.h>
-#include <immintrin.h>
 
 #include "gaussfilter.h"
 
+#ifdef CPU_X86
+#	include <immintrin.h>
+#endif
+
+/* FIR weights are Q14 and sum up to exactly 1 << FIR_WEIGHT_BITS. The
+   vertical pass keeps 8 fraction bits in 16-bit rows, so no 32-bit sum
+   can overflow for 8-bit input. */
+#define FIR_WEIGHT_BITS 14
+#define FIR_ROW_BITS 8
+
+/* IIR response past this many sigmas is taken as zero when only part of
+   the image is filtered, it is below 1e-3 of the peak there. */
+#define IIR_REACH_SIGMAS 6
+
 /** @typedef struct GFilterCoeff.
  ** @brief Gaussian filter coefficient.
  **/
@@ -40,102 +50,290 @@ typedef struct
 	float cn;
 }GFilterCoeff;
 
+/** @typedef struct GaussFilter
+ ** @brief gaussian filter structure definition
+ **/
+struct tagGaussFilter
+{
+	unsigned int width;				/**< image width. */
+	unsigned int height;			/**< image height. */
+	float sigma;					/**< standard deviation. */
+	GaussMode mode;					/**< FIR or IIR. */
+	unsigned int krad;				/**< FIR kernel radius. */
+	unsigned int reach;				/**< pixels an input pixel reaches. */
+	int weights[2 * GAUSS_FIR_MAX_RADIUS + 1];	/**< FIR weights. */
+	GFilterCoeff gfc;				/**< IIR coefficients. */
+	int *acc;						/**< FIR accumulator row. */
+	unsigned short *line;			/**< FIR vertically filtered row, padded by krad. */
+	float *hbuf;					/**< IIR horizontally filtered image. */
+	float *fbuf;					/**< IIR vertical forward pass image. */
+	float *rows;					/**< IIR rows of the recursions. */
+};
+
+/* row kernels, every loop along a row goes through one of them. */
+typedef void (*RowMacU8)(const unsigned char *src, int w, unsigned int n, int *acc);
+typedef void (*RowMacU16)(const unsigned short *src, int w, unsigned int n, int *acc);
+typedef void (*RowRecur)(const float *x0, const float *x1, const float *y1,
+                         const float *y2, const float *c, unsigned int n, float *y);
+typedef void (*RowSumU8)(const float *a, const float *b, unsigned int n,
+                         unsigned char *dst);
+
+/** @typedef struct RowKernels
+ ** @brief row kernels of one instruction set level
+ **/
+typedef struct
+{
+	RowMacU8 mac_u8;				/**< acc += w * src of 8-bit row. */
+	RowMacU16 mac_u16;				/**< acc += w * src of 16-bit row. */
+	RowRecur recur;					/**< one step of second order recursion. */
+	RowSumU8 sum_u8;				/**< rounded and saturated sum of two rows. */
+}RowKernels;
+
 /** @name some private functions.
  ** @{ */
+static void row_mac_u8_nsu(const unsigned char *src, int w, unsigned int n, int *acc);
+static void row_mac_u16_nsu(const unsigned short *src, int w, unsigned int n, int *acc);
+static void row_recur_nsu(const float *x0, const float *x1, const float *y1,
+                          const float *y2, const float *c, unsigned int n, float *y);
+static void row_sum_u8_nsu(const float *a, const float *b, unsigned int n,
+                           unsigned char *dst);
+#ifdef CPU_X86
+static void row_mac_u8_sse(const unsigned char *src, int w, unsigned int n, int *acc);
+static void row_mac_u16_sse(const unsigned short *src, int w, unsigned int n, int *acc);
+static void row_recur_sse(const float *x0, const float *x1, const float *y1,
+                          const float *y2, const float *c, unsigned int n, float *y);
+static void row_sum_u8_sse(const float *a, const float *b, unsigned int n,
+                           unsigned char *dst);
+static void row_mac_u8_avx2(const unsigned char *src, int w, unsigned int n, int *acc);
+static void row_mac_u16_avx2(const unsigned short *src, int w, unsigned int n, int *acc);
+static void row_recur_avx2(const float *x0, const float *x1, const float *y1,
+                           const float *y2, const float *c, unsigned int n, float *y);
+static void row_sum_u8_avx2(const float *a, const float *b, unsigned int n,
+                            unsigned char *dst);
+#endif
 static void cal_gauss_coeff(float sigma,
                             GFilterCoeff *gfc);
-static void gauss_filter_H_sse(unsigned char *line,
-                               unsigned int width,
-							   unsigned int height,
-							   GFilterCoeff *gfc,
-							   float *temp,
-							   float *fline);
-static void gauss_filter_V_sse(float *line,
-                               unsigned int width,
-							   unsigned int height,
-							   GFilterCoeff *gfc,
-							   float *temp,
-							   unsigned char *fline);
-static void gauss_filter_nsu(const unsigned char *image, unsigned int width,
-                             unsigned int height, unsigned int ksize, float sigma,
-							 unsigned char *gf_image);
+static void cal_fir_weights(float sigma, unsigned int krad, int *weights);
+static void fir_filter(GaussFilter *self, const unsigned char *image,
+                       unsigned int left, unsigned int top, unsigned int right,
+                       unsigned int bottom, unsigned char *gf_image);
+static void iir_filter(GaussFilter *self, const unsigned char *image,
+                       unsigned int left, unsigned int top, unsigned int right,
+                       unsigned int bottom, unsigned char *gf_image);
 /** @} */
 
-/** @brief IIR Gaussian filter.
- ** @param image single channel 8bit image.
+/* row kernels by CpuLevel, AVX-512 gains nothing on rows this short. */
+#ifdef CPU_X86
+static const RowKernels row_kernels[CPU_LEVELS] = {
+	{row_mac_u8_nsu, row_mac_u16_nsu, row_recur_nsu, row_sum_u8_nsu},
+	{row_mac_u8_sse, row_mac_u16_sse, row_recur_sse, row_sum_u8_sse},
+	{row_mac_u8_avx2, row_mac_u16_avx2, row_recur_avx2, row_sum_u8_avx2},
+	{row_mac_u8_avx2, row_mac_u16_avx2, row_recur_avx2, row_sum_u8_avx2}
+};
+#else
+static const RowKernels row_kernels[CPU_LEVELS] = {
+	{row_mac_u8_nsu, row_mac_u16_nsu, row_recur_nsu, row_sum_u8_nsu},
+	{row_mac_u8_nsu, row_mac_u16_nsu, row_recur_nsu, row_sum_u8_nsu},
+	{row_mac_u8_nsu, row_mac_u16_nsu, row_recur_nsu, row_sum_u8_nsu},
+	{row_mac_u8_nsu, row_mac_u16_nsu, row_recur_nsu, row_sum_u8_nsu}
+};
+#endif
+
+/** @brief Create a new instance of gaussian filter.
+ ** @return the instance.
+ **/
+GaussFilter *gauss_filter_new()
+{
+	GaussFilter *self = NULL;
+	self = (GaussFilter *)malloc(sizeof(GaussFilter));
+	if (!self) {
+		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+		return self;
+	}
+	
+	memset(self, 0, sizeof(GaussFilter));
+	
+	return self;
+}
+
+/** @brief Initialize gaussian filter instance. The coefficients and the
+ **        scratch buffers are made here once, filtering allocates nothing.
+ ** @param self gaussian filter instance.
  ** @param width image width.
  ** @param height image height.
  ** @param sigma standard deviation.
- ** @param gf_image gaussian filtered image.
- **/ 
-void gauss_filter(unsigned char *image,
-                  unsigned int width,
-				  unsigned int height,
-				  float sigma,
-				  unsigned char *gf_image)
+ ** @param mode GAUSS_MODE_AUTO picks FIR if sigma is not above
+ **        GAUSS_FIR_MAX_SIGMA, otherwise IIR.
+ ** @return  0 if success,
+ **         -1 if fail.
+ **/
+int gauss_filter_init(GaussFilter *self, unsigned int width, unsigned int height,
+                      float sigma, GaussMode mode)
 {
-#if 0
-	GFilterCoeff gfc;
-	unsigned int len = 0;
-	unsigned int i = 0;
-	float *ltr_buf = NULL;
-	float *imf_buf = NULL;
-	unsigned char *ptrr = NULL;
-	float *ptrc = NULL;
+	assert(self);
 	
-	assert(image);
-	assert(gf_image);
+	self->width = width;
+	self->height = height;
+	self->sigma = sigma;
 	
-	len = ((width > height) ? width : height);
-	len *= 4;
-
-	ltr_buf = (float *)malloc(len * sizeof(float));
-	if (!ltr_buf) {
-		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
-		return;
+	if (GAUSS_MODE_AUTO == mode) {
+		mode = sigma <= GAUSS_FIR_MAX_SIGMA ? GAUSS_MODE_FIR : GAUSS_MODE_IIR;
 	}
 	
-	imf_buf = (float *)malloc(width * height * sizeof(float));
-	if (!imf_buf) {
+	self->mode = mode;
+	
+	if (GAUSS_MODE_FIR == self->mode) {
+		self->krad = (unsigned int)ceilf(3 * sigma);
+		if (self->krad < 1) {
+			self->krad = 1;
+		} else if (self->krad > GAUSS_FIR_MAX_RADIUS) {
+			self->krad = GAUSS_FIR_MAX_RADIUS;
+		}
+		
+		cal_fir_weights(sigma, self->krad, self->weights);
+		self->reach = self->krad;
+		
+		self->acc = (int *)malloc(width * sizeof(int));
+		if (!self->acc) {
+			fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+			return -1;
+		}
+		
+		self->line = (unsigned short *)malloc((width + 2 * self->krad) * sizeof(unsigned short));
+		if (!self->line) {
+			fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+			return -1;
+		}
+		
+		return 0;
+	}
+	
+	cal_gauss_coeff(sigma, &self->gfc);
+	self->reach = (unsigned int)ceilf(IIR_REACH_SIGMAS * sigma);
+	
+	self->hbuf = (float *)malloc(width * height * sizeof(float));
+	if (!self->hbuf) {
 		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
-		return;
+		return -1;
 	}
 	
-	cal_gauss_coeff(sigma, &gfc);
+	self->fbuf = (float *)malloc(width * height * sizeof(float));
+	if (!self->fbuf) {
+		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+		return -1;
+	}
 	
-	ptrr = image;
-	ptrc = imf_buf;
+	self->rows = (float *)malloc(4 * width * sizeof(float));
+	if (!self->rows) {
+		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+		return -1;
+	}
 	
-	/* horizontal filter. */
-	for (i = 0; i < height; i += 4) {
-		gauss_filter_H_sse(ptrr, width, height, &gfc, ltr_buf, ptrc);
-		ptrr += (width << 2);
-		ptrc += 4;;
+	return 0;
+}
+
+/** @brief Destroy gaussian filter instance.
+ ** @param self gaussian filter instance.
+ **/
+void gauss_filter_delete(GaussFilter *self)
+{
+	if (self) {
+		if (self->acc) {
+			free(self->acc);
+			self->acc = NULL;
+		}
+		if (self->line) {
+			free(self->line);
+			self->line = NULL;
+		}
+		if (self->hbuf) {
+			free(self->hbuf);
+			self->hbuf = NULL;
+		}
+		if (self->fbuf) {
+			free(self->fbuf);
+			self->fbuf = NULL;
+		}
+		if (self->rows) {
+			free(self->rows);
+			self->rows = NULL;
+		}
+		free(self);
+		self = NULL;
 	}
+}
 
-	ptrc = imf_buf;
-	ptrr = gf_image;
+/** @brief Gaussian filter. Image border is extended by replicating the
+ **        border pixels.
+ ** @param self gaussian filter instance.
+ ** @param image single channel 8bit image.
+ ** @param gf_image gaussian filtered image, not the input image.
+ **/
+void gauss_filter(GaussFilter *self, const unsigned char *image,
+                  unsigned char *gf_image)
+{
+	assert(self);
+	assert(image);
+	assert(gf_image);
 	
-	/* vertical filter. */
-	for (i = 0; i < width; i += 4) {
-		gauss_filter_V_sse(ptrc, height, width, &gfc, ltr_buf, ptrr);
-		ptrc += (height << 2);
-		ptrr += 4;
+	if (GAUSS_MODE_FIR == self->mode) {
+		fir_filter(self, image, 0, 0, self->width, self->height, gf_image);
+	} else {
+		iir_filter(self, image, 0, 0, self->width, self->height, gf_image);
 	}
+}
+
+/** @brief Gaussian filter part of image. Only pixels inside the rectangle
+ **        are written, from input pixels up to gauss_filter_reach around
+ **        it. FIR results are the same as gauss_filter's, IIR results
+ **        miss the response tail past the reach.
+ ** @param self gaussian filter instance.
+ ** @param image single channel 8bit image.
+ ** @param left x position of left side.
+ ** @param top y position of top side.
+ ** @param right x position of right side, exclusive.
+ ** @param bottom y position of bottom side, exclusive.
+ ** @param gf_image gaussian filtered image, not the input image.
+ **/
+void gauss_filter_rect(GaussFilter *self, const unsigned char *image,
+                       unsigned int left, unsigned int top, unsigned int right,
+                       unsigned int bottom, unsigned char *gf_image)
+{
+	assert(self);
+	assert(image);
+	assert(gf_image);
+	assert(right <= self->width && bottom <= self->height);
 	
-	if (ltr_buf) {
-		free(ltr_buf);
-		ltr_buf = NULL;
+	if (left >= right || top >= bottom) {
+		return;
 	}
 	
-	if (imf_buf) {
-		free(imf_buf);
-		imf_buf = NULL;
+	if (GAUSS_MODE_FIR == self->mode) {
+		fir_filter(self, image, left, top, right, bottom, gf_image);
+	} else {
+		iir_filter(self, image, left, top, right, bottom, gf_image);
 	}
-#else
-	unsigned int ksize = 5;
-	gauss_filter_nsu(image, width, height, ksize, sigma, gf_image);
-#endif
+}
+
+/** @brief Get how far a pixel reaches, the kernel radius for FIR and
+ **        the distance the response is cut at for IIR.
+ ** @param self gaussian filter instance.
+ ** @return reach in pixels.
+ **/
+unsigned int gauss_filter_reach(GaussFilter *self)
+{
+	assert(self);
+	return self->reach;
+}
+
+/** @brief Get filter implementation the instance uses.
+ ** @param self gaussian filter instance.
+ ** @return GAUSS_MODE_FIR or GAUSS_MODE_IIR.
+ **/
+GaussMode gauss_filter_mode(GaussFilter *self)
+{
+	assert(self);
+	return self->mode;
 }
 
 /** @brief Calculate gaussian filter coefficient.
@@ -170,536 +368,517 @@ void cal_gauss_coeff(float sigma,
 	gfc->cn = (gfc->a2 + gfc->a3) / (1 + gfc->b1 + gfc->b2);
 }
 
-/** @brief Horizontal filter width SSE.
- ** @param line input image line. 
- ** @param width image width.
- ** @param height image height.
- ** @param gfc gaussian filter coeffes.
- ** @param ltr_buf left to right filter buffer.
- ** @param imf_buf intermediate filter buffer.
+/** @brief Calculate fixed-point FIR weights. The rounding error goes to
+ **        the center weight so that the weights sum up to exactly one.
+ ** @param sigma standard deviation of filter.
+ ** @param krad kernel radius.
+ ** @param weights 2 * krad + 1 weights.
  **/
-void gauss_filter_H_sse(unsigned char *line,
-                        unsigned int width,
-					    unsigned int height,
-						GFilterCoeff *gfc,
-						float *ltr_buf,
-						float *imf_buf)
+void cal_fir_weights(float sigma, unsigned int krad, int *weights)
 {
-	__m128 A0;
-	__m128 A1;
-	__m128 A2;
-	__m128 A3;
-	__m128 B1;
-	__m128 B2;
-	__m128 CP;
-	__m128 CN;
-	
-	__m128 X1;
-	__m128 X1_1;
-	__m128 X2;
-	__m128 X2_1;
-	__m128 X3;
-	__m128 X3_1;
-	__m128 X4;
-	__m128 X4_1;
-	__m128 XP;
-	__m128 X_1P;
-	__m128 XS;
-	
-	__m128 Y1;
-	__m128 Y1_1;
-	__m128 Y1_2;
-	__m128 Y2;
-	__m128 Y2_1;
-	__m128 Y2_2;
-	__m128 Y3;
-	__m128 Y3_1;
-	__m128 Y3_2;
-	__m128 Y4;
-	__m128 Y4_1;
-	__m128 Y4_2;
-	__m128 Y_1P;
-	__m128 Y_2P;
-	__m128 YS;
-	
-	__m128 T1;
-	__m128 T2;
-	__m128 T3;
-	__m128 T4;
-	
-	unsigned int i = 0;
-	unsigned char *ptrl = line;
-	float *ptrt = ltr_buf;
-	float *ptrf = imf_buf;
-	
-	A0 = _mm_load_ss(&gfc->a0);
-	A0 = _mm_shuffle_ps(A0, A0, 0x00);
-	A1 = _mm_load_ss(&gfc->a1);
-	A1 = _mm_shuffle_ps(A1, A1, 0x00);
-	A2 = _mm_load_ss(&gfc->a2);
-	A2 = _mm_shuffle_ps(A2, A2, 0x00);
-	A3 = _mm_load_ss(&gfc->a3);
-	A3 = _mm_shuffle_ps(A3, A3, 0x00);
-	B1 = _mm_load_ss(&gfc->b1);
-	B1 = _mm_shuffle_ps(B1, B1, 0x00);
-	B2 = _mm_load_ss(&gfc->b2);
-	B2 = _mm_shuffle_ps(B2, B2, 0x00);
-	CP = _mm_load_ss(&gfc->cp);
-	CP = _mm_shuffle_ps(CP, CP, 0x00);
-	CN = _mm_load_ss(&gfc->cn);
-	CN = _mm_shuffle_ps(CN, CN, 0x00);
-	
-	X1_1 = _mm_cvtpu8_ps(\
-	   _mm_movepi64_pi64(\
-	     _mm_loadu_si128((__m128i *)ptrl)));
-		 
-	X2_1 = _mm_cvtpu8_ps(\
-	   _mm_movepi64_pi64(\
-	     _mm_loadu_si128((__m128i *)(ptrl + width))));
-		 
-	X3_1 = _mm_cvtpu8_ps(\
-	   _mm_movepi64_pi64(\
-	     _mm_loadu_si128((__m128i *)(ptrl + 2 * width))));
-		 
-	X4_1 = _mm_cvtpu8_ps(\
-	   _mm_movepi64_pi64(\
-	     _mm_loadu_si128((__m128i *)(ptrl + 3 * width))));
-	 	 
-	_MM_TRANSPOSE4_PS(X1_1, X2_1, X3_1, X4_1);	 
-		 	 
-	Y1_2 = _mm_mul_ps(X1_1, CP);
-	Y1_1 = Y1_2;
-		
-	for (i = 0; i < width; i += 4) {
-		X1 = _mm_cvtpu8_ps(\
-	     _mm_movepi64_pi64(\
-	       _mm_loadu_si128((__m128i *)ptrl)));
-
-		X2 = _mm_cvtpu8_ps(\
-	     _mm_movepi64_pi64(\
-	       _mm_loadu_si128((__m128i *)(ptrl + width))));  
-
-		X3 = _mm_cvtpu8_ps(\
-	     _mm_movepi64_pi64(\
-	       _mm_loadu_si128((__m128i *)(ptrl + 2 * width)))); 
-
-		X4 = _mm_cvtpu8_ps(\
-	     _mm_movepi64_pi64(\
-	       _mm_loadu_si128((__m128i *)(ptrl + 3 * width))));
-		   
-		_MM_TRANSPOSE4_PS(X1, X2, X3, X4);
-		   
-		XP = _mm_mul_ps(X1, A0);
-		X_1P = _mm_mul_ps(X1_1, A1);
-		XS = _mm_add_ps(XP, X_1P);
-		Y_1P = _mm_mul_ps(Y1_1, B1);
-		Y_2P = _mm_mul_ps(Y1_2, B2);
-		YS = _mm_add_ps(Y_1P, Y_2P);
-		Y1 = _mm_sub_ps(XS, YS);
-		
-		X2_1 = X1;
-		Y2_2 = Y1_1;
-		Y2_1 = Y1;
-		 
-		XP = _mm_mul_ps(X2, A0);
-		X_1P = _mm_mul_ps(X2_1, A1);
-		XS = _mm_add_ps(XP, X_1P);
-		Y_1P = _mm_mul_ps(Y2_1, B1);
-		Y_2P = _mm_mul_ps(Y2_2, B2);
-		YS = _mm_add_ps(Y_1P, Y_2P);
-		Y2 = _mm_sub_ps(XS, YS);
-		
-		X3_1 = X2;
-		Y3_2 = Y2_1;
-		Y3_1 = Y2;
+	float kernel[2 * GAUSS_FIR_MAX_RADIUS + 1];
+	float d;
+	float sum = 0;
+	int total = 0;
+	unsigned int i;
+	
+	for (i = 0; i <= 2 * krad; i++) {
+		d = (float)i - krad;
+		kernel[i] = expf(-d * d / 2 / sigma / sigma);
+		sum += kernel[i];
+	}
+	
+	for (i = 0; i <= 2 * krad; i++) {
+		weights[i] = (int)(kernel[i] / sum * (1 << FIR_WEIGHT_BITS) + 0.5f);
+		total += weights[i];
+	}
+	
+	weights[krad] += (1 << FIR_WEIGHT_BITS) - total;
+}
+
+/** @brief Separable fixed-point FIR filter, one row at a time.
+ ** @param self gaussian filter instance.
+ ** @param image single channel 8bit image.
+ ** @param left x position of left side of output.
+ ** @param top y position of top side of output.
+ ** @param right x position of right side of output.
+ ** @param bottom y position of bottom side of output.
+ ** @param gf_image gaussian filtered image.
+ **/
+void fir_filter(GaussFilter *self, const unsigned char *image,
+                unsigned int left, unsigned int top, unsigned int right,
+                unsigned int bottom, unsigned char *gf_image)
+{
+	const RowKernels *rk = &row_kernels[cpu_level()];
+	const int *weights = self->weights;
+	unsigned short *line = self->line;
+	unsigned char *dst;
+	int *acc = self->acc;
+	unsigned int width = self->width;
+	unsigned int height = self->height;
+	unsigned int krad = self->krad;
+	unsigned int cx0, cx1, cw;
+	unsigned int ow = right - left;
+	unsigned int offset;
+	unsigned int x, y, k;
+	int row;
+	
+	/* input columns, line[k] is column left - krad + k. */
+	cx0 = left > krad ? left - krad : 0;
+	cx1 = right + krad < width ? right + krad : width;
+	cw = cx1 - cx0;
+	offset = cx0 + krad - left;
+	
+	for (y = top; y < bottom; y++) {
+		/* vertical taps, rows out of image are the border rows. */
+		memset(acc, 0, cw * sizeof(int));
+		for (k = 0; k <= 2 * krad; k++) {
+			row = (int)y + (int)k - (int)krad;
+			row = row < 0 ? 0 : (row >= (int)height ? (int)height - 1 : row);
+			rk->mac_u8(image + row * width + cx0, weights[k], cw, acc);
+		}
 		
-		XP = _mm_mul_ps(X3, A0);
-		X_1P = _mm_mul_ps(X3_1, A1);
-		XS = _mm_add_ps(XP, X_1P);
-		Y_1P = _mm_mul_ps(Y3_1, B1);
-		Y_2P = _mm_mul_ps(Y3_2, B2);
-		YS = _mm_add_ps(Y_1P, Y_2P);
-		Y3 = _mm_sub_ps(XS, YS);
+		for (x = 0; x < cw; x++) {
+			line[offset + x] = (unsigned short)((acc[x] +
+				(1 << (FIR_WEIGHT_BITS - FIR_ROW_BITS - 1))) >> (FIR_WEIGHT_BITS - FIR_ROW_BITS));
+		}
 		
-		X4_1 = X3;
-		Y4_2 = Y3_1;
-		Y4_1 = Y3;
+		for (x = 0; x < offset; x++) {
+			line[x] = line[offset];
+		}
 		
-		XP = _mm_mul_ps(X4, A0);
-		X_1P = _mm_mul_ps(X4_1, A1);
-		XS = _mm_add_ps(XP, X_1P);
-		Y_1P = _mm_mul_ps(Y4_1, B1);
-		Y_2P = _mm_mul_ps(Y4_2, B2);
-		YS = _mm_add_ps(Y_1P, Y_2P);
-		Y4 = _mm_sub_ps(XS, YS);
+		for (x = offset + cw; x < ow + 2 * krad; x++) {
+			line[x] = line[offset + cw - 1];
+		}
 		
-		X1_1 = X4;
-		Y1_2 = Y4_1;
-		Y1_1 = Y4;
+		/* horizontal taps along the padded row. */
+		memset(acc, 0, ow * sizeof(int));
+		for (k = 0; k <= 2 * krad; k++) {
+			rk->mac_u16(line + k, weights[k], ow, acc);
+		}
 		
-		_mm_storeu_ps((float *)(ptrt), Y1);
-		_mm_storeu_ps((float *)(ptrt + 4), Y2);
-		_mm_storeu_ps((float *)(ptrt + 8), Y3);
-		_mm_storeu_ps((float *)(ptrt + 12), Y4);
+		dst = gf_image + y * width + left;
+		for (x = 0; x < ow; x++) {
+			dst[x] = (unsigned char)((acc[x] + (1 << (FIR_WEIGHT_BITS + FIR_ROW_BITS - 1))) >>
+				(FIR_WEIGHT_BITS + FIR_ROW_BITS));
+		}
+	}
+}
+
+/** @brief Recursive Deriche filter. Rows are filtered one after another,
+ **        columns are filtered a whole row at a time so that the column
+ **        recursions run along rows in vectors. The output rectangle is
+ **        filtered with the input around it up to the reach, pixels
+ **        beyond are taken as the border pixels of that crop.
+ ** @param self gaussian filter instance.
+ ** @param image single channel 8bit image.
+ ** @param left x position of left side of output.
+ ** @param top y position of top side of output.
+ ** @param right x position of right side of output.
+ ** @param bottom y position of bottom side of output.
+ ** @param gf_image gaussian filtered image.
+ **/
+void iir_filter(GaussFilter *self, const unsigned char *image,
+                unsigned int left, unsigned int top, unsigned int right,
+                unsigned int bottom, unsigned char *gf_image)
+{
+	const RowKernels *rk = &row_kernels[cpu_level()];
+	const GFilterCoeff *gfc = &self->gfc;
+	const unsigned char *src;
+	const float *xp;
+	const float *xn;
+	const float *xa;
+	const float *y1;
+	const float *y2;
+	float *fwd;
+	float *yc;
+	float *dst;
+	float *tmp;
+	float causal[4];
+	float anticausal[4];
+	unsigned int width = self->width;
+	unsigned int reach = self->reach;
+	unsigned int cx0, cy0, cx1, cy1;
+	unsigned int cw, ch;
+	unsigned int ox, ow;
+	unsigned int x, y;
+	float xprev, xnext, xafter;
+	float p1, p2, val;
+	
+	cx0 = left > reach ? left - reach : 0;
+	cy0 = top > reach ? top - reach : 0;
+	cx1 = right + reach < width ? right + reach : width;
+	cy1 = bottom + reach < self->height ? bottom + reach : self->height;
+	cw = cx1 - cx0;
+	ch = cy1 - cy0;
+	ox = left - cx0;
+	ow = right - left;
+	
+	causal[0] = gfc->a0;
+	causal[1] = gfc->a1;
+	causal[2] = gfc->b1;
+	causal[3] = gfc->b2;
+	anticausal[0] = gfc->a2;
+	anticausal[1] = gfc->a3;
+	anticausal[2] = gfc->b1;
+	anticausal[3] = gfc->b2;
+	
+	/* horizontal, causal pass into a row then anti-causal pass added up.
+	   Out of image pixels are the border pixels, so the recursions start
+	   from their steady state. */
+	fwd = self->rows;
+	for (y = 0; y < ch; y++) {
+		src = image + (cy0 + y) * width + cx0;
+		dst = self->hbuf + y * cw;
+		
+		xprev = src[0];
+		p1 = p2 = gfc->cp * src[0];
+		for (x = 0; x < cw; x++) {
+			val = gfc->a0 * src[x] + gfc->a1 * xprev - gfc->b1 * p1 - gfc->b2 * p2;
+			fwd[x] = val;
+			xprev = src[x];
+			p2 = p1;
+			p1 = val;
+		}
 		
-		ptrl += 4;
-		ptrt += 16;
+		xnext = xafter = src[cw - 1];
+		p1 = p2 = gfc->cn * src[cw - 1];
+		for (x = cw; x > 0; x--) {
+			val = gfc->a2 * xnext + gfc->a3 * xafter - gfc->b1 * p1 - gfc->b2 * p2;
+			dst[x - 1] = fwd[x - 1] + val;
+			xafter = xnext;
+			xnext = src[x - 1];
+			p2 = p1;
+			p1 = val;
+		}
 	}
 	
-	ptrl -= 4;
-	ptrt -= 16;
-	ptrf += height * (width - 4);
+	/* vertical causal pass. */
+	tmp = self->rows;
+	for (x = 0; x < cw; x++) {
+		tmp[x] = gfc->cp * self->hbuf[x];
+	}
+	
+	xp = self->hbuf;
+	y1 = y2 = tmp;
+	for (y = 0; y < ch; y++) {
+		xn = self->hbuf + y * cw;
+		fwd = self->fbuf + y * cw;
+		rk->recur(xn, xp, y1, y2, causal, cw, fwd);
+		xp = xn;
+		y2 = y1;
+		y1 = fwd;
+	}
 	
-	X4_1 = X1_1;	
-	Y4_2 = _mm_mul_ps(X4_1, CN);
-	Y4_1 = Y4_2;
+	/* vertical anti-causal pass added to the causal one. Three rows take
+	   turns being the current and the two previous outputs. */
+	tmp = self->rows;
+	for (x = 0; x < cw; x++) {
+		tmp[x] = gfc->cn * self->hbuf[(ch - 1) * cw + x];
+	}
 	
-	for (i = 0; i < width; i += 4) {
-		X1 = _mm_cvtpu8_ps(\
-	     _mm_movepi64_pi64(\
-	       _mm_loadu_si128((__m128i *)(ptrl))));
+	xn = xa = self->hbuf + (ch - 1) * cw;
+	y1 = y2 = tmp;
+	for (y = ch; y > 0; y--) {
+		yc = self->rows + (1 + y % 3) * cw;
+		rk->recur(xn, xa, y1, y2, anticausal, cw, yc);
+		if (cy0 + y - 1 >= top && cy0 + y - 1 < bottom) {
+			rk->sum_u8(self->fbuf + (y - 1) * cw + ox, yc + ox, ow,
+				gf_image + (cy0 + y - 1) * width + left);
+		}
+		xa = xn;
+		xn = self->hbuf + (y - 1) * cw;
+		y2 = y1;
+		y1 = yc;
+	}
+}
 
-		X2 = _mm_cvtpu8_ps(\
-	     _mm_movepi64_pi64(\
-	       _mm_loadu_si128((__m128i *)(ptrl + width)))); 
+/** @brief Multiply 8-bit row by a weight and accumulate, no speed up.
+ ** @param src source row.
+ ** @param w weight.
+ ** @param n row length.
+ ** @param acc accumulator row.
+ **/
+void row_mac_u8_nsu(const unsigned char *src, int w, unsigned int n, int *acc)
+{
+	unsigned int i;
+	
+	for (i = 0; i < n; i++) {
+		acc[i] += w * src[i];
+	}
+}
 
-		X3 = _mm_cvtpu8_ps(\
-	     _mm_movepi64_pi64(\
-	       _mm_loadu_si128((__m128i *)(ptrl + 2 * width)))); 
+/** @brief Multiply 16-bit row by a weight and accumulate, no speed up.
+ ** @param src source row.
+ ** @param w weight.
+ ** @param n row length.
+ ** @param acc accumulator row.
+ **/
+void row_mac_u16_nsu(const unsigned short *src, int w, unsigned int n, int *acc)
+{
+	unsigned int i;
+	
+	for (i = 0; i < n; i++) {
+		acc[i] += w * src[i];
+	}
+}
 
-		X4 = _mm_cvtpu8_ps(\
-	     _mm_movepi64_pi64(\
-	       _mm_loadu_si128((__m128i *)(ptrl + 3 * width))));
-		   
-		_MM_TRANSPOSE4_PS(X1, X2, X3, X4);
-		
-		T1 = _mm_loadu_ps(ptrt);
-		T2 = _mm_loadu_ps(ptrt + 4);
-		T3 = _mm_loadu_ps(ptrt + 8);
-		T4 = _mm_loadu_ps(ptrt + 12);
-		
-		XP = _mm_mul_ps(X4, A2);
-		X_1P = _mm_mul_ps(X4_1, A3);
-		XS = _mm_add_ps(XP, X_1P);
-		Y_1P = _mm_mul_ps(Y4_1, B1);
-		Y_2P = _mm_mul_ps(Y4_2, B2);
-		YS = _mm_add_ps(Y_1P, Y_2P);
-		Y4 = _mm_sub_ps(XS, YS); 
-		
-		X3_1 = X4;
-		Y3_2 = Y4_1;
-		Y3_1 = Y4; 
-		 
-		XP = _mm_mul_ps(X3, A2);
-		X_1P = _mm_mul_ps(X3_1, A3);
-		XS = _mm_add_ps(XP, X_1P);
-		Y_1P = _mm_mul_ps(Y3_1, B1);
-		Y_2P = _mm_mul_ps(Y3_2, B2);
-		YS = _mm_add_ps(Y_1P, Y_2P);
-		Y3 = _mm_sub_ps(XS, YS); 
-		
-		X2_1 = X3;
-		Y2_2 = Y3_1;
-		Y2_1 = Y3; 
-		 
-		XP = _mm_mul_ps(X2, A2);
-		X_1P = _mm_mul_ps(X2_1, A3);
-		XS = _mm_add_ps(XP, X_1P);
-		Y_1P = _mm_mul_ps(Y2_1, B1);
-		Y_2P = _mm_mul_ps(Y2_2, B2);
-		YS = _mm_add_ps(Y_1P, Y_2P);
-		Y2 = _mm_sub_ps(XS, YS); 
-		 
-		X1_1 = X2;
-		Y1_2 = Y2_1;
-		Y1_1 = Y2; 
-		  
-		XP = _mm_mul_ps(X1, A2);
-		X_1P = _mm_mul_ps(X1_1, A3);
-		XS = _mm_add_ps(XP, X_1P);
-		Y_1P = _mm_mul_ps(Y1_1, B1);
-		Y_2P = _mm_mul_ps(Y1_2, B2);
-		YS = _mm_add_ps(Y_1P, Y_2P);
-		Y1 = _mm_sub_ps(XS, YS);
-
-		X4_1 = X1;
-		Y4_2 = Y1_1;
-		Y4_1 = Y1;
-		
-		Y4 = _mm_add_ps(Y4, T4);
-		Y3 = _mm_add_ps(Y3, T3);
-		Y2 = _mm_add_ps(Y2, T2);
-		Y1 = _mm_add_ps(Y1, T1);
-		
-		_mm_storeu_ps(ptrf, Y1);
-		_mm_storeu_ps(ptrf + height, Y2);
-		_mm_storeu_ps(ptrf + 2 * height, Y3);
-		_mm_storeu_ps(ptrf + 3 * height, Y4);
-		
-		ptrl -= 4;
-		ptrt -= 16;
-		ptrf -= 4 * height;
+/** @brief One step of second order recursion along a row, no speed up.
+ **        y = c[0] * x0 + c[1] * x1 - c[2] * y1 - c[3] * y2.
+ ** @param x0 current input row.
+ ** @param x1 previous input row.
+ ** @param y1 previous output row.
+ ** @param y2 output row before y1.
+ ** @param c coefficients.
+ ** @param n row length.
+ ** @param y output row.
+ **/
+void row_recur_nsu(const float *x0, const float *x1, const float *y1,
+                   const float *y2, const float *c, unsigned int n, float *y)
+{
+	unsigned int i;
+	
+	for (i = 0; i < n; i++) {
+		y[i] = c[0] * x0[i] + c[1] * x1[i] - c[2] * y1[i] - c[3] * y2[i];
 	}
 }
 
-/** @brief Vertical filter width SSE.
- ** @param line intermediate image line.
- ** @param width image width.
- ** @param height image height.
- ** @param gfc gaussian filter coeffes.
- ** @param ltr_buf left to right filter buffer.
- ** @param gf_image gaussian filter image.
+/** @brief Sum two rows, round and saturate to 8 bits, no speed up.
+ ** @param a one row.
+ ** @param b another row.
+ ** @param n row length.
+ ** @param dst output row.
+ **/
+void row_sum_u8_nsu(const float *a, const float *b, unsigned int n,
+                    unsigned char *dst)
+{
+	unsigned int i;
+	float val;
+	
+	for (i = 0; i < n; i++) {
+		val = a[i] + b[i] + 0.5f;
+		val = val < 0 ? 0 : (val > 255 ? 255 : val);
+		dst[i] = (unsigned char)val;
+	}
+}
+
+#ifdef CPU_X86
+/** @brief Multiply 8-bit row by a weight and accumulate with SSE.
+ ** @param src source row.
+ ** @param w weight.
+ ** @param n row length.
+ ** @param acc accumulator row.
+ **/
+CPU_TARGET_SSE41
+void row_mac_u8_sse(const unsigned char *src, int w, unsigned int n, int *acc)
+{
+	unsigned int i;
+	const unsigned int ppl = 4;
+	__m128i W = _mm_set1_epi32(w);
+	__m128i X;
+	
+	for (i = 0; i + ppl <= n; i += ppl) {
+		X = _mm_cvtepu8_epi32(_mm_cvtsi32_si128(*(const int *)(src + i)));
+		X = _mm_add_epi32(_mm_loadu_si128((__m128i *)(acc + i)), _mm_mullo_epi32(X, W));
+		_mm_storeu_si128((__m128i *)(acc + i), X);
+	}
+	
+	row_mac_u8_nsu(src + i, w, n - i, acc + i);
+}
+
+/** @brief Multiply 16-bit row by a weight and accumulate with SSE.
+ ** @param src source row.
+ ** @param w weight.
+ ** @param n row length.
+ ** @param acc accumulator row.
+ **/
+CPU_TARGET_SSE41
+void row_mac_u16_sse(const unsigned short *src, int w, unsigned int n, int *acc)
+{
+	unsigned int i;
+	const unsigned int ppl = 4;
+	__m128i W = _mm_set1_epi32(w);
+	__m128i X;
+	
+	for (i = 0; i + ppl <= n; i += ppl) {
+		X = _mm_cvtepu16_epi32(_mm_loadl_epi64((__m128i *)(src + i)));
+		X = _mm_add_epi32(_mm_loadu_si128((__m128i *)(acc + i)), _mm_mullo_epi32(X, W));
+		_mm_storeu_si128((__m128i *)(acc + i), X);
+	}
+	
+	row_mac_u16_nsu(src + i, w, n - i, acc + i);
+}
+
+/** @brief One step of second order recursion along a row with SSE.
+ ** @param x0 current input row.
+ ** @param x1 previous input row.
+ ** @param y1 previous output row.
+ ** @param y2 output row before y1.
+ ** @param c coefficients.
+ ** @param n row length.
+ ** @param y output row.
  **/
-void gauss_filter_V_sse(float *line,
-                        unsigned int width,
-						unsigned int height,
-						GFilterCoeff *gfc,
-						float *ltr_buf,
-						unsigned char *gf_image)
+CPU_TARGET_SSE41
+void row_recur_sse(const float *x0, const float *x1, const float *y1,
+                   const float *y2, const float *c, unsigned int n, float *y)
 {
-	__m128 A0;
-	__m128 A1;
-	__m128 A2;
-	__m128 A3;
-	__m128 B1;
-	__m128 B2;
-	__m128 CP;
-	__m128 CN;
-	
-	__m128 X1;
-	__m128 X1_1;
-	__m128 X2;
-	__m128 X2_1;
-	__m128 X3;
-	__m128 X3_1;
-	__m128 X4;
-	__m128 X4_1;
-	__m128 XP;
-	__m128 X_1P;
-	__m128 XS;
-	
-	__m128 Y1;
-	__m128 Y1_1;
-	__m128 Y1_2;
-	__m128 Y2;
-	__m128 Y2_1;
-	__m128 Y2_2;
-	__m128 Y3;
-	__m128 Y3_1;
-	__m128 Y3_2;
-	__m128 Y4;
-	__m128 Y4_1;
-	__m128 Y4_2;
-	__m128 Y_1P;
-	__m128 Y_2P;
-	__m128 YS;
-	__m128 T1;
-	__m128 T2;
-	__m128 T3;
-	__m128 T4;
+	unsigned int i;
+	const unsigned int ppl = 4;
+	__m128 C0 = _mm_set1_ps(c[0]);
+	__m128 C1 = _mm_set1_ps(c[1]);
+	__m128 C2 = _mm_set1_ps(c[2]);
+	__m128 C3 = _mm_set1_ps(c[3]);
+	__m128 Y;
+	
+	/* same operation order as the scalar kernel, results are identical. */
+	for (i = 0; i + ppl <= n; i += ppl) {
+		Y = _mm_add_ps(_mm_mul_ps(C0, _mm_loadu_ps(x0 + i)), _mm_mul_ps(C1, _mm_loadu_ps(x1 + i)));
+		Y = _mm_sub_ps(Y, _mm_mul_ps(C2, _mm_loadu_ps(y1 + i)));
+		Y = _mm_sub_ps(Y, _mm_mul_ps(C3, _mm_loadu_ps(y2 + i)));
+		_mm_storeu_ps(y + i, Y);
+	}
+	
+	row_recur_nsu(x0 + i, x1 + i, y1 + i, y2 + i, c, n - i, y + i);
+}
+
+/** @brief Sum two rows, round and saturate to 8 bits with SSE.
+ ** @param a one row.
+ ** @param b another row.
+ ** @param n row length.
+ ** @param dst output row.
+ **/
+CPU_TARGET_SSE41
+void row_sum_u8_sse(const float *a, const float *b, unsigned int n,
+                    unsigned char *dst)
+{
+	unsigned int i;
+	const unsigned int ppl = 4;
+	__m128 H = _mm_set1_ps(0.5f);
 	__m128i Z;
 	
-	unsigned int i = 0;
-	float *ptrl = line;
-	float *ptrt = ltr_buf;
-	unsigned char *ptrf = gf_image;
-	
-	A0 = _mm_load_ss(&gfc->a0);
-	A0 = _mm_shuffle_ps(A0, A0, 0x00);
-	A1 = _mm_load_ss(&gfc->a1);
-	A1 = _mm_shuffle_ps(A1, A1, 0x00);
-	A2 = _mm_load_ss(&gfc->a2);
-	A2 = _mm_shuffle_ps(A2, A2, 0x00);
-	A3 = _mm_load_ss(&gfc->a3);
-	A3 = _mm_shuffle_ps(A3, A3, 0x00);
-	B1 = _mm_load_ss(&gfc->b1);
-	B1 = _mm_shuffle_ps(B1, B1, 0x00);
-	B2 = _mm_load_ss(&gfc->b2);
-	B2 = _mm_shuffle_ps(B2, B2, 0x00);
-	CP = _mm_load_ss(&gfc->cp);
-	CP = _mm_shuffle_ps(CP, CP, 0x00);
-	CN = _mm_load_ss(&gfc->cn);
-	CN = _mm_shuffle_ps(CN, CN, 0x00);
-	
-	X1_1 = _mm_loadu_ps(ptrl);
-	X2_1 = _mm_loadu_ps(ptrl + width);
-	X3_1 = _mm_loadu_ps(ptrl + 2 * width);
-	X4_1 = _mm_loadu_ps(ptrl + 3 * width);
-	
-	_MM_TRANSPOSE4_PS(X1_1, X2_1, X3_1, X4_1);	
-	
-	Y1_2 = _mm_mul_ps(X1_1, CP);
-	Y1_1 = Y1_2;
-	
-	for (i = 0; i < width; i += 4) {
-		X1 = _mm_loadu_ps(ptrl);   
-		X2 = _mm_loadu_ps(ptrl + width);  
-		X3 = _mm_loadu_ps(ptrl + 2 * width);  
-		X4 = _mm_loadu_ps(ptrl + 3 * width);
-		
-		_MM_TRANSPOSE4_PS(X1, X2, X3, X4);	
-		
-		XP = _mm_mul_ps(X1, A0);
-		X_1P = _mm_mul_ps(X1_1, A1);
-		XS = _mm_add_ps(XP, X_1P);
-		Y_1P = _mm_mul_ps(Y1_1, B1);
-		Y_2P = _mm_mul_ps(Y1_2, B2);
-		YS = _mm_add_ps(Y_1P, Y_2P);
-		Y1 = _mm_sub_ps(XS, YS);
-		
-		X2_1 = X1;
-		Y2_2 = Y1_1;
-		Y2_1 = Y1;
-		 
-		XP = _mm_mul_ps(X2, A0);
-		X_1P = _mm_mul_ps(X2_1, A1);
-		XS = _mm_add_ps(XP, X_1P);
-		Y_1P = _mm_mul_ps(Y2_1, B1);
-		Y_2P = _mm_mul_ps(Y2_2, B2);
-		YS = _mm_add_ps(Y_1P, Y_2P);
-		Y2 = _mm_sub_ps(XS, YS);
-		
-		X3_1 = X2;
-		Y3_2 = Y2_1;
-		Y3_1 = Y2;
-		 
-		XP = _mm_mul_ps(X3, A0);
-		X_1P = _mm_mul_ps(X3_1, A1);
-		XS = _mm_add_ps(XP, X_1P);
-		Y_1P = _mm_mul_ps(Y3_1, B1);
-		Y_2P = _mm_mul_ps(Y3_2, B2);
-		YS = _mm_add_ps(Y_1P, Y_2P);
-		Y3 = _mm_sub_ps(XS, YS);
-		
-		X4_1 = X3;
-		Y4_2 = Y3_1;
-		Y4_1 = Y3;
-		
-		XP = _mm_mul_ps(X4, A0);
-		X_1P = _mm_mul_ps(X4_1, A1);
-		XS = _mm_add_ps(XP, X_1P);
-		Y_1P = _mm_mul_ps(Y4_1, B1);
-		Y_2P = _mm_mul_ps(Y4_2, B2);
-		YS = _mm_add_ps(Y_1P, Y_2P);
-		Y4 = _mm_sub_ps(XS, YS);
-		
-		X1_1 = X4;
-		Y1_2 = Y4_1;
-		Y1_1 = Y4;
-		
-		_mm_storeu_ps(ptrt, Y1);
-		_mm_storeu_ps(ptrt + 4, Y2);
-		_mm_storeu_ps(ptrt + 8, Y3);
-		_mm_storeu_ps(ptrt + 12, Y4);
-		
-		ptrl += 4;
-		ptrt += 16;
+	for (i = 0; i + ppl <= n; i += ppl) {
+		Z = _mm_cvttps_epi32(_mm_add_ps(_mm_add_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)), H));
+		Z = _mm_packus_epi16(_mm_packs_epi32(Z, Z), Z);
+		*(int *)(dst + i) = _mm_cvtsi128_si32(Z);
 	}
 	
-	ptrl -= 4;
-	ptrt -= 16;
-	ptrf += height * (width - 4);
+	row_sum_u8_nsu(a + i, b + i, n - i, dst + i);
+}
+
+/** @brief Multiply 8-bit row by a weight and accumulate with AVX2.
+ ** @param src source row.
+ ** @param w weight.
+ ** @param n row length.
+ ** @param acc accumulator row.
+ **/
+CPU_TARGET_AVX2
+void row_mac_u8_avx2(const unsigned char *src, int w, unsigned int n, int *acc)
+{
+	unsigned int i;
+	const unsigned int ppl = 8;
+	__m256i W = _mm256_set1_epi32(w);
+	__m256i X;
+	
+	for (i = 0; i + ppl <= n; i += ppl) {
+		X = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i *)(src + i)));
+		X = _mm256_add_epi32(_mm256_loadu_si256((__m256i *)(acc + i)), _mm256_mullo_epi32(X, W));
+		_mm256_storeu_si256((__m256i *)(acc + i), X);
+	}
 	
-	X4_1 = X1_1;	
-	Y4_2 = _mm_mul_ps(X4_1, CN);
-	Y4_1 = Y4_2;
+	row_mac_u8_nsu(src + i, w, n - i, acc + i);
+}
+
+/** @brief Multiply 16-bit row by a weight and accumulate with AVX2.
+ ** @param src source row.
+ ** @param w weight.
+ ** @param n row length.
+ ** @param acc accumulator row.
+ **/
+CPU_TARGET_AVX2
+void row_mac_u16_avx2(const unsigned short *src, int w, unsigned int n, int *acc)
+{
+	unsigned int i;
+	const unsigned int ppl = 8;
+	__m256i W = _mm256_set1_epi32(w);
+	__m256i X;
+	
+	for (i = 0; i + ppl <= n; i += ppl) {
+		X = _mm256_cvtepu16_epi32(_mm_loadu_si128((__m128i *)(src + i)));
+		X = _mm256_add_epi32(_mm256_loadu_si256((__m256i *)(acc + i)), _mm256_mullo_epi32(X, W));
+		_mm256_storeu_si256((__m256i *)(acc + i), X);
+	}
 	
-	for (i = 0; i < width; i += 4) {
-		X1 = _mm_loadu_ps(ptrl);   
-		X2 = _mm_loadu_ps(ptrl + width);  
-		X3 = _mm_loadu_ps(ptrl + 2 * width); 
-		X4 = _mm_loadu_ps(ptrl + 3 * width); 
-		
-		_MM_TRANSPOSE4_PS(X1, X2, X3, X4);
-		
-		T1 = _mm_loadu_ps(ptrt);
-		T2 = _mm_loadu_ps(ptrt + 4);
-		T3 = _mm_loadu_ps(ptrt + 8);
-		T4 = _mm_loadu_ps(ptrt + 12);
-		
-		XP = _mm_mul_ps(X4, A2);
-		X_1P = _mm_mul_ps(X4_1, A3);
-		XS = _mm_add_ps(XP, X_1P);
-		Y_1P = _mm_mul_ps(Y4_1, B1);
-		Y_2P = _mm_mul_ps(Y4_2, B2);
-		YS = _mm_add_ps(Y_1P, Y_2P);
-		Y4 = _mm_sub_ps(XS, YS);
-		
-		X3_1 = X4;
-		Y3_2 = Y4_1;
-		Y3_1 = Y4;
-		
-		XP = _mm_mul_ps(X3, A2);
-		X_1P = _mm_mul_ps(X3_1, A3);
-		XS = _mm_add_ps(XP, X_1P);
-		Y_1P = _mm_mul_ps(Y3_1, B1);
-		Y_2P = _mm_mul_ps(Y3_2, B2);
-		YS = _mm_add_ps(Y_1P, Y_2P);
-		Y3 = _mm_sub_ps(XS, YS);
-		
-		X2_1 = X3;
-		Y2_2 = Y3_1;
-		Y2_1 = Y3;
-		
-		XP = _mm_mul_ps(X2, A2);
-		X_1P = _mm_mul_ps(X2_1, A3);
-		XS = _mm_add_ps(XP, X_1P);
-		Y_1P = _mm_mul_ps(Y2_1, B1);
-		Y_2P = _mm_mul_ps(Y2_2, B2);
-		YS = _mm_add_ps(Y_1P, Y_2P);
-		Y2 = _mm_sub_ps(XS, YS);
-		
-		X1_1 = X2;
-		Y1_2 = Y2_1;
-		Y1_1 = Y2;
-		
-		XP = _mm_mul_ps(X1, A2);
-		X_1P = _mm_mul_ps(X1_1, A3);
-		XS = _mm_add_ps(XP, X_1P);
-		Y_1P = _mm_mul_ps(Y1_1, B1);
-		Y_2P = _mm_mul_ps(Y1_2, B2);
-		YS = _mm_add_ps(Y_1P, Y_2P);
-		Y1 = _mm_sub_ps(XS, YS);
-		
-		X4_1 = X1;
-		Y4_2 = Y1_1;
-		Y4_1 = Y1;
-		
-		Y4 = _mm_add_ps(Y4, T4);
-		Y3 = _mm_add_ps(Y3, T3);
-		Y2 = _mm_add_ps(Y2, T2);
-		Y1 = _mm_add_ps(Y1, T1);
-		
-		Z = _mm_cvtps_epi32(Y1);
-		Z = _mm_packs_epi32(Z, Z);
-		Z = _mm_packus_epi16(Z, Z);
-		*((unsigned int *)ptrf) = _mm_cvtsi128_si32(Z);
-
-		Z = _mm_cvtps_epi32(Y2);
-		Z = _mm_packs_epi32(Z, Z);
-		Z = _mm_packus_epi16(Z, Z);
-		*((unsigned int *)(ptrf + height)) = _mm_cvtsi128_si32(Z);
-		
-		Z = _mm_cvtps_epi32(Y3);
-		Z = _mm_packs_epi32(Z, Z);
-		Z = _mm_packus_epi16(Z, Z);
-		*((unsigned int *)(ptrf + 2 * height)) = _mm_cvtsi128_si32(Z);
-		
-		Z = _mm_cvtps_epi32(Y4);
-		Z = _mm_packs_epi32(Z, Z);
-		Z = _mm_packus_epi16(Z, Z);
-		*((unsigned int *)(ptrf + 3 * height)) = _mm_cvtsi128_si32(Z);
-		
-		ptrl -= 4;
-		ptrt -= 16;
-		ptrf -= 4 * height;
+	row_mac_u16_nsu(src + i, w, n - i, acc + i);
+}
+
+/** @brief One step of second order recursion along a row with AVX2.
+ ** @param x0 current input row.
+ ** @param x1 previous input row.
+ ** @param y1 previous output row.
+ ** @param y2 output row before y1.
+ ** @param c coefficients.
+ ** @param n row length.
+ ** @param y output row.
+ **/
+CPU_TARGET_AVX2
+void row_recur_avx2(const float *x0, const float *x1, const float *y1,
+                    const float *y2, const float *c, unsigned int n, float *y)
+{
+	unsigned int i;
+	const unsigned int ppl = 8;
+	__m256 C0 = _mm256_set1_ps(c[0]);
+	__m256 C1 = _mm256_set1_ps(c[1]);
+	__m256 C2 = _mm256_set1_ps(c[2]);
+	__m256 C3 = _mm256_set1_ps(c[3]);
+	__m256 Y;
+	
+	/* no FMA, so results are identical to the scalar kernel. */
+	for (i = 0; i + ppl <= n; i += ppl) {
+		Y = _mm256_add_ps(_mm256_mul_ps(C0, _mm256_loadu_ps(x0 + i)),
+			_mm256_mul_ps(C1, _mm256_loadu_ps(x1 + i)));
+		Y = _mm256_sub_ps(Y, _mm256_mul_ps(C2, _mm256_loadu_ps(y1 + i)));
+		Y = _mm256_sub_ps(Y, _mm256_mul_ps(C3, _mm256_loadu_ps(y2 + i)));
+		_mm256_storeu_ps(y + i, Y);
 	}
+	
+	row_recur_nsu(x0 + i, x1 + i, y1 + i, y2 + i, c, n - i, y + i);
 }
 
-/** @brief Gaussian filter no speed up.
+/** @brief Sum two rows, round and saturate to 8 bits with AVX2.
+ ** @param a one row.
+ ** @param b another row.
+ ** @param n row length.
+ ** @param dst output row.
+ **/
+CPU_TARGET_AVX2
+void row_sum_u8_avx2(const float *a, const float *b, unsigned int n,
+                     unsigned char *dst)
+{
+	unsigned int i;
+	const unsigned int ppl = 8;
+	__m256 H = _mm256_set1_ps(0.5f);
+	__m256i Z;
+	__m128i P;
+	
+	for (i = 0; i + ppl <= n; i += ppl) {
+		Z = _mm256_cvttps_epi32(_mm256_add_ps(_mm256_add_ps(_mm256_loadu_ps(a + i),
+			_mm256_loadu_ps(b + i)), H));
+		P = _mm_packs_epi32(_mm256_castsi256_si128(Z), _mm256_extracti128_si256(Z, 1));
+		_mm_storel_epi64((__m128i *)(dst + i), _mm_packus_epi16(P, P));
+	}
+	
+	row_sum_u8_nsu(a + i, b + i, n - i, dst + i);
+}
+#endif
+
+/** @brief Gaussian filter by 2D convolution, the reference of
+ **        gauss_filter. Pixels closer than ksize / 2 to image border copy
+ **        the nearest pixel filtered with a whole kernel.
  ** @param image input image.
  ** @param width image width.
  ** @param height image height.
+ ** @param ksize kernel size.
+ ** @param sigma standard deviation.
  ** @param gf_image gaussian filtered image.
  **/
 void gauss_filter_nsu(const unsigned char *image, unsigned int width,
@@ -710,10 +889,12 @@ void gauss_filter_nsu(const unsigned char *image, unsigned int width,
 	unsigned int i, kx, ky;
 	unsigned int krad = ksize >> 1;
 	const float pi = 3.141592653f;
-	float kernel[1024];
+	float kernel[4096];
 	float dx, dy, kval;
 	float sum = 0;
 	
+	assert(ksize <= 64);
+	
 	for (y = 0; y < ksize; y++) {
 		for (x = 0; x < ksize; x++) {
 			dx = (float)x - krad;
@@ -737,11 +918,11 @@ void gauss_filter_nsu(const unsigned char *image, unsigned int width,
 			sum = 0;
 			for (ky = y - krad; ky <= y + krad; ky++) {
 				for (kx = x - krad; kx <= x + krad; kx++) {
-					sum += image[ky * width + kx] * kernel[i];
+					sum += image[ky * width + kx] * kernel[i++];
 				}
 			}
 			
-			gf_image[y * width + x] = (unsigned int)(sum);
+			gf_image[y * width + x] = (unsigned char)(sum + 0.5f);
 		}
 	}
 	
@@ -763,4 +944,4 @@ void gauss_filter_nsu(const unsigned char *image, unsigned int width,
 			gf_image[y * width + x] = gf_image[y * width + width - krad - 1];
 		}
 	}
-} 
\ No newline at end of file
+}
\ No newline at end of file
@@ -1,5 +1,5 @@
 /** @file gaussfilter.h
- ** @brief IIR Gaussian blur filter.
+ ** @brief Gaussian blur filter.
  ** @author Zhiwei Zeng
  ** @date 2018.05.01
  **/
@@ -16,21 +16,62 @@ the terms of the BSD license (see the COPYING file).
 #ifndef _GAUSSFILTER_H_
 #define _GAUSSFILTER_H_
 
-#ifdef __cpluslplus
+#ifdef __cplusplus
 extern "C"
 {
 #endif
 
-/** @brief IIR Gaussian filter.
+#include "cpu.h"
+
+/* sigma up to this is filtered by FIR, above it by IIR. */
+#define GAUSS_FIR_MAX_SIGMA 2.0f
+
+/* largest FIR kernel radius. */
+#define GAUSS_FIR_MAX_RADIUS 16
+
+/** @typedef enum GaussMode
+ ** @brief gaussian filter implementation
+ **/
+typedef enum
+{
+	GAUSS_MODE_AUTO = 0,		/**< choose by sigma. */
+	GAUSS_MODE_FIR,				/**< separable fixed-point FIR, exact for small sigma. */
+	GAUSS_MODE_IIR				/**< recursive Deriche filter, constant cost for any sigma. */
+}GaussMode;
+
+/** @typedef struct GaussFilter
+ ** @brief gaussian filter structure
+ **/
+struct tagGaussFilter;
+typedef struct tagGaussFilter GaussFilter;
+
+/** @name Create, initialize, and destroy
+ ** @{ */
+GaussFilter *gauss_filter_new();
+int gauss_filter_init(GaussFilter *self, unsigned int width, unsigned int height,
+                      float sigma, GaussMode mode);
+void gauss_filter_delete(GaussFilter *self);
+/** @} */
+
+/** @name Filter
+ ** @{ */
+void gauss_filter(GaussFilter *self, const unsigned char *image,
+                  unsigned char *gf_image);
+void gauss_filter_rect(GaussFilter *self, const unsigned char *image,
+                       unsigned int left, unsigned int top, unsigned int right,
+                       unsigned int bottom, unsigned char *gf_image);
+unsigned int gauss_filter_reach(GaussFilter *self);
+GaussMode gauss_filter_mode(GaussFilter *self);
+/** @} */
+
+/** @name Reference 2D convolution, slow.
  ** @{ */
-void gauss_filter(unsigned char *image,
-                  unsigned int width,
-				  unsigned int height,
-				  float sigma,
-				  unsigned char *gf_image);
+void gauss_filter_nsu(const unsigned char *image, unsigned int width,
+                      unsigned int height, unsigned int ksize, float sigma,
+				      unsigned char *gf_image);
 /** @} */
 
-#ifdef __cpluslplus
+#ifdef __cplusplus
 }
 #endif
 
@@ -18,39 +18,40 @@ the terms of the BSD license (see the COPYING file).
 #include <string.h>
 #include <assert.h>
 
-#ifdef __WIN_SSE__	
-#	include <smmintrin.h>
-#endif
+#include "imgadd.h"
 
-#ifdef __WIN_AVX__
+#ifdef CPU_X86
 #	include <immintrin.h>
 #endif
 
-#include "imgadd.h"
+typedef void (*ImgAddKr)(const unsigned char *A, unsigned int width,
+                         unsigned int height, const unsigned char *B,
+                         unsigned char *C);
+typedef void (*ImgAdd)(const unsigned char *A, unsigned int width,
+                       unsigned int height, const unsigned char *B,
+                       unsigned short *C);
+
+/* kernels by CpuLevel. */
+#ifdef CPU_X86
+static const ImgAddKr img_add_kr_fns[CPU_LEVELS] = {
+	img_add_kr_nsu, img_add_kr_sse, img_add_kr_avx2, img_add_kr_avx512
+};
 
-/** @name Some local functions.
- ** @{ */
-static void img_add_kr_sse(const unsigned char *A, unsigned int width,
-                           unsigned int height, const unsigned char *B,
-			               unsigned char *C);
-static void img_add_kr_avx(const unsigned char *A, unsigned int width,
-                           unsigned int height, const unsigned char *B,
-			               unsigned char *C);
-static void img_add_kr_nsu(const unsigned char *A, unsigned int width,
-                           unsigned int height, const unsigned char *B,
-			               unsigned char *C);
-static void img_add_sse(const unsigned char *A, unsigned int width,
-                        unsigned int height, const unsigned char *B,
-			            unsigned short *C);
-static void img_add_avx(const unsigned char *A, unsigned int width,
-                        unsigned int height, const unsigned char *B,
-			            unsigned short *C);
-static void img_add_nsu(const unsigned char *A, unsigned int width,
-                        unsigned int height, const unsigned char *B,
-			            unsigned short *C);
-/** @} */
+static const ImgAdd img_add_fns[CPU_LEVELS] = {
+	img_add_nsu, img_add_sse, img_add_avx2, img_add_avx512
+};
+#else
+static const ImgAddKr img_add_kr_fns[CPU_LEVELS] = {
+	img_add_kr_nsu, img_add_kr_nsu, img_add_kr_nsu, img_add_kr_nsu
+};
+
+static const ImgAdd img_add_fns[CPU_LEVELS] = {
+	img_add_nsu, img_add_nsu, img_add_nsu, img_add_nsu
+};
+#endif
 
 /** @brief Add two images and keep gray range no changed.
+ **        The kernel is picked by cpu_level.
  ** @param A one gray image.
  ** @param width image width.
  ** @param height image height.
@@ -65,16 +66,10 @@ void img_add_kr(const unsigned char *A, unsigned int width,
 	assert(B);
 	assert(C);
 	
-#ifdef __WIN_SSE__
-	img_add_kr_sse(A, width, height, B, C);
-#elif __WIN_AVX__
-	img_add_kr_avx(A, width, height, B, C);
-#else
-	img_add_kr_nsu(A, width, height, B, C);
-#endif
+	img_add_kr_fns[cpu_level()](A, width, height, B, C);
 }
 
-/** @brief Add two images.
+/** @brief Add two images. The kernel is picked by cpu_level.
  ** @param A one gray image.
  ** @param width image width.
  ** @param height image height.
@@ -89,15 +84,10 @@ void img_add(const unsigned char *A, unsigned int width,
 	assert(B);
 	assert(C);
 	
-#ifdef __WIN_SSE__
-	img_add_sse(A, width, height, B, C);
-#elif __WIN_AVX__
-	img_add_avx(A, width, height, B, C);
-#else
-	img_add_nsu(A, width, height, B, C);
-#endif	
+	img_add_fns[cpu_level()](A, width, height, B, C);
 }
 
+#ifdef CPU_X86
 /** @brief Add two images with SSE.
  **        keep gray range no changed.
  ** @param A one gray image.
@@ -106,7 +96,7 @@ void img_add(const unsigned char *A, unsigned int width,
  ** @param B another gray image.
  ** @param C the sum image.
  **/
-#ifdef __WIN_SSE__
+CPU_TARGET_SSE41
 void img_add_kr_sse(const unsigned char *A, unsigned int width,
                     unsigned int height, const unsigned char *B,
 			        unsigned char *C)
@@ -121,16 +111,17 @@ void img_add_kr_sse(const unsigned char *A, unsigned int width,
 	
 	npixels = width * height;
 	
-	for (i = 0; i < npixels; i += ppl) {
+	for (i = 0; i + ppl <= npixels; i += ppl) {
 		X = _mm_loadu_si128((__m128i *)(A + i));
 		Y = _mm_loadu_si128((__m128i *)(B + i));
 		S = _mm_adds_epu8(X, Y);
 		_mm_storeu_si128((__m128i *)(C + i), S);
 	}
-}	
-#endif
 	
-/** @brief Add two images with AVX.
+	img_add_kr_nsu(A + i, npixels - i, 1, B + i, C + i);
+}
+	
+/** @brief Add two images with AVX2.
  **        keep gray range no changed.
  ** @param A one gray image.
  ** @param width image width.
@@ -138,10 +129,10 @@ void img_add_kr_sse(const unsigned char *A, unsigned int width,
  ** @param B another gray image.
  ** @param C the sum image.
  **/	
-#ifdef __WIN_AVX__		
-void img_add_kr_avx(const unsigned char *A, unsigned int width,
-                    unsigned int height, const unsigned char *B,
-			        unsigned char *C)
+CPU_TARGET_AVX2
+void img_add_kr_avx2(const unsigned char *A, unsigned int width,
+                     unsigned int height, const unsigned char *B,
+			         unsigned char *C)
 {
 	unsigned int i;
 	unsigned int npixels;
@@ -153,13 +144,48 @@ void img_add_kr_avx(const unsigned char *A, unsigned int width,
 	
 	npixels = width * height;
 	
-	for (i = 0; i < npixels; i += ppl) {
+	for (i = 0; i + ppl <= npixels; i += ppl) {
 		X = _mm256_loadu_si256((__m256i *)(A + i));
 		Y = _mm256_loadu_si256((__m256i *)(B + i));
 		S = _mm256_adds_epu8(X, Y);
 		_mm256_storeu_si256((__m256i *)(C + i), S);
 	}
-}	
+	
+	img_add_kr_nsu(A + i, npixels - i, 1, B + i, C + i);
+}
+
+/** @brief Add two images with AVX-512.
+ **        keep gray range no changed.
+ ** @param A one gray image.
+ ** @param width image width.
+ ** @param height image height.
+ ** @param B another gray image.
+ ** @param C the sum image.
+ **/	
+CPU_TARGET_AVX512BW
+void img_add_kr_avx512(const unsigned char *A, unsigned int width,
+                       unsigned int height, const unsigned char *B,
+			           unsigned char *C)
+{
+	unsigned int i;
+	unsigned int npixels;
+	const unsigned int ppl = 64;
+	
+	__m512i X;
+	__m512i Y;
+	__m512i S;
+	
+	npixels = width * height;
+	
+	for (i = 0; i + ppl <= npixels; i += ppl) {
+		X = _mm512_loadu_si512((const void *)(A + i));
+		Y = _mm512_loadu_si512((const void *)(B + i));
+		S = _mm512_adds_epu8(X, Y);
+		_mm512_storeu_si512((void *)(C + i), S);
+	}
+	
+	img_add_kr_nsu(A + i, npixels - i, 1, B + i, C + i);
+}
 #endif
 
 /** @brief Add two images no speed up.
@@ -190,6 +216,7 @@ void img_add_kr_nsu(const unsigned char *A, unsigned int width,
 	}
 }
 
+#ifdef CPU_X86
 /** @brief Add two images with SSE.
  ** @param A one gray image.
  ** @param width image width.
@@ -197,16 +224,14 @@ void img_add_kr_nsu(const unsigned char *A, unsigned int width,
  ** @param B another gray image.
  ** @param C the sum image.
  **/
-#ifdef __WIN_SSE__
+CPU_TARGET_SSE41
 void img_add_sse(const unsigned char *A, unsigned int width,
                  unsigned int height, const unsigned char *B,
 			     unsigned short *C)
 {	
 	unsigned int i;
-	unsigned int j;
 	unsigned int npixels;
 	const unsigned int ppl = 16;
-	const unsigned int pps = 8;
 	
 	__m128i Zero;
 	__m128i X;
@@ -218,11 +243,10 @@ void img_add_sse(const unsigned char *A, unsigned int width,
 	__m128i SL;
 	__m128i SH;
 	
-	j = 0;
 	npixels = width * height;
 	Zero = _mm_setzero_si128();
 	
-	for (i = 0; i < npixels; i += ppl) {
+	for (i = 0; i + ppl <= npixels; i += ppl) {
 		X = _mm_loadu_si128((__m128i *)(A + i));
 		XL = _mm_unpacklo_epi8(X, Zero);
 		XH = _mm_unpackhi_epi8(X, Zero);
@@ -234,63 +258,94 @@ void img_add_sse(const unsigned char *A, unsigned int width,
 		SL = _mm_adds_epu16(XL, YL);
 		SH = _mm_adds_epu16(XH, YH);
 		
-		_mm_storeu_si128((__m128i *)(C + j), SL);
-		j += pps;
-		_mm_storeu_si128((__m128i *)(C + j), SH);
-		j += pps;
+		_mm_storeu_si128((__m128i *)(C + i), SL);
+		_mm_storeu_si128((__m128i *)(C + i + 8), SH);
 	}
+	
+	img_add_nsu(A + i, npixels - i, 1, B + i, C + i);
 }
-#endif
 
-/** @brief Add two images with AVX.
+/** @brief Add two images with AVX2. The bytes are widened per 128-bit
+ **        half, the in-lane unpack of AVX2 would swap the middle quarters.
  ** @param A one gray image.
  ** @param width image width.
  ** @param height image height.
  ** @param B another gray image.
  ** @param C the sum image.
  **/
-#ifdef __WIN_AVX__
-void img_add_avx(const unsigned char *A, unsigned int width,
-                 unsigned int height, const unsigned char *B,
-			     unsigned short *C)
+CPU_TARGET_AVX2
+void img_add_avx2(const unsigned char *A, unsigned int width,
+                  unsigned int height, const unsigned char *B,
+			      unsigned short *C)
 {
 	unsigned int i;
-	unsigned int j;
 	unsigned int npixels;
 	const unsigned int ppl = 32;
-	const unsigned int pps = 16;
 	
-	__m256i Zero;
 	__m256i X;
 	__m256i XL;
 	__m256i XH;
 	__m256i Y;
 	__m256i YL;
 	__m256i YH;
-	__m256i SL;
-	__m256i SH;
 	
-	j = 0;
 	npixels = width * height;
-	Zero = _mm256_setzero_si256();
 	
-	for (i = 0; i < npixels; i += ppl) {
+	for (i = 0; i + ppl <= npixels; i += ppl) {
 		X = _mm256_loadu_si256((__m256i *)(A + i));
-		XL = _mm256_unpacklo_epi8(X, Zero);
-		XH = _mm256_unpackhi_epi8(X, Zero);
+		XL = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(X));
+		XH = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(X, 1));
 		
 		Y = _mm256_loadu_si256((__m256i *)(B + i));
-		YL = _mm256_unpacklo_epi8(Y, Zero);
-		YH = _mm256_unpackhi_epi8(Y, Zero);
+		YL = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(Y));
+		YH = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(Y, 1));
 		
-		SL = _mm256_adds_epu16(XL, YL);
-		SH = _mm256_adds_epu16(XH, YH);
+		_mm256_storeu_si256((__m256i *)(C + i), _mm256_add_epi16(XL, YL));
+		_mm256_storeu_si256((__m256i *)(C + i + 16), _mm256_add_epi16(XH, YH));
+	}
+	
+	img_add_nsu(A + i, npixels - i, 1, B + i, C + i);
+}
+
+/** @brief Add two images with AVX-512.
+ ** @param A one gray image.
+ ** @param width image width.
+ ** @param height image height.
+ ** @param B another gray image.
+ ** @param C the sum image.
+ **/
+CPU_TARGET_AVX512BW
+void img_add_avx512(const unsigned char *A, unsigned int width,
+                    unsigned int height, const unsigned char *B,
+			        unsigned short *C)
+{
+	unsigned int i;
+	unsigned int npixels;
+	const unsigned int ppl = 64;
+	
+	__m512i X;
+	__m512i XL;
+	__m512i XH;
+	__m512i Y;
+	__m512i YL;
+	__m512i YH;
+	
+	npixels = width * height;
+	
+	for (i = 0; i + ppl <= npixels; i += ppl) {
+		X = _mm512_loadu_si512((const void *)(A + i));
+		XL = _mm512_cvtepu8_epi16(_mm512_castsi512_si256(X));
+		XH = _mm512_cvtepu8_epi16(_mm512_extracti64x4_epi64(X, 1));
+		
+		Y = _mm512_loadu_si512((const void *)(B + i));
+		YL = _mm512_cvtepu8_epi16(_mm512_castsi512_si256(Y));
+		YH = _mm512_cvtepu8_epi16(_mm512_extracti64x4_epi64(Y, 1));
 		
-		_mm256_storeu_si256((__m256i *)(C + j), SL);
-		j += pps;
-		_mm256_storeu_si256((__m256i *)(C + j), SH);
-		j += pps;
+		_mm512_storeu_si512((void *)(C + i), _mm512_add_epi16(XL, YL));
+		_mm512_storeu_si512((void *)(C + i + 32), _mm512_add_epi16(XH, YH));
 	}
+	
+	img_add_nsu(A + i, npixels - i, 1, B + i, C + i);
 }
 #endif
 
@@ -313,4 +368,4 @@ void img_add_nsu(const unsigned char *A, unsigned int width,
 	for (i = 0; i < npixels; i++) {
 		C[i] = A[i] + B[i];
 	}
-}		   
\ No newline at end of file
+}
\ No newline at end of file
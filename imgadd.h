@@ -21,6 +21,8 @@ extern "C"
 {
 #endif
 
+#include "cpu.h"
+
 /** @name Add two images.
  ** @{ */
 void img_add_kr(const unsigned char *A, unsigned int width,
@@ -31,6 +33,36 @@ void img_add(const unsigned char *A, unsigned int width,
 			 unsigned short *C);
 /** @} */
 
+/** @name Kernel variants, the ones above pick one by cpu_level.
+ ** @{ */
+#ifdef CPU_X86
+void img_add_kr_sse(const unsigned char *A, unsigned int width,
+                    unsigned int height, const unsigned char *B,
+			        unsigned char *C);
+void img_add_kr_avx2(const unsigned char *A, unsigned int width,
+                     unsigned int height, const unsigned char *B,
+			         unsigned char *C);
+void img_add_kr_avx512(const unsigned char *A, unsigned int width,
+                       unsigned int height, const unsigned char *B,
+			           unsigned char *C);
+void img_add_sse(const unsigned char *A, unsigned int width,
+                 unsigned int height, const unsigned char *B,
+			     unsigned short *C);
+void img_add_avx2(const unsigned char *A, unsigned int width,
+                  unsigned int height, const unsigned char *B,
+			      unsigned short *C);
+void img_add_avx512(const unsigned char *A, unsigned int width,
+                    unsigned int height, const unsigned char *B,
+			        unsigned short *C);
+#endif
+void img_add_kr_nsu(const unsigned char *A, unsigned int width,
+                    unsigned int height, const unsigned char *B,
+			        unsigned char *C);
+void img_add_nsu(const unsigned char *A, unsigned int width,
+                 unsigned int height, const unsigned char *B,
+			     unsigned short *C);
+/** @} */
+
 #ifdef __cplusplus
 }
 #endif
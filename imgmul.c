@@ -17,132 +17,184 @@ the terms of the BSD license (see the COPYING file).
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
-#include <omp.h>
 
-#ifdef __WIN_SSE__	
-#	include <smmintrin.h>
-#endif
+#include "imgmul.h"
 
-#ifdef __WIN_AVX__
+#ifdef CPU_X86
 #	include <immintrin.h>
 #endif
 
-static void img_mul_s_kr_sse(const unsigned char *A, unsigned int width,
-                             unsigned int height, float k, unsigned char *B);
-static void img_mul_s_kr_avx(const unsigned char *A, unsigned int width,
-                             unsigned int height, float k, unsigned char *B);
-static void img_mul_s_kr_nsu(const unsigned char *A, unsigned int width,
-                             unsigned int height, float k, unsigned char *B);
+typedef void (*ImgMulSKr)(const unsigned char *A, unsigned int width,
+                          unsigned int height, float k, unsigned char *B);
+
+/* kernels by CpuLevel. */
+#ifdef CPU_X86
+static const ImgMulSKr img_mul_s_kr_fns[CPU_LEVELS] = {
+	img_mul_s_kr_nsu, img_mul_s_kr_sse, img_mul_s_kr_avx2, img_mul_s_kr_avx512
+};
+#else
+static const ImgMulSKr img_mul_s_kr_fns[CPU_LEVELS] = {
+	img_mul_s_kr_nsu, img_mul_s_kr_nsu, img_mul_s_kr_nsu, img_mul_s_kr_nsu
+};
+#endif
 
+/** @brief Multiply image by a scalar and keep gray range no changed.
+ **        The kernel is picked by cpu_level.
+ ** @param A gray image.
+ ** @param width image width.
+ ** @param height image height.
+ ** @param k scalar.
+ ** @param B product image.
+ **/
 void img_mul_s_kr(const unsigned char *A, unsigned int width,
                   unsigned int height, float k, unsigned char *B)
 {
 	assert(A);
 	assert(B);
 	
-#ifdef __WIN_SSE__
-	img_mul_s_kr_sse(A, width, height, k, B);
-#elif __WIN_AVX__
-	img_mul_s_kr_avx(A, width, height, k, B);
-#else
-	img_mul_s_kr_nsu(A, width, height, k, B);
-#endif
+	img_mul_s_kr_fns[cpu_level()](A, width, height, k, B);
 }
 
+#ifdef CPU_X86
+/** @brief Multiply image by a scalar with SSE. Products are truncated
+ **        like the scalar kernel does.
+ ** @param A gray image.
+ ** @param width image width.
+ ** @param height image height.
+ ** @param k scalar.
+ ** @param B product image.
+ **/
+CPU_TARGET_SSE41
 void img_mul_s_kr_sse(const unsigned char *A, unsigned int width,
                       unsigned int height, float k, unsigned char *B)
-{
-	img_mul_s_kr_nsu(A, width, height, k, B);
-}					  
-
-#ifdef __WIN_AVX__					  
-void img_mul_s_kr_avx(const unsigned char *A, unsigned int width,
-                      unsigned int height, float k, unsigned char *B)
 {
 	unsigned int i;
 	unsigned int npixels;
 	const unsigned int ppl = 16;
-
-	__m128i Zero;
+	
+	__m128 K;
 	__m128i X;
-	__m128i XL;
-	__m128i XH;
-	__m256i XL_u32;
-	__m256i XH_u32;
-	__m256  XL_f32;
-	__m256  XH_f32;
-	__m256  YL_f32;
-	__m256  YH_f32;
-	__m256i YL_u32;
-	__m256i YH_u32;
-	__m128i YLL_u32;
-	__m128i YLH_u32;
-	__m128i YHL_u32;
-	__m128i YHH_u32;
-	__m128i YLL_u8;
-	__m128i YLH_u8;
-	__m128i YHL_u8;
-	__m128i YHH_u8;
-	__m128i Y;
+	__m128i Y0;
+	__m128i Y1;
+	__m128i Y2;
+	__m128i Y3;
 	
-	__m128i SHUFFLE_MASKYC_LL = {0x00, 0x04, 0x08, 0x0C,
-	                             0x80, 0x80, 0x80, 0x80,
-						         0x80, 0x80, 0x80, 0x80,
-						         0x80, 0x80, 0x80, 0x80};
+	npixels = width * height;
+	K = _mm_set1_ps(k);
 	
-	__m128i SHUFFLE_MASKYC_LH = {0x80, 0x80, 0x80, 0x80,
-	                             0x00, 0x04, 0x08, 0x0C,
-						         0x80, 0x80, 0x80, 0x80,
-						         0x80, 0x80, 0x80, 0x80};
+	for (i = 0; i + ppl <= npixels; i += ppl) {
+		X = _mm_loadu_si128((__m128i *)(A + i));
+		
+		Y0 = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(X)), K));
+		Y1 = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(
+			_mm_srli_si128(X, 4))), K));
+		Y2 = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(
+			_mm_srli_si128(X, 8))), K));
+		Y3 = _mm_cvttps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(_mm_cvtepu8_epi32(
+			_mm_srli_si128(X, 12))), K));
+		
+		Y0 = _mm_packus_epi32(Y0, Y1);
+		Y2 = _mm_packus_epi32(Y2, Y3);
+		
+		_mm_storeu_si128((__m128i *)(B + i), _mm_packus_epi16(Y0, Y2));
+	}
 	
-	__m128i SHUFFLE_MASKYC_HL = {0x80, 0x80, 0x80, 0x80,
-	                             0x80, 0x80, 0x80, 0x80,
-						         0x00, 0x04, 0x08, 0x0C,
-						         0x80, 0x80, 0x80, 0x80};
+	img_mul_s_kr_nsu(A + i, npixels - i, 1, k, B + i);
+}
+
+/** @brief Multiply image by a scalar with AVX2.
+ ** @param A gray image.
+ ** @param width image width.
+ ** @param height image height.
+ ** @param k scalar.
+ ** @param B product image.
+ **/
+CPU_TARGET_AVX2
+void img_mul_s_kr_avx2(const unsigned char *A, unsigned int width,
+                       unsigned int height, float k, unsigned char *B)
+{
+	unsigned int i;
+	unsigned int npixels;
+	const unsigned int ppl = 32;
 	
-	__m128i SHUFFLE_MASKYC_HH = {0x80, 0x80, 0x80, 0x80,
-	                             0x80, 0x80, 0x80, 0x80,
-						         0x80, 0x80, 0x80, 0x80,
-						         0x00, 0x04, 0x08, 0x0C};
+	__m256 K;
+	__m256i Y0;
+	__m256i Y1;
+	__m256i Y2;
+	__m256i Y3;
+	__m256i ORDER;
 	
 	npixels = width * height;
-	Zero = _mm_setzero_si128();
+	K = _mm256_set1_ps(k);
 	
-	for (i = 0; i < npixels; i += ppl) {
-		X = _mm_loadu_si128((__m128i *)(A + i));				/* u8x16 */
-		
-		XL = _mm_unpacklo_epi8(X, Zero);						/* u16x8 */
-		XH = _mm_unpackhi_epi8(X, Zero);						/* u16x8 */
-		
-		XL_u32 = _mm256_cvtepu16_epi32(XL);						/* u32x8 */
-		XH_u32 = _mm256_cvtepu16_epi32(XH);						/* u32x8 */
-		
-		XL_f32 = _mm256_cvtepi32_ps(XL_u32);					/* f32x8 */
-		XH_f32 = _mm256_cvtepi32_ps(XH_u32);					/* f32x8 */
-		
-		YL_f32 = _mm256_mul_ps(XL_f32, _mm256_broadcast_ss(&k));
-		YH_f32 = _mm256_mul_ps(XH_f32, _mm256_broadcast_ss(&k));
+	/* the packs work per 128-bit lane, put the dwords back in order. */
+	ORDER = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	
+	for (i = 0; i + ppl <= npixels; i += ppl) {
+		Y0 = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i *)(A + i)));
+		Y1 = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i *)(A + i + 8)));
+		Y2 = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i *)(A + i + 16)));
+		Y3 = _mm256_cvtepu8_epi32(_mm_loadl_epi64((__m128i *)(A + i + 24)));
 		
-		YL_u32 = _mm256_cvtps_epi32(YL_f32);					/* u32x8 */
-		YH_u32 = _mm256_cvtps_epi32(YH_f32);					/* u32x8 */
+		Y0 = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(Y0), K));
+		Y1 = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(Y1), K));
+		Y2 = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(Y2), K));
+		Y3 = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(Y3), K));
 		
-		YLL_u32 = _mm256_extractf128_si256(YL_u32, 0x00);		/* u32x4 */
-		YLH_u32 = _mm256_extractf128_si256(YL_u32, 0x01);		/* u32x4 */
-		YHL_u32 = _mm256_extractf128_si256(YH_u32, 0x00);		/* u32x4 */
-		YHH_u32 = _mm256_extractf128_si256(YH_u32, 0x01);		/* u32x4 */
+		Y0 = _mm256_packus_epi32(Y0, Y1);
+		Y2 = _mm256_packus_epi32(Y2, Y3);
+		Y0 = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(Y0, Y2), ORDER);
 		
-		YLL_u8 = _mm_shuffle_epi8(YLL_u32, SHUFFLE_MASKYC_LL);	/* u8x4 */
-		YLH_u8 = _mm_shuffle_epi8(YLH_u32, SHUFFLE_MASKYC_LH);	/* u8x4 */
-		YHL_u8 = _mm_shuffle_epi8(YHL_u32, SHUFFLE_MASKYC_HL);	/* u8x4 */
-		YHH_u8 = _mm_shuffle_epi8(YHH_u32, SHUFFLE_MASKYC_HH);	/* u8x4 */
+		_mm256_storeu_si256((__m256i *)(B + i), Y0);
+	}
+	
+	img_mul_s_kr_nsu(A + i, npixels - i, 1, k, B + i);
+}
+
+/** @brief Multiply image by a scalar with AVX-512.
+ ** @param A gray image.
+ ** @param width image width.
+ ** @param height image height.
+ ** @param k scalar.
+ ** @param B product image.
+ **/
+CPU_TARGET_AVX512BW
+void img_mul_s_kr_avx512(const unsigned char *A, unsigned int width,
+                         unsigned int height, float k, unsigned char *B)
+{
+	unsigned int i;
+	unsigned int npixels;
+	const unsigned int ppl = 32;
+	
+	__m512 K;
+	__m512i Y0;
+	__m512i Y1;
+	
+	npixels = width * height;
+	K = _mm512_set1_ps(k);
+	
+	for (i = 0; i + ppl <= npixels; i += ppl) {
+		Y0 = _mm512_cvtepu8_epi32(_mm_loadu_si128((__m128i *)(A + i)));
+		Y1 = _mm512_cvtepu8_epi32(_mm_loadu_si128((__m128i *)(A + i + 16)));
 		
-		Y = _mm_or_si128(_mm_or_si128(YLL_u8, YLH_u8),_mm_or_si128(YHL_u8, YHH_u8));
+		Y0 = _mm512_cvttps_epi32(_mm512_mul_ps(_mm512_cvtepi32_ps(Y0), K));
+		Y1 = _mm512_cvttps_epi32(_mm512_mul_ps(_mm512_cvtepi32_ps(Y1), K));
 		
-		_mm_storeu_si128((__m128i *)(B + i), Y);
+		_mm_storeu_si128((__m128i *)(B + i), _mm512_cvtusepi32_epi8(Y0));
+		_mm_storeu_si128((__m128i *)(B + i + 16), _mm512_cvtusepi32_epi8(Y1));
 	}
+	
+	img_mul_s_kr_nsu(A + i, npixels - i, 1, k, B + i);
 }
-#endif					  
-					  
+#endif
+
+/** @brief Multiply image by a scalar no speed up.
+ ** @param A gray image.
+ ** @param width image width.
+ ** @param height image height.
+ ** @param k scalar.
+ ** @param B product image.
+ **/
 void img_mul_s_kr_nsu(const unsigned char *A, unsigned int width,
                       unsigned int height, float k, unsigned char *B)
 {
@@ -154,4 +206,4 @@ void img_mul_s_kr_nsu(const unsigned char *A, unsigned int width,
 	for (i = 0; i < npixels; i++) {
 		B[i] = (unsigned char)(k * A[i]);
 	}
-}					  
\ No newline at end of file
+}
\ No newline at end of file
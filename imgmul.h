@@ -21,12 +21,28 @@ extern "C"
 {
 #endif
 
+#include "cpu.h"
+
 /** @name A image multiply a scalar.
  ** @{ */
 void img_mul_s_kr(const unsigned char *A, unsigned int width,
                   unsigned int height, float k, unsigned char *B);
 /** @} */
 
+/** @name Kernel variants, the one above picks one by cpu_level.
+ ** @{ */
+#ifdef CPU_X86
+void img_mul_s_kr_sse(const unsigned char *A, unsigned int width,
+                      unsigned int height, float k, unsigned char *B);
+void img_mul_s_kr_avx2(const unsigned char *A, unsigned int width,
+                       unsigned int height, float k, unsigned char *B);
+void img_mul_s_kr_avx512(const unsigned char *A, unsigned int width,
+                         unsigned int height, float k, unsigned char *B);
+#endif
+void img_mul_s_kr_nsu(const unsigned char *A, unsigned int width,
+                      unsigned int height, float k, unsigned char *B);
+/** @} */
+
 #ifdef __cplusplus
 }
 #endif
@@ -18,40 +18,40 @@ the terms of the BSD license (see the COPYING file).
 #include <string.h>
 #include <assert.h>
 
-#ifdef __WIN_SSE__	
-#	include <smmintrin.h>
-#endif
+#include "imgsubtract.h"
 
-#ifdef __WIN_AVX__
+#ifdef CPU_X86
 #	include <immintrin.h>
 #endif
 
-#include "imgsubtract.h"
+typedef void (*ImgSubtractKr)(const unsigned char *A, unsigned int width,
+                              unsigned int height, const unsigned char *B,
+                              unsigned char *C);
+typedef void (*ImgSubtract)(const unsigned char *A, unsigned int width,
+                            unsigned int height, const unsigned char *B,
+                            short *C);
 
-/** @name Some local functions.
- ** @{ */
-static void img_subtract_kr_sse(const unsigned char *A, unsigned int width,
-                                unsigned int height, const unsigned char *B,
-					            unsigned char *C);
-static void img_subtract_kr_avx(const unsigned char *A, unsigned int width,
-                                unsigned int height, const unsigned char *B,
-					            unsigned char *C);
-static void img_subtract_kr_nsu(const unsigned char *A, unsigned int width,
-                                unsigned int height, const unsigned char *B,
-					            unsigned char *C);
-static void img_subtract_sse(const unsigned char *A, unsigned int width,
-                             unsigned int height, const unsigned char *B,
-			                 short *C);
-static void img_subtract_avx(const unsigned char *A, unsigned int width,
-                             unsigned int height, const unsigned char *B,
-			                 short *C);
-static void img_subtract_nsu(const unsigned char *A, unsigned int width,
-                             unsigned int height, const unsigned char *B,
-			                 short *C);
-/** @} */
+/* kernels by CpuLevel. */
+#ifdef CPU_X86
+static const ImgSubtractKr img_subtract_kr_fns[CPU_LEVELS] = {
+	img_subtract_kr_nsu, img_subtract_kr_sse, img_subtract_kr_avx2, img_subtract_kr_avx512
+};
+
+static const ImgSubtract img_subtract_fns[CPU_LEVELS] = {
+	img_subtract_nsu, img_subtract_sse, img_subtract_avx2, img_subtract_avx512
+};
+#else
+static const ImgSubtractKr img_subtract_kr_fns[CPU_LEVELS] = {
+	img_subtract_kr_nsu, img_subtract_kr_nsu, img_subtract_kr_nsu, img_subtract_kr_nsu
+};
+
+static const ImgSubtract img_subtract_fns[CPU_LEVELS] = {
+	img_subtract_nsu, img_subtract_nsu, img_subtract_nsu, img_subtract_nsu
+};
+#endif
 
 /** @brief Subtract one image from another.
- **        keep gray range no changed.
+ **        keep gray range no changed. The kernel is picked by cpu_level.
  ** @param A one gray image.
  ** @param width image width.
  ** @param height image height.
@@ -66,16 +66,10 @@ void img_subtract_kr(const unsigned char *A, unsigned int width,
 	assert(B);
 	assert(C);
 	
-#ifdef __WIN_SSE__
-	img_subtract_kr_sse(A, width, height, B, C);
-#elif __WIN_AVX__
-	img_subtract_kr_avx(A, width, height, B, C);
-#else
-	img_subtract_kr_nsu(A, width, height, B, C);
-#endif
+	img_subtract_kr_fns[cpu_level()](A, width, height, B, C);
 }
 
-/** @brief Subtract one image from another.
+/** @brief Subtract one image from another. The kernel is picked by cpu_level.
  ** @param A one gray image.
  ** @param width image width.
  ** @param height image height.
@@ -90,15 +84,10 @@ void img_subtract(const unsigned char *A, unsigned int width,
 	assert(B);
 	assert(C);
 	
-#ifdef __WIN_SSE__
-	img_subtract_sse(A, width, height, B, C);
-#elif __WIN_AVX__
-	img_subtract_avx(A, width, height, B, C);
-#else
-	img_subtract_nsu(A, width, height, B, C);
-#endif
+	img_subtract_fns[cpu_level()](A, width, height, B, C);
 }
 
+#ifdef CPU_X86
 /** @brief Subtract one image from another with SSE.
  **        keep gray range no changed.
  ** @param A one gray image.
@@ -107,7 +96,7 @@ void img_subtract(const unsigned char *A, unsigned int width,
  ** @param B another gray image.
  ** @param C difference image.
  **/
-#ifdef __WIN_SSE__
+CPU_TARGET_SSE41
 void img_subtract_kr_sse(const unsigned char *A, unsigned int width,
                          unsigned int height, const unsigned char *B,
 					     unsigned char *C)
@@ -118,22 +107,21 @@ void img_subtract_kr_sse(const unsigned char *A, unsigned int width,
 	
 	__m128i X;
 	__m128i Y;
-	__m128i Z;
 	__m128i D;
 	
 	npixels = width * height;
 	
-	for (i = 0; i < npixels; i += ppl) {
+	for (i = 0; i + ppl <= npixels; i += ppl) {
 		X = _mm_loadu_si128((__m128i *)(A + i));
 		Y = _mm_loadu_si128((__m128i *)(B + i));
-		Z = _mm_min_epu8(X, Y);
-		D = _mm_sub_epi8(X, Z);
+		D = _mm_subs_epu8(X, Y);
 		_mm_storeu_si128((__m128i *)(C + i), D);
 	}
+	
+	img_subtract_kr_nsu(A + i, npixels - i, 1, B + i, C + i);
 }
-#endif							 
 
-/** @brief Subtract one image from another with AVX.
+/** @brief Subtract one image from another with AVX2.
  **        keep gray range no changed.
  ** @param A one gray image.
  ** @param width image width.
@@ -141,10 +129,10 @@ void img_subtract_kr_sse(const unsigned char *A, unsigned int width,
  ** @param B another gray image.
  ** @param C difference image.
  **/
-#ifdef __WIN_AVX__ 
-void img_subtract_kr_avx(const unsigned char *A, unsigned int width,
-                         unsigned int height, const unsigned char *B,
-					     unsigned char *C)
+CPU_TARGET_AVX2
+void img_subtract_kr_avx2(const unsigned char *A, unsigned int width,
+                          unsigned int height, const unsigned char *B,
+					      unsigned char *C)
 {
 	unsigned int i;
 	unsigned int npixels;
@@ -152,20 +140,53 @@ void img_subtract_kr_avx(const unsigned char *A, unsigned int width,
 	
 	__m256i X;
 	__m256i Y;
-	__m256i Z;
 	__m256i D;
 	
 	npixels = width * height;
 	
-	for (i = 0; i < npixels; i += ppl) {
+	for (i = 0; i + ppl <= npixels; i += ppl) {
 		X = _mm256_loadu_si256((__m256i *)(A + i));
 		Y = _mm256_loadu_si256((__m256i *)(B + i));
-		Z = _mm256_min_epu8(X, Y);
-		D = _mm256_subs_epu8(X, Z);
+		D = _mm256_subs_epu8(X, Y);
 		_mm256_storeu_si256((__m256i *)(C + i), D);
 	}
+	
+	img_subtract_kr_nsu(A + i, npixels - i, 1, B + i, C + i);
 }
-#endif							 
+
+/** @brief Subtract one image from another with AVX-512.
+ **        keep gray range no changed.
+ ** @param A one gray image.
+ ** @param width image width.
+ ** @param height image height.
+ ** @param B another gray image.
+ ** @param C difference image.
+ **/
+CPU_TARGET_AVX512BW
+void img_subtract_kr_avx512(const unsigned char *A, unsigned int width,
+                            unsigned int height, const unsigned char *B,
+					        unsigned char *C)
+{
+	unsigned int i;
+	unsigned int npixels;
+	const unsigned int ppl = 64;
+	
+	__m512i X;
+	__m512i Y;
+	__m512i D;
+	
+	npixels = width * height;
+	
+	for (i = 0; i + ppl <= npixels; i += ppl) {
+		X = _mm512_loadu_si512((const void *)(A + i));
+		Y = _mm512_loadu_si512((const void *)(B + i));
+		D = _mm512_subs_epu8(X, Y);
+		_mm512_storeu_si512((void *)(C + i), D);
+	}
+	
+	img_subtract_kr_nsu(A + i, npixels - i, 1, B + i, C + i);
+}
+#endif
 
 /** @brief Subtract one image from another no speed up.
  **        keep gray range no changed.
@@ -197,6 +218,7 @@ void img_subtract_kr_nsu(const unsigned char *A, unsigned int width,
 	}
 }	
 
+#ifdef CPU_X86
 /** @brief Subtract one image from another with SSE.
  ** @param A one gray image.
  ** @param width image width.
@@ -204,16 +226,14 @@ void img_subtract_kr_nsu(const unsigned char *A, unsigned int width,
  ** @param B another gray image.
  ** @param C difference image.
  **/
-#ifdef __WIN_SSE__
+CPU_TARGET_SSE41
 void img_subtract_sse(const unsigned char *A, unsigned int width,
                       unsigned int height, const unsigned char *B,
 			          short *C)
 {
 	unsigned int i;
-	unsigned int j;
 	unsigned int npixels;
 	const unsigned int ppl = 16;
-	const unsigned int pps = 8;
 	
 	__m128i Zero;
 	__m128i X;
@@ -225,79 +245,108 @@ void img_subtract_sse(const unsigned char *A, unsigned int width,
 	__m128i DL;
 	__m128i DH;
 	
-	j = 0;
 	npixels = width * height;
 	Zero = _mm_setzero_si128();
 	
-	for (i = 0; i < npixels; i += ppl) {
-		X = _mm_load_si128((__m128i *)(A + i));
+	for (i = 0; i + ppl <= npixels; i += ppl) {
+		X = _mm_loadu_si128((__m128i *)(A + i));
 		XL = _mm_unpacklo_epi8(X, Zero);
 		XH = _mm_unpackhi_epi8(X, Zero);
 		
-		Y = _mm_load_si128((__m128i *)(B + i));
-		YL = _mm_unpacklo_epi8(X, Zero);
-		YH = _mm_unpackhi_epi8(X, Zero);
+		Y = _mm_loadu_si128((__m128i *)(B + i));
+		YL = _mm_unpacklo_epi8(Y, Zero);
+		YH = _mm_unpackhi_epi8(Y, Zero);
 		
 		DL = _mm_sub_epi16(XL, YL);
 		DH = _mm_sub_epi16(XH, YH);
 		
-		_mm_store_si128((__m128i *)(C + j), DL);
-		j += pps;
-		_mm_store_si128((__m128i *)(C + j), DH);
-		j += pps;
+		_mm_storeu_si128((__m128i *)(C + i), DL);
+		_mm_storeu_si128((__m128i *)(C + i + 8), DH);
 	}
+	
+	img_subtract_nsu(A + i, npixels - i, 1, B + i, C + i);
 }
-#endif
 
-/** @brief Subtract one image from another with AVX.
+/** @brief Subtract one image from another with AVX2.
  ** @param A one gray image.
  ** @param width image width.
  ** @param height image height.
  ** @param B another gray image.
  ** @param C difference image.
  **/		
-#ifdef __WIN_AVX__		
-void img_subtract_avx(const unsigned char *A, unsigned int width,
-                      unsigned int height, const unsigned char *B,
-			          short *C)
+CPU_TARGET_AVX2
+void img_subtract_avx2(const unsigned char *A, unsigned int width,
+                       unsigned int height, const unsigned char *B,
+			           short *C)
 {
 	unsigned int i;
-	unsigned int j;
 	unsigned int npixels;
 	const unsigned int ppl = 32;
-	const unsigned int pps = 16;
 	
-	__m256i Zero;
 	__m256i X;
 	__m256i XL;
 	__m256i XH;
 	__m256i Y;
 	__m256i YL;
 	__m256i YH;
-	__m256i DL;
-	__m256i DH;
 	
-	j = 0;
 	npixels = width * height;
-	Zero = _mm256_setzero_si256();
 	
-	for (i = 0; i < npixels; i += ppl) {
-		X = _mm256_load_si256((__m256i *)(A + i));
-		XL = _mm256_unpacklo_epi8(X, Zero);
-		XH = _mm256_unpackhi_epi8(X, Zero);
+	for (i = 0; i + ppl <= npixels; i += ppl) {
+		X = _mm256_loadu_si256((__m256i *)(A + i));
+		XL = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(X));
+		XH = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(X, 1));
+		
+		Y = _mm256_loadu_si256((__m256i *)(B + i));
+		YL = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(Y));
+		YH = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(Y, 1));
 		
-		Y = _mm256_load_si256((__m256i *)(B + i));
-		YL = _mm256_unpacklo_epi8(Y, Zero);
-		YH = _mm256_unpackhi_epi8(Y, Zero);
+		_mm256_storeu_si256((__m256i *)(C + i), _mm256_sub_epi16(XL, YL));
+		_mm256_storeu_si256((__m256i *)(C + i + 16), _mm256_sub_epi16(XH, YH));
+	}
+	
+	img_subtract_nsu(A + i, npixels - i, 1, B + i, C + i);
+}
+
+/** @brief Subtract one image from another with AVX-512.
+ ** @param A one gray image.
+ ** @param width image width.
+ ** @param height image height.
+ ** @param B another gray image.
+ ** @param C difference image.
+ **/		
+CPU_TARGET_AVX512BW
+void img_subtract_avx512(const unsigned char *A, unsigned int width,
+                         unsigned int height, const unsigned char *B,
+			             short *C)
+{
+	unsigned int i;
+	unsigned int npixels;
+	const unsigned int ppl = 64;
+	
+	__m512i X;
+	__m512i XL;
+	__m512i XH;
+	__m512i Y;
+	__m512i YL;
+	__m512i YH;
+	
+	npixels = width * height;
+	
+	for (i = 0; i + ppl <= npixels; i += ppl) {
+		X = _mm512_loadu_si512((const void *)(A + i));
+		XL = _mm512_cvtepu8_epi16(_mm512_castsi512_si256(X));
+		XH = _mm512_cvtepu8_epi16(_mm512_extracti64x4_epi64(X, 1));
 		
-		DL = _mm256_sub_epi16(XL, YL);
-		DH = _mm256_sub_epi16(XH, YH);
+		Y = _mm512_loadu_si512((const void *)(B + i));
+		YL = _mm512_cvtepu8_epi16(_mm512_castsi512_si256(Y));
+		YH = _mm512_cvtepu8_epi16(_mm512_extracti64x4_epi64(Y, 1));
 		
-		_mm256_store_si256((__m256i *)(C + j), DL);
-		j += pps;
-		_mm256_store_si256((__m256i *)(C + j), DH);
-		j += pps;
+		_mm512_storeu_si512((void *)(C + i), _mm512_sub_epi16(XL, YL));
+		_mm512_storeu_si512((void *)(C + i + 32), _mm512_sub_epi16(XH, YH));
 	}
+	
+	img_subtract_nsu(A + i, npixels - i, 1, B + i, C + i);
 }
 #endif
 	
@@ -320,5 +369,4 @@ void img_subtract_nsu(const unsigned char *A, unsigned int width,
 	for (i = 0; i < npixels; i++) {
 		C[i] = (short)A[i] - (short)B[i];
 	}
-}
-							
\ No newline at end of file
+}
\ No newline at end of file
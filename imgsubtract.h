@@ -21,6 +21,8 @@ extern "C"
 {
 #endif
 
+#include "cpu.h"
+
 /** @name Subtract one image from another.
  ** @{ */
 void img_subtract_kr(const unsigned char *A, unsigned int width,
@@ -31,6 +33,36 @@ void img_subtract(const unsigned char *A, unsigned int width,
 			      short *C);
 /** @} */
 
+/** @name Kernel variants, the ones above pick one by cpu_level.
+ ** @{ */
+#ifdef CPU_X86
+void img_subtract_kr_sse(const unsigned char *A, unsigned int width,
+                         unsigned int height, const unsigned char *B,
+			             unsigned char *C);
+void img_subtract_kr_avx2(const unsigned char *A, unsigned int width,
+                          unsigned int height, const unsigned char *B,
+			              unsigned char *C);
+void img_subtract_kr_avx512(const unsigned char *A, unsigned int width,
+                            unsigned int height, const unsigned char *B,
+			                unsigned char *C);
+void img_subtract_sse(const unsigned char *A, unsigned int width,
+                      unsigned int height, const unsigned char *B,
+			          short *C);
+void img_subtract_avx2(const unsigned char *A, unsigned int width,
+                       unsigned int height, const unsigned char *B,
+			           short *C);
+void img_subtract_avx512(const unsigned char *A, unsigned int width,
+                         unsigned int height, const unsigned char *B,
+			             short *C);
+#endif
+void img_subtract_kr_nsu(const unsigned char *A, unsigned int width,
+                         unsigned int height, const unsigned char *B,
+			             unsigned char *C);
+void img_subtract_nsu(const unsigned char *A, unsigned int width,
+                      unsigned int height, const unsigned char *B,
+			          short *C);
+/** @} */
+
 #ifdef __cplusplus
 }
 #endif
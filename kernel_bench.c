@@ -0,0 +1,885 @@
+/** @file kernel_bench.c
+ ** @brief Image kernel micro-benchmark, every compiled variant side by side
+ **        and checked against the scalar reference
+ ** @author Zhiwei Zeng
+ ** @date 2018.06.12
+ **/
+
+/*
+Copyright (C) 2018 Zhiwei Zeng.
+Copyright (C) 2018 Chengdu ZLT Technology Co., Ltd.
+All rights reserved.
+
+This file is part of the railway monitor toolkit and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "timer.h"
+#include "cpu.h"
+#include "imgadd.h"
+#include "imgsubtract.h"
+#include "imgmul.h"
+#include "brightfeature.h"
+#include "minfilter.h"
+#include "gaussfilter.h"
+#include "registration.h"
+#include "RDC.h"
+
+#define MIN_BENCH_TIME 200000
+#define MIN_BENCH_RUNS 5
+#define UNREG_WIDTH 1920
+#define UNREG_HEIGHT 1080
+#define BENCH_FIR_SIGMA 1.5f
+#define BENCH_IIR_SIGMA 4.5f
+#define BENCH_FIR_KSIZE 11
+#define BENCH_IIR_KSIZE 29
+#define BENCH_WARP_COS 0.9998477f
+#define BENCH_WARP_SIN 0.0174524f
+#define OUT_BYTES 6
+
+/** @typedef struct BenchData
+ ** @brief kernel inputs and output of one image size
+ **/
+typedef struct
+{
+	unsigned int width;				/**< image width. */
+	unsigned int height;			/**< image height. */
+	unsigned int npixels;			/**< pixels of image. */
+	unsigned char *a;				/**< gray image. */
+	unsigned char *b;				/**< another gray image. */
+	unsigned char *c;				/**< third gray image. */
+	unsigned short *raw;			/**< 14-bit infrared raw image. */
+	unsigned char *yuv;				/**< YUV420 visual image of UNREG_WIDTH x UNREG_HEIGHT. */
+	unsigned char *out;				/**< kernel output, up to OUT_BYTES per pixel. */
+	unsigned char *ref;				/**< reference kernel output. */
+	unsigned char *tmp;				/**< intermediate images of multi-pass kernels. */
+	int *offs;						/**< warp table source offsets of a scaling. */
+	unsigned short *fracs;			/**< warp table weights. */
+	Registration *regist;			/**< table mode registration instance of this size. */
+	Registration *affine;			/**< affine mode registration instance of this size. */
+	unsigned char *unwarped;		/**< 1 where affine mode leaves output unwarped, 2 where
+										 table mode does, 3 where both do. */
+	GaussFilter *gfir;				/**< FIR gaussian filter of this size. */
+	GaussFilter *giir;				/**< IIR gaussian filter of this size. */
+}BenchData;
+
+/* compare the output of len bytes with the reference, and write the
+   result into report. */
+typedef void (*CheckOutput)(BenchData *data, unsigned int len, char *report);
+
+/** @typedef struct KernelCase
+ ** @brief one variant of one kernel
+ **/
+typedef struct
+{
+	const char *kernel;						/**< kernel name. */
+	const char *variant;					/**< variant name. */
+	int ref;								/**< reference variant, run first. */
+	CpuLevel level;							/**< instruction set the variant needs. */
+	float traffic;							/**< input and output bytes per pixel. */
+	unsigned int (*run)(BenchData *data);	/**< run kernel, return output bytes. */
+	CheckOutput check;						/**< compare with reference, NULL for bit-exact. */
+}KernelCase;
+
+/* every variant runs through a wrapper of the same shape. */
+#define BINARY_CASE(fn, type) \
+static unsigned int run_##fn(BenchData *d) \
+{ \
+	fn(d->a, d->width, d->height, d->b, (type *)d->out); \
+	return d->npixels * sizeof(type); \
+}
+
+BINARY_CASE(img_add_kr_nsu, unsigned char)
+BINARY_CASE(img_add_nsu, unsigned short)
+BINARY_CASE(img_subtract_kr_nsu, unsigned char)
+BINARY_CASE(img_subtract_nsu, short)
+#ifdef CPU_X86
+BINARY_CASE(img_add_kr_sse, unsigned char)
+BINARY_CASE(img_add_sse, unsigned short)
+BINARY_CASE(img_subtract_kr_sse, unsigned char)
+BINARY_CASE(img_subtract_sse, short)
+BINARY_CASE(img_add_kr_avx2, unsigned char)
+BINARY_CASE(img_add_avx2, unsigned short)
+BINARY_CASE(img_subtract_kr_avx2, unsigned char)
+BINARY_CASE(img_subtract_avx2, short)
+BINARY_CASE(img_add_kr_avx512, unsigned char)
+BINARY_CASE(img_add_avx512, unsigned short)
+BINARY_CASE(img_subtract_kr_avx512, unsigned char)
+BINARY_CASE(img_subtract_avx512, short)
+#endif
+
+/* products stay in gray range like in suppress_bright_feature. */
+#define MUL_CASE(fn) \
+static unsigned int run_##fn(BenchData *d) \
+{ \
+	fn(d->a, d->width, d->height, 0.8f, d->out); \
+	return d->npixels; \
+}
+
+MUL_CASE(img_mul_s_kr_nsu)
+#ifdef CPU_X86
+MUL_CASE(img_mul_s_kr_sse)
+MUL_CASE(img_mul_s_kr_avx2)
+MUL_CASE(img_mul_s_kr_avx512)
+#endif
+
+/* infrared, visual and background images are a, b and c. Output is the
+   suppressed feature, the fusion image, the refined feature and the
+   histogram of the unsuppressed fusion image. */
+#define BRIGHT_FEATURE_CASE(extract, overlay) \
+static unsigned int run_##extract(BenchData *d) \
+{ \
+	unsigned int *hist = (unsigned int *)(d->out + 3 * d->npixels); \
+	extract(d->a, d->b, d->c, d->width, d->height, d->out + 2 * d->npixels, hist); \
+	overlay(d->b, d->out + 2 * d->npixels, d->width, d->height, 0.8f, d->out, \
+		d->out + d->npixels); \
+	return 3 * d->npixels + BRIGHT_FEATURE_BINS * sizeof(unsigned int); \
+}
+
+BRIGHT_FEATURE_CASE(bright_feature_extract_nsu, bright_feature_overlay_nsu)
+#ifdef CPU_X86
+BRIGHT_FEATURE_CASE(bright_feature_extract_sse, bright_feature_overlay_sse)
+BRIGHT_FEATURE_CASE(bright_feature_extract_avx2, bright_feature_overlay_avx2)
+BRIGHT_FEATURE_CASE(bright_feature_extract_avx512, bright_feature_overlay_avx512)
+#endif
+
+/* every row of the scaling table goes through the kernel like in
+   rm_regist_warp_image, with pseudo random weights. */
+#define REMAP_CASE(fn) \
+static unsigned int run_##fn(BenchData *d) \
+{ \
+	unsigned int y; \
+	for (y = 0; y < d->height; y++) { \
+		fn(d->yuv, UNREG_WIDTH, d->offs + y * d->width, d->fracs + y * d->width, \
+			d->width, d->out + y * d->width); \
+	} \
+	return d->npixels; \
+}
+
+REMAP_CASE(remap_row_nsu)
+#ifdef CPU_X86
+REMAP_CASE(remap_row_sse)
+REMAP_CASE(remap_row_avx2)
+#elif defined(__ARM_NEON__)
+REMAP_CASE(remap_row_neon)
+#endif
+
+/* rows are stepped across the visual image drifting down by 1/256 row
+   per pixel. Output is the offsets followed by the weights. */
+#define AFFINE_CASE(fn) \
+static unsigned int run_##fn(BenchData *d) \
+{ \
+	int *offs = (int *)d->out; \
+	unsigned short *fracs = (unsigned short *)(d->out + d->npixels * sizeof(int)); \
+	unsigned int y; \
+	for (y = 0; y < d->height; y++) { \
+		fn(4 << 16, (y * (UNREG_HEIGHT - 8) / d->height + 2) << 16, \
+			((UNREG_WIDTH - 8) << 16) / d->width, 1 << 8, UNREG_WIDTH, d->width, \
+			offs + y * d->width, fracs + y * d->width); \
+	} \
+	return d->npixels * (sizeof(int) + sizeof(unsigned short)); \
+}
+
+AFFINE_CASE(affine_row_nsu)
+#ifdef CPU_X86
+AFFINE_CASE(affine_row_sse)
+AFFINE_CASE(affine_row_avx2)
+#endif
+
+/* the whole image as one row, a and b being the two rows. */
+#define ROW_MIN_CASE(fn) \
+static unsigned int run_##fn(BenchData *d) \
+{ \
+	fn(d->a, d->b, d->npixels, d->out); \
+	return d->npixels; \
+}
+
+ROW_MIN_CASE(row_min_nsu)
+#ifdef CPU_X86
+ROW_MIN_CASE(row_min_sse)
+ROW_MIN_CASE(row_min_avx2)
+ROW_MIN_CASE(row_min_avx512)
+#endif
+
+/* kernels dispatching by cpu_level inside run once per level. */
+#define LEVEL_CASE(name, level) \
+static unsigned int run_##name##_##level(BenchData *d) \
+{ \
+	CpuLevel saved = cpu_level(); \
+	unsigned int len; \
+	cpu_set_level(CPU_LEVEL_##level); \
+	len = run_##name(d); \
+	cpu_set_level(saved); \
+	return len; \
+}
+
+/* the gaussian filter engine replicates the border while the references
+   do not, so only pixels a reference kernel radius inside are compared,
+   and they pass within the rounding the engine is built to. */
+#define INTERIOR_CHECK(name, ksize, tolerance) \
+static void check_##name(BenchData *d, unsigned int len, char *report) \
+{ \
+	check_interior(d, (ksize) >> 1, tolerance, report); \
+}
+
+static unsigned int run_gauss_fir(BenchData *d);
+static unsigned int run_gauss_iir(BenchData *d);
+
+LEVEL_CASE(gauss_fir, SCALAR)
+LEVEL_CASE(gauss_iir, SCALAR)
+#ifdef CPU_X86
+LEVEL_CASE(gauss_fir, SSE41)
+LEVEL_CASE(gauss_fir, AVX2)
+LEVEL_CASE(gauss_fir, AVX512BW)
+LEVEL_CASE(gauss_iir, SSE41)
+LEVEL_CASE(gauss_iir, AVX2)
+LEVEL_CASE(gauss_iir, AVX512BW)
+#endif
+
+static void check_interior(BenchData *d, unsigned int border, int tolerance, char *report);
+
+INTERIOR_CHECK(gauss_fir, BENCH_FIR_KSIZE, 1)
+INTERIOR_CHECK(gauss_iir, BENCH_IIR_KSIZE, 4)
+
+static unsigned int run_min_filter_nsu(BenchData *d);
+static unsigned int run_min_filter(BenchData *d);
+static unsigned int run_bright_feature_passes(BenchData *d);
+static unsigned int run_gauss_fir_nsu(BenchData *d);
+static unsigned int run_gauss_iir_nsu(BenchData *d);
+static unsigned int run_clahe(BenchData *d);
+static unsigned int run_warp_table(BenchData *d);
+static unsigned int run_warp_affine(BenchData *d);
+static unsigned int run_warp_nv12(BenchData *d);
+static void check_warp_affine(BenchData *d, unsigned int len, char *report);
+static int bench_data_init(BenchData *d, unsigned int width, unsigned int height);
+static void bench_data_free(BenchData *d);
+static int make_registration(BenchData *d);
+static int mark_unwarped(BenchData *d);
+static void bench_case(BenchData *d, const KernelCase *kc);
+static void check_exact(BenchData *d, unsigned int len, char *report);
+
+static const KernelCase cases[] = {
+	{"img_add_kr", "nsu", 1, CPU_LEVEL_SCALAR, 3, run_img_add_kr_nsu},
+#ifdef CPU_X86
+	{"img_add_kr", "sse", 0, CPU_LEVEL_SSE41, 3, run_img_add_kr_sse},
+	{"img_add_kr", "avx2", 0, CPU_LEVEL_AVX2, 3, run_img_add_kr_avx2},
+	{"img_add_kr", "avx512", 0, CPU_LEVEL_AVX512BW, 3, run_img_add_kr_avx512},
+#endif
+	{"img_add", "nsu", 1, CPU_LEVEL_SCALAR, 4, run_img_add_nsu},
+#ifdef CPU_X86
+	{"img_add", "sse", 0, CPU_LEVEL_SSE41, 4, run_img_add_sse},
+	{"img_add", "avx2", 0, CPU_LEVEL_AVX2, 4, run_img_add_avx2},
+	{"img_add", "avx512", 0, CPU_LEVEL_AVX512BW, 4, run_img_add_avx512},
+#endif
+	{"img_subtract_kr", "nsu", 1, CPU_LEVEL_SCALAR, 3, run_img_subtract_kr_nsu},
+#ifdef CPU_X86
+	{"img_subtract_kr", "sse", 0, CPU_LEVEL_SSE41, 3, run_img_subtract_kr_sse},
+	{"img_subtract_kr", "avx2", 0, CPU_LEVEL_AVX2, 3, run_img_subtract_kr_avx2},
+	{"img_subtract_kr", "avx512", 0, CPU_LEVEL_AVX512BW, 3, run_img_subtract_kr_avx512},
+#endif
+	{"img_subtract", "nsu", 1, CPU_LEVEL_SCALAR, 4, run_img_subtract_nsu},
+#ifdef CPU_X86
+	{"img_subtract", "sse", 0, CPU_LEVEL_SSE41, 4, run_img_subtract_sse},
+	{"img_subtract", "avx2", 0, CPU_LEVEL_AVX2, 4, run_img_subtract_avx2},
+	{"img_subtract", "avx512", 0, CPU_LEVEL_AVX512BW, 4, run_img_subtract_avx512},
+#endif
+	{"img_mul_s_kr", "nsu", 1, CPU_LEVEL_SCALAR, 2, run_img_mul_s_kr_nsu},
+#ifdef CPU_X86
+	{"img_mul_s_kr", "sse", 0, CPU_LEVEL_SSE41, 2, run_img_mul_s_kr_sse},
+	{"img_mul_s_kr", "avx2", 0, CPU_LEVEL_AVX2, 2, run_img_mul_s_kr_avx2},
+	{"img_mul_s_kr", "avx512", 0, CPU_LEVEL_AVX512BW, 2, run_img_mul_s_kr_avx512},
+#endif
+	{"bright_feature", "passes", 1, CPU_LEVEL_SCALAR, 20, run_bright_feature_passes},
+	{"bright_feature", "nsu", 0, CPU_LEVEL_SCALAR, 8, run_bright_feature_extract_nsu},
+#ifdef CPU_X86
+	{"bright_feature", "sse", 0, CPU_LEVEL_SSE41, 8, run_bright_feature_extract_sse},
+	{"bright_feature", "avx2", 0, CPU_LEVEL_AVX2, 8, run_bright_feature_extract_avx2},
+	{"bright_feature", "avx512", 0, CPU_LEVEL_AVX512BW, 8, run_bright_feature_extract_avx512},
+#endif
+	{"min_filter", "nsu", 1, CPU_LEVEL_SCALAR, 2, run_min_filter_nsu},
+	{"min_filter", "vhgw", 0, CPU_LEVEL_SCALAR, 2, run_min_filter},
+	{"row_min", "nsu", 1, CPU_LEVEL_SCALAR, 3, run_row_min_nsu},
+#ifdef CPU_X86
+	{"row_min", "sse", 0, CPU_LEVEL_SSE41, 3, run_row_min_sse},
+	{"row_min", "avx2", 0, CPU_LEVEL_AVX2, 3, run_row_min_avx2},
+	{"row_min", "avx512", 0, CPU_LEVEL_AVX512BW, 3, run_row_min_avx512},
+#endif
+	{"gauss_fir", "nsu", 1, CPU_LEVEL_SCALAR, 2, run_gauss_fir_nsu},
+	{"gauss_fir", "scalar", 0, CPU_LEVEL_SCALAR, 2, run_gauss_fir_SCALAR, check_gauss_fir},
+#ifdef CPU_X86
+	{"gauss_fir", "sse", 0, CPU_LEVEL_SSE41, 2, run_gauss_fir_SSE41, check_gauss_fir},
+	{"gauss_fir", "avx2", 0, CPU_LEVEL_AVX2, 2, run_gauss_fir_AVX2, check_gauss_fir},
+	{"gauss_fir", "avx512", 0, CPU_LEVEL_AVX512BW, 2, run_gauss_fir_AVX512BW, check_gauss_fir},
+#endif
+	{"gauss_iir", "nsu", 1, CPU_LEVEL_SCALAR, 2, run_gauss_iir_nsu},
+	{"gauss_iir", "scalar", 0, CPU_LEVEL_SCALAR, 2, run_gauss_iir_SCALAR, check_gauss_iir},
+#ifdef CPU_X86
+	{"gauss_iir", "sse", 0, CPU_LEVEL_SSE41, 2, run_gauss_iir_SSE41, check_gauss_iir},
+	{"gauss_iir", "avx2", 0, CPU_LEVEL_AVX2, 2, run_gauss_iir_AVX2, check_gauss_iir},
+	{"gauss_iir", "avx512", 0, CPU_LEVEL_AVX512BW, 2, run_gauss_iir_AVX512BW, check_gauss_iir},
+#endif
+#ifdef __WIN_SSE__
+	{"clahe", "sse", 1, CPU_LEVEL_SCALAR, 3.5f, run_clahe},
+#else
+	{"clahe", "nsu", 1, CPU_LEVEL_SCALAR, 3.5f, run_clahe},
+#endif
+	{"warp", "table", 1, CPU_LEVEL_SCALAR, 3, run_warp_table},
+	{"warp", "affine", 0, CPU_LEVEL_SCALAR, 3, run_warp_affine, check_warp_affine},
+	{"warp", "nv12", 0, CPU_LEVEL_SCALAR, 3, run_warp_nv12},
+	{"remap_row", "nsu", 1, CPU_LEVEL_SCALAR, 8, run_remap_row_nsu},
+#ifdef CPU_X86
+	{"remap_row", "sse", 0, CPU_LEVEL_SSE41, 8, run_remap_row_sse},
+	{"remap_row", "avx2", 0, CPU_LEVEL_AVX2, 8, run_remap_row_avx2},
+#elif defined(__ARM_NEON__)
+	{"remap_row", "neon", 0, CPU_LEVEL_SCALAR, 8, run_remap_row_neon},
+#endif
+	{"affine_row", "nsu", 1, CPU_LEVEL_SCALAR, 6, run_affine_row_nsu},
+#ifdef CPU_X86
+	{"affine_row", "sse", 0, CPU_LEVEL_SSE41, 6, run_affine_row_sse},
+	{"affine_row", "avx2", 0, CPU_LEVEL_AVX2, 6, run_affine_row_avx2},
+#endif
+};
+
+int main(int argc, char *argv[])
+{
+	unsigned int sizes[][2] = {{384, 288}, {640, 480}};
+	BenchData data;
+	unsigned int i, j;
+
+	printf("cpu %s, kernels dispatch to %s\n", cpu_level_name(cpu_detect()),
+		cpu_level_name(cpu_level()));
+	printf("%-16s %-8s %9s %10s %9s %s\n", "kernel", "variant", "size", "ns/pixel",
+		"GB/s", "check");
+
+	for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+		if (bench_data_init(&data, sizes[i][0], sizes[i][1])) {
+			fprintf(stderr, "bench_data_init fail[%s:%d].\n", __FILE__, __LINE__);
+			return -1;
+		}
+
+		for (j = 0; j < sizeof(cases) / sizeof(cases[0]); j++) {
+			bench_case(&data, &cases[j]);
+		}
+
+		bench_data_free(&data);
+	}
+
+	return 0;
+}
+
+/* the image arithmetic fusion_thread ran before the fused kernels, one
+   full-image pass per step, dispatched by cpu_level. */
+unsigned int run_bright_feature_passes(BenchData *d)
+{
+	unsigned int *hist = (unsigned int *)(d->out + 3 * d->npixels);
+	unsigned char *brft = d->tmp;
+	unsigned char *etbk = d->tmp + d->npixels;
+	unsigned short *usfn = (unsigned short *)(d->tmp + 2 * d->npixels);
+	unsigned int i;
+
+	img_subtract_kr(d->a, d->width, d->height, d->c, brft);
+	img_subtract_kr(d->b, d->width, d->height, d->a, etbk);
+	img_subtract_kr(brft, d->width, d->height, etbk, d->out + 2 * d->npixels);
+	img_add(d->b, d->width, d->height, d->out + 2 * d->npixels, usfn);
+
+	memset(hist, 0, BRIGHT_FEATURE_BINS * sizeof(unsigned int));
+	for (i = 0; i < d->npixels; i++) {
+		hist[usfn[i]]++;
+	}
+
+	img_mul_s_kr(d->out + 2 * d->npixels, d->width, d->height, 0.8f, d->out);
+	img_add_kr(d->b, d->width, d->height, d->out, d->out + d->npixels);
+
+	return 3 * d->npixels + BRIGHT_FEATURE_BINS * sizeof(unsigned int);
+}
+
+/* kernel sizes and sigma are the ones BkgReconst uses. */
+unsigned int run_min_filter_nsu(BenchData *d)
+{
+	min_filter_nsu(d->a, d->width, d->height, 11, d->out);
+	return d->npixels;
+}
+
+/* row minimums are dispatched by cpu_level, the scratch rows are the
+   first ones of tmp. */
+unsigned int run_min_filter(BenchData *d)
+{
+	min_filter(d->a, d->width, d->height, 11, d->tmp, d->out);
+	return d->npixels;
+}
+
+/* a sigma small enough for FIR. References are 2D convolutions of
+   radius 3 sigma, so they differ from the engine near image border. */
+unsigned int run_gauss_fir_nsu(BenchData *d)
+{
+	gauss_filter_nsu(d->a, d->width, d->height, BENCH_FIR_KSIZE, BENCH_FIR_SIGMA, d->out);
+	return d->npixels;
+}
+
+unsigned int run_gauss_fir(BenchData *d)
+{
+	gauss_filter(d->gfir, d->a, d->out);
+	return d->npixels;
+}
+
+/* the sigma BkgReconst uses. */
+unsigned int run_gauss_iir_nsu(BenchData *d)
+{
+	gauss_filter_nsu(d->a, d->width, d->height, BENCH_IIR_KSIZE, BENCH_IIR_SIGMA, d->out);
+	return d->npixels;
+}
+
+unsigned int run_gauss_iir(BenchData *d)
+{
+	gauss_filter(d->giir, d->a, d->out);
+	return d->npixels;
+}
+
+/* RDC keeps its CLAHE state in a single instance, so it is timed through
+   its public interface, the raw recombination and YUV420 output included. */
+unsigned int run_clahe(BenchData *d)
+{
+	unsigned int len;
+
+	RDC_SendRawData((unsigned char *)d->raw, d->npixels * sizeof(unsigned short));
+	RDC_GetFrame(d->out, &len);
+
+	return len;
+}
+
+/* affine mode steps 16.16 coordinates from the matrix fitted to the
+   tables, so a pixel may round 1 apart from table mode. Pixels whose
+   source falls in (-1, 0) are clamped into the image by table mode but
+   left unwarped by affine mode, see check_warp_affine. */
+unsigned int run_warp_table(BenchData *d)
+{
+	rm_regist_warp_image(d->regist, d->yuv, d->out);
+	return d->npixels * 3 >> 1;
+}
+
+unsigned int run_warp_affine(BenchData *d)
+{
+	rm_regist_warp_image(d->affine, d->yuv, d->out);
+	return d->npixels * 3 >> 1;
+}
+
+/* NV12 output is put back into I420 layout, so it is checked against the
+   table mode planes. Y outside the warped spans is left as the caller had
+   it, hence the copy in. */
+unsigned int run_warp_nv12(BenchData *d)
+{
+	unsigned char *udata = d->out + d->npixels;
+	unsigned char *vdata = udata + (d->npixels >> 2);
+	unsigned int i;
+
+	memmove(d->tmp, d->out, d->npixels);
+	rm_regist_set_format(d->regist, WARP_FORMAT_NV12);
+	rm_regist_warp_image(d->regist, d->yuv, d->tmp);
+	rm_regist_set_format(d->regist, WARP_FORMAT_I420);
+
+	memmove(d->out, d->tmp, d->npixels);
+	for (i = 0; i < d->npixels >> 2; i++) {
+		udata[i] = d->tmp[d->npixels + 2 * i];
+		vdata[i] = d->tmp[d->npixels + 2 * i + 1];
+	}
+
+	return d->npixels * 3 >> 1;
+}
+
+/** @brief Allocate and fill kernel inputs of one image size.
+ ** @param d benchmark data.
+ ** @param width image width.
+ ** @param height image height.
+ ** @return  0 if success,
+ **         -1 if fail.
+ **/
+int bench_data_init(BenchData *d, unsigned int width, unsigned int height)
+{
+	unsigned int seed = 20180612;
+	unsigned int i;
+
+	memset(d, 0, sizeof(BenchData));
+	d->width = width;
+	d->height = height;
+	d->npixels = width * height;
+
+	/* the SIMD loads may run a vector past the last pixel. */
+	d->a = (unsigned char *)malloc(d->npixels + 32);
+	d->b = (unsigned char *)malloc(d->npixels + 32);
+	d->c = (unsigned char *)malloc(d->npixels + 32);
+	d->raw = (unsigned short *)malloc(d->npixels * sizeof(unsigned short));
+	d->yuv = (unsigned char *)malloc(UNREG_WIDTH * UNREG_HEIGHT * 3 >> 1);
+	d->out = (unsigned char *)malloc(d->npixels * OUT_BYTES);
+	d->ref = (unsigned char *)malloc(d->npixels * OUT_BYTES);
+	d->tmp = (unsigned char *)malloc(d->npixels * 4);
+	d->offs = (int *)malloc(d->npixels * sizeof(int));
+	d->fracs = (unsigned short *)malloc(d->npixels * sizeof(unsigned short));
+	if (!d->a || !d->b || !d->c || !d->raw || !d->yuv || !d->out || !d->ref || !d->tmp ||
+		!d->offs || !d->fracs) {
+		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+		goto clean;
+	}
+
+	/* same pseudo random images on every run. */
+	for (i = 0; i < d->npixels; i++) {
+		seed = seed * 1103515245 + 12345;
+		d->a[i] = (unsigned char)(seed >> 16);
+		seed = seed * 1103515245 + 12345;
+		d->b[i] = (unsigned char)(seed >> 16);
+		seed = seed * 1103515245 + 12345;
+		d->c[i] = (unsigned char)(seed >> 16);
+		d->raw[i] = (unsigned short)((seed >> 8) & 0x3FFF);
+	}
+
+	/* visual pixels are below 128, so that weights a rounding step apart
+	   in both directions move a warped pixel by less than 1. */
+	for (i = 0; i < UNREG_WIDTH * UNREG_HEIGHT * 3 >> 1; i++) {
+		seed = seed * 1103515245 + 12345;
+		d->yuv[i] = (unsigned char)(seed >> 17) & 0x7F;
+	}
+
+	/* top-left neighbours stay one row and column inside the Y plane. */
+	for (i = 0; i < d->npixels; i++) {
+		seed = seed * 1103515245 + 12345;
+		d->offs[i] = i / width * (UNREG_HEIGHT - 2) / height * UNREG_WIDTH +
+			i % width * (UNREG_WIDTH - 2) / width;
+		d->fracs[i] = (unsigned short)(seed >> 16);
+	}
+
+	if (RDC_Init(23, 384 == width ? 15 : 16)) {
+		fprintf(stderr, "RDC_Init fail[%s:%d].\n", __FILE__, __LINE__);
+		goto clean;
+	}
+
+	d->gfir = gauss_filter_new();
+	d->giir = gauss_filter_new();
+	if (!d->gfir || !d->giir) {
+		fprintf(stderr, "gauss_filter_new fail[%s:%d].\n", __FILE__, __LINE__);
+		goto clean;
+	}
+
+	if (gauss_filter_init(d->gfir, width, height, BENCH_FIR_SIGMA, GAUSS_MODE_FIR) ||
+		gauss_filter_init(d->giir, width, height, BENCH_IIR_SIGMA, GAUSS_MODE_IIR)) {
+		fprintf(stderr, "gauss_filter_init fail[%s:%d].\n", __FILE__, __LINE__);
+		goto clean;
+	}
+
+	if (make_registration(d)) {
+		fprintf(stderr, "make_registration fail[%s:%d].\n", __FILE__, __LINE__);
+		clean:bench_data_free(d);
+		return -1;
+	}
+
+	return 0;
+}
+
+/** @brief Free kernel inputs.
+ ** @param d benchmark data.
+ **/
+void bench_data_free(BenchData *d)
+{
+	free(d->a);
+	free(d->b);
+	free(d->c);
+	free(d->raw);
+	free(d->yuv);
+	free(d->out);
+	free(d->ref);
+	free(d->tmp);
+	free(d->offs);
+	free(d->fracs);
+	free(d->unwarped);
+
+	if (d->regist) {
+		rm_regist_delete(d->regist);
+	}
+
+	if (d->affine) {
+		rm_regist_delete(d->affine);
+	}
+
+	if (d->gfir) {
+		gauss_filter_delete(d->gfir);
+	}
+
+	if (d->giir) {
+		gauss_filter_delete(d->giir);
+	}
+
+	memset(d, 0, sizeof(BenchData));
+}
+
+/** @brief Create table and affine mode registration instances which scale
+ **        the visual image to the infrared size and turn it by a degree
+ **        around its centre, so that corners fall outside it like in a real
+ **        calibration. The interpolation tables go through temporary text
+ **        files since that is how rm_regist_init takes them, and no binary
+ **        table is kept.
+ ** @param d benchmark data.
+ ** @return  0 if success,
+ **         -1 if fail.
+ **/
+int make_registration(BenchData *d)
+{
+	const char *rtf = "kernel_bench_rtab.txt";
+	const char *ctf = "kernel_bench_ctab.txt";
+	int points[6 * 2];
+	FILE *rfp, *cfp;
+	unsigned int x, y;
+	float cx, cy;
+	float u, v;
+	int ret;
+
+	rfp = fopen(rtf, "w");
+	cfp = fopen(ctf, "w");
+	if (!rfp || !cfp) {
+		fprintf(stderr, "fopen fail[%s:%d].\n", __FILE__, __LINE__);
+		if (rfp) {
+			fclose(rfp);
+		}
+		if (cfp) {
+			fclose(cfp);
+		}
+		return -1;
+	}
+
+	cx = (UNREG_WIDTH - 2) * 0.5f;
+	cy = (UNREG_HEIGHT - 2) * 0.5f;
+
+	for (y = 0; y < d->height; y++) {
+		for (x = 0; x < d->width; x++) {
+			u = (float)x * (UNREG_WIDTH - 2) / d->width - cx;
+			v = (float)y * (UNREG_HEIGHT - 2) / d->height - cy;
+			fprintf(rfp, "%f ", cy + u * BENCH_WARP_SIN + v * BENCH_WARP_COS);
+			fprintf(cfp, "%f ", cx + u * BENCH_WARP_COS - v * BENCH_WARP_SIN);
+		}
+		fprintf(rfp, "\n");
+		fprintf(cfp, "\n");
+	}
+
+	fclose(rfp);
+	fclose(cfp);
+
+	/* only checked for count, the tables above are used. */
+	memset(points, 0, sizeof(points));
+
+	d->regist = rm_regist_new();
+	d->affine = rm_regist_new();
+	if (!d->regist || !d->affine) {
+		fprintf(stderr, "rm_regist_new fail[%s:%d].\n", __FILE__, __LINE__);
+		ret = -1;
+	} else if (rm_regist_init(d->regist, d->width, d->height, UNREG_WIDTH, UNREG_HEIGHT,
+		points, 6, NULL, rtf, ctf, WARP_MODE_TABLE) ||
+		rm_regist_init(d->affine, d->width, d->height, UNREG_WIDTH, UNREG_HEIGHT,
+		points, 6, NULL, rtf, ctf, WARP_MODE_AFFINE)) {
+		fprintf(stderr, "rm_regist_init fail[%s:%d].\n", __FILE__, __LINE__);
+		ret = -1;
+	} else {
+		ret = mark_unwarped(d);
+	}
+
+	remove(rtf);
+	remove(ctf);
+
+	return ret;
+}
+
+/** @brief Mark the output pixels each mode leaves unwarped. A black
+ **        image is warped over a white Y plane, so that warped pixels are
+ **        0 and unwarped ones keep Y or get the neutral chroma.
+ ** @param d benchmark data.
+ ** @return  0 if success,
+ **         -1 if fail.
+ **/
+int mark_unwarped(BenchData *d)
+{
+	unsigned char *black;
+	unsigned int i;
+
+	black = (unsigned char *)calloc(UNREG_WIDTH * UNREG_HEIGHT * 3 >> 1, 1);
+	d->unwarped = (unsigned char *)malloc(d->npixels * 3 >> 1);
+	if (!black || !d->unwarped) {
+		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+		free(black);
+		return -1;
+	}
+
+	memset(d->unwarped, 0xFF, d->npixels);
+	memset(d->tmp, 0xFF, d->npixels);
+	rm_regist_warp_image(d->affine, black, d->unwarped);
+	rm_regist_warp_image(d->regist, black, d->tmp);
+	free(black);
+
+	for (i = 0; i < d->npixels * 3 >> 1; i++) {
+		d->unwarped[i] = (unsigned char)((d->unwarped[i] ? 1 : 0) | (d->tmp[i] ? 2 : 0));
+	}
+
+	return 0;
+}
+
+/** @brief Time one kernel variant and check its output.
+ **        GB/s counts each input and output image byte once.
+ ** @param d benchmark data.
+ ** @param kc kernel variant.
+ **/
+void bench_case(BenchData *d, const KernelCase *kc)
+{
+	long long start, elapsed;
+	unsigned int runs = 0;
+	unsigned int len;
+	double seconds;
+	char size[16];
+	char report[256];
+
+	if (kc->level > cpu_detect()) {
+		return;
+	}
+
+	memset(d->out, 0, d->npixels * OUT_BYTES);
+	len = kc->run(d);
+
+	if (kc->ref) {
+		memmove(d->ref, d->out, len);
+		strcpy(report, "reference");
+	} else if (kc->check) {
+		kc->check(d, len, report);
+	} else {
+		check_exact(d, len, report);
+	}
+
+	start = timer_now_us();
+	do {
+		kc->run(d);
+		runs++;
+		elapsed = timer_now_us() - start;
+	} while (elapsed < MIN_BENCH_TIME || runs < MIN_BENCH_RUNS);
+
+	seconds = elapsed * 1e-6 / runs;
+	sprintf(size, "%ux%u", d->width, d->height);
+
+	printf("%-16s %-8s %9s %10.3f %9.2f ", kc->kernel, kc->variant, size,
+		seconds * 1e9 / d->npixels, kc->traffic * d->npixels / seconds * 1e-9);
+
+	printf("%s\n", report);
+}
+
+/** @brief Compare output with the reference byte by byte.
+ ** @param d benchmark data.
+ ** @param len output bytes.
+ ** @param report check result.
+ **/
+void check_exact(BenchData *d, unsigned int len, char *report)
+{
+	unsigned int i;
+	unsigned int diffs = 0;
+	int diff, max_diff = 0;
+
+	for (i = 0; i < len; i++) {
+		diff = d->out[i] - d->ref[i];
+		diff = diff < 0 ? -diff : diff;
+		if (diff) {
+			diffs++;
+			if (diff > max_diff) {
+				max_diff = diff;
+			}
+		}
+	}
+
+	if (!diffs) {
+		strcpy(report, "bit-exact");
+	} else {
+		sprintf(report, "%u bytes differ, max %d", diffs, max_diff);
+	}
+}
+
+/** @brief Compare the pixels of a gray image output at least border
+ **        pixels inside with the reference, within a tolerance.
+ ** @param d benchmark data.
+ ** @param border image border rows and columns not compared.
+ ** @param tolerance largest difference which passes.
+ ** @param report check result.
+ **/
+void check_interior(BenchData *d, unsigned int border, int tolerance, char *report)
+{
+	unsigned int x, y, i;
+	unsigned int fails = 0;
+	int diff, max_diff = 0;
+
+	for (y = border; y + border < d->height; y++) {
+		for (x = border; x + border < d->width; x++) {
+			i = y * d->width + x;
+			diff = d->out[i] - d->ref[i];
+			diff = diff < 0 ? -diff : diff;
+			if (diff > tolerance) {
+				fails++;
+			}
+			if (diff > max_diff) {
+				max_diff = diff;
+			}
+		}
+	}
+
+	if (!fails) {
+		sprintf(report, "pass, interior max %d within %d", max_diff, tolerance);
+	} else {
+		sprintf(report, "FAIL, %u interior pixels past %d, max %d", fails, tolerance,
+			max_diff);
+	}
+}
+
+/** @brief Compare affine mode warp with table mode. Pixels affine mode
+ **        leaves unwarped are counted on a line of their own and not
+ **        compared, the others pass within 1. Unwarped pixels table mode
+ **        warps are the ones whose source falls in (-1, 0), which table
+ **        mode clamps into the image.
+ ** @param d benchmark data.
+ ** @param len output bytes.
+ ** @param report check result.
+ **/
+void check_warp_affine(BenchData *d, unsigned int len, char *report)
+{
+	unsigned int i;
+	unsigned int luma = 0, chroma = 0;
+	unsigned int luma_clamped = 0, chroma_clamped = 0;
+	unsigned int fails = 0;
+	int diff, max_diff = 0;
+	char size[16];
+
+	for (i = 0; i < len; i++) {
+		if (d->unwarped[i] & 1) {
+			if (i < d->npixels) {
+				luma++;
+				luma_clamped += !(d->unwarped[i] & 2);
+			} else {
+				chroma++;
+				chroma_clamped += !(d->unwarped[i] & 2);
+			}
+			continue;
+		}
+
+		diff = d->out[i] - d->ref[i];
+		diff = diff < 0 ? -diff : diff;
+		if (diff > 1) {
+			fails++;
+		}
+		if (diff > max_diff) {
+			max_diff = diff;
+		}
+	}
+
+	sprintf(size, "%ux%u", d->width, d->height);
+	if (!fails) {
+		report += sprintf(report, "pass, max %d within 1\n", max_diff);
+	} else {
+		report += sprintf(report, "FAIL, %u bytes past 1, max %d\n", fails, max_diff);
+	}
+
+	/* U and V planes share spans, so chroma pixels are half the bytes. */
+	sprintf(report, "%-16s %-8s %9s %u Y and %u chroma pixels unwarped, %u and %u "
+		"clamped by table mode", "warp", "affine", size, luma, chroma >> 1, luma_clamped,
+		chroma_clamped >> 1);
+}
\ No newline at end of file
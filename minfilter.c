@@ -20,15 +20,143 @@ the terms of the BSD license (see the COPYING file).
 
 #include "minfilter.h"
 
-/** @brief Minimum filter.
+#ifdef CPU_X86
+#	include <immintrin.h>
+#endif
+
+/* element wise minimum of two rows, all min_filter work goes through it. */
+typedef void (*RowMin)(const unsigned char *a, const unsigned char *b,
+                       unsigned int n, unsigned char *c);
+
+/** @name some private functions.
+ ** @{ */
+static void replicate_border(unsigned char *minf_image, unsigned int width,
+                             unsigned int height, unsigned int krad);
+/** @} */
+
+/* row kernels by CpuLevel. */
+#ifdef CPU_X86
+static const RowMin row_min_fns[CPU_LEVELS] = {
+	row_min_nsu, row_min_sse, row_min_avx2, row_min_avx512
+};
+#else
+static const RowMin row_min_fns[CPU_LEVELS] = {
+	row_min_nsu, row_min_nsu, row_min_nsu, row_min_nsu
+};
+#endif
+
+/** @brief Get size of the scratch buffer min_filter needs.
+ ** @param width image width.
+ ** @param ksize kernel size.
+ ** @return scratch buffer bytes.
+ **/
+unsigned int min_filter_scratch(unsigned int width, unsigned int ksize)
+{
+	return (((ksize >> 1) << 1) + 3) * width;
+}
+
+/** @brief Minimum filter. The square window is split into a vertical
+ **        and a horizontal pass. The vertical pass is van Herk/Gil-Werman
+ **        over blocks of ksize rows, about 3 row minimums per row whatever
+ **        the kernel size. The horizontal pass doubles the window span
+ **        in place, log2(ksize) + 1 row minimums per row. Both are whole
+ **        row minimums which are vectorized by cpu_level.
+ **        Pixels closer than ksize / 2 to image border copy the nearest
+ **        pixel filtered with a whole window, like min_filter_nsu.
  ** @param image input image.
  ** @param width image width.
  ** @param height image height.
- ** @param minf_image minimum filtered image.
+ ** @param ksize kernel size.
+ ** @param scratch buffer of min_filter_scratch bytes, which the caller
+ **        allocates once, min_filter runs every frame.
+ ** @param minf_image minimum filtered image, not the input image.
  **/
 void min_filter(const unsigned char *image, unsigned int width,
                 unsigned int height, unsigned int ksize,
-			    unsigned char *minf_image)
+			    unsigned char *scratch, unsigned char *minf_image)
+{
+	RowMin row_min;
+	unsigned int krad;
+	unsigned int kw;
+	unsigned int span;
+	unsigned int r0, s, e, j, y;
+	unsigned char *sufx;
+	unsigned char *pref;
+	unsigned char *line;
+	const unsigned char *pmin;
+	
+	assert(image);
+	assert(scratch);
+	assert(minf_image);
+	assert(image != minf_image);
+	
+	krad = ksize >> 1;
+	kw = (krad << 1) + 1;
+	if (width < kw || height < kw) {
+		return;
+	}
+	
+	/* suffix minimum rows of a block, running prefix minimum row and the
+	   row being filtered horizontally. */
+	sufx = scratch;
+	pref = sufx + kw * width;
+	line = pref + width;
+	row_min = row_min_fns[cpu_level()];
+	
+	/* vertical pass. Window starting at row s in block r0 is the suffix
+	   minimum of s in its block and the prefix minimum of the next block
+	   up to row s + kw - 1. */
+	for (r0 = 0; r0 + kw <= height; r0 += kw) {
+		memmove(sufx + (kw - 1) * width, image + (r0 + kw - 1) * width, width);
+		for (j = kw - 1; j > 0; j--) {
+			row_min(image + (r0 + j - 1) * width, sufx + j * width, width,
+				sufx + (j - 1) * width);
+		}
+		
+		memmove(minf_image + (r0 + krad) * width, sufx, width);
+		
+		pmin = image + (r0 + kw) * width;
+		for (j = 1; j < kw; j++) {
+			s = r0 + j;
+			if (s + kw > height) {
+				break;
+			}
+			
+			e = s + kw - 1;
+			if (j > 1) {
+				row_min(pmin, image + e * width, width, pref);
+				pmin = pref;
+			}
+			
+			row_min(sufx + j * width, pmin, width, minf_image + (s + krad) * width);
+		}
+	}
+	
+	/* horizontal pass. After each doubling line[x] is the minimum of
+	   span pixels from x, two overlapping spans make up the window. */
+	for (y = krad; y < height - krad; y++) {
+		memmove(line, minf_image + y * width, width);
+		for (span = 1; span << 1 <= kw; span <<= 1) {
+			row_min(line, line + span, width - (span << 1) + 1, line);
+		}
+		
+		row_min(line, line + kw - span, width - kw + 1, minf_image + y * width + krad);
+	}
+	
+	replicate_border(minf_image, width, height, krad);
+}
+
+/** @brief Minimum filter scanning the whole window of every pixel, it is
+ **        the reference of min_filter.
+ ** @param image input image.
+ ** @param width image width.
+ ** @param height image height.
+ ** @param ksize kernel size.
+ ** @param minf_image minimum filtered image.
+ **/
+void min_filter_nsu(const unsigned char *image, unsigned int width,
+                    unsigned int height, unsigned int ksize,
+			        unsigned char *minf_image)
 {	
 	unsigned int krad;
 	unsigned int x, y;
@@ -52,6 +180,102 @@ void min_filter(const unsigned char *image, unsigned int width,
 		}
 	}
 	
+	replicate_border(minf_image, width, height, krad);
+}
+
+/** @brief Element wise minimum of two rows no speed up.
+ ** @param a one row.
+ ** @param b another row.
+ ** @param n row length.
+ ** @param c minimum row, may be a.
+ **/
+void row_min_nsu(const unsigned char *a, const unsigned char *b,
+                 unsigned int n, unsigned char *c)
+{
+	unsigned int i;
+	
+	for (i = 0; i < n; i++) {
+		c[i] = a[i] < b[i] ? a[i] : b[i];
+	}
+}
+
+#ifdef CPU_X86
+/** @brief Element wise minimum of two rows with SSE.
+ ** @param a one row.
+ ** @param b another row.
+ ** @param n row length.
+ ** @param c minimum row, may be a.
+ **/
+CPU_TARGET_SSE41
+void row_min_sse(const unsigned char *a, const unsigned char *b,
+                 unsigned int n, unsigned char *c)
+{
+	unsigned int i;
+	const unsigned int ppl = 16;
+	
+	for (i = 0; i + ppl <= n; i += ppl) {
+		_mm_storeu_si128((__m128i *)(c + i), _mm_min_epu8(
+			_mm_loadu_si128((__m128i *)(a + i)), _mm_loadu_si128((__m128i *)(b + i))));
+	}
+	
+	row_min_nsu(a + i, b + i, n - i, c + i);
+}
+
+/** @brief Element wise minimum of two rows with AVX2.
+ ** @param a one row.
+ ** @param b another row.
+ ** @param n row length.
+ ** @param c minimum row, may be a.
+ **/
+CPU_TARGET_AVX2
+void row_min_avx2(const unsigned char *a, const unsigned char *b,
+                  unsigned int n, unsigned char *c)
+{
+	unsigned int i;
+	const unsigned int ppl = 32;
+	
+	for (i = 0; i + ppl <= n; i += ppl) {
+		_mm256_storeu_si256((__m256i *)(c + i), _mm256_min_epu8(
+			_mm256_loadu_si256((__m256i *)(a + i)), _mm256_loadu_si256((__m256i *)(b + i))));
+	}
+	
+	row_min_nsu(a + i, b + i, n - i, c + i);
+}
+
+/** @brief Element wise minimum of two rows with AVX-512.
+ ** @param a one row.
+ ** @param b another row.
+ ** @param n row length.
+ ** @param c minimum row, may be a.
+ **/
+CPU_TARGET_AVX512BW
+void row_min_avx512(const unsigned char *a, const unsigned char *b,
+                    unsigned int n, unsigned char *c)
+{
+	unsigned int i;
+	const unsigned int ppl = 64;
+	
+	for (i = 0; i + ppl <= n; i += ppl) {
+		_mm512_storeu_si512((void *)(c + i), _mm512_min_epu8(
+			_mm512_loadu_si512((void *)(a + i)), _mm512_loadu_si512((void *)(b + i))));
+	}
+	
+	row_min_nsu(a + i, b + i, n - i, c + i);
+}
+#endif
+
+/** @brief Copy the nearest pixel filtered with a whole window to the
+ **        pixels near image border.
+ ** @param minf_image minimum filtered image.
+ ** @param width image width.
+ ** @param height image height.
+ ** @param krad kernel radius.
+ **/
+void replicate_border(unsigned char *minf_image, unsigned int width,
+                      unsigned int height, unsigned int krad)
+{
+	unsigned int x, y;
+	
 	for (y = 0; y < krad; y++) {
 		memmove(minf_image + y * width, minf_image + krad * width, width * sizeof(unsigned char));
 	}
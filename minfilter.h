@@ -21,9 +21,33 @@ extern "C"
 {
 #endif
 
+#include "cpu.h"
+
+/** @name Minimum filter, min_filter_nsu is the reference of min_filter.
+ ** @{ */
+unsigned int min_filter_scratch(unsigned int width, unsigned int ksize);
 void min_filter(const unsigned char *image, unsigned int width,
                 unsigned int height, unsigned int ksize,
-				unsigned char *minf_image);
+				unsigned char *scratch, unsigned char *minf_image);
+void min_filter_nsu(const unsigned char *image, unsigned int width,
+                    unsigned int height, unsigned int ksize,
+				    unsigned char *minf_image);
+/** @} */
+
+/** @name Row kernel variants, min_filter picks one by cpu_level. c is the
+ **       element wise minimum of rows a and b, and may be a.
+ ** @{ */
+#ifdef CPU_X86
+void row_min_sse(const unsigned char *a, const unsigned char *b,
+                 unsigned int n, unsigned char *c);
+void row_min_avx2(const unsigned char *a, const unsigned char *b,
+                  unsigned int n, unsigned char *c);
+void row_min_avx512(const unsigned char *a, const unsigned char *b,
+                    unsigned int n, unsigned char *c);
+#endif
+void row_min_nsu(const unsigned char *a, const unsigned char *b,
+                 unsigned int n, unsigned char *c);
+/** @} */
 
 #ifdef __cplusplus
 }
@@ -20,8 +20,17 @@ the terms of the BSD license (see the COPYING file).
 
 #include "quadtree.h"
 
+#ifdef CPU_X86
+#	include <immintrin.h>
+#endif
+
+/* fold a row into running column minimums and maximums. */
+typedef void (*RowMinMax)(const unsigned char *row, unsigned int n,
+                          unsigned char *minr, unsigned char *maxr);
+
 /** @typedef enum Corner
- ** @brief enumerate corner
+ ** @brief enumerate corner, also the offset of a child from four times
+ **        its father's index in the node array.
  **/
 typedef enum
 {
@@ -31,61 +40,153 @@ typedef enum
 	LRC								/**< lower right corner. */
 }Corner;
 
+/** @typedef enum NodeState
+ ** @brief enumerate node state
+ **/
+typedef enum
+{
+	UNUSED = 0,						/**< node not in this decomposition. */
+	LEAF,							/**< leaf node. */
+	SPLIT							/**< node split into four children. */
+}NodeState;
+
 /** @typedef struct QNode
- ** @brief quadtree node structure
+ ** @brief quadtree node structure. Nodes live in a flat array in level
+ **        order, node i has children 4i+1 to 4i+4 and father (i-1)/4.
  **/
-typedef struct tagQNode
+typedef struct
 {
 	Blob blob;						/**< image blob. */
-	struct tagQNode *next[4];		/**< children nodes. */
+	unsigned int state;				/**< node state. */
+	unsigned char minval;			/**< minimum gray value of blob. */
+	unsigned char maxval;			/**< maximum gray value of blob. */
 }QNode;
 
 struct tagQTree
 {
-	QNode *root;					/**< root node. */
-	unsigned int depth;				/**< quadtree depth. */
-	unsigned int minbw;				/**< minimum blob width. */		
+	QNode *nodes;					/**< node array of a full tree. */
+	unsigned int levels;			/**< quadtree levels at most. */
+	unsigned int nnodes;			/**< number of nodes of a full tree. */
+	unsigned int ncells;			/**< cells per side on the deepest level. */
+	unsigned int *xcuts;			/**< column boundaries of deepest cells. */
+	unsigned int *ycuts;			/**< row boundaries of deepest cells. */
+	unsigned char *minr;			/**< column minimums of a row of cells. */
+	unsigned char *maxr;			/**< column maximums of a row of cells. */
+	unsigned int width;				/**< image width. */
+	unsigned int height;			/**< image height. */
+	unsigned int minbw;				/**< minimum blob width. */
 	unsigned int minbh;				/**< minimum blob height. */
 	unsigned int mingr;				/**< minimum gray range. */
 };
 
 /** @name some private functions
  ** @{ */
-static void split_blob(QTree *self, QNode *root, Quadrant quad,
-                       const unsigned char *image, unsigned int width,
-					   unsigned int height);
-static void get_leafnode(QNode *root, Blob *blobs, int *nblobs);
-static QNode *add_node(QTree *self, Blob *blob);
-static void add_child_node(QNode *root, QNode *node);
-static int which_child_of_father(const Blob *father, const Blob *child);
-static void delete_all_nodes(QNode *root);
+static void make_cuts(unsigned int *cuts, unsigned int ncells, unsigned int size);
+static unsigned int spread_bits(unsigned int a);
+static void min_max_pyramid(QTree *self, const unsigned char *image);
+static void split_node(QNode *nodes, unsigned int index);
+static void row_min_max_nsu(const unsigned char *row, unsigned int n,
+                            unsigned char *minr, unsigned char *maxr);
+#ifdef CPU_X86
+static void row_min_max_sse(const unsigned char *row, unsigned int n,
+                            unsigned char *minr, unsigned char *maxr);
+static void row_min_max_avx2(const unsigned char *row, unsigned int n,
+                             unsigned char *minr, unsigned char *maxr);
+static void row_min_max_avx512(const unsigned char *row, unsigned int n,
+                               unsigned char *minr, unsigned char *maxr);
+#endif
 /** @} */
 
+/* row kernels by CpuLevel. */
+#ifdef CPU_X86
+static const RowMinMax row_min_max_fns[CPU_LEVELS] = {
+	row_min_max_nsu, row_min_max_sse, row_min_max_avx2, row_min_max_avx512
+};
+#else
+static const RowMinMax row_min_max_fns[CPU_LEVELS] = {
+	row_min_max_nsu, row_min_max_nsu, row_min_max_nsu, row_min_max_nsu
+};
+#endif
+
 /** @brief Create a new instance of quadtree.
  ** @return a new instance of quadtree.
  **/
 QTree *qtree_new()
 {
 	QTree *self = (QTree *)malloc(sizeof(QTree));
+	if (self) {
+		memset(self, 0, sizeof(QTree));
+	}
+	
 	return self;
 }
 
-/** @brief Initialize quadtree.
+/** @brief Initialize quadtree. Nodes of the deepest possible tree are
+ **        allocated here, decomposing an image allocates nothing.
  ** @param self quadtree instance.
+ ** @param width image width.
+ ** @param height image height.
  ** @param minbw minimum blob width.
  ** @param minbh minimum blob height.
  ** @param mingr minimum blob gray range.
+ ** @return  0 if success,
+ **         -1 if fail.
  **/
-void qtree_init(QTree *self, unsigned int minbw,
-                unsigned int minbh, unsigned int mingr)
+int qtree_init(QTree *self, unsigned int width, unsigned int height,
+               unsigned int minbw, unsigned int minbh, unsigned int mingr)
 {
+	unsigned int bw = width;
+	unsigned int bh = height;
+	unsigned int level_nodes = 1;
+	
 	assert(self);
 	
-	self->root = NULL;
-	self->depth = 0;
+	self->width = width;
+	self->height = height;
 	self->minbw = minbw;
 	self->minbh = minbh;
 	self->mingr = mingr;
+	
+	/* halves are at most half of the blob size rounded up, so the
+	   largest blob of each level bounds the depth. */
+	self->levels = 1;
+	self->nnodes = 1;
+	while (bw > minbw && bh > minbh && bw > 1 && bh > 1) {
+		bw = (bw + 1) >> 1;
+		bh = (bh + 1) >> 1;
+		level_nodes <<= 2;
+		self->levels++;
+		self->nnodes += level_nodes;
+	}
+	
+	self->ncells = 1 << (self->levels - 1);
+	
+	self->nodes = (QNode *)malloc(self->nnodes * sizeof(QNode));
+	if (!self->nodes) {
+		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+		return -1;
+	}
+	
+	memset(self->nodes, 0, self->nnodes * sizeof(QNode));
+	
+	self->xcuts = (unsigned int *)malloc((self->ncells + 1) * sizeof(unsigned int));
+	self->ycuts = (unsigned int *)malloc((self->ncells + 1) * sizeof(unsigned int));
+	if (!self->xcuts || !self->ycuts) {
+		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+		return -1;
+	}
+	
+	make_cuts(self->xcuts, self->ncells, width);
+	make_cuts(self->ycuts, self->ncells, height);
+	
+	self->minr = (unsigned char *)malloc(width);
+	self->maxr = (unsigned char *)malloc(width);
+	if (!self->minr || !self->maxr) {
+		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+		return -1;
+	}
+	
+	return 0;
 }
 
 /** @brief Delete quadtree instance.
@@ -94,17 +195,38 @@ void qtree_init(QTree *self, unsigned int minbw,
 void qtree_delete(QTree *self)
 {
 	if (self) {
-		delete_all_nodes(self->root);
-		
-		self->root = NULL;
-		self->depth = 0;
+		if (self->nodes) {
+			free(self->nodes);
+			self->nodes = NULL;
+		}
+		if (self->xcuts) {
+			free(self->xcuts);
+			self->xcuts = NULL;
+		}
+		if (self->ycuts) {
+			free(self->ycuts);
+			self->ycuts = NULL;
+		}
+		if (self->minr) {
+			free(self->minr);
+			self->minr = NULL;
+		}
+		if (self->maxr) {
+			free(self->maxr);
+			self->maxr = NULL;
+		}
 		
 		free(self);
 		self = NULL;
 	}
 }
 
-/** @brief Decompose image into blobs with quadtree structure.
+/** @brief Decompose image into blobs with quadtree structure. Gray
+ **        ranges of all possible nodes come from a min/max pyramid built
+ **        first. Nodes are then visited level by level, each node either
+ **        splits into its four children or marks them unused, so every
+ **        node is rewritten and nothing is left over from the previous
+ **        image.
  ** @param self quadtree instance.
  ** @param image single channel image.
  ** @param width image width.
@@ -115,18 +237,59 @@ void qtree_decompose(QTree *self,
 					 unsigned int width,
 					 unsigned int height)
 {
-	QNode *root = NULL;
-	Quadrant quad;
+	QNode *nodes;
+	QNode *node;
+	unsigned int parents;
+	unsigned int bw, bh;
+	unsigned int i;
 	
 	assert(self);
 	assert(image);
+	assert(width == self->width && height == self->height);
+	
+	min_max_pyramid(self, image);
+	
+	nodes = self->nodes;
+	nodes[0].blob.quad.top = 0;
+	nodes[0].blob.quad.left = 0;
+	nodes[0].blob.quad.bottom = height;
+	nodes[0].blob.quad.right = width;
+	nodes[0].state = LEAF;
 	
-	quad.top = 0;
-	quad.left = 0;
-	quad.bottom = height;
-	quad.right = width;
+	/* nodes with children in the array. */
+	parents = (self->nnodes - 1) >> 2;
 	
-	split_blob(self, root, quad, image, width, height);
+	for (i = 0; i < self->nnodes; i++) {
+		node = &nodes[i];
+		if (UNUSED == node->state) {
+			if (i < parents) {
+				nodes[4 * i + TLC].state = UNUSED;
+				nodes[4 * i + TRC].state = UNUSED;
+				nodes[4 * i + LLC].state = UNUSED;
+				nodes[4 * i + LRC].state = UNUSED;
+			}
+			continue;
+		}
+		
+		node->blob.range = node->maxval - node->minval;
+		
+		bw = node->blob.quad.right - node->blob.quad.left;
+		bh = node->blob.quad.bottom - node->blob.quad.top;
+		
+		if (bw > self->minbw && bh > self->minbh && node->blob.range > self->mingr) {
+			assert(i < parents);
+			node->state = SPLIT;
+			split_node(nodes, i);
+		} else {
+			node->state = LEAF;
+			if (i < parents) {
+				nodes[4 * i + TLC].state = UNUSED;
+				nodes[4 * i + TRC].state = UNUSED;
+				nodes[4 * i + LLC].state = UNUSED;
+				nodes[4 * i + LRC].state = UNUSED;
+			}
+		}
+	}
 }
 
 /** @brief Get leaf node of quadtree.
@@ -136,308 +299,281 @@ void qtree_decompose(QTree *self,
  **/
 int gtree_get_leafnode(QTree *self, Blob *blobs)
 {
+	const QNode *nodes;
+	unsigned int i;
 	int nblobs = 0;
 	
 	assert(self);
 	assert(blobs);
-
-	get_leafnode(self->root, blobs, &nblobs);
+	
+	nodes = self->nodes;
+	for (i = 0; i < self->nnodes; i++) {
+		if (LEAF == nodes[i].state) {
+			blobs[nblobs] = nodes[i].blob;
+			blobs[nblobs].node = i;
+			nblobs++;
+		}
+	}
 	
 	return nblobs;
 }
 
-/** @brief Reset quadtree.
+/** @brief Get number of nodes of a full tree, node indexes of blobs
+ **        are below it.
  ** @param self quadtree instance.
+ ** @return number of nodes.
  **/
-void qtree_reset(QTree *self)
+unsigned int qtree_nodes(QTree *self)
 {
 	assert(self);
-	
-	delete_all_nodes(self->root);
-	
-	self->root = NULL;
-	self->depth = 0;
+	return self->nnodes;
 }
 
-/** @brief Split image blob with quadtree.
+/** @brief Reset quadtree. Nodes are marked unused, none is freed.
  ** @param self quadtree instance.
- ** @param root root node.
- ** @param quad blob quadrant.
- ** @param image single channel image.
- ** @param width image width.
- ** @param height image height.
  **/
-void split_blob(QTree *self, QNode *root, Quadrant quad,
-                const unsigned char *image, unsigned int width,
-				unsigned int height)
+void qtree_reset(QTree *self)
 {
-	Blob blob;
-	unsigned int range;
-	unsigned char *rptr;
-	unsigned char val;
-	unsigned char minval = 0xFF;
-	unsigned char maxval = 0;
-	unsigned int bw, bh;
-	unsigned int x, y;
-	unsigned int horizon_middle;
-	unsigned int vertical_middle;
-	Quadrant tlc_blob;
-	Quadrant trc_blob;
-	Quadrant llc_blob;
-	Quadrant lrc_blob;
-
-	/* blob gray range. */
-	for (y = quad.top; y < quad.bottom; y++) {
-		rptr = (unsigned char *)(image + y * width);
-		for (x = quad.left; x < quad.right; x++) {
-			val = *(rptr + x);
-			if (val < minval) {
-				minval = val;
-			}
-			if (val > maxval) {
-				maxval = val;
-			}
-		}
-	}
+	unsigned int i;
 	
-	bw = quad.right - quad.left;
-	bh = quad.bottom - quad.top;
-	range = maxval - minval;
-
-	blob.quad.top = quad.top;
-	blob.quad.left = quad.left;
-	blob.quad.bottom = quad.bottom;
-	blob.quad.right = quad.right;
-	blob.range = range;
-
-	/* add node to tree. */
-	root = add_node(self, &blob);
+	assert(self);
 	
-	/* split blob if possible. */
-	if (bw > self->minbw && bh > self->minbh && range > self->mingr) {
-		horizon_middle = (quad.top + quad.bottom) >> 1;
-		vertical_middle = (quad.left + quad.right) >> 1;
-		
-		/* top left corner. */
-		tlc_blob.top = quad.top;
-		tlc_blob.left = quad.left;
-		tlc_blob.bottom = horizon_middle;
-		tlc_blob.right = vertical_middle;
-
-		split_blob(self, root->next[0], tlc_blob, image, width, height);
-
-		/* top right corner. */
-		trc_blob.top = quad.top;
-		trc_blob.left = vertical_middle;
-		trc_blob.bottom = horizon_middle;
-		trc_blob.right = quad.right;
-		
-		split_blob(self, root->next[1], trc_blob, image, width, height);
-		
-		/* lower left corner. */
-		llc_blob.top = horizon_middle;
-		llc_blob.left = quad.left;
-		llc_blob.bottom = quad.bottom;
-		llc_blob.right = vertical_middle;
-		
-		split_blob(self, root->next[2], llc_blob, image, width, height);
-		
-		/*lower right corner.*/
-		lrc_blob.top = horizon_middle;
-		lrc_blob.left = vertical_middle;
-		lrc_blob.bottom = quad.bottom;
-		lrc_blob.right = quad.right;
-		
-		split_blob(self, root->next[3], lrc_blob, image, width, height);
+	for (i = 0; i < self->nnodes; i++) {
+		self->nodes[i].state = UNUSED;
 	}
 }
 
-/** @brief Add node to tree.
- ** @param self quadtree instance.
- ** @param blob image blob.
- ** @return added node.
+/** @brief Split [0, size) into ncells intervals by halving, the way
+ **        nodes are split.
+ ** @param cuts ncells + 1 interval boundaries.
+ ** @param ncells number of intervals, power of 2.
+ ** @param size length to split.
  **/
-QNode *add_node(QTree *self, Blob *blob)
+void make_cuts(unsigned int *cuts, unsigned int ncells, unsigned int size)
 {
-	QNode *child = NULL;
-	
-	child = (QNode *)malloc(sizeof(QNode));
-	assert(child);
-	
-	child->blob.quad.top = blob->quad.top;
-	child->blob.quad.left = blob->quad.left;
-	child->blob.quad.bottom = blob->quad.bottom;
-	child->blob.quad.right = blob->quad.right;
-	child->blob.range = blob->range;
-	child->next[0] = NULL;
-	child->next[1] = NULL;
-	child->next[2] = NULL;
-	child->next[3] = NULL;
-	
-	if (!self->root) {
-		self->root = child;
-	} else {
-		add_child_node(self->root, child);
-	}
+	unsigned int step, k;
 	
-	self->depth++;
-	
-	return child;
+	cuts[0] = 0;
+	cuts[ncells] = size;
+	for (step = ncells; step > 1; step >>= 1) {
+		for (k = 0; k < ncells; k += step) {
+			cuts[k + (step >> 1)] = (cuts[k] + cuts[k + step]) >> 1;
+		}
+	}
 }
 
-/** @brief Add child node to father node.
- ** @param root father node.
- ** @param node child node.
+/** @brief Spread bits of a to even bit positions.
+ ** @param a value below 65536.
+ ** @return spread bits.
  **/
-void add_child_node(QNode *root, QNode *node)
+unsigned int spread_bits(unsigned int a)
 {
-	int child_id;
+	a = (a | (a << 8)) & 0x00FF00FF;
+	a = (a | (a << 4)) & 0x0F0F0F0F;
+	a = (a | (a << 2)) & 0x33333333;
+	a = (a | (a << 1)) & 0x55555555;
 	
-	child_id = which_child_of_father(&root->blob, &node->blob);
-	if (-1 == child_id) {
-		return;
-	}
+	return a;
+}
+
+/** @brief Build gray minimums and maximums of all nodes of a full tree.
+ **        Deepest cells take one pass over the image: rows of a row of
+ **        cells are folded into column minimums and maximums, which are
+ **        then reduced per cell. Upper nodes combine their four children.
+ **        Children of a node are its top and bottom halves crossed with
+ **        its left and right halves, so the deepest cell in row r and
+ **        column c is node first + 2 * spread(r) + spread(c).
+ ** @param self quadtree instance.
+ ** @param image single channel image.
+ **/
+void min_max_pyramid(QTree *self, const unsigned char *image)
+{
+	RowMinMax row_min_max = row_min_max_fns[cpu_level()];
+	QNode *nodes = self->nodes;
+	QNode *node;
+	const QNode *child;
+	unsigned char *minr = self->minr;
+	unsigned char *maxr = self->maxr;
+	unsigned int ncells = self->ncells;
+	unsigned int first = self->nnodes - ncells * ncells;
+	unsigned int width = self->width;
+	unsigned int r, c, x, y, i, k;
+	unsigned int ycode;
+	unsigned char minval, maxval;
 	
-	switch (child_id) {
-	case TLC:
-	{
-		if (!root->next[0]) {
-			root->next[0] = node;
-		} else {
-			add_child_node(root->next[0], node);
-		}
-	}
-		break;
-	case TRC:
-	{
-		if (!root->next[1]) {
-			root->next[1] = node;
-		} else {
-			add_child_node(root->next[1], node);
+	for (r = 0; r < ncells; r++) {
+		memset(minr, 0xFF, width);
+		memset(maxr, 0, width);
+		for (y = self->ycuts[r]; y < self->ycuts[r + 1]; y++) {
+			row_min_max(image + y * width, width, minr, maxr);
 		}
-	}
-		break;
-	case LLC:
-	{
-		if (!root->next[2]) {
-			root->next[2] = node;
-		} else {
-			add_child_node(root->next[2], node);
+		
+		ycode = spread_bits(r) << 1;
+		for (c = 0; c < ncells; c++) {
+			minval = 0xFF;
+			maxval = 0;
+			for (x = self->xcuts[c]; x < self->xcuts[c + 1]; x++) {
+				minval = minr[x] < minval ? minr[x] : minval;
+				maxval = maxr[x] > maxval ? maxr[x] : maxval;
+			}
+			
+			node = &nodes[first + (ycode | spread_bits(c))];
+			node->minval = minval;
+			node->maxval = maxval;
 		}
 	}
-		break;
-	case LRC:
-	{
-		if (!root->next[3]) {
-			root->next[3] = node;
-		} else {
-			add_child_node(root->next[3], node);
+	
+	for (i = first; i > 0; i--) {
+		node = &nodes[i - 1];
+		child = &nodes[4 * (i - 1) + TLC];
+		minval = child[0].minval;
+		maxval = child[0].maxval;
+		for (k = 1; k < 4; k++) {
+			minval = child[k].minval < minval ? child[k].minval : minval;
+			maxval = child[k].maxval > maxval ? child[k].maxval : maxval;
 		}
-	}
-		break;
-	default:
-		break;
+		
+		node->minval = minval;
+		node->maxval = maxval;
 	}
 }
 
-/** @brief Which child of father.
- ** @param father father blob.
- ** @param child child blob.
- ** @return child identity if found,
- **            -1 if not found.
+/** @brief Split node into four children, which become leaves until
+ **        their own turn comes.
+ ** @param nodes node array.
+ ** @param index node index.
  **/
-int which_child_of_father(const Blob *father, const Blob *child)
+void split_node(QNode *nodes, unsigned int index)
 {
+	const Quadrant *quad = &nodes[index].blob.quad;
 	unsigned int horizon_middle;
 	unsigned int vertical_middle;
+	QNode *child;
 	
-	horizon_middle = (father->quad.top + father->quad.bottom) >> 1;
-	vertical_middle = (father->quad.left + father->quad.right) >> 1;
-	
-	if (child->quad.left >= father->quad.left &&
-		child->quad.right <= vertical_middle &&
-		child->quad.top >= father->quad.top &&
-		child->quad.bottom <= horizon_middle) {
-		return TLC;
-	} else if (child->quad.left >= vertical_middle &&
-		child->quad.right <= father->quad.right &&
-		child->quad.top >= father->quad.top &&
-		child->quad.bottom <= horizon_middle) {
-		return TRC;
-	} else if (child->quad.left >= father->quad.left &&
-		child->quad.right <= vertical_middle &&
-		child->quad.top >= horizon_middle &&
-		child->quad.bottom <= father->quad.bottom) {
-		return LLC;
-	} else if (child->quad.left >= vertical_middle &&
-		child->quad.right <= father->quad.right &&
-		child->quad.top >= horizon_middle &&
-		child->quad.bottom <= father->quad.bottom) {
-		return LRC;
-	} else {
-		return -1;
-	}
+	horizon_middle = (quad->top + quad->bottom) >> 1;
+	vertical_middle = (quad->left + quad->right) >> 1;
+	
+	/* top left corner. */
+	child = &nodes[4 * index + TLC];
+	child->blob.quad.top = quad->top;
+	child->blob.quad.left = quad->left;
+	child->blob.quad.bottom = horizon_middle;
+	child->blob.quad.right = vertical_middle;
+	child->state = LEAF;
+	
+	/* top right corner. */
+	child = &nodes[4 * index + TRC];
+	child->blob.quad.top = quad->top;
+	child->blob.quad.left = vertical_middle;
+	child->blob.quad.bottom = horizon_middle;
+	child->blob.quad.right = quad->right;
+	child->state = LEAF;
+	
+	/* lower left corner. */
+	child = &nodes[4 * index + LLC];
+	child->blob.quad.top = horizon_middle;
+	child->blob.quad.left = quad->left;
+	child->blob.quad.bottom = quad->bottom;
+	child->blob.quad.right = vertical_middle;
+	child->state = LEAF;
+	
+	/* lower right corner. */
+	child = &nodes[4 * index + LRC];
+	child->blob.quad.top = horizon_middle;
+	child->blob.quad.left = vertical_middle;
+	child->blob.quad.bottom = quad->bottom;
+	child->blob.quad.right = quad->right;
+	child->state = LEAF;
 }
 
-/** @brief Get leaf node fo quadtree.
- ** @param root root node.
- ** @param nblobs number of blobs.
+/** @brief Fold a row into column minimums and maximums, no speed up.
+ ** @param row image row.
+ ** @param n row length.
+ ** @param minr column minimums.
+ ** @param maxr column maximums.
  **/
-void get_leafnode(QNode *root, Blob *blobs, int *nblobs)
-{	
-	if (!root) {
-		return;
+void row_min_max_nsu(const unsigned char *row, unsigned int n,
+                     unsigned char *minr, unsigned char *maxr)
+{
+	unsigned int i;
+	
+	for (i = 0; i < n; i++) {
+		minr[i] = row[i] < minr[i] ? row[i] : minr[i];
+		maxr[i] = row[i] > maxr[i] ? row[i] : maxr[i];
 	}
+}
 
-	if (NULL == root->next[0] &&
-		NULL == root->next[1] &&
-		NULL == root->next[2] &&
-		NULL == root->next[3]) {
-		blobs[*nblobs].quad.top = root->blob.quad.top;
-		blobs[*nblobs].quad.left = root->blob.quad.left;
-		blobs[*nblobs].quad.bottom = root->blob.quad.bottom;
-		blobs[*nblobs].quad.right = root->blob.quad.right;
-		blobs[*nblobs].range = root->blob.range;
-		(*nblobs)++;
-	}
+#ifdef CPU_X86
+/** @brief Fold a row into column minimums and maximums with SSE.
+ ** @param row image row.
+ ** @param n row length.
+ ** @param minr column minimums.
+ ** @param maxr column maximums.
+ **/
+CPU_TARGET_SSE41
+void row_min_max_sse(const unsigned char *row, unsigned int n,
+                     unsigned char *minr, unsigned char *maxr)
+{
+	unsigned int i;
+	const unsigned int ppl = 16;
+	__m128i R;
 	
-	if (root->next[0]) {
-		get_leafnode(root->next[0], blobs, nblobs);
+	for (i = 0; i + ppl <= n; i += ppl) {
+		R = _mm_loadu_si128((__m128i *)(row + i));
+		_mm_storeu_si128((__m128i *)(minr + i), _mm_min_epu8(R, _mm_loadu_si128((__m128i *)(minr + i))));
+		_mm_storeu_si128((__m128i *)(maxr + i), _mm_max_epu8(R, _mm_loadu_si128((__m128i *)(maxr + i))));
 	}
 	
-	if (root->next[1]) {
-		get_leafnode(root->next[1], blobs, nblobs);
-	}
+	row_min_max_nsu(row + i, n - i, minr + i, maxr + i);
+}
+
+/** @brief Fold a row into column minimums and maximums with AVX2.
+ ** @param row image row.
+ ** @param n row length.
+ ** @param minr column minimums.
+ ** @param maxr column maximums.
+ **/
+CPU_TARGET_AVX2
+void row_min_max_avx2(const unsigned char *row, unsigned int n,
+                      unsigned char *minr, unsigned char *maxr)
+{
+	unsigned int i;
+	const unsigned int ppl = 32;
+	__m256i R;
 	
-	if (root->next[2]) {
-		get_leafnode(root->next[2], blobs, nblobs);
+	for (i = 0; i + ppl <= n; i += ppl) {
+		R = _mm256_loadu_si256((__m256i *)(row + i));
+		_mm256_storeu_si256((__m256i *)(minr + i),
+			_mm256_min_epu8(R, _mm256_loadu_si256((__m256i *)(minr + i))));
+		_mm256_storeu_si256((__m256i *)(maxr + i),
+			_mm256_max_epu8(R, _mm256_loadu_si256((__m256i *)(maxr + i))));
 	}
 	
-	if (root->next[3]) {
-		get_leafnode(root->next[3], blobs, nblobs);
-	}
+	row_min_max_nsu(row + i, n - i, minr + i, maxr + i);
 }
 
-/** @brief Delete all nodes.
- ** @param root root node.
+/** @brief Fold a row into column minimums and maximums with AVX-512.
+ ** @param row image row.
+ ** @param n row length.
+ ** @param minr column minimums.
+ ** @param maxr column maximums.
  **/
-void delete_all_nodes(QNode *root)
+CPU_TARGET_AVX512BW
+void row_min_max_avx512(const unsigned char *row, unsigned int n,
+                        unsigned char *minr, unsigned char *maxr)
 {
-	QNode *second_node;
-	QNode *third_node;
-	QNode *fourth_node;
-	
-	if (root) {
-		second_node = root->next[1];
-		third_node = root->next[2];
-		fourth_node = root->next[3];
-		
-		delete_all_nodes(root->next[0]);
+	unsigned int i;
+	const unsigned int ppl = 64;
+	__m512i R;
 	
-		free(root);
-		
-		delete_all_nodes(second_node);
-		delete_all_nodes(third_node);
-		delete_all_nodes(fourth_node);
+	for (i = 0; i + ppl <= n; i += ppl) {
+		R = _mm512_loadu_si512((void *)(row + i));
+		_mm512_storeu_si512((void *)(minr + i),
+			_mm512_min_epu8(R, _mm512_loadu_si512((void *)(minr + i))));
+		_mm512_storeu_si512((void *)(maxr + i),
+			_mm512_max_epu8(R, _mm512_loadu_si512((void *)(maxr + i))));
 	}
-}
\ No newline at end of file
+	
+	row_min_max_nsu(row + i, n - i, minr + i, maxr + i);
+}
+#endif
\ No newline at end of file
@@ -21,6 +21,8 @@ extern "C"
 {
 #endif
 
+#include "cpu.h"
+
 /** @typedef struct Quadrant
  ** @brief quadrant structure
  **/
@@ -39,6 +41,8 @@ typedef struct
 {
 	Quadrant quad;			/**< blob position. */
 	unsigned int range;		/**< blob gray range. */
+	unsigned int node;		/**< quadtree node index, the same blob
+							     position always has the same index. */
 }Blob;
 
 /** @typedef struct QTree
@@ -50,8 +54,8 @@ typedef struct tagQTree QTree;
 /** @name Create, Initialize, and destroy
  ** @{ */
 QTree *qtree_new();
-void qtree_init(QTree *self, unsigned int minbw,
-                unsigned int minbh, unsigned int mingr);
+int qtree_init(QTree *self, unsigned int width, unsigned int height,
+               unsigned int minbw, unsigned int minbh, unsigned int mingr);
 void qtree_delete(QTree *self);
 /** @} */
 
@@ -62,6 +66,7 @@ void qtree_decompose(QTree *self,
 					 unsigned int width,
 					 unsigned int height);
 int gtree_get_leafnode(QTree *self, Blob *blobs);
+unsigned int qtree_nodes(QTree *self);
 void qtree_reset(QTree *self);
 /** @} */
 
@@ -0,0 +1,104 @@
+/** @file regist_convert.c
+ ** @brief Converts text registration interpolation tables to the binary
+ **        table file Registration memory maps
+ ** @author Zhiwei Zeng
+ ** @date 2018.06.20
+ **/
+
+/*
+Copyright (C) 2018 Zhiwei Zeng.
+Copyright (C) 2018 Chengdu ZLT Technology Co., Ltd.
+All rights reserved.
+
+This file is part of the railway monitor toolkit and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "registration.h"
+
+static void usage(const char *prog);
+static int parse_size(const char *arg, int *width, int *height);
+
+int main(int argc, char *argv[])
+{
+	int base_width = 384;
+	int base_height = 288;
+	int unreg_width = 1920;
+	int unreg_height = 1080;
+	const char *rtf = "interpY.txt";
+	const char *ctf = "interpX.txt";
+	const char *btf = "interp.bin";
+	int i;
+
+	for (i = 1; i < argc; i++) {
+		if (i + 1 >= argc) {
+			usage(argv[0]);
+			return -1;
+		}
+
+		if (!strcmp(argv[i], "-s")) {
+			if (parse_size(argv[++i], &base_width, &base_height)) {
+				usage(argv[0]);
+				return -1;
+			}
+		} else if (!strcmp(argv[i], "-u")) {
+			if (parse_size(argv[++i], &unreg_width, &unreg_height)) {
+				usage(argv[0]);
+				return -1;
+			}
+		} else if (!strcmp(argv[i], "-r")) {
+			rtf = argv[++i];
+		} else if (!strcmp(argv[i], "-c")) {
+			ctf = argv[++i];
+		} else if (!strcmp(argv[i], "-o")) {
+			btf = argv[++i];
+		} else {
+			usage(argv[0]);
+			return -1;
+		}
+	}
+
+	if (rm_regist_convert(base_width, base_height, unreg_width, unreg_height,
+		rtf, ctf, btf)) {
+		fprintf(stderr, "rm_regist_convert fail[%s:%d].\n", __FILE__, __LINE__);
+		return -1;
+	}
+
+	printf("%s and %s written to %s\n", rtf, ctf, btf);
+
+	return 0;
+}
+
+/** @brief Print command line usage.
+ ** @param prog program name.
+ **/
+void usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [options]\n"
+		"  -s WxH    infrared (base) frame size, default 384x288\n"
+		"  -u WxH    visual (unregistered) frame size, default 1920x1080\n"
+		"  -r file   row interpolation table text, default interpY.txt\n"
+		"  -c file   column interpolation table text, default interpX.txt\n"
+		"  -o file   binary interpolation table, default interp.bin\n", prog);
+}
+
+/** @brief Parse image size.
+ ** @param arg size string like 384x288.
+ ** @param width image width.
+ ** @param height image height.
+ ** @return  0 if success,
+ **         -1 if fail.
+ **/
+int parse_size(const char *arg, int *width, int *height)
+{
+	if (2 != sscanf(arg, "%dx%d", width, height) || *width <= 0 || *height <= 0) {
+		return -1;
+	}
+
+	return 0;
+}
\ No newline at end of file
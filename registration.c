@@ -18,10 +18,27 @@ the terms of the BSD license (see the COPYING file).
 #include <string.h>
 #include <assert.h>
 #include <math.h>
-#include <io.h>
+#ifdef _WIN32
+#	include <io.h>
+#	include <windows.h>
+#else
+#	include <unistd.h>
+#	include <fcntl.h>
+#	include <sys/mman.h>
+#	include <sys/stat.h>
+#	define _access access
+#endif
 
 #include "registration.h"
 
+#ifdef CPU_X86
+#	include <immintrin.h>
+#endif
+
+#ifdef __ARM_NEON__
+#	include <arm_neon.h>
+#endif
+
 /** @typedef RegistrationConst
  ** @brief Registration enumerate variables
  **/
@@ -29,17 +46,89 @@ typedef enum
 {
 	NAMELEN = 256,			/**< length of file name. */
 	MIN_POINT_SIZE = 6,		/**< minimum control point number. */
+	TABLE_VERSION = 1,		/**< binary interpolation table file version. */
+	WARP_BITS = 8,			/**< fraction bits of compiled warp weights. */
+	CHROMA_FILL = 0x80,		/**< chroma of pixels outside the visual image. */
+	AFFINE_BITS = 16,		/**< fraction bits of stepped affine coordinates. */
+	AFFINE_RANGE = 16384,	/**< stepped affine coordinates stay below. */
+	WARP_CHUNK = 256,		/**< pixels of a row the affine warp steps at once. */
+	AFFINE_ANCHOR = 64,		/**< pixels stepped on from one exact coordinate, the
+							     rounded step drifts 1/8 weight over them. */
 }RegistrationConst;
 
+/* tables farther than this from the affine matrix, in pixels, are not
+   warped in affine mode automatically. */
+#define AFFINE_TOLERANCE 0.002f
+
+/** @typedef TableHeader
+ ** @brief Binary interpolation table file header. The row table and then
+ **        the column table follow, base_height x base_width floats each,
+ **        in the byte order of the machine that wrote them.
+ **/
+typedef struct
+{
+	char magic[4];						/**< "RGTB". */
+	unsigned int version;				/**< TABLE_VERSION. */
+	unsigned int header_size;			/**< sizeof(TableHeader). */
+	unsigned int table_size;			/**< byte size of both tables. */
+	int base_width;						/**< width of base image. */
+	int base_height;					/**< height of base image. */
+	int unreg_width;					/**< width of unregistered image. */
+	int unreg_height;					/**< height of unregistered image. */
+	float affine_matrix[6];				/**< affine matrix tables sample. */
+	unsigned int checksum;				/**< table_checksum of both tables. */
+	unsigned int reserved;				/**< zero. */
+}TableHeader;
+
+static const char table_magic[4] = {'R', 'G', 'T', 'B'};
+
+/* bilinear remap of n pixels of a row span, all warping goes through it. */
+typedef void (*RemapRow)(const unsigned char *src, int stride,
+                         const int *offs, const unsigned short *fracs,
+                         int n, unsigned char *dst);
+
+/* steps affine coordinates u, v of n pixels into the layout of the
+   compiled warp table. */
+typedef void (*AffineRow)(int u, int v, int du, int dv, int stride, int n,
+                          int *offs, unsigned short *fracs);
+
+/** @typedef struct WarpPlane
+ ** @brief compiled warp of one plane, Y at full or U and V at half size
+ **/
+typedef struct
+{
+	int width;							/**< width of registered plane. */
+	int height;							/**< height of registered plane. */
+	int stride;							/**< width of unregistered plane. */
+	int *offs;							/**< source offset of top-left neighbour. */
+	unsigned short *fracs;				/**< horizontal | vertical << 8 weights. */
+	int *spans;							/**< first and one past last warped pixel per row. */
+	int *starts;						/**< exact coordinates at every AFFINE_ANCHOR-th
+										     pixel per row, the rest are stepped. */
+	int nanchors;						/**< anchors per row. */
+	int edge_row;						/**< first row sampling the bottom-right source
+										     corner, where 32-bit gathers of the south
+										     neighbours read 2 bytes past the plane. */
+}WarpPlane;
+
 struct tagRegistration
 {
 	int base_width;						/**< width of base image. */
 	int base_height;					/**< height of base image. */
 	int unreg_width;					/**< width of unregistered image. */
 	int unreg_height;					/**< height of unregistered image. */
-	float *row_inter_tab;				/**< row interpolation table. */
-	float *col_inter_tab;				/**< col interpolation table. */
+	const float *row_inter_tab;			/**< row interpolation table. */
+	const float *col_inter_tab;			/**< col interpolation table. */
 	float affine_matrix[6];				/**< affine matrix. */
+	float *tables;						/**< tables computed or read from text. */
+	void *map_base;						/**< binary table file mapping. */
+	size_t map_size;					/**< byte size of mapping. */
+	WarpMode mode;						/**< WARP_MODE_TABLE or WARP_MODE_AFFINE. */
+	WarpFormat format;					/**< registered image layout. */
+	WarpPlane luma;						/**< Y plane warp. */
+	WarpPlane chroma;					/**< U and V plane warp. */
+	int affine_du;						/**< stepped column coordinate change per pixel. */
+	int affine_dv;						/**< stepped row coordinate change per pixel. */
 };
 
 /** @name Some private functions 
@@ -56,11 +145,56 @@ static void cal_interp_table(const float *const affine_matrix,
 							 float *const row_inter_tab,
 							 float *const col_inter_tab);
 
-static void save_interp_table(const float *const tab,
-							  int rows, int cols,
-							  const char *filename);
+static int map_interp_tables(Registration *self, const char *filename);
+
+static void unmap_interp_tables(Registration *self);
+
+static int save_interp_tables(const Registration *const self,
+                              const char *filename);
+
+static void fit_affine_matrix(const Registration *const self,
+                              float *const affine_matrix);
+
+static unsigned int table_checksum(const float *const tab, size_t count);
+
+static int compile_warp_table(const Registration *const self, int sub,
+                              WarpPlane *plane);
+
+static int tables_are_affine(const Registration *const self);
+
+static int compile_affine_warp(Registration *self, int sub, WarpPlane *plane);
+
+static void free_warp_plane(WarpPlane *plane);
+
+static void warp_plane_chunk(const Registration *const self,
+                             const WarpPlane *const plane,
+                             AffineRow affine_row, int x, int y, int n,
+                             int *const chunk_offs,
+                             unsigned short *const chunk_fracs,
+                             const int **offs, const unsigned short **fracs);
 /** @} */
 
+/* row kernels by CpuLevel. AVX-512 gathers are no faster per element than
+   AVX2 ones. remap_row_neon is not dispatched until kernel_bench has
+   checked it on an ARM build. */
+#ifdef CPU_X86
+static const RemapRow remap_row_fns[CPU_LEVELS] = {
+	remap_row_nsu, remap_row_sse, remap_row_avx2, remap_row_avx2
+};
+
+static const AffineRow affine_row_fns[CPU_LEVELS] = {
+	affine_row_nsu, affine_row_sse, affine_row_avx2, affine_row_avx2
+};
+#else
+static const RemapRow remap_row_fns[CPU_LEVELS] = {
+	remap_row_nsu, remap_row_nsu, remap_row_nsu, remap_row_nsu
+};
+
+static const AffineRow affine_row_fns[CPU_LEVELS] = {
+	affine_row_nsu, affine_row_nsu, affine_row_nsu, affine_row_nsu
+};
+#endif
+
 /** @name Gauss elimination method.
  ** @} */
 static void ge_swap_row(float *const mat, int order,
@@ -77,6 +211,10 @@ static void ge_solver(float *const mat, int order);
 Registration *rm_regist_new()
 {
 	Registration *self = (Registration *)malloc(sizeof(Registration));
+	if (self) {
+		memset(self, 0, sizeof(Registration));
+	}
+	
 	return self;
 }
 
@@ -88,8 +226,14 @@ Registration *rm_regist_new()
  ** @param unreg_height height of unregistered image.
  ** @param contrl_points control points.
  ** @param npoints number of control points.
- ** @param rtf row interpolation table filename.
- ** @param ctf column interpolation table filename.
+ ** @param btf binary interpolation table filename. It is memory mapped if
+ **        it matches the image sizes, else the tables are read from the
+ **        text files or calculated from the control points and saved to it.
+ **        NULL to always read or calculate the tables.
+ ** @param rtf row interpolation table text filename.
+ ** @param ctf column interpolation table text filename.
+ ** @param mode warp implementation. WARP_MODE_AFFINE warps with the affine
+ **        matrix whatever the tables are.
  ** @return  0 if success,
  **         -1 if fail.
  **/
@@ -97,7 +241,8 @@ int rm_regist_init(Registration *self,
                    int base_width, int base_height,
 				   int unreg_width, int unreg_height,
                    const int *const contrl_points, int npoints,
-                   const char *rtf, const char *ctf)
+                   const char *btf, const char *rtf, const char *ctf,
+                   WarpMode mode)
 {	
 	assert(self);
 	assert(contrl_points);
@@ -111,21 +256,52 @@ int rm_regist_init(Registration *self,
 	self->unreg_width = unreg_width;
 	self->unreg_height = unreg_height;
 	
-	self->row_inter_tab = (float *)malloc(base_width * base_height * sizeof(float));
-	assert(self->row_inter_tab);
+	if (!btf || map_interp_tables(self, btf)) {
+		self->tables = (float *)malloc(2 * base_width * base_height * sizeof(float));
+		if (!self->tables) {
+			fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+			return -1;
+		}
+		
+		self->row_inter_tab = self->tables;
+		self->col_inter_tab = self->tables + base_width * base_height;
+		
+		if (load_interp_table(rtf, self->tables, base_height, base_width) ||
+			load_interp_table(ctf, self->tables + base_width * base_height,
+			base_height, base_width)) {
+			cal_affine_matrix(contrl_points, npoints, self->affine_matrix);
+			cal_interp_table(self->affine_matrix, base_width, base_height,
+				unreg_width, unreg_height, self->tables,
+				self->tables + base_width * base_height);
+		} else {
+			fit_affine_matrix(self, self->affine_matrix);
+		}
+		
+		if (btf && save_interp_tables(self, btf)) {
+			fprintf(stderr, "save_interp_tables fail[%s:%d].\n", __FILE__, __LINE__);
+		}
+	}
 	
-	self->col_inter_tab = (float *)malloc(base_width * base_height * sizeof(float));
-	assert(self->col_inter_tab);
+	self->mode = mode;
+	if (WARP_MODE_AUTO == mode) {
+		self->mode = tables_are_affine(self) ? WARP_MODE_AFFINE : WARP_MODE_TABLE;
+	}
 	
-	if (load_interp_table(rtf, self->row_inter_tab, base_height, base_width) ||
-		load_interp_table(ctf, self->col_inter_tab, base_height, base_width)) {		
-		cal_affine_matrix(contrl_points, npoints, self->affine_matrix);
-		cal_interp_table(self->affine_matrix, base_width, base_height,
-			unreg_width, unreg_height, self->row_inter_tab, self->col_inter_tab);
-		save_interp_table(self->row_inter_tab, base_height, base_width, rtf);
-		save_interp_table(self->col_inter_tab, base_height, base_width, ctf);
+	if (WARP_MODE_AFFINE == self->mode) {
+		if (compile_affine_warp(self, 1, &self->luma) ||
+			compile_affine_warp(self, 2, &self->chroma)) {
+			fprintf(stderr, "compile_affine_warp fail[%s:%d].\n", __FILE__, __LINE__);
+			return -1;
+		}
+	} else if (compile_warp_table(self, 1, &self->luma) ||
+		compile_warp_table(self, 2, &self->chroma)) {
+		fprintf(stderr, "compile_warp_table fail[%s:%d].\n", __FILE__, __LINE__);
+		return -1;
 	}
 	
+	/* the warp only reads the compiled table or the affine steps. */
+	unmap_interp_tables(self);
+	
 	return 0;
 }
 
@@ -136,23 +312,81 @@ void rm_regist_delete(Registration *self)
 {
 	assert(self);
 	
-	if (self->row_inter_tab) {
-		free(self->row_inter_tab);
-		self->row_inter_tab = 0;
+	unmap_interp_tables(self);
+	
+	free_warp_plane(&self->luma);
+	free_warp_plane(&self->chroma);
+	
+	free(self);
+}
+
+/** @brief Convert text interpolation tables to a binary table file
+ **        rm_regist_init maps.
+ ** @param base_width width of base image.
+ ** @param base_height height of base image.
+ ** @param unreg_width width of unregistered image.
+ ** @param unreg_height height of unregistered image.
+ ** @param rtf row interpolation table text filename.
+ ** @param ctf column interpolation table text filename.
+ ** @param btf binary interpolation table filename.
+ ** @return  0 if success,
+ **         -1 if fail.
+ **/
+int rm_regist_convert(int base_width, int base_height,
+                      int unreg_width, int unreg_height,
+                      const char *rtf, const char *ctf, const char *btf)
+{
+	Registration *self;
+	int ret = -1;
+	
+	self = rm_regist_new();
+	if (!self) {
+		fprintf(stderr, "rm_regist_new fail[%s:%d].\n", __FILE__, __LINE__);
+		return -1;
+	}
+	
+	self->base_width = base_width;
+	self->base_height = base_height;
+	self->unreg_width = unreg_width;
+	self->unreg_height = unreg_height;
+	
+	self->tables = (float *)malloc(2 * base_width * base_height * sizeof(float));
+	if (!self->tables) {
+		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+		goto clean;
 	}
 	
-	if (self->col_inter_tab) {
-		free(self->col_inter_tab);
-		self->col_inter_tab = 0;
+	self->row_inter_tab = self->tables;
+	self->col_inter_tab = self->tables + base_width * base_height;
+	
+	if (load_interp_table(rtf, self->tables, base_height, base_width) ||
+		load_interp_table(ctf, self->tables + base_width * base_height,
+		base_height, base_width)) {
+		fprintf(stderr, "load_interp_table fail[%s:%d].\n", __FILE__, __LINE__);
+		goto clean;
 	}
 	
-	free(self);
+	fit_affine_matrix(self, self->affine_matrix);
+	
+	if (save_interp_tables(self, btf)) {
+		fprintf(stderr, "save_interp_tables fail[%s:%d].\n", __FILE__, __LINE__);
+		goto clean;
+	}
+	
+	ret = 0;
+	
+	clean:
+	rm_regist_delete(self);
+	
+	return ret;
 }
 
-/** @brief Warp registration image.
+/** @brief Warp registration image. Y is warped at full size, U and V at
+ **        half size, both bilinearly. Pixels outside the visual image
+ **        keep their Y and get neutral chroma.
  ** @param self registration instance.
- ** @param src source image.
- ** @param warped image.
+ ** @param src source image, I420. It is not read past its V plane.
+ ** @param warped image, I420 or NV12 by rm_regist_set_format.
  ** @return  0 if success,
  **         -1 if fail.  
  **/
@@ -160,124 +394,113 @@ int rm_regist_warp_image(const Registration *const self,
                          const unsigned char *const src,
 						 unsigned char *const dst)
 {
-	int x, y, c;
-	float rx, ry;
-	int tlcx, tlcy;
-	int lrcx, lrcy;
-	float *citptr, *ritptr;
-	unsigned char nval, sval;
-	unsigned char neval, seval;
-	unsigned char nwval, swval;
-	int interp_val;
-	enum {NCHANNELS = 3};
-	unsigned char *src_udata;
-	unsigned char *src_vdata;
+	const WarpPlane *luma = &self->luma;
+	const WarpPlane *chroma = &self->chroma;
+	RemapRow remap_row;
+	RemapRow remap_vrow;
+	AffineRow affine_row;
+	int chunk_offs[WARP_CHUNK];
+	unsigned short chunk_fracs[WARP_CHUNK];
+	unsigned char chunk_u[WARP_CHUNK];
+	unsigned char chunk_v[WARP_CHUNK];
+	const int *offs;
+	const unsigned short *fracs;
+	const unsigned char *src_udata;
+	const unsigned char *src_vdata;
 	unsigned char *dst_udata;
 	unsigned char *dst_vdata;
-	int srcuv_width;
-	int dstuv_width;
-	int src_uvx, src_uvy;
-	int dst_uvx, dst_uvy;
+	unsigned char *uptr, *vptr;
+	int x, y, i, n;
+	int x0, x1;
 	
 	assert(self);
 	assert(src);
 	assert(dst);
 	
-	memset(dst + self->base_width * self->base_height, 0x80, self->base_width * self->base_height >> 1);
-	
-	src_udata = (unsigned char *)src + self->unreg_width * self->unreg_height;
-	src_vdata = (unsigned char *)src + self->unreg_width * self->unreg_height * 5 / 4;
-	srcuv_width = self->unreg_width >> 1;
+	src_udata = src + self->unreg_width * self->unreg_height;
+	src_vdata = src_udata + chroma->stride * (self->unreg_height >> 1);
 	
 	dst_udata = dst + self->base_width * self->base_height;
-	dst_vdata = dst + self->base_width * self->base_height * 5 / 4;
-	dstuv_width = self->base_width >> 1;
-	
-	for (y = 0; y < self->base_height; y++) {
-		citptr = self->col_inter_tab + y * self->base_width;
-		ritptr = self->row_inter_tab + y * self->base_width;
-		for (x = 0; x < self->base_width; x++) {
-			rx = *(citptr + x);
-			ry = *(ritptr + x);
-			
-			tlcx = (int)(rx);
-			if (tlcx < 0 || tlcx > self->unreg_width - 1) {
-				continue;
-			}
-			
-			tlcy = (int)(ry);
-			if (tlcy < 0 || tlcy > self->unreg_height - 1) {
-				continue;
-			}
-			
-			lrcx = tlcx + 1;
-			if (lrcx < 0 || lrcx > self->unreg_width - 1) {
-				continue;
-			}
-			
-			lrcy = tlcy + 1;
-			if (lrcy < 0 || lrcy > self->unreg_height - 1) {
-				continue;
-			}
-#if 0			
-			for (c = 0; c < NCHANNELS; c++) {
-				nwval = src[tlcy * self->unreg_width * 3 + tlcx * 3 + c];
-				swval = src[lrcy * self->unreg_width * 3 + tlcx * 3 + c];
-				neval = src[tlcy * self->unreg_width * 3 + lrcx * 3 + c];
-				seval = src[lrcy * self->unreg_width * 3 + lrcx * 3 + c];
-				
-				nval = (int)((rx - tlcx) * neval + (tlcx + 1 - rx) * nwval);
-                sval = (int)((rx - tlcx) * seval + (tlcx + 1 - rx) * swval);
-				
-				interp_val = (int)((tlcy + 1 - ry) * nval + (ry - tlcy) * sval);
-				if (interp_val < 0) {
-					interp_val = 0;
-				}
-				
-				if (interp_val > 255) {
-					interp_val = 255;
+	dst_vdata = dst_udata + chroma->width * chroma->height;
+	
+	remap_row = remap_row_fns[cpu_level()];
+	affine_row = affine_row_fns[cpu_level()];
+	
+	/* Y */
+	for (y = 0; y < luma->height; y++) {
+		x0 = luma->spans[2 * y];
+		x1 = luma->spans[2 * y + 1];
+		for (x = x0; x < x1; x += n) {
+			n = x1 - x < WARP_CHUNK ? x1 - x : WARP_CHUNK;
+			warp_plane_chunk(self, luma, affine_row, x, y, n, chunk_offs,
+				chunk_fracs, &offs, &fracs);
+			remap_row(src, luma->stride, offs, fracs, n,
+				dst + y * luma->width + x);
+		}
+	}
+	
+	/* UV */
+	for (y = 0; y < chroma->height; y++) {
+		x0 = chroma->spans[2 * y];
+		x1 = chroma->spans[2 * y + 1];
+		
+		/* V plane ends src, so that the gathers of the SIMD kernels must
+		   not reach past its bottom-right corner. */
+		remap_vrow = y < chroma->edge_row ? remap_row : remap_row_nsu;
+		
+		if (WARP_FORMAT_NV12 == self->format) {
+			uptr = dst_udata + y * chroma->width * 2;
+			vptr = uptr + 1;
+			memset(uptr, CHROMA_FILL, 2 * x0);
+			memset(uptr + 2 * x1, CHROMA_FILL, 2 * (chroma->width - x1));
+		} else {
+			uptr = dst_udata + y * chroma->width;
+			vptr = dst_vdata + y * chroma->width;
+			memset(uptr, CHROMA_FILL, x0);
+			memset(uptr + x1, CHROMA_FILL, chroma->width - x1);
+			memset(vptr, CHROMA_FILL, x0);
+			memset(vptr + x1, CHROMA_FILL, chroma->width - x1);
+		}
+		
+		for (x = x0; x < x1; x += n) {
+			n = x1 - x < WARP_CHUNK ? x1 - x : WARP_CHUNK;
+			warp_plane_chunk(self, chroma, affine_row, x, y, n, chunk_offs,
+				chunk_fracs, &offs, &fracs);
+			if (WARP_FORMAT_NV12 == self->format) {
+				remap_row(src_udata, chroma->stride, offs, fracs, n, chunk_u);
+				remap_vrow(src_vdata, chroma->stride, offs, fracs, n, chunk_v);
+				for (i = 0; i < n; i++) {
+					uptr[2 * (x + i)] = chunk_u[i];
+					vptr[2 * (x + i)] = chunk_v[i];
 				}
-				
-				dst[y * self->base_width * 3 + x * 3 + c] = interp_val;
-			}
-#else
-			/* Y */
-			nwval = src[tlcy * self->unreg_width + tlcx];
-			swval = src[lrcy * self->unreg_width + tlcx];
-			neval = src[tlcy * self->unreg_width + lrcx];
-			seval = src[lrcy * self->unreg_width + lrcx];
-			
-			nval = (int)((rx - tlcx) * neval + (tlcx + 1 - rx) * nwval);
-			sval = (int)((rx - tlcx) * seval + (tlcx + 1 - rx) * swval);
-			
-			interp_val = (int)((tlcy + 1 - ry) * nval + (ry - tlcy) * sval);
-			if (interp_val < 0) {
-				interp_val = 0;
-			}
-			
-			if (interp_val > 255) {
-				interp_val = 255;
-			}
-			
-			dst[y * self->base_width + x] = interp_val;
-			
-			/* UV */
-			src_uvx = tlcx >> 1;
-			src_uvy = tlcy >> 1;
-			dst_uvx = x >> 1;
-			dst_uvy = y >> 1;
-						
-			if (0 == y % 2 && 0 == x % 2) {
-				dst_udata[dst_uvy * dstuv_width + dst_uvx] = src_udata[src_uvy * srcuv_width + src_uvx];
-				dst_vdata[dst_uvy * dstuv_width + dst_uvx] = src_vdata[src_uvy * srcuv_width + src_uvx];
+			} else {
+				remap_row(src_udata, chroma->stride, offs, fracs, n, uptr + x);
+				remap_vrow(src_vdata, chroma->stride, offs, fracs, n, vptr + x);
 			}
-#endif
 		}
 	}
 	
 	return 0;
 }
 
+/** @brief Set layout of registered images.
+ ** @param self registration instance.
+ ** @param format WARP_FORMAT_I420, the default, or WARP_FORMAT_NV12.
+ **/
+void rm_regist_set_format(Registration *self, WarpFormat format)
+{
+	self->format = format;
+}
+
+/** @brief Get warp implementation.
+ ** @param self registration instance.
+ ** @return WARP_MODE_TABLE or WARP_MODE_AFFINE.
+ **/
+WarpMode rm_regist_warp_mode(const Registration *const self)
+{
+	return self->mode;
+}
+
 /** @brief Load matrix from file.
  ** @param filename matrix filename.
  ** @param tab interpolation table.
@@ -304,7 +527,10 @@ int load_interp_table(const char *filename,
 	
 	for (y = 0; y < rows; y++) {
 		for (x = 0; x < cols; x++) {
-			fscanf(fp, "%f ", &tab[y * cols + x]);
+			if (1 != fscanf(fp, "%f ", &tab[y * cols + x])) {
+				fclose(fp);
+				return -1;
+			}
 		}
 	}
 	
@@ -434,34 +660,209 @@ void cal_interp_table(const float *const affine_matrix,
 	}
 }
 
-/** @brief Save interpolation table.
- ** @param row_inter_tab row interpolation table.
- ** @param col_inter_tab column interpolation table.
- ** @param rows rows of interpolation table.
- ** @param cols columns of interpolation table.
- ** @param rtf row interpolation table filename.
- ** @param ctf column interpolation table filename.
+/** @brief Map binary interpolation table file, written by
+ **        save_interp_tables, and point the tables into it.
+ ** @param self registration instance.
+ ** @param filename binary interpolation table filename.
+ ** @return  0 if success,
+ **         -1 if the file is missing, of other image sizes or corrupt.
  **/
-void save_interp_table(const float *const tab,
-					   int rows, int cols,
-					   const char *filename)
+int map_interp_tables(Registration *self, const char *filename)
 {
+	const size_t size = (size_t)self->base_width * self->base_height;
+	const size_t map_size = sizeof(TableHeader) + 2 * size * sizeof(float);
+	const TableHeader *header;
+	const float *tab;
+	void *base;
+#ifdef _WIN32
+	HANDLE file;
+	HANDLE mapping;
+	LARGE_INTEGER file_size;
+	
+	file = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (INVALID_HANDLE_VALUE == file) {
+		return -1;
+	}
+	
+	if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart != (LONGLONG)map_size) {
+		CloseHandle(file);
+		return -1;
+	}
+	
+	/* the view keeps the mapping and the file open. */
+	mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle(file);
+	if (!mapping) {
+		return -1;
+	}
+	
+	base = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	if (!base) {
+		return -1;
+	}
+#else
+	struct stat st;
+	int fd;
+	
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		return -1;
+	}
+	
+	if (fstat(fd, &st) || st.st_size != (off_t)map_size) {
+		close(fd);
+		return -1;
+	}
+	
+	base = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (MAP_FAILED == base) {
+		return -1;
+	}
+#endif
+	self->map_base = base;
+	self->map_size = map_size;
+	
+	header = (const TableHeader *)base;
+	tab = (const float *)(header + 1);
+	
+	if (memcmp(header->magic, table_magic, sizeof(table_magic)) ||
+		TABLE_VERSION != header->version ||
+		sizeof(TableHeader) != header->header_size ||
+		2 * size * sizeof(float) != header->table_size ||
+		self->base_width != header->base_width ||
+		self->base_height != header->base_height ||
+		self->unreg_width != header->unreg_width ||
+		self->unreg_height != header->unreg_height ||
+		table_checksum(tab, 2 * size) != header->checksum) {
+		unmap_interp_tables(self);
+		return -1;
+	}
+	
+	memcpy(self->affine_matrix, header->affine_matrix, sizeof(self->affine_matrix));
+	self->row_inter_tab = tab;
+	self->col_inter_tab = tab + size;
+	
+	return 0;
+}
+
+/** @brief Release the binary interpolation table file mapping or the
+ **        tables computed or read from text.
+ ** @param self registration instance.
+ **/
+void unmap_interp_tables(Registration *self)
+{
+	if (self->map_base) {
+#ifdef _WIN32
+		UnmapViewOfFile(self->map_base);
+#else
+		munmap(self->map_base, self->map_size);
+#endif
+		self->map_base = NULL;
+		self->map_size = 0;
+	}
+	
+	if (self->tables) {
+		free(self->tables);
+		self->tables = NULL;
+	}
+	
+	self->row_inter_tab = NULL;
+	self->col_inter_tab = NULL;
+}
+
+/** @brief Save interpolation tables to a binary table file.
+ ** @param self registration instance, the column table following the
+ **        row table in memory.
+ ** @param filename binary interpolation table filename.
+ ** @return  0 if success,
+ **         -1 if fail.
+ **/
+int save_interp_tables(const Registration *const self,
+                       const char *filename)
+{
+	const size_t size = (size_t)self->base_width * self->base_height;
+	TableHeader header;
 	FILE *fp;
-	int x, y;
+	int ret = 0;
 	
-	assert(tab);
-		
-	fp = fopen(filename, "w");
-	assert(fp);
+	assert(self->col_inter_tab == self->row_inter_tab + size);
 	
-	for (y = 0; y < rows; y++) {
-		for (x = 0; x < cols; x++) {
-			fprintf(fp, "%f ", tab[y * cols + x]);
-		}
-		fputs("\n", fp);
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, table_magic, sizeof(table_magic));
+	header.version = TABLE_VERSION;
+	header.header_size = sizeof(TableHeader);
+	header.table_size = (unsigned int)(2 * size * sizeof(float));
+	header.base_width = self->base_width;
+	header.base_height = self->base_height;
+	header.unreg_width = self->unreg_width;
+	header.unreg_height = self->unreg_height;
+	memcpy(header.affine_matrix, self->affine_matrix, sizeof(header.affine_matrix));
+	header.checksum = table_checksum(self->row_inter_tab, 2 * size);
+	
+	fp = fopen(filename, "wb");
+	if (!fp) {
+		return -1;
 	}
 	
-	fclose(fp);
+	if (1 != fwrite(&header, sizeof(header), 1, fp) ||
+		2 * size != fwrite(self->row_inter_tab, sizeof(float), 2 * size, fp)) {
+		ret = -1;
+	}
+	
+	if (fclose(fp)) {
+		ret = -1;
+	}
+	
+	/* a partial file would fail the size check anyway, but do not leave
+	   one behind for the next start to map and reject. */
+	if (ret) {
+		remove(filename);
+	}
+	
+	return ret;
+}
+
+/** @brief Fit the affine matrix interpolation tables sample. Text tables
+ **        do not record it; this is exact for tables cal_interp_table made.
+ ** @param self registration instance.
+ ** @param affine_matrix affine matrix.
+ **/
+void fit_affine_matrix(const Registration *const self,
+                       float *const affine_matrix)
+{
+	const int w = self->base_width;
+	const int h = self->base_height;
+	const float *ct = self->col_inter_tab;
+	const float *rt = self->row_inter_tab;
+	
+	affine_matrix[0] = w > 1 ? (ct[w - 1] - ct[0]) / (w - 1) : 0;
+	affine_matrix[1] = h > 1 ? (ct[(h - 1) * w] - ct[0]) / (h - 1) : 0;
+	affine_matrix[2] = ct[0];
+	affine_matrix[3] = w > 1 ? (rt[w - 1] - rt[0]) / (w - 1) : 0;
+	affine_matrix[4] = h > 1 ? (rt[(h - 1) * w] - rt[0]) / (h - 1) : 0;
+	affine_matrix[5] = rt[0];
+}
+
+/** @brief Checksum of interpolation tables, FNV-1a over 32-bit words.
+ ** @param tab interpolation tables.
+ ** @param count number of table entries.
+ ** @return checksum.
+ **/
+unsigned int table_checksum(const float *const tab, size_t count)
+{
+	const unsigned int *words = (const unsigned int *)tab;
+	unsigned int hash = 2166136261u;
+	size_t i;
+	
+	for (i = 0; i < count; i++) {
+		hash ^= words[i];
+		hash *= 16777619u;
+	}
+	
+	return hash;
 }
 
 /** @brief Swap two rows of matrix.
@@ -561,4 +962,617 @@ void ge_solver(float *const mat, int order)
 		
 		mat[y * cols + order] /= mat[y * cols + y];
 	}
-}
\ No newline at end of file
+}
+
+/** @brief Compile interpolation tables into the warp table of a plane:
+ **        per pixel the source offset of the top-left neighbour and
+ **        WARP_BITS weights, and per row the span of pixels whose
+ **        neighbours are all inside the unregistered plane. Pixels outside
+ **        the span are not warped. Outside pixels inside the span, which
+ **        only tables that are not affine have, are clamped to the border.
+ ** @param self registration instance.
+ ** @param sub plane subsampling, 1 for Y, 2 for U and V. Pixel (x, y) of
+ **        a subsampled plane samples the tables at (sub * x, sub * y).
+ ** @param plane plane warp.
+ ** @return  0 if success,
+ **         -1 if fail.
+ **/
+int compile_warp_table(const Registration *const self, int sub,
+                       WarpPlane *plane)
+{
+	const int bw = self->base_width;
+	const int w = self->base_width / sub;
+	const int h = self->base_height / sub;
+	const int uw = self->unreg_width / sub;
+	const int uh = self->unreg_height / sub;
+	const int edge = uw * uh - uw - 3;
+	const int one = 1 << WARP_BITS;
+	int x, y;
+	int x0, x1;
+	int sx, sy;
+	int wx, wy;
+	float rx, ry;
+	int inside;
+	
+	plane->width = w;
+	plane->height = h;
+	plane->stride = uw;
+	plane->edge_row = h;
+	
+	plane->offs = (int *)malloc(w * h * sizeof(int));
+	if (!plane->offs) {
+		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+		return -1;
+	}
+	
+	plane->fracs = (unsigned short *)malloc(w * h * sizeof(unsigned short));
+	if (!plane->fracs) {
+		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+		return -1;
+	}
+	
+	plane->spans = (int *)malloc(2 * h * sizeof(int));
+	if (!plane->spans) {
+		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+		return -1;
+	}
+	
+	for (y = 0; y < h; y++) {
+		x0 = w;
+		x1 = 0;
+		for (x = 0; x < w; x++) {
+			rx = self->col_inter_tab[sub * (y * bw + x)] / sub;
+			ry = self->row_inter_tab[sub * (y * bw + x)] / sub;
+			
+			/* same as truncating and checking both neighbours, and false
+			   for NaN. */
+			inside = rx > -1 && rx < uw - 1 && ry > -1 && ry < uh - 1;
+			if (inside) {
+				if (x < x0) {
+					x0 = x;
+				}
+				x1 = x + 1;
+			}
+			
+			sx = !(rx > 0) ? 0 : (rx < uw - 2 ? (int)rx : uw - 2);
+			sy = !(ry > 0) ? 0 : (ry < uh - 2 ? (int)ry : uh - 2);
+			wx = inside ? (int)((rx - sx) * one + 0.5f) : 0;
+			wy = inside ? (int)((ry - sy) * one + 0.5f) : 0;
+			wx = wx < 0 ? 0 : (wx > one - 1 ? one - 1 : wx);
+			wy = wy < 0 ? 0 : (wy > one - 1 ? one - 1 : wy);
+			
+			plane->offs[y * w + x] = sy * uw + sx;
+			plane->fracs[y * w + x] = (unsigned short)(wx | (wy << WARP_BITS));
+		}
+		
+		plane->spans[2 * y] = x0 < x1 ? x0 : 0;
+		plane->spans[2 * y + 1] = x1;
+		
+		for (x = x0; x < x1 && plane->edge_row > y; x++) {
+			if (plane->offs[y * w + x] >= edge) {
+				plane->edge_row = y;
+			}
+		}
+	}
+	
+	return 0;
+}
+
+/** @brief Check interpolation tables sample the affine matrix within
+ **        AFFINE_TOLERANCE and in the range stepped coordinates hold.
+ ** @param self registration instance.
+ ** @return 1 if the tables are affine,
+ **         0 if not.
+ **/
+int tables_are_affine(const Registration *const self)
+{
+	const float *m = self->affine_matrix;
+	const int bw = self->base_width;
+	const int bh = self->base_height;
+	float rx, ry;
+	int x, y;
+	
+	for (y = 0; y < bh; y++) {
+		for (x = 0; x < bw; x++) {
+			rx = m[0] * x + m[1] * y + m[2];
+			ry = m[3] * x + m[4] * y + m[5];
+			if (!(fabs(rx - self->col_inter_tab[y * bw + x]) <= AFFINE_TOLERANCE) ||
+				!(fabs(ry - self->row_inter_tab[y * bw + x]) <= AFFINE_TOLERANCE) ||
+				!(fabs(rx) < AFFINE_RANGE) || !(fabs(ry) < AFFINE_RANGE)) {
+				return 0;
+			}
+		}
+	}
+	
+	return 1;
+}
+
+/** @brief Compile the affine matrix into the affine warp of a plane:
+ **        source coordinates at every AFFINE_ANCHOR-th pixel of each row,
+ **        in AFFINE_BITS fixed point, and the row spans of
+ **        compile_warp_table. Stepping a whole row from x = 0 would drift
+ **        more than a weight step away from the tables on wide images.
+ **        Spans are found by stepping exactly like warp_plane_chunk, so
+ **        every pixel in a span has its neighbours inside the unregistered
+ **        plane.
+ ** @param self registration instance, affine_du and affine_dv are set.
+ ** @param sub plane subsampling, 1 for Y, 2 for U and V. A subsampled
+ **        plane has the same steps and an offset divided by sub.
+ ** @param plane plane warp.
+ ** @return  0 if success,
+ **         -1 if fail.
+ **/
+int compile_affine_warp(Registration *self, int sub, WarpPlane *plane)
+{
+	const float *m = self->affine_matrix;
+	const double scale = 1 << AFFINE_BITS;
+	const int w = self->base_width / sub;
+	const int h = self->base_height / sub;
+	const int uw = self->unreg_width / sub;
+	const int uh = self->unreg_height / sub;
+	const int edge = uw * uh - uw - 3;
+	double rx, ry;
+	int x, y;
+	int x0, x1;
+	int u, v;
+	int a;
+	
+	/* the corners bound an affine image. */
+	for (y = 0; y < h; y += h > 1 ? h - 1 : 1) {
+		for (x = 0; x < w; x += w > 1 ? w - 1 : 1) {
+			rx = (double)m[0] * x + (double)m[1] * y + (double)m[2] / sub;
+			ry = (double)m[3] * x + (double)m[4] * y + (double)m[5] / sub;
+			if (!(fabs(rx) < AFFINE_RANGE) || !(fabs(ry) < AFFINE_RANGE)) {
+				return -1;
+			}
+		}
+	}
+	
+	plane->width = w;
+	plane->height = h;
+	plane->stride = uw;
+	plane->edge_row = h;
+	plane->nanchors = (w + AFFINE_ANCHOR - 1) / AFFINE_ANCHOR;
+	
+	plane->starts = (int *)malloc(2 * h * plane->nanchors * sizeof(int));
+	if (!plane->starts) {
+		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+		return -1;
+	}
+	
+	plane->spans = (int *)malloc(2 * h * sizeof(int));
+	if (!plane->spans) {
+		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+		return -1;
+	}
+	
+	self->affine_du = (int)floor(m[0] * scale + 0.5);
+	self->affine_dv = (int)floor(m[3] * scale + 0.5);
+	
+	for (y = 0; y < h; y++) {
+		for (a = 0; a < plane->nanchors; a++) {
+			x = a * AFFINE_ANCHOR;
+			plane->starts[2 * (y * plane->nanchors + a)] = (int)floor(((double)m[0] * x +
+				(double)m[1] * y + (double)m[2] / sub) * scale + 0.5);
+			plane->starts[2 * (y * plane->nanchors + a) + 1] = (int)floor(((double)m[3] * x +
+				(double)m[4] * y + (double)m[5] / sub) * scale + 0.5);
+		}
+		
+		x0 = w;
+		x1 = 0;
+		u = v = 0;
+		for (x = 0; x < w; x++) {
+			if (0 == x % AFFINE_ANCHOR) {
+				u = plane->starts[2 * (y * plane->nanchors + x / AFFINE_ANCHOR)];
+				v = plane->starts[2 * (y * plane->nanchors + x / AFFINE_ANCHOR) + 1];
+			}
+			
+			if (u >= 0 && (u >> AFFINE_BITS) <= uw - 2 &&
+				v >= 0 && (v >> AFFINE_BITS) <= uh - 2) {
+				if (x < x0) {
+					x0 = x;
+				}
+				x1 = x + 1;
+				
+				if (plane->edge_row > y &&
+					(v >> AFFINE_BITS) * uw + (u >> AFFINE_BITS) >= edge) {
+					plane->edge_row = y;
+				}
+			}
+			u += self->affine_du;
+			v += self->affine_dv;
+		}
+		
+		plane->spans[2 * y] = x0 < x1 ? x0 : 0;
+		plane->spans[2 * y + 1] = x1;
+	}
+	
+	return 0;
+}
+
+/** @brief Free compiled warp of a plane.
+ ** @param plane plane warp.
+ **/
+void free_warp_plane(WarpPlane *plane)
+{
+	if (plane->offs) {
+		free(plane->offs);
+		plane->offs = NULL;
+	}
+	
+	if (plane->fracs) {
+		free(plane->fracs);
+		plane->fracs = NULL;
+	}
+	
+	if (plane->spans) {
+		free(plane->spans);
+		plane->spans = NULL;
+	}
+	
+	if (plane->starts) {
+		free(plane->starts);
+		plane->starts = NULL;
+	}
+}
+
+/** @brief Get source offsets and weights of n pixels of a row span, from
+ **        the compiled table or stepped into chunk buffers in affine mode.
+ ** @param self registration instance.
+ ** @param plane plane warp.
+ ** @param affine_row affine stepping kernel.
+ ** @param x first pixel.
+ ** @param y row.
+ ** @param n number of pixels, at most WARP_CHUNK.
+ ** @param chunk_offs offsets buffer of affine mode.
+ ** @param chunk_fracs weights buffer of affine mode.
+ ** @param offs source offsets of top-left neighbours.
+ ** @param fracs horizontal | vertical << WARP_BITS weights.
+ **/
+void warp_plane_chunk(const Registration *const self,
+                      const WarpPlane *const plane,
+                      AffineRow affine_row, int x, int y, int n,
+                      int *const chunk_offs,
+                      unsigned short *const chunk_fracs,
+                      const int **offs, const unsigned short **fracs)
+{
+	const int *start;
+	int a, k, m;
+	
+	if (WARP_MODE_AFFINE == self->mode) {
+		/* each anchor segment is stepped on from its exact coordinates. */
+		for (k = 0; k < n; k += m) {
+			a = (x + k) / AFFINE_ANCHOR;
+			m = (a + 1) * AFFINE_ANCHOR - (x + k);
+			m = m < n - k ? m : n - k;
+			start = plane->starts + 2 * (y * plane->nanchors + a);
+			affine_row(start[0] + (x + k - a * AFFINE_ANCHOR) * self->affine_du,
+				start[1] + (x + k - a * AFFINE_ANCHOR) * self->affine_dv,
+				self->affine_du, self->affine_dv, plane->stride, m,
+				chunk_offs + k, chunk_fracs + k);
+		}
+		*offs = chunk_offs;
+		*fracs = chunk_fracs;
+	} else {
+		*offs = plane->offs + y * plane->width + x;
+		*fracs = plane->fracs + y * plane->width + x;
+	}
+}
+
+/** @brief Step source coordinates of n pixels in AFFINE_BITS fixed point,
+ **        into the layout of the compiled warp table. Weights are rounded
+ **        like compile_warp_table rounds them.
+ ** @param u column coordinate of the first pixel.
+ ** @param v row coordinate of the first pixel.
+ ** @param du column coordinate change per pixel.
+ ** @param dv row coordinate change per pixel.
+ ** @param stride source image width.
+ ** @param n number of pixels, inside a row span.
+ ** @param offs source offsets of top-left neighbours.
+ ** @param fracs horizontal | vertical << WARP_BITS weights.
+ **/
+void affine_row_nsu(int u, int v, int du, int dv, int stride, int n,
+                    int *offs, unsigned short *fracs)
+{
+	const int mask = (1 << AFFINE_BITS) - 1;
+	const int half = 1 << (AFFINE_BITS - WARP_BITS - 1);
+	int wx, wy;
+	int i;
+	
+	for (i = 0; i < n; i++) {
+		offs[i] = (v >> AFFINE_BITS) * stride + (u >> AFFINE_BITS);
+		wx = ((u & mask) + half) >> (AFFINE_BITS - WARP_BITS);
+		wy = ((v & mask) + half) >> (AFFINE_BITS - WARP_BITS);
+		
+		/* a fraction rounding up to one stays just below it. */
+		wx -= wx >> WARP_BITS;
+		wy -= wy >> WARP_BITS;
+		fracs[i] = (unsigned short)(wx | (wy << WARP_BITS));
+		u += du;
+		v += dv;
+	}
+}
+
+#ifdef CPU_X86
+/** @brief Step affine coordinates of n pixels with SSE.
+ ** @param u column coordinate of the first pixel.
+ ** @param v row coordinate of the first pixel.
+ ** @param du column coordinate change per pixel.
+ ** @param dv row coordinate change per pixel.
+ ** @param stride source image width.
+ ** @param n number of pixels, inside a row span.
+ ** @param offs source offsets of top-left neighbours.
+ ** @param fracs horizontal | vertical << WARP_BITS weights.
+ **/
+CPU_TARGET_SSE41
+void affine_row_sse(int u, int v, int du, int dv, int stride, int n,
+                    int *offs, unsigned short *fracs)
+{
+	const __m128i ramp = _mm_setr_epi32(0, 1, 2, 3);
+	const __m128i mask = _mm_set1_epi32((1 << AFFINE_BITS) - 1);
+	const __m128i half = _mm_set1_epi32(1 << (AFFINE_BITS - WARP_BITS - 1));
+	const __m128i width = _mm_set1_epi32(stride);
+	const unsigned int ppl = 4;
+	const __m128i du4 = _mm_set1_epi32(du * ppl);
+	const __m128i dv4 = _mm_set1_epi32(dv * ppl);
+	__m128i U, V, wx, wy;
+	int i;
+	
+	U = _mm_add_epi32(_mm_set1_epi32(u), _mm_mullo_epi32(ramp, _mm_set1_epi32(du)));
+	V = _mm_add_epi32(_mm_set1_epi32(v), _mm_mullo_epi32(ramp, _mm_set1_epi32(dv)));
+	
+	for (i = 0; i + (int)ppl <= n; i += ppl) {
+		_mm_storeu_si128((__m128i *)(offs + i), _mm_add_epi32(_mm_mullo_epi32(
+			_mm_srai_epi32(V, AFFINE_BITS), width), _mm_srai_epi32(U, AFFINE_BITS)));
+		
+		wx = _mm_srli_epi32(_mm_add_epi32(_mm_and_si128(U, mask), half), AFFINE_BITS - WARP_BITS);
+		wy = _mm_srli_epi32(_mm_add_epi32(_mm_and_si128(V, mask), half), AFFINE_BITS - WARP_BITS);
+		wx = _mm_sub_epi32(wx, _mm_srli_epi32(wx, WARP_BITS));
+		wy = _mm_sub_epi32(wy, _mm_srli_epi32(wy, WARP_BITS));
+		wx = _mm_or_si128(wx, _mm_slli_epi32(wy, WARP_BITS));
+		_mm_storel_epi64((__m128i *)(fracs + i), _mm_packus_epi32(wx, wx));
+		
+		U = _mm_add_epi32(U, du4);
+		V = _mm_add_epi32(V, dv4);
+	}
+	
+	affine_row_nsu(u + i * du, v + i * dv, du, dv, stride, n - i, offs + i, fracs + i);
+}
+
+/** @brief Step affine coordinates of n pixels with AVX2.
+ ** @param u column coordinate of the first pixel.
+ ** @param v row coordinate of the first pixel.
+ ** @param du column coordinate change per pixel.
+ ** @param dv row coordinate change per pixel.
+ ** @param stride source image width.
+ ** @param n number of pixels, inside a row span.
+ ** @param offs source offsets of top-left neighbours.
+ ** @param fracs horizontal | vertical << WARP_BITS weights.
+ **/
+CPU_TARGET_AVX2
+void affine_row_avx2(int u, int v, int du, int dv, int stride, int n,
+                     int *offs, unsigned short *fracs)
+{
+	const __m256i ramp = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	const __m256i mask = _mm256_set1_epi32((1 << AFFINE_BITS) - 1);
+	const __m256i half = _mm256_set1_epi32(1 << (AFFINE_BITS - WARP_BITS - 1));
+	const __m256i width = _mm256_set1_epi32(stride);
+	const unsigned int ppl = 8;
+	const __m256i du8 = _mm256_set1_epi32(du * ppl);
+	const __m256i dv8 = _mm256_set1_epi32(dv * ppl);
+	__m256i U, V, wx, wy;
+	int i;
+	
+	U = _mm256_add_epi32(_mm256_set1_epi32(u), _mm256_mullo_epi32(ramp, _mm256_set1_epi32(du)));
+	V = _mm256_add_epi32(_mm256_set1_epi32(v), _mm256_mullo_epi32(ramp, _mm256_set1_epi32(dv)));
+	
+	for (i = 0; i + (int)ppl <= n; i += ppl) {
+		_mm256_storeu_si256((__m256i *)(offs + i), _mm256_add_epi32(_mm256_mullo_epi32(
+			_mm256_srai_epi32(V, AFFINE_BITS), width), _mm256_srai_epi32(U, AFFINE_BITS)));
+		
+		wx = _mm256_srli_epi32(_mm256_add_epi32(_mm256_and_si256(U, mask), half),
+			AFFINE_BITS - WARP_BITS);
+		wy = _mm256_srli_epi32(_mm256_add_epi32(_mm256_and_si256(V, mask), half),
+			AFFINE_BITS - WARP_BITS);
+		wx = _mm256_sub_epi32(wx, _mm256_srli_epi32(wx, WARP_BITS));
+		wy = _mm256_sub_epi32(wy, _mm256_srli_epi32(wy, WARP_BITS));
+		wx = _mm256_or_si256(wx, _mm256_slli_epi32(wy, WARP_BITS));
+		wx = _mm256_permute4x64_epi64(_mm256_packus_epi32(wx, wx), 0x08);
+		_mm_storeu_si128((__m128i *)(fracs + i), _mm256_castsi256_si128(wx));
+		
+		U = _mm256_add_epi32(U, du8);
+		V = _mm256_add_epi32(V, dv8);
+	}
+	
+	affine_row_nsu(u + i * du, v + i * dv, du, dv, stride, n - i, offs + i, fracs + i);
+}
+#endif
+
+/** @brief Bilinear remap of a row span.
+ ** @param src source image.
+ ** @param stride source image width.
+ ** @param offs source offsets of top-left neighbours.
+ ** @param fracs horizontal | vertical << WARP_BITS weights.
+ ** @param n number of pixels.
+ ** @param dst destination row.
+ **/
+void remap_row_nsu(const unsigned char *src, int stride,
+                   const int *offs, const unsigned short *fracs,
+                   int n, unsigned char *dst)
+{
+	const int one = 1 << WARP_BITS;
+	const unsigned char *sptr;
+	int north, south;
+	int wx, wy;
+	int i;
+	
+	for (i = 0; i < n; i++) {
+		sptr = src + offs[i];
+		wx = fracs[i] & (one - 1);
+		wy = fracs[i] >> WARP_BITS;
+		north = sptr[0] * (one - wx) + sptr[1] * wx;
+		south = sptr[stride] * (one - wx) + sptr[stride + 1] * wx;
+		dst[i] = (unsigned char)((north * (one - wy) + south * wy +
+			(1 << (2 * WARP_BITS - 1))) >> (2 * WARP_BITS));
+	}
+}
+
+#ifdef CPU_X86
+/** @brief Bilinear remap of a row span with SSE. West and east neighbours
+ **        are loaded into the 16-bit halves of a lane and blended with
+ **        one madd, then the two rows are blended in 32 bits.
+ ** @param src source image.
+ ** @param stride source image width.
+ ** @param offs source offsets of top-left neighbours.
+ ** @param fracs horizontal | vertical << WARP_BITS weights.
+ ** @param n number of pixels.
+ ** @param dst destination row.
+ **/
+CPU_TARGET_SSE41
+void remap_row_sse(const unsigned char *src, int stride,
+                   const int *offs, const unsigned short *fracs,
+                   int n, unsigned char *dst)
+{
+	const __m128i one = _mm_set1_epi32(1 << WARP_BITS);
+	const __m128i half = _mm_set1_epi32(1 << (2 * WARP_BITS - 1));
+	const __m128i low = _mm_set1_epi32((1 << WARP_BITS) - 1);
+	const unsigned char *n0, *n1, *n2, *n3;
+	__m128i frac, wx, wy, wxs;
+	__m128i north, south, val;
+	int i;
+	const int ppl = 4;
+	
+	for (i = 0; i + ppl <= n; i += ppl) {
+		n0 = src + offs[i];
+		n1 = src + offs[i + 1];
+		n2 = src + offs[i + 2];
+		n3 = src + offs[i + 3];
+		north = _mm_setr_epi32(n0[0] | n0[1] << 16, n1[0] | n1[1] << 16,
+			n2[0] | n2[1] << 16, n3[0] | n3[1] << 16);
+		south = _mm_setr_epi32(n0[stride] | n0[stride + 1] << 16,
+			n1[stride] | n1[stride + 1] << 16, n2[stride] | n2[stride + 1] << 16,
+			n3[stride] | n3[stride + 1] << 16);
+		
+		frac = _mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *)(fracs + i)));
+		wx = _mm_and_si128(frac, low);
+		wy = _mm_srli_epi32(frac, WARP_BITS);
+		wxs = _mm_or_si128(_mm_sub_epi32(one, wx), _mm_slli_epi32(wx, 16));
+		
+		north = _mm_madd_epi16(north, wxs);
+		south = _mm_madd_epi16(south, wxs);
+		val = _mm_add_epi32(_mm_mullo_epi32(north, _mm_sub_epi32(one, wy)),
+			_mm_mullo_epi32(south, wy));
+		val = _mm_srli_epi32(_mm_add_epi32(val, half), 2 * WARP_BITS);
+		val = _mm_packus_epi16(_mm_packs_epi32(val, val), val);
+		*(int *)(dst + i) = _mm_cvtsi128_si32(val);
+	}
+	
+	remap_row_nsu(src, stride, offs + i, fracs + i, n - i, dst + i);
+}
+
+/** @brief Bilinear remap of a row span with AVX2. Each neighbour row is
+ **        one 32-bit gather; src is a whole YUV420 frame, so gathers past
+ **        the last luma pixel read chroma rather than unmapped memory.
+ ** @param src source image.
+ ** @param stride source image width.
+ ** @param offs source offsets of top-left neighbours.
+ ** @param fracs horizontal | vertical << WARP_BITS weights.
+ ** @param n number of pixels.
+ ** @param dst destination row.
+ **/
+CPU_TARGET_AVX2
+void remap_row_avx2(const unsigned char *src, int stride,
+                    const int *offs, const unsigned short *fracs,
+                    int n, unsigned char *dst)
+{
+	const __m256i one = _mm256_set1_epi32(1 << WARP_BITS);
+	const __m256i half = _mm256_set1_epi32(1 << (2 * WARP_BITS - 1));
+	const __m256i low = _mm256_set1_epi32((1 << WARP_BITS) - 1);
+	/* west and east bytes of each gathered word to 16-bit halves. */
+	const __m256i pair = _mm256_setr_epi8(
+		0, -1, 1, -1, 4, -1, 5, -1, 8, -1, 9, -1, 12, -1, 13, -1,
+		0, -1, 1, -1, 4, -1, 5, -1, 8, -1, 9, -1, 12, -1, 13, -1);
+	const __m256i gather = _mm256_setr_epi32(0, 4, 0, 0, 0, 0, 0, 0);
+	__m256i off, frac, wx, wy, wxs;
+	__m256i north, south, val;
+	int i;
+	const int ppl = 8;
+	
+	for (i = 0; i + ppl <= n; i += ppl) {
+		off = _mm256_loadu_si256((const __m256i *)(offs + i));
+		north = _mm256_i32gather_epi32((const int *)src, off, 1);
+		south = _mm256_i32gather_epi32((const int *)(src + stride), off, 1);
+		
+		frac = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i *)(fracs + i)));
+		wx = _mm256_and_si256(frac, low);
+		wy = _mm256_srli_epi32(frac, WARP_BITS);
+		wxs = _mm256_or_si256(_mm256_sub_epi32(one, wx), _mm256_slli_epi32(wx, 16));
+		
+		north = _mm256_madd_epi16(_mm256_shuffle_epi8(north, pair), wxs);
+		south = _mm256_madd_epi16(_mm256_shuffle_epi8(south, pair), wxs);
+		val = _mm256_add_epi32(_mm256_mullo_epi32(north, _mm256_sub_epi32(one, wy)),
+			_mm256_mullo_epi32(south, wy));
+		val = _mm256_srli_epi32(_mm256_add_epi32(val, half), 2 * WARP_BITS);
+		val = _mm256_packus_epi16(_mm256_packs_epi32(val, val), val);
+		val = _mm256_permutevar8x32_epi32(val, gather);
+		_mm_storel_epi64((__m128i *)(dst + i), _mm256_castsi256_si128(val));
+	}
+	
+	remap_row_nsu(src, stride, offs + i, fracs + i, n - i, dst + i);
+}
+#elif defined(__ARM_NEON__)
+/** @brief Bilinear remap of a row span with NEON. There is no gather, so
+ **        west and east neighbours are loaded as one 16-bit lane, then
+ **        blended with widening multiply-accumulates.
+ ** @param src source image.
+ ** @param stride source image width.
+ ** @param offs source offsets of top-left neighbours.
+ ** @param fracs horizontal | vertical << WARP_BITS weights.
+ ** @param n number of pixels.
+ ** @param dst destination row.
+ **/
+void remap_row_neon(const unsigned char *src, int stride,
+                    const int *offs, const unsigned short *fracs,
+                    int n, unsigned char *dst)
+{
+	unsigned short npairs[8];
+	unsigned short spairs[8];
+	uint16x8_t north, south, frac, wy;
+	uint8x8_t nw, ne, sw, se, wx;
+	uint32x4_t lo, hi;
+	int i, k;
+	const int ppl = 8;
+	
+	for (i = 0; i + ppl <= n; i += ppl) {
+		for (k = 0; k < ppl; k++) {
+			memcpy(&npairs[k], src + offs[i + k], sizeof(npairs[k]));
+			memcpy(&spairs[k], src + offs[i + k] + stride, sizeof(spairs[k]));
+		}
+		
+		north = vld1q_u16(npairs);
+		south = vld1q_u16(spairs);
+		nw = vmovn_u16(north);
+		ne = vshrn_n_u16(north, 8);
+		sw = vmovn_u16(south);
+		se = vshrn_n_u16(south, 8);
+		
+		frac = vld1q_u16(fracs + i);
+		wx = vmovn_u16(frac);
+		wy = vshrq_n_u16(frac, WARP_BITS);
+		
+		/* w * (one - x) + e * x, never negative on the way. */
+		north = vmlal_u8(vmlsl_u8(vshll_n_u8(nw, WARP_BITS), nw, wx), ne, wx);
+		south = vmlal_u8(vmlsl_u8(vshll_n_u8(sw, WARP_BITS), sw, wx), se, wx);
+		
+		lo = vmlal_u16(vmlsl_u16(vshll_n_u16(vget_low_u16(north), WARP_BITS),
+			vget_low_u16(north), vget_low_u16(wy)), vget_low_u16(south), vget_low_u16(wy));
+		hi = vmlal_u16(vmlsl_u16(vshll_n_u16(vget_high_u16(north), WARP_BITS),
+			vget_high_u16(north), vget_high_u16(wy)), vget_high_u16(south), vget_high_u16(wy));
+		
+		vst1_u8(dst + i, vmovn_u16(vcombine_u16(vrshrn_n_u32(lo, 2 * WARP_BITS),
+			vrshrn_n_u32(hi, 2 * WARP_BITS))));
+	}
+	
+	remap_row_nsu(src, stride, offs + i, fracs + i, n - i, dst + i);
+}
+#endif
\ No newline at end of file
@@ -21,6 +21,27 @@ extern "C"
 {
 #endif
 
+#include "cpu.h"
+
+/** @typedef enum WarpMode
+ ** @brief image registration warp implementation
+ **/
+typedef enum
+{
+	WARP_MODE_AUTO = 0,			/**< affine if the tables are, else table. */
+	WARP_MODE_TABLE,			/**< compiled per pixel table, any calibration. */
+	WARP_MODE_AFFINE			/**< coordinates stepped from the affine matrix, no table. */
+}WarpMode;
+
+/** @typedef enum WarpFormat
+ ** @brief registered image layout
+ **/
+typedef enum
+{
+	WARP_FORMAT_I420 = 0,		/**< Y, U and V planes. */
+	WARP_FORMAT_NV12			/**< Y plane and interleaved UV plane. */
+}WarpFormat;
+
 /** @typedef Registration
  ** @brief Image registration
  **/
@@ -35,9 +56,14 @@ int rm_regist_init(Registration *self,
                    int base_width, int base_height,
 				   int unreg_width, int unreg_height,
                    const int *const contrl_points, int npoints,
-                   const char *rtf, const char *ctf);
+                   const char *btf, const char *rtf, const char *ctf,
+                   WarpMode mode);
 
 void rm_regist_delete(Registration *self);
+
+int rm_regist_convert(int base_width, int base_height,
+                      int unreg_width, int unreg_height,
+                      const char *rtf, const char *ctf, const char *btf);
 /** @} */
 
 /** @name Image registration
@@ -45,6 +71,38 @@ void rm_regist_delete(Registration *self);
 int rm_regist_warp_image(const Registration *const self,
                          const unsigned char *const src,
 						 unsigned char *const dst);
+
+void rm_regist_set_format(Registration *self, WarpFormat format);
+
+WarpMode rm_regist_warp_mode(const Registration *const self);
+/** @} */
+
+/** @name Row kernel variants, rm_regist_warp_image picks them by
+ **       cpu_level. A row is remapped through source offsets of top-left
+ **       neighbours and horizontal | vertical << 8 weights, which affine
+ **       mode steps from 16.16 fixed-point source coordinates.
+ ** @{ */
+#ifdef CPU_X86
+void affine_row_sse(int u, int v, int du, int dv, int stride, int n,
+                    int *offs, unsigned short *fracs);
+void affine_row_avx2(int u, int v, int du, int dv, int stride, int n,
+                     int *offs, unsigned short *fracs);
+void remap_row_sse(const unsigned char *src, int stride,
+                   const int *offs, const unsigned short *fracs,
+                   int n, unsigned char *dst);
+void remap_row_avx2(const unsigned char *src, int stride,
+                    const int *offs, const unsigned short *fracs,
+                    int n, unsigned char *dst);
+#elif defined(__ARM_NEON__)
+void remap_row_neon(const unsigned char *src, int stride,
+                    const int *offs, const unsigned short *fracs,
+                    int n, unsigned char *dst);
+#endif
+void affine_row_nsu(int u, int v, int du, int dv, int stride, int n,
+                    int *offs, unsigned short *fracs);
+void remap_row_nsu(const unsigned char *src, int stride,
+                   const int *offs, const unsigned short *fracs,
+                   int n, unsigned char *dst);
 /** @} */
 						 
 #ifdef __cplusplus
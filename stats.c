@@ -0,0 +1,166 @@
+/** @file stats.c - Implementation
+ ** @brief Lightweight timing and queue depth statistics
+ ** @author Zhiwei Zeng
+ ** @date 2018.06.11
+ **/
+
+/*
+Copyright (C) 2018 Zhiwei Zeng.
+Copyright (C) 2018 Chengdu ZLT Technology Co., Ltd.
+All rights reserved.
+
+This file is part of the railway monitor toolkit and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+
+#include "stats.h"
+
+/** @name some private functions
+ ** @{ */
+static int stat_bucket(long long duration);
+static double stat_bucket_value(int bucket);
+static double stat_percentile(const StatTimer *self, unsigned int count, double p);
+/** @} */
+
+/** @brief Clear duration accumulator.
+ ** @param self duration accumulator.
+ **/
+void stat_timer_reset(StatTimer *self)
+{
+	assert(self);
+	memset((void *)self, 0, sizeof(StatTimer));
+}
+
+/** @brief Add a duration.
+ ** @param self duration accumulator.
+ ** @param duration duration in microseconds.
+ **/
+void stat_timer_add(StatTimer *self, long long duration)
+{
+	assert(self);
+	
+	if (duration < 0) {
+		duration = 0;
+	}
+	
+	self->hist[stat_bucket(duration)]++;
+	self->total += duration;
+	if (duration > self->max) {
+		self->max = duration;
+	}
+	
+	self->count++;
+}
+
+/** @brief Summarize durations.
+ ** @param self duration accumulator.
+ ** @param summary duration summary.
+ **/
+void stat_timer_summary(const StatTimer *self, StatSummary *summary)
+{
+	unsigned int count;
+	
+	assert(self);
+	assert(summary);
+	
+	memset(summary, 0, sizeof(StatSummary));
+	
+	count = self->count;
+	if (!count) {
+		return;
+	}
+	
+	summary->count = count;
+	summary->mean = (double)self->total / count;
+	summary->p50 = stat_percentile(self, count, 0.50);
+	summary->p99 = stat_percentile(self, count, 0.99);
+	summary->max = (double)self->max;
+}
+
+/** @brief Clear queue depth histogram.
+ ** @param self queue depth histogram.
+ **/
+void stat_depth_reset(StatDepth *self)
+{
+	assert(self);
+	memset((void *)self, 0, sizeof(StatDepth));
+}
+
+/** @brief Add a queue depth sample.
+ ** @param self queue depth histogram.
+ ** @param depth queued records.
+ **/
+void stat_depth_add(StatDepth *self, unsigned int depth)
+{
+	assert(self);
+	
+	if (depth >= STAT_DEPTHS) {
+		depth = STAT_DEPTHS - 1;
+	}
+	
+	self->hist[depth]++;
+}
+
+/** @brief Get histogram bucket of duration.
+ ** @param duration duration in microseconds.
+ ** @return bucket index.
+ **/
+int stat_bucket(long long duration)
+{
+	int e = 0;
+	int bucket;
+	
+	if (duration < 4) {
+		return (int)duration;
+	}
+	
+	while (duration >> (e + 1)) {
+		e++;
+	}
+	
+	bucket = ((e - 1) << 2) + (int)((duration >> (e - 2)) & 3);
+	
+	return bucket < STAT_BUCKETS ? bucket : STAT_BUCKETS - 1;
+}
+
+/** @brief Get middle duration of histogram bucket.
+ ** @param bucket bucket index.
+ ** @return duration in microseconds.
+ **/
+double stat_bucket_value(int bucket)
+{
+	int e;
+	
+	if (bucket < 4) {
+		return bucket;
+	}
+	
+	e = (bucket >> 2) + 1;
+	
+	return (4 + (bucket & 3) + 0.5) * (double)(1LL << (e - 2));
+}
+
+/** @brief Get percentile from duration histogram.
+ ** @param self duration accumulator.
+ ** @param count number of durations.
+ ** @param p percentile in (0, 1).
+ ** @return duration in microseconds.
+ **/
+double stat_percentile(const StatTimer *self, unsigned int count, double p)
+{
+	unsigned int sum = 0;
+	int i;
+	
+	for (i = 0; i < STAT_BUCKETS; i++) {
+		sum += self->hist[i];
+		if (sum >= p * count) {
+			return stat_bucket_value(i);
+		}
+	}
+	
+	return (double)self->max;
+}
\ No newline at end of file
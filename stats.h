@@ -0,0 +1,78 @@
+/** @file stats.h
+ ** @brief Lightweight timing and queue depth statistics
+ ** @author Zhiwei Zeng
+ ** @date 2018.06.11
+ **/
+
+/*
+Copyright (C) 2018 Zhiwei Zeng.
+Copyright (C) 2018 Chengdu ZLT Technology Co., Ltd.
+All rights reserved.
+
+This file is part of the railway monitor toolkit and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define STAT_BUCKETS 128
+#define STAT_DEPTHS 16
+
+/** @typedef struct StatTimer
+ ** @brief duration accumulator. Durations go to logarithmic buckets with
+ **        four buckets per octave, so percentiles are within 1/8 of the
+ **        true value. One thread adds, any thread may read without lock
+ **        and get a slightly stale view.
+ **/
+typedef struct
+{
+	volatile unsigned int count;					/**< number of durations. */
+	volatile long long total;						/**< sum of durations in microseconds. */
+	volatile long long max;							/**< longest duration in microseconds. */
+	volatile unsigned int hist[STAT_BUCKETS];		/**< duration histogram. */
+}StatTimer;
+
+/** @typedef struct StatSummary
+ ** @brief summary of a StatTimer, all durations in microseconds
+ **/
+typedef struct
+{
+	unsigned int count;		/**< number of durations. */
+	double mean;			/**< mean duration. */
+	double p50;				/**< median duration. */
+	double p99;				/**< 99th percentile duration. */
+	double max;				/**< longest duration. */
+}StatSummary;
+
+/** @typedef struct StatDepth
+ ** @brief queue depth histogram, deeper queues go to the last bin
+ **/
+typedef struct
+{
+	volatile unsigned int hist[STAT_DEPTHS];		/**< depth histogram. */
+}StatDepth;
+
+/** @name Duration statistics
+ ** @{ */
+void stat_timer_reset(StatTimer *self);
+void stat_timer_add(StatTimer *self, long long duration);
+void stat_timer_summary(const StatTimer *self, StatSummary *summary);
+/** @} */
+
+/** @name Queue depth statistics
+ ** @{ */
+void stat_depth_reset(StatDepth *self);
+void stat_depth_add(StatDepth *self, unsigned int depth);
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
\ No newline at end of file
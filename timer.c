@@ -0,0 +1,60 @@
+/** @file timer.c - Implementation
+ ** @brief Monotonic time stamps and simple code section timing
+ ** @author Zhiwei Zeng
+ ** @date 2018.06.08
+ **/
+
+/*
+Copyright (C) 2018 Zhiwei Zeng.
+Copyright (C) 2018 Chengdu ZLT Technology Co., Ltd.
+All rights reserved.
+
+This file is part of the railway monitor toolkit and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include <stdio.h>
+#ifdef _WIN32
+#	include <windows.h>
+#else
+#	include <time.h>
+#endif
+
+#include "timer.h"
+
+static long long start_us = 0;
+
+/** @brief Get monotonic clock. Unlike wall clock it never jumps, so
+ **        time stamps taken by different threads can be compared.
+ ** @return microseconds since an unspecified point.
+ **/
+long long timer_now_us()
+{
+#ifdef _WIN32
+	LARGE_INTEGER frequency;
+	LARGE_INTEGER count;
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&count);
+	return count.QuadPart / frequency.QuadPart * 1000000 +
+		count.QuadPart % frequency.QuadPart * 1000000 / frequency.QuadPart;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#endif
+}
+
+/** @brief Start timing a code section.
+ **/
+void StartTimer()
+{
+	start_us = timer_now_us();
+}
+
+/** @brief Stop timing a code section and print elapsed time.
+ ** @param name code section name.
+ **/
+void StopTimer(const char *name)
+{
+	printf("%s: %.3f ms\n", name, (timer_now_us() - start_us) / 1000.0);
+}
\ No newline at end of file
@@ -0,0 +1,39 @@
+/** @file timer.h
+ ** @brief Monotonic time stamps and simple code section timing
+ ** @author Zhiwei Zeng
+ ** @date 2018.06.08
+ **/
+
+/*
+Copyright (C) 2018 Zhiwei Zeng.
+Copyright (C) 2018 Chengdu ZLT Technology Co., Ltd.
+All rights reserved.
+
+This file is part of the railway monitor toolkit and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef _TIMER_H_
+#define _TIMER_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** @name Monotonic clock
+ ** @{ */
+long long timer_now_us();
+/** @} */
+
+/** @name Code section timing, not thread safe
+ ** @{ */
+void StartTimer();
+void StopTimer(const char *name);
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
\ No newline at end of file
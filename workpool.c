@@ -0,0 +1,241 @@
+/** @file workpool.c - Implementation
+ ** @brief Persistent worker threads running a batch of tasks
+ ** @author Zhiwei Zeng
+ ** @date 2018.06.04
+ **/
+
+/*
+Copyright (C) 2018 Zhiwei Zeng.
+Copyright (C) 2018 Chengdu ZLT Technology Co., Ltd.
+All rights reserved.
+
+This file is part of the railway monitor toolkit and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "workpool.h"
+#include "pthread.h"
+
+/** @typedef struct WorkPool
+ ** @brief worker pool structure definition
+ **/
+struct tagWorkPool
+{
+	int nthreads;					/**< threads running tasks, the caller included. */
+	int nworkers;					/**< worker threads started. */
+	pthread_t *workers;				/**< worker threads. */
+	pthread_mutex_t mutex;			/**< guard of the batch state. */
+	pthread_cond_t start;			/**< signaled when a batch is posted. */
+	pthread_cond_t done;			/**< signaled when a batch is finished. */
+	int sync_init;					/**< mutex and conditions are initialized. */
+	WorkTask task;					/**< task of current batch. */
+	void *arg;						/**< argument of current batch. */
+	unsigned int count;				/**< tasks of current batch. */
+	unsigned int next;				/**< next task to take. */
+	unsigned int pending;			/**< tasks not finished yet. */
+	unsigned int batch;				/**< batch sequence number. */
+	int stop;						/**< workers quit when set. */
+};
+
+/** @name some private functions.
+ ** @{ */
+static void *worker_thread(void *s);
+static void run_tasks(WorkPool *self);
+/** @} */
+
+/** @brief Create a new instance of worker pool.
+ ** @return the instance.
+ **/
+WorkPool *workpool_new()
+{
+	WorkPool *self = NULL;
+	self = (WorkPool *)malloc(sizeof(WorkPool));
+	if (!self) {
+		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+		return self;
+	}
+	
+	memset(self, 0, sizeof(WorkPool));
+	
+	return self;
+}
+
+/** @brief Initialize worker pool instance.
+ ** @param self worker pool instance.
+ ** @param nthreads threads running tasks, the thread calling workpool_run
+ **        included, so nthreads - 1 workers are started.
+ ** @return  0 if success,
+ **         -1 if fail.
+ **/
+int workpool_init(WorkPool *self, int nthreads)
+{
+	int i;
+	
+	assert(self);
+	
+	self->nthreads = nthreads > 1 ? nthreads : 1;
+	
+	pthread_mutex_init(&self->mutex, NULL);
+	pthread_cond_init(&self->start, NULL);
+	pthread_cond_init(&self->done, NULL);
+	self->sync_init = 1;
+	
+	if (1 == self->nthreads) {
+		return 0;
+	}
+	
+	self->workers = (pthread_t *)malloc((self->nthreads - 1) * sizeof(pthread_t));
+	if (!self->workers) {
+		fprintf(stderr, "malloc fail[%s:%d].\n", __FILE__, __LINE__);
+		return -1;
+	}
+	
+	for (i = 0; i < self->nthreads - 1; i++) {
+		if (pthread_create(&self->workers[i], NULL, worker_thread, self)) {
+			fprintf(stderr, "pthread_create fail[%s:%d].\n", __FILE__, __LINE__);
+			return -1;
+		}
+		self->nworkers++;
+	}
+	
+	return 0;
+}
+
+/** @brief Stop workers and destroy worker pool instance.
+ ** @param self worker pool instance.
+ **/
+void workpool_delete(WorkPool *self)
+{
+	int i;
+	
+	if (self) {
+		if (self->sync_init) {
+			pthread_mutex_lock(&self->mutex);
+			self->stop = 1;
+			pthread_cond_broadcast(&self->start);
+			pthread_mutex_unlock(&self->mutex);
+		}
+		for (i = 0; i < self->nworkers; i++) {
+			pthread_join(self->workers[i], NULL);
+		}
+		if (self->workers) {
+			free(self->workers);
+		}
+		if (self->sync_init) {
+			pthread_cond_destroy(&self->done);
+			pthread_cond_destroy(&self->start);
+			pthread_mutex_destroy(&self->mutex);
+		}
+		free(self);
+		self = NULL;
+	}
+}
+
+/** @brief Get number of threads running tasks, the caller included.
+ ** @param self worker pool instance.
+ ** @return thread count.
+ **/
+int workpool_threads(WorkPool *self)
+{
+	assert(self);
+	return self->nworkers + 1;
+}
+
+/** @brief Run a batch of tasks and wait them all. The calling thread
+ **        takes tasks too. Only one thread may call it at a time.
+ ** @param self worker pool instance.
+ ** @param task task function, called once for each index.
+ ** @param arg argument passed to every task.
+ ** @param count number of tasks.
+ **/
+void workpool_run(WorkPool *self, WorkTask task, void *arg, unsigned int count)
+{
+	unsigned int i;
+	
+	assert(self);
+	assert(task);
+	
+	if (!self->nworkers || count < 2) {
+		for (i = 0; i < count; i++) {
+			task(arg, i, count);
+		}
+		return;
+	}
+	
+	pthread_mutex_lock(&self->mutex);
+	self->task = task;
+	self->arg = arg;
+	self->count = count;
+	self->next = 0;
+	self->pending = count;
+	self->batch++;
+	pthread_cond_broadcast(&self->start);
+	pthread_mutex_unlock(&self->mutex);
+	
+	run_tasks(self);
+	
+	pthread_mutex_lock(&self->mutex);
+	while (self->pending) {
+		pthread_cond_wait(&self->done, &self->mutex);
+	}
+	pthread_mutex_unlock(&self->mutex);
+}
+
+/** @brief Worker thread, runs tasks of every posted batch.
+ ** @param s worker pool instance.
+ **/
+void *worker_thread(void *s)
+{
+	WorkPool *self = (WorkPool *)s;
+	unsigned int batch = 0;
+	
+	for (;;) {
+		pthread_mutex_lock(&self->mutex);
+		while (!self->stop && batch == self->batch) {
+			pthread_cond_wait(&self->start, &self->mutex);
+		}
+		
+		if (self->stop) {
+			pthread_mutex_unlock(&self->mutex);
+			break;
+		}
+		
+		batch = self->batch;
+		pthread_mutex_unlock(&self->mutex);
+		
+		run_tasks(self);
+	}
+	
+	return (void *)(0);
+}
+
+/** @brief Take and run tasks of current batch until none is left.
+ ** @param self worker pool instance.
+ **/
+void run_tasks(WorkPool *self)
+{
+	unsigned int index;
+	
+	for (;;) {
+		pthread_mutex_lock(&self->mutex);
+		if (self->next >= self->count) {
+			pthread_mutex_unlock(&self->mutex);
+			break;
+		}
+		index = self->next++;
+		pthread_mutex_unlock(&self->mutex);
+		
+		self->task(self->arg, index, self->count);
+		
+		pthread_mutex_lock(&self->mutex);
+		if (!--self->pending) {
+			pthread_cond_signal(&self->done);
+		}
+		pthread_mutex_unlock(&self->mutex);
+	}
+}
\ No newline at end of file
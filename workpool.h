@@ -0,0 +1,55 @@
+/** @file workpool.h
+ ** @brief Persistent worker threads running a batch of tasks
+ ** @author Zhiwei Zeng
+ ** @date 2018.06.04
+ **/
+
+/*
+Copyright (C) 2018 Zhiwei Zeng.
+Copyright (C) 2018 Chengdu ZLT Technology Co., Ltd.
+All rights reserved.
+
+This file is part of the railway monitor toolkit and is made available under
+the terms of the BSD license (see the COPYING file).
+*/
+
+#ifndef _WORKPOOL_H_
+#define _WORKPOOL_H_
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/** @typedef struct WorkPool
+ ** @brief worker pool structure
+ **/
+struct tagWorkPool;
+typedef struct tagWorkPool WorkPool;
+
+/** @typedef WorkTask
+ ** @brief task of a batch
+ ** @param arg batch argument.
+ ** @param index task index in [0, count).
+ ** @param count number of tasks of the batch.
+ **/
+typedef void (*WorkTask)(void *arg, unsigned int index, unsigned int count);
+
+/** @name Create, initialize, and destroy
+ ** @{ */
+WorkPool *workpool_new();
+int workpool_init(WorkPool *self, int nthreads);
+void workpool_delete(WorkPool *self);
+/** @} */
+
+/** @name Task execution
+ ** @{ */
+int workpool_threads(WorkPool *self);
+void workpool_run(WorkPool *self, WorkTask task, void *arg, unsigned int count);
+/** @} */
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
\ No newline at end of file